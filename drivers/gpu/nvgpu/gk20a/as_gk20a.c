@@ -192,6 +192,7 @@ static int gk20a_as_ioctl_map_buffer_batch(
 		args->maps;
 
 	struct vm_gk20a_mapping_batch batch;
+	u64 *map_offsets;
 
 	gk20a_dbg_fn("");
 
@@ -199,6 +200,12 @@ static int gk20a_as_ioctl_map_buffer_batch(
 	    args->num_maps > g->gpu_characteristics.map_buffer_batch_limit)
 		return -EINVAL;
 
+	/* to take back maps whose deferred PTE update failed */
+	map_offsets = kcalloc(max_t(u32, args->num_maps, 1),
+			      sizeof(*map_offsets), GFP_KERNEL);
+	if (!map_offsets)
+		return -ENOMEM;
+
 	gk20a_vm_mapping_batch_start(&batch);
 
 	for (i = 0; i < args->num_unmaps; ++i) {
@@ -221,6 +228,7 @@ static int gk20a_as_ioctl_map_buffer_batch(
 
 		args->num_unmaps = i;
 		args->num_maps = 0;
+		kfree(map_offsets);
 		return err;
 	}
 
@@ -234,6 +242,7 @@ static int gk20a_as_ioctl_map_buffer_batch(
 			break;
 		}
 
+		batch.index = i;
 		err = gk20a_vm_map_buffer(
 			as_share->vm, map_args.dmabuf_fd,
 			&map_args.offset, map_args.flags,
@@ -243,15 +252,34 @@ static int gk20a_as_ioctl_map_buffer_batch(
 			&batch);
 		if (err)
 			break;
+		map_offsets[i] = map_args.offset;
 	}
 
 	gk20a_vm_mapping_batch_finish(as_share->vm, &batch);
 
+	/*
+	 * A deferred PTE update failed after the buffers were already
+	 * tracked in the VM. Keep the maps in front of the first failed one
+	 * and take back that one and everything after it, so num_maps
+	 * reports exactly what is mapped.
+	 */
+	if (batch.err && batch.first_err_index < i) {
+		u32 done = i;
+
+		for (i = batch.first_err_index; i < done; i++)
+			gk20a_vm_unmap_buffer(as_share->vm, map_offsets[i],
+					      NULL);
+		i = batch.first_err_index;
+	}
+
+	if (!err)
+		err = batch.err;
 	if (err)
 		args->num_maps = i;
 	/* note: args->num_unmaps will be unmodified, which is ok
 	 * since all unmaps are done */
 
+	kfree(map_offsets);
 	return err;
 }
 
@@ -136,6 +136,17 @@ struct gk20a_buddy_allocator {
 	u64 buddy_list_split[GPU_BALLOC_ORDER_LIST_LEN];
 	u64 buddy_list_alloced[GPU_BALLOC_ORDER_LIST_LEN];
 
+	/* Bit n is set when buddy_list[n] is not empty. */
+	unsigned long buddy_list_mask;
+
+	/*
+	 * Top level buddies sorted by address. Every buddy in the space
+	 * descends from one of these so fixed allocs can find the free buddy
+	 * covering an address by walking down the tree.
+	 */
+	struct gk20a_buddy **roots;
+	int nr_roots;
+
 	/*
 	 * This is for when the allocator is managing a GVA space (the
 	 * GPU_ALLOC_GVA_SPACE bit is set in @flags). This requires
@@ -151,6 +162,12 @@ struct gk20a_buddy_allocator {
 	u64 bytes_alloced;
 	u64 bytes_alloced_real;
 	u64 bytes_freed;
+
+	/* Search cost accounting. */
+	u64 nr_allocs;
+	u64 alloc_orders_probed;
+	u64 nr_fixed_allocs;
+	u64 fixed_nodes_walked;
 };
 
 static inline struct gk20a_buddy_allocator *buddy_allocator(
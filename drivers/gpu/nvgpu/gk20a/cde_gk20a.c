@@ -20,6 +20,8 @@
 #include <linux/firmware.h>
 #include <linux/fs.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
 #include <linux/dma-buf.h>
 
 #include <trace/events/gk20a.h>
@@ -69,11 +71,24 @@ static void gk20a_cde_remove_ctx(struct gk20a_cde_ctx *cde_ctx)
 __must_hold(&cde_app->mutex)
 {
 	struct gk20a *g = cde_ctx->g;
+	struct gk20a_cde_app *cde_app = &g->cde_app;
 	struct channel_gk20a *ch = cde_ctx->ch;
 	struct vm_gk20a *vm = ch->vm;
 
 	trace_gk20a_cde_remove_ctx(cde_ctx);
 
+	/*
+	 * Wait for a conversion still preparing on this context. Only a stop
+	 * gets here with one running, and with the app deinitialised nobody
+	 * else removes the context while we are off the mutex.
+	 */
+	while (cde_ctx->converting) {
+		mutex_unlock(&cde_app->mutex);
+		wait_event(cde_app->convert_wq,
+			   !ACCESS_ONCE(cde_ctx->converting));
+		mutex_lock(&cde_app->mutex);
+	}
+
 	/* release mapped memory */
 	gk20a_deinit_cde_img(cde_ctx);
 	gk20a_gmmu_unmap(vm, cde_ctx->backing_store_vaddr,
@@ -112,20 +127,21 @@ static void gk20a_cde_remove_contexts(struct gk20a *g)
 __must_hold(&cde_app->mutex)
 {
 	struct gk20a_cde_app *cde_app = &g->cde_app;
-	struct gk20a_cde_ctx *cde_ctx, *cde_ctx_save;
+	struct gk20a_cde_ctx *cde_ctx;
 
 	/* safe to go off the mutex in cancel_deleter since app is
 	 * deinitialised; no new jobs are started. deleter works may be only at
-	 * waiting for the mutex or before, going to abort */
-
-	list_for_each_entry_safe(cde_ctx, cde_ctx_save,
-			&cde_app->free_contexts, list) {
-		gk20a_cde_cancel_deleter(cde_ctx, true);
-		gk20a_cde_remove_ctx(cde_ctx);
-	}
-
-	list_for_each_entry_safe(cde_ctx, cde_ctx_save,
-			&cde_app->used_contexts, list) {
+	 * waiting for the mutex or before, going to abort. Contexts may still
+	 * move between the lists meanwhile, so always restart from a head */
+
+	while (!list_empty(&cde_app->free_contexts) ||
+	       !list_empty(&cde_app->used_contexts)) {
+		if (!list_empty(&cde_app->free_contexts))
+			cde_ctx = list_first_entry(&cde_app->free_contexts,
+					struct gk20a_cde_ctx, list);
+		else
+			cde_ctx = list_first_entry(&cde_app->used_contexts,
+					struct gk20a_cde_ctx, list);
 		gk20a_cde_cancel_deleter(cde_ctx, true);
 		gk20a_cde_remove_ctx(cde_ctx);
 	}
@@ -138,6 +154,7 @@ __must_hold(&cde_app->mutex)
 
 	/* prevent further conversions and delayed works from working */
 	cde_app->initialised = false;
+	cde_app->generation++;
 	/* free all data, empty the list */
 	gk20a_cde_remove_contexts(g);
 }
@@ -203,10 +220,14 @@ __must_hold(&cde_app->mutex)
 static int gk20a_cde_create_contexts(struct gk20a *g)
 __must_hold(&g->cde_app->mutex)
 {
+	struct gk20a_cde_app *cde_app = &g->cde_app;
 	int err;
 	int i;
 
-	for (i = 0; i < NUM_CDE_CONTEXTS; i++) {
+	if (cde_app->num_prewarmed > MAX_CTX_USE_COUNT)
+		cde_app->num_prewarmed = MAX_CTX_USE_COUNT;
+
+	for (i = 0; i < cde_app->num_prewarmed; i++) {
 		err = gk20a_cde_create_context(g);
 		if (err)
 			goto out;
@@ -742,7 +763,9 @@ __releases(&cde_app->mutex)
 
 	if (cde_ctx->in_use) {
 		cde_ctx->in_use = false;
-		list_move(&cde_ctx->list, &cde_app->free_contexts);
+		/* gk20a_cde_convert() moves it when done with it */
+		if (!cde_ctx->converting)
+			list_move(&cde_ctx->list, &cde_app->free_contexts);
 		cde_app->ctx_usecount--;
 	} else {
 		gk20a_dbg_info("double release cde context %p", cde_ctx);
@@ -779,7 +802,7 @@ __releases(&cde_app->mutex)
 	}
 
 	mutex_lock(&cde_app->mutex);
-	if (cde_ctx->in_use || !cde_app->initialised) {
+	if (cde_ctx->in_use || cde_ctx->converting || !cde_app->initialised) {
 		gk20a_dbg(gpu_dbg_cde_ctx,
 				"cde: context use raced, not deleting %p",
 				cde_ctx);
@@ -801,10 +824,16 @@ out:
 }
 
 static struct gk20a_cde_ctx *gk20a_cde_do_get_context(struct gk20a *g)
-__must_hold(&cde_app->mutex)
+__releases(&cde_app->mutex)
+__acquires(&cde_app->mutex)
 {
 	struct gk20a_cde_app *cde_app = &g->cde_app;
 	struct gk20a_cde_ctx *cde_ctx;
+	u32 generation;
+
+	/* stopped while the caller was off the mutex? */
+	if (!cde_app->initialised)
+		return ERR_PTR(-ENOSYS);
 
 	/* exhausted? */
 
@@ -839,8 +868,34 @@ __must_hold(&cde_app->mutex)
 			"cde: no free contexts, count=%d",
 			cde_app->ctx_count);
 
+	/*
+	 * Loading a context is slow; reserve the use count and do it off the
+	 * mutex so that conversions on other contexts are not held up.
+	 */
+	cde_app->ctx_usecount++;
+	generation = cde_app->generation;
+	mutex_unlock(&cde_app->mutex);
 	cde_ctx = gk20a_cde_allocate_context(g);
+	mutex_lock(&cde_app->mutex);
+
+	/*
+	 * A stop (and maybe a reload) ran meanwhile and emptied the lists.
+	 * Drop the new context; a fresh init may have zeroed our use count.
+	 */
+	if (generation != cde_app->generation) {
+		if (cde_app->ctx_usecount)
+			cde_app->ctx_usecount--;
+		if (IS_ERR(cde_ctx))
+			return cde_ctx;
+
+		list_add(&cde_ctx->list, &cde_app->used_contexts);
+		cde_app->ctx_count++;
+		gk20a_cde_remove_ctx(cde_ctx);
+		return ERR_PTR(-EAGAIN);
+	}
+
 	if (IS_ERR(cde_ctx)) {
+		cde_app->ctx_usecount--;
 		gk20a_warn(g->dev, "cde: cannot allocate context: %ld",
 				PTR_ERR(cde_ctx));
 		return cde_ctx;
@@ -849,7 +904,7 @@ __must_hold(&cde_app->mutex)
 	trace_gk20a_cde_get_context(cde_ctx);
 	cde_ctx->in_use = true;
 	cde_ctx->is_temporary = true;
-	cde_app->ctx_usecount++;
+	cde_app->temp_ctx_created++;
 	cde_app->ctx_count++;
 	if (cde_app->ctx_count > cde_app->ctx_count_top)
 		cde_app->ctx_count_top = cde_app->ctx_count;
@@ -901,6 +956,7 @@ static struct gk20a_cde_ctx *gk20a_cde_allocate_context(struct gk20a *g)
 	INIT_LIST_HEAD(&cde_ctx->list);
 	cde_ctx->is_temporary = false;
 	cde_ctx->in_use = false;
+	cde_ctx->converting = false;
 	INIT_DELAYED_WORK(&cde_ctx->ctx_deleter_work,
 			gk20a_cde_ctx_deleter_fn);
 
@@ -909,6 +965,20 @@ static struct gk20a_cde_ctx *gk20a_cde_allocate_context(struct gk20a *g)
 	return cde_ctx;
 }
 
+static void gk20a_cde_update_stats(struct gk20a_cde_app *cde_app,
+				   u64 wait_ns, u64 convert_ns)
+{
+	spin_lock(&cde_app->stats_lock);
+	cde_app->convert_count++;
+	cde_app->convert_wait_ns += wait_ns;
+	cde_app->convert_ns += convert_ns;
+	if (wait_ns > cde_app->convert_wait_max_ns)
+		cde_app->convert_wait_max_ns = wait_ns;
+	if (convert_ns > cde_app->convert_max_ns)
+		cde_app->convert_max_ns = convert_ns;
+	spin_unlock(&cde_app->stats_lock);
+}
+
 int gk20a_cde_convert(struct gk20a *g,
 		      struct dma_buf *compbits_scatter_buf,
 		      u64 compbits_byte_offset,
@@ -919,7 +989,9 @@ int gk20a_cde_convert(struct gk20a *g,
 __acquires(&cde_app->mutex)
 __releases(&cde_app->mutex)
 {
+	struct gk20a_cde_app *cde_app = &g->cde_app;
 	struct gk20a_cde_ctx *cde_ctx = NULL;
+	u64 start_ns, acquired_ns;
 	struct gk20a_comptags comptags;
 	u64 mapped_compbits_offset = 0;
 	u64 compbits_size = 0;
@@ -942,14 +1014,28 @@ __releases(&cde_app->mutex)
 	    scatterbuffer_byte_offset < compbits_byte_offset)
 		return -EINVAL;
 
-	mutex_lock(&g->cde_app.mutex);
+	start_ns = ktime_to_ns(ktime_get());
+
+	mutex_lock(&cde_app->mutex);
 
 	cde_ctx = gk20a_cde_get_context(g);
 	if (IS_ERR(cde_ctx)) {
-		err = PTR_ERR(cde_ctx);
-		goto exit_unlock;
+		mutex_unlock(&cde_app->mutex);
+		return PTR_ERR(cde_ctx);
 	}
 
+	/*
+	 * The context is now marked in use, so nobody else picks it from the
+	 * lists. Marking it converting also keeps it off the free list and
+	 * away from the deleter if its finish callback releases it before we
+	 * are done unmapping, so the app mutex can be dropped for the rest of
+	 * the conversion.
+	 */
+	cde_ctx->converting = true;
+	mutex_unlock(&cde_app->mutex);
+
+	acquired_ns = ktime_to_ns(ktime_get());
+
 	/* First, map the buffer to local va */
 
 	/* ensure that the compbits buffer has drvdata */
@@ -1114,7 +1200,22 @@ exit_unlock:
 	if (surface)
 		dma_buf_vunmap(compbits_scatter_buf, surface);
 
-	mutex_unlock(&g->cde_app.mutex);
+	mutex_lock(&cde_app->mutex);
+	cde_ctx->converting = false;
+	/* released by its finish callback meanwhile */
+	if (!cde_ctx->in_use && cde_app->initialised) {
+		list_move(&cde_ctx->list, &cde_app->free_contexts);
+		if (cde_ctx->is_temporary)
+			schedule_delayed_work(&cde_ctx->ctx_deleter_work,
+				msecs_to_jiffies(CTX_DELETE_TIME));
+	}
+	mutex_unlock(&cde_app->mutex);
+	/* cde_ctx may be gone from here on */
+	wake_up_all(&cde_app->convert_wq);
+
+	gk20a_cde_update_stats(cde_app, acquired_ns - start_ns,
+			       ktime_to_ns(ktime_get()) - start_ns);
+
 	return err;
 }
 
@@ -1299,8 +1400,13 @@ __releases(&cde_app->mutex)
 	gk20a_dbg(gpu_dbg_fn | gpu_dbg_cde_ctx, "cde: init");
 
 	mutex_init(&cde_app->mutex);
+	init_waitqueue_head(&cde_app->convert_wq);
+	spin_lock_init(&cde_app->stats_lock);
 	mutex_lock(&cde_app->mutex);
 
+	if (!cde_app->num_prewarmed)
+		cde_app->num_prewarmed = NUM_CDE_CONTEXTS;
+
 	INIT_LIST_HEAD(&cde_app->free_contexts);
 	INIT_LIST_HEAD(&cde_app->used_contexts);
 	cde_app->ctx_count = 0;
@@ -1650,6 +1756,45 @@ static const struct file_operations gk20a_cde_reload_fops = {
 	.write		= gk20a_cde_reload_write,
 };
 
+static int gk20a_cde_stats_show(struct seq_file *s, void *unused)
+{
+	struct gk20a *g = s->private;
+	struct gk20a_cde_app *cde_app = &g->cde_app;
+	u64 count, wait_ns, wait_max_ns, convert_ns, convert_max_ns;
+
+	spin_lock(&cde_app->stats_lock);
+	count = cde_app->convert_count;
+	wait_ns = cde_app->convert_wait_ns;
+	wait_max_ns = cde_app->convert_wait_max_ns;
+	convert_ns = cde_app->convert_ns;
+	convert_max_ns = cde_app->convert_max_ns;
+	spin_unlock(&cde_app->stats_lock);
+
+	seq_printf(s, "conversions:          %llu\n", count);
+	seq_printf(s, "avg queue wait (ns):  %llu\n",
+		   count ? div64_u64(wait_ns, count) : 0);
+	seq_printf(s, "max queue wait (ns):  %llu\n", wait_max_ns);
+	seq_printf(s, "avg convert (ns):     %llu\n",
+		   count ? div64_u64(convert_ns, count) : 0);
+	seq_printf(s, "max convert (ns):     %llu\n", convert_max_ns);
+	seq_printf(s, "temporary contexts:   %llu\n",
+		   cde_app->temp_ctx_created);
+
+	return 0;
+}
+
+static int gk20a_cde_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, gk20a_cde_stats_show, inode->i_private);
+}
+
+static const struct file_operations gk20a_cde_stats_fops = {
+	.open		= gk20a_cde_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 void gk20a_cde_debugfs_init(struct device *dev)
 {
 	struct gk20a_platform *platform = dev_get_drvdata(dev);
@@ -1666,6 +1811,10 @@ void gk20a_cde_debugfs_init(struct device *dev)
 			   platform->debugfs, &g->cde_app.ctx_usecount);
 	debugfs_create_u32("cde_ctx_count_top", S_IWUSR | S_IRUGO,
 			   platform->debugfs, &g->cde_app.ctx_count_top);
+	debugfs_create_u32("cde_prewarmed_contexts", S_IWUSR | S_IRUGO,
+			   platform->debugfs, &g->cde_app.num_prewarmed);
 	debugfs_create_file("reload_cde_firmware", S_IWUSR, platform->debugfs,
 			    g, &gk20a_cde_reload_fops);
+	debugfs_create_file("cde_stats", S_IRUGO, platform->debugfs,
+			    g, &gk20a_cde_stats_fops);
 }
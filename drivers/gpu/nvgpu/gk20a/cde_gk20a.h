@@ -258,17 +258,41 @@ struct gk20a_cde_ctx {
 	bool is_temporary;
 	bool in_use;
 	struct delayed_work ctx_deleter_work;
+
+	/*
+	 * Set while gk20a_cde_convert() prepares and submits on this context
+	 * off the app mutex. Protected by cde_app->mutex; the context is not
+	 * put back on the free list or removed until it is cleared.
+	 */
+	bool converting;
 };
 
 struct gk20a_cde_app {
 	bool initialised;
+	/* protects the context lists and counts only */
 	struct mutex mutex;
+	/* woken whenever a context stops converting */
+	wait_queue_head_t convert_wq;
 
 	struct list_head free_contexts;
 	struct list_head used_contexts;
 	unsigned int ctx_count;
 	unsigned int ctx_usecount;
 	unsigned int ctx_count_top;
+	/* bumped by every stop, so off-mutex loads can detect a teardown */
+	u32 generation;
+
+	/* permanent contexts created at init/reload, see NUM_CDE_CONTEXTS */
+	u32 num_prewarmed;
+
+	/* conversion statistics */
+	spinlock_t stats_lock;
+	u64 convert_count;
+	u64 convert_wait_ns;
+	u64 convert_wait_max_ns;
+	u64 convert_ns;
+	u64 convert_max_ns;
+	u64 temp_ctx_created;
 
 	u32 firmware_version;
 
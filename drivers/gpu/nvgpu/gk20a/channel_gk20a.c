@@ -413,12 +413,15 @@ int channel_gk20a_alloc_inst(struct gk20a *g, struct channel_gk20a *ch)
 	gk20a_dbg_info("channel %d inst block physical addr: 0x%16llx",
 		ch->hw_chid, gk20a_mm_inst_block_addr(g, &ch->inst_block));
 
+	gk20a_fifo_inst_hash_add(g, ch);
+
 	gk20a_dbg_fn("done");
 	return 0;
 }
 
 void channel_gk20a_free_inst(struct gk20a *g, struct channel_gk20a *ch)
 {
+	gk20a_fifo_inst_hash_del(g, ch);
 	gk20a_free_inst_block(g, &ch->inst_block);
 }
 
@@ -672,6 +675,23 @@ static int gk20a_attach_cycle_stats_snapshot(struct channel_gk20a *ch,
 	return ret;
 }
 
+static int gk20a_notify_cycle_stats_snapshot(struct channel_gk20a *ch,
+				u32 eventfd,
+				u32 watermark)
+{
+	int ret;
+
+	mutex_lock(&ch->cs_client_mutex);
+	if (ch->cs_client)
+		ret = gr_gk20a_css_set_notify(ch, ch->cs_client,
+					eventfd, watermark);
+	else
+		ret = -EBADF;
+	mutex_unlock(&ch->cs_client_mutex);
+
+	return ret;
+}
+
 static int gk20a_free_cycle_stats_snapshot(struct channel_gk20a *ch)
 {
 	int ret;
@@ -720,6 +740,12 @@ static int gk20a_channel_cycle_stats_snapshot(struct channel_gk20a *ch,
 		args->extra = 0;
 		break;
 
+	case NVGPU_IOCTL_CHANNEL_CYCLE_STATS_SNAPSHOT_CMD_NOTIFY:
+		ret = gk20a_notify_cycle_stats_snapshot(ch,
+						args->dmabuf_fd,
+						args->extra);
+		break;
+
 	default:
 		pr_err("cyclestats: unknown command %u\n", args->cmd);
 		ret = -EINVAL;
@@ -1258,6 +1284,7 @@ struct channel_gk20a *gk20a_open_new_channel(struct gk20a *g,
 
 	init_waitqueue_head(&ch->notifier_wq);
 	init_waitqueue_head(&ch->semaphore_wq);
+	atomic_set(&ch->semaphore_waiters, 0);
 
 	ch->update_fn = NULL;
 	ch->update_fn_data = NULL;
@@ -2136,16 +2163,15 @@ static int gk20a_channel_add_job(struct channel_gk20a *c,
 				 bool skip_buffer_refcounting)
 {
 	struct vm_gk20a *vm = c->vm;
-	struct mapped_buffer_node **mapped_buffers = NULL;
-	int err = 0, num_mapped_buffers = 0;
+	struct gk20a_vm_buffer_set *buffer_set = NULL;
+	int err = 0;
 	bool pre_alloc_enabled = channel_gk20a_is_prealloc_enabled(c);
 
 	/* job needs reference to this vm (released in channel_update) */
 	gk20a_vm_get(vm);
 
 	if (!skip_buffer_refcounting) {
-		err = gk20a_vm_get_buffers(vm, &mapped_buffers,
-					&num_mapped_buffers);
+		err = gk20a_vm_get_buffer_set(vm, &buffer_set);
 		if (err)
 			goto err_put_vm;
 	}
@@ -2154,8 +2180,7 @@ static int gk20a_channel_add_job(struct channel_gk20a *c,
 	c = gk20a_channel_get(c);
 
 	if (c) {
-		job->num_mapped_buffers = num_mapped_buffers;
-		job->mapped_buffers = mapped_buffers;
+		job->buffer_set = buffer_set;
 
 		gk20a_channel_timeout_start(c, job);
 
@@ -2172,6 +2197,8 @@ static int gk20a_channel_add_job(struct channel_gk20a *c,
 
 		if (!pre_alloc_enabled)
 			channel_gk20a_joblist_unlock(c);
+
+		gk20a_channel_semaphore_wakeup_arm(c);
 	} else {
 		err = -ETIMEDOUT;
 		goto err_put_buffers;
@@ -2180,7 +2207,7 @@ static int gk20a_channel_add_job(struct channel_gk20a *c,
 	return 0;
 
 err_put_buffers:
-	gk20a_vm_put_buffers(vm, mapped_buffers, num_mapped_buffers);
+	gk20a_vm_put_buffer_set(vm, buffer_set);
 err_put_vm:
 	gk20a_vm_put(vm);
 
@@ -2259,9 +2286,7 @@ static void gk20a_channel_clean_up_jobs(struct channel_gk20a *c,
 			}
 		}
 
-		if (job->num_mapped_buffers)
-			gk20a_vm_put_buffers(vm, job->mapped_buffers,
-				job->num_mapped_buffers);
+		gk20a_vm_put_buffer_set(vm, job->buffer_set);
 
 		/* Close the fences (this will unref the semaphores and release
 		 * them to the pool). */
@@ -2626,6 +2651,9 @@ int gk20a_submit_channel_gpfifo(struct channel_gk20a *c,
 		return -EINVAL;
 	}
 
+	/* comptags of buffers mapped since the last submit may be clearing */
+	gk20a_ctag_clear_wait(g, atomic64_read(&c->vm->ctag_clear_ticket));
+
 #ifdef CONFIG_DEBUG_FS
 	/* update debug settings */
 	if (g->ops.ltc.sync_debugfs)
@@ -2825,6 +2853,7 @@ int gk20a_init_channel_support(struct gk20a *g, u32 chid)
 	mutex_init(&c->cs_client_mutex);
 #endif
 	INIT_LIST_HEAD(&c->dbg_s_list);
+	INIT_LIST_HEAD(&c->runlist_level_entry);
 	INIT_LIST_HEAD(&c->event_id_list);
 	mutex_init(&c->event_id_list_lock);
 	mutex_init(&c->dbg_s_lock);
@@ -2863,11 +2892,16 @@ static int gk20a_channel_wait_semaphore(struct channel_gk20a *ch,
 
 	semaphore = data + (offset & ~PAGE_MASK);
 
+	atomic_inc(&ch->semaphore_waiters);
+	gk20a_channel_semaphore_wakeup_arm(ch);
+
 	remain = wait_event_interruptible_timeout(
 			ch->semaphore_wq,
 			*semaphore == payload || ch->has_timedout,
 			timeout);
 
+	atomic_dec(&ch->semaphore_waiters);
+
 	if (remain == 0 && *semaphore != payload)
 		ret = -ETIMEDOUT;
 	else if (remain < 0)
@@ -3143,6 +3177,8 @@ static int gk20a_channel_event_id_enable(struct channel_gk20a *ch,
 	list_add_tail(&event_id_data->event_id_node, &ch->event_id_list);
 	mutex_unlock(&ch->event_id_list_lock);
 
+	gk20a_channel_semaphore_wakeup_arm(ch);
+
 	fd_install(local_fd, file);
 	file->private_data = event_id_data;
 
@@ -3317,10 +3353,41 @@ int gk20a_channel_resume(struct gk20a *g)
 	return 0;
 }
 
+/*
+ * Mark @c as possibly affected by the next semaphore wakeup. Callers must have
+ * made the reason visible (job on the joblist, waiter count, event id on the
+ * list) before arming, so that a concurrent wakeup either sees the bit or sees
+ * the reason when it re-checks the channel.
+ */
+void gk20a_channel_semaphore_wakeup_arm(struct channel_gk20a *c)
+{
+	smp_mb();
+	set_bit(c->hw_chid, c->g->fifo.sema_wakeup_map);
+}
+
+/*
+ * A channel stays registered for semaphore wakeups while it has outstanding
+ * jobs, a thread sleeping in the semaphore wait ioctl, or event ids that
+ * could receive a BLOCKING_SYNC event.
+ */
+static bool gk20a_channel_semaphore_wakeup_needed(struct channel_gk20a *c)
+{
+	if (!channel_gk20a_joblist_is_empty(c))
+		return true;
+
+	if (atomic_read(&c->semaphore_waiters))
+		return true;
+
+	if (gk20a_is_channel_marked_as_tsg(c))
+		return !list_empty(&c->g->fifo.tsg[c->tsgid].event_id_list);
+
+	return !list_empty(&c->event_id_list);
+}
+
 void gk20a_channel_semaphore_wakeup(struct gk20a *g, bool post_events)
 {
 	struct fifo_gk20a *f = &g->fifo;
-	u32 chid;
+	unsigned long chid;
 
 	gk20a_dbg_fn("");
 
@@ -3330,39 +3397,58 @@ void gk20a_channel_semaphore_wakeup(struct gk20a *g, bool post_events)
 	 */
 	g->ops.mm.fb_flush(g);
 
-	for (chid = 0; chid < f->num_channels; chid++) {
+	f->sema_wakeup_calls++;
+
+	for_each_set_bit(chid, f->sema_wakeup_map, f->num_channels) {
 		struct channel_gk20a *c = g->fifo.channel+chid;
-		if (gk20a_channel_get(c)) {
-			if (atomic_read(&c->bound)) {
-				wake_up_interruptible_all(&c->semaphore_wq);
-				if (post_events) {
-					if (gk20a_is_channel_marked_as_tsg(c)) {
-						struct tsg_gk20a *tsg =
-							&g->fifo.tsg[c->tsgid];
-
-						gk20a_tsg_event_id_post_event(tsg,
-						    NVGPU_IOCTL_CHANNEL_EVENT_ID_BLOCKING_SYNC);
-					} else {
-						gk20a_channel_event_id_post_event(c,
-						    NVGPU_IOCTL_CHANNEL_EVENT_ID_BLOCKING_SYNC);
-					}
+
+		/*
+		 * Disarm before looking at the channel; anyone arming it
+		 * after this point is either seen below or re-sets the bit.
+		 */
+		clear_bit(chid, f->sema_wakeup_map);
+		smp_mb();
+
+		f->sema_wakeup_visited++;
+
+		if (!gk20a_channel_get(c))
+			continue;
+
+		if (atomic_read(&c->bound)) {
+			f->sema_wakeup_woken++;
+
+			wake_up_interruptible_all(&c->semaphore_wq);
+			if (post_events) {
+				if (gk20a_is_channel_marked_as_tsg(c)) {
+					struct tsg_gk20a *tsg =
+						&g->fifo.tsg[c->tsgid];
+
+					gk20a_tsg_event_id_post_event(tsg,
+					    NVGPU_IOCTL_CHANNEL_EVENT_ID_BLOCKING_SYNC);
+				} else {
+					gk20a_channel_event_id_post_event(c,
+					    NVGPU_IOCTL_CHANNEL_EVENT_ID_BLOCKING_SYNC);
 				}
-				/*
-				 * Only non-deterministic channels get the
-				 * channel_update callback. We don't allow
-				 * semaphore-backed syncs for these channels
-				 * anyways, since they have a dependency on
-				 * the sync framework.
-				 * If deterministic channels are receiving a
-				 * semaphore wakeup, it must be for a
-				 * user-space managed
-				 * semaphore.
-				 */
-				if (!c->deterministic)
-					gk20a_channel_update(c, 0);
 			}
-			gk20a_channel_put(c);
+			/*
+			 * Only non-deterministic channels get the
+			 * channel_update callback. We don't allow
+			 * semaphore-backed syncs for these channels
+			 * anyways, since they have a dependency on
+			 * the sync framework.
+			 * If deterministic channels are receiving a
+			 * semaphore wakeup, it must be for a
+			 * user-space managed
+			 * semaphore.
+			 */
+			if (!c->deterministic)
+				gk20a_channel_update(c, 0);
 		}
+
+		if (gk20a_channel_semaphore_wakeup_needed(c))
+			set_bit(chid, f->sema_wakeup_map);
+
+		gk20a_channel_put(c);
 	}
 }
 
@@ -61,8 +61,7 @@ struct channel_ctx_gk20a {
 };
 
 struct channel_gk20a_job {
-	struct mapped_buffer_node **mapped_buffers;
-	int num_mapped_buffers;
+	struct gk20a_vm_buffer_set *buffer_set;
 	struct gk20a_fence *pre_fence;
 	struct gk20a_fence *post_fence;
 	struct priv_cmd_entry *wait_cmd;
@@ -150,6 +149,8 @@ struct channel_gk20a {
 	struct channel_ctx_gk20a ch_ctx;
 
 	struct mem_desc inst_block;
+	struct hlist_node inst_hash_node; /* in fifo->inst_hash */
+	u32 inst_ptr; /* inst block addr >> ram_in_base_shift_v() */
 	struct mem_desc_sub ramfc;
 
 	u64 userd_iova;
@@ -161,6 +162,7 @@ struct channel_gk20a {
 
 	wait_queue_head_t notifier_wq;
 	wait_queue_head_t semaphore_wq;
+	atomic_t semaphore_waiters;
 
 	u32 timeout_accumulated_ms;
 	u32 timeout_gpfifo_get;
@@ -200,6 +202,7 @@ struct channel_gk20a {
 
 #ifdef CONFIG_TEGRA_GR_VIRTUALIZATION
 	u64 virt_ctx;
+	int virt_async_err;	/* first failed async vgpu cmd, not reported */
 #endif
 
 	/* signal channel owner via a callback, if set, in gk20a_channel_update
@@ -210,6 +213,7 @@ struct channel_gk20a {
 	struct work_struct update_fn_work;
 
 	u32 interleave_level;
+	struct list_head runlist_level_entry;
 
 	u32 runlist_id;
 
@@ -233,6 +237,7 @@ void gk20a_channel_abort(struct channel_gk20a *ch, bool channel_preempt);
 void gk20a_channel_abort_clean_up(struct channel_gk20a *ch);
 void gk20a_set_error_notifier(struct channel_gk20a *ch, __u32 error);
 void gk20a_channel_semaphore_wakeup(struct gk20a *g, bool post_events);
+void gk20a_channel_semaphore_wakeup_arm(struct channel_gk20a *c);
 int gk20a_channel_alloc_priv_cmdbuf(struct channel_gk20a *c, u32 size,
 			     struct priv_cmd_entry *entry);
 int gk20a_free_priv_cmdbuf(struct channel_gk20a *c, struct priv_cmd_entry *e);
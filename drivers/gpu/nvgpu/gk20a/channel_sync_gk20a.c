@@ -546,6 +546,11 @@ static int __semaphore_wait_fd_fast_path(struct channel_gk20a *c,
 		return 0;
 	}
 
+	/* The sea may have grown since this VM mapped it. */
+	err = gk20a_semaphore_map_ro(sema, c->vm);
+	if (err)
+		return err;
+
 	err = gk20a_channel_alloc_priv_cmdbuf(c, 8, wait_cmd);
 	if (err)
 		return err;
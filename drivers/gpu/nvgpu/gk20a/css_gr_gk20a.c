@@ -19,7 +19,9 @@
 #include <linux/bitops.h>
 #include <linux/dma-mapping.h>
 #include <linux/dma-buf.h>
+#include <linux/eventfd.h>
 #include <linux/mutex.h>
+#include <linux/pm_runtime.h>
 #include <linux/vmalloc.h>
 
 #include "gk20a.h"
@@ -27,11 +29,6 @@
 #include "hw_mc_gk20a.h"
 #include "css_gr_gk20a.h"
 
-/* check client for pointed perfmon ownership */
-#define CONTAINS_PERFMON(cl, pm)				\
-		((cl)->perfmon_start <= (pm) &&			\
-		((pm) - (cl)->perfmon_start) < (cl)->perfmon_count)
-
 /* the minimal size of client buffer */
 #define CSS_MIN_CLIENT_SNAPSHOT_SIZE				\
 		(sizeof(struct gk20a_cs_snapshot_fifo) +	\
@@ -48,8 +45,8 @@
 
 /* reserved to indicate failures with data */
 #define CSS_FIRST_PERFMON_ID	32
-/* should correlate with size of gk20a_cs_snapshot_fifo_entry::perfmon_id */
-#define CSS_MAX_PERFMON_IDS	256
+/* period of the worker delivering snapshots to clients waiting on eventfd */
+#define CSS_NOTIFY_PERIOD_MS	20
 
 /* reports whether the hw queue overflowed */
 static inline bool css_hw_get_overflow_status(struct gk20a *g)
@@ -239,20 +236,80 @@ static void css_gr_free_shared_data(struct gr_gk20a *gr)
 }
 
 
-static struct gk20a_cs_snapshot_client*
-css_gr_search_client(struct list_head *clients, u32 perfmon)
+/* (un)registers the client as owner of its perfmons in the lookup table */
+static void css_gr_set_client_perfmons(struct gk20a_cs_snapshot *data,
+				struct gk20a_cs_snapshot_client *client,
+				bool owner)
 {
-	struct list_head *pos;
+	u32 pm = client->perfmon_start;
+	u32 end = min_t(u32, pm + client->perfmon_count, CSS_MAX_PERFMON_IDS);
+
+	for (; pm < end; pm++) {
+		if (owner)
+			data->pm_clients[pm] = client;
+		else if (data->pm_clients[pm] == client)
+			data->pm_clients[pm] = NULL;
+	}
+}
 
-	list_for_each(pos, clients) {
-		struct gk20a_cs_snapshot_client *client =
-			container_of(pos,
-				struct gk20a_cs_snapshot_client, list);
-		if (CONTAINS_PERFMON(client, perfmon))
-			return client;
+/*
+ * Appends a run of count HW entries to the client fifo with at most two
+ * copies and returns how many of them fitted in. The rest is accounted
+ * as software overflow.
+ */
+static u32 css_gr_copy_to_client(struct gk20a *g,
+				struct gk20a_cs_snapshot_client *cur,
+				struct gk20a_cs_snapshot_fifo_entry *src,
+				u32 count)
+{
+	const u32 esize = sizeof(struct gk20a_cs_snapshot_fifo_entry);
+	struct gk20a_cs_snapshot_fifo *dst = cur->snapshot;
+	struct gk20a_cs_snapshot_fifo_entry *dst_head;
+	u32 size, get, put, used, room, copy, part;
+
+	/* due to data sharing with userspace we allowed update only */
+	/* overflows and put field in the fifo header, and get is    */
+	/* re-validated because userspace is free to move it around  */
+	size = (dst->end - dst->start) / esize;
+	get = ACCESS_ONCE(dst->get);
+	put = dst->put;
+	if (get < dst->start || get >= dst->end ||
+	    (get - dst->start) % esize ||
+	    put < dst->start || put >= dst->end) {
+		room = 0;
+		goto overflow;
 	}
 
-	return NULL;
+	get = (get - dst->start) / esize;
+	put = (put - dst->start) / esize;
+	used = (put + size - get) % size;
+	/* one entry is kept free to distinguish full from empty */
+	room = size - 1 - used;
+	copy = min(count, room);
+
+	dst_head = CSS_FIFO_ENTRY(dst, dst->start);
+	part = min(copy, size - put);
+	memcpy(dst_head + put, src, part * esize);
+	memcpy(dst_head, src + part, (copy - part) * esize);
+
+	/* entries must be visible before the consumer sees the new put */
+	smp_wmb();
+	dst->put = dst->start + ((put + copy) % size) * esize;
+
+	if (cur->notify && used < cur->notify_watermark &&
+	    used + copy >= cur->notify_watermark)
+		eventfd_signal(cur->notify, 1);
+
+overflow:
+	if (count > room) {
+		dst->sw_overflow_events_occured += count - room;
+		gk20a_warn(dev_from_gk20a(g),
+			   "cyclestats: perfmon %u soft overflow, %u dropped\n",
+						src->perfmon_id, count - room);
+		return room;
+	}
+
+	return count;
 }
 
 static int css_gr_flush_snapshots(struct channel_gk20a *ch)
@@ -266,18 +323,9 @@ static int css_gr_flush_snapshots(struct channel_gk20a *ch)
 	int err;
 
 	/* variables for iterating over HW entries */
-	u32 sid;
+	u32 sid, run, limit;
 	struct gk20a_cs_snapshot_fifo_entry *src;
 
-	/* due to data sharing with userspace we allowed update only */
-	/* overflows and put field in the fifo header                */
-	struct gk20a_cs_snapshot_fifo *dst;
-	struct gk20a_cs_snapshot_fifo_entry *dst_get;
-	struct gk20a_cs_snapshot_fifo_entry *dst_put;
-	struct gk20a_cs_snapshot_fifo_entry *dst_nxt;
-	struct gk20a_cs_snapshot_fifo_entry *dst_head;
-	struct gk20a_cs_snapshot_fifo_entry *dst_tail;
-
 	if (!css)
 		return -EINVAL;
 
@@ -308,74 +356,36 @@ static int css_gr_flush_snapshots(struct channel_gk20a *ch)
 	/* process all items in HW buffer */
 	sid = 0;
 	completed = 0;
-	cur = NULL;
-	dst = NULL;
-	dst_put = NULL;
 	src = css->hw_get;
 
-	/* proceed all completed records */
+	/* proceed all completed records in runs of the same client */
 	while (sid < pending && 0 == src->zero0) {
-		/* we may have a new perfmon_id which required to */
-		/* switch to a new client -> let's forget current */
-		if (cur && !CONTAINS_PERFMON(cur, src->perfmon_id)) {
-			dst->put = (char *)dst_put - (char *)dst;
-			dst = NULL;
-			cur = NULL;
-		}
-
-		/* now we have to select a new current client         */
-		/* the client selection rate depends from experiment  */
-		/* activity but on Android usually happened 1-2 times */
-		if (!cur) {
-			cur = css_gr_search_client(&css->clients,
-							src->perfmon_id);
-			if (cur) {
-				/* found - setup all required data */
-				dst = cur->snapshot;
-				dst_get = CSS_FIFO_ENTRY(dst, dst->get);
-				dst_put = CSS_FIFO_ENTRY(dst, dst->put);
-				dst_head = CSS_FIFO_ENTRY(dst, dst->start);
-				dst_tail = CSS_FIFO_ENTRY(dst, dst->end);
-
-				dst_nxt = dst_put + 1;
-				if (dst_nxt == dst_tail)
-					dst_nxt = dst_head;
-			} else {
-				/* client not found - skipping this entry */
-				gk20a_warn(dev_from_gk20a(g),
-					   "cyclestats: orphaned perfmon %u\n",
-							src->perfmon_id);
-				goto next_hw_fifo_entry;
-			}
+		cur = css->pm_clients[src->perfmon_id];
+
+		/* extend the run while records are completed, belong to */
+		/* the same client and do not wrap around the HW buffer  */
+		limit = min_t(u32, pending - sid, css->hw_end - src);
+		for (run = 1; run < limit; run++) {
+			if (src[run].zero0 ||
+			    css->pm_clients[src[run].perfmon_id] != cur)
+				break;
 		}
 
-		/* check for software overflows */
-		if (dst_nxt == dst_get) {
-			/* no data copy, no pointer updates */
-			dst->sw_overflow_events_occured++;
+		if (cur) {
+			completed += css_gr_copy_to_client(g, cur, src, run);
+		} else {
+			/* client not found - skipping these entries */
 			gk20a_warn(dev_from_gk20a(g),
-				   "cyclestats: perfmon %u soft overflow\n",
+				   "cyclestats: orphaned perfmon %u\n",
 							src->perfmon_id);
-		} else {
-			*dst_put = *src;
-			completed++;
-
-			dst_put = dst_nxt++;
-
-			if (dst_nxt == dst_tail)
-				dst_nxt = dst_head;
 		}
 
-next_hw_fifo_entry:
-		sid++;
-		if (++src >= css->hw_end)
+		sid += run;
+		src += run;
+		if (src >= css->hw_end)
 			src = css->hw_snapshot;
 	}
 
-	/* update client put pointer if necessary */
-	if (cur && dst)
-		dst->put = (char *)dst_put - (char *)dst;
-
 	/* re-set HW buffer after processing taking wrapping into account */
 	if (css->hw_get < src) {
 		memset(css->hw_get, 0xff, (src - css->hw_get) * sizeof(*src));
@@ -444,6 +454,13 @@ static int css_gr_free_client_data(struct gk20a *g,
 	if (client->list.next && client->list.prev)
 		list_del(&client->list);
 
+	css_gr_set_client_perfmons(data, client, false);
+
+	if (client->notify) {
+		eventfd_ctx_put(client->notify);
+		data->notify_clients--;
+	}
+
 	if (client->perfmon_start && client->perfmon_count
 					&& g->ops.css.release_perfmon_ids) {
 		if (client->perfmon_count != g->ops.css.release_perfmon_ids(data,
@@ -573,6 +590,10 @@ int gr_gk20a_css_attach(struct channel_gk20a *ch,
 	if (ret)
 		goto failed;
 
+	/* perfmons are known only now in the virtual case */
+	(*cs_client)->ch = ch;
+	css_gr_set_client_perfmons(gr->cs_data, *cs_client, true);
+
 	if (perfmon_start)
 		*perfmon_start = (*cs_client)->perfmon_start;
 
@@ -645,11 +666,107 @@ int gr_gk20a_css_flush(struct channel_gk20a *ch,
 	return ret;
 }
 
+int gr_gk20a_css_set_notify(struct channel_gk20a *ch,
+				struct gk20a_cs_snapshot_client *cs_client,
+				int eventfd, u32 watermark)
+{
+	struct gk20a *g = ch->g;
+	struct gr_gk20a *gr = &g->gr;
+	struct gk20a_cs_snapshot *data;
+	struct eventfd_ctx *notify = NULL;
+	int ret = 0;
+
+	if (!cs_client)
+		return -EINVAL;
+
+	/* zero watermark just disables notifications */
+	if (watermark) {
+		if (watermark >=
+		    CSS_FIFO_ENTRY_CAPACITY(cs_client->snapshot_size))
+			return -EINVAL;
+
+		notify = eventfd_ctx_fdget(eventfd);
+		if (IS_ERR(notify))
+			return PTR_ERR(notify);
+	}
+
+	mutex_lock(&gr->cs_lock);
+	data = gr->cs_data;
+	if (!data) {
+		ret = -EBADF;
+		goto out;
+	}
+
+	if (cs_client->notify) {
+		eventfd_ctx_put(cs_client->notify);
+		data->notify_clients--;
+	}
+
+	cs_client->notify = notify;
+	cs_client->notify_watermark = watermark;
+	notify = NULL;
+
+	if (cs_client->notify) {
+		data->notify_clients++;
+		schedule_delayed_work(&gr->cs_notify_work,
+				msecs_to_jiffies(CSS_NOTIFY_PERIOD_MS));
+	}
+
+out:
+	mutex_unlock(&gr->cs_lock);
+	if (notify)
+		eventfd_ctx_put(notify);
+
+	return ret;
+}
+
+/*
+ * Delivers snapshots on behalf of clients waiting on eventfd, so they do
+ * not need to poll with explicit flushes. Re-arms itself while at least
+ * one such client exists. It never powers the GPU up: while it is off no
+ * snapshots are produced, so there is nothing to deliver.
+ */
+static void gr_gk20a_css_notify_worker(struct work_struct *work)
+{
+	struct gr_gk20a *gr = container_of(to_delayed_work(work),
+					struct gr_gk20a, cs_notify_work);
+	struct gk20a *g = gr->g;
+	struct gk20a_cs_snapshot *data;
+	struct gk20a_cs_snapshot_client *cur;
+
+	mutex_lock(&gr->cs_lock);
+	data = gr->cs_data;
+	if (!data || !data->notify_clients) {
+		mutex_unlock(&gr->cs_lock);
+		return;
+	}
+
+	gk20a_busy_noresume(g->dev);
+	if (g->power_on) {
+		cur = list_first_entry(&data->clients,
+				struct gk20a_cs_snapshot_client, list);
+		css_gr_flush_snapshots(cur->ch);
+	}
+	pm_runtime_put_noidle(g->dev);
+	mutex_unlock(&gr->cs_lock);
+
+	schedule_delayed_work(&gr->cs_notify_work,
+			msecs_to_jiffies(CSS_NOTIFY_PERIOD_MS));
+}
+
+void gr_gk20a_init_cyclestats_snapshot(struct gk20a *g)
+{
+	mutex_init(&g->gr.cs_lock);
+	INIT_DELAYED_WORK(&g->gr.cs_notify_work, gr_gk20a_css_notify_worker);
+}
+
 /* helper function with locking to cleanup snapshot code code in gr_gk20a.c */
 void gr_gk20a_free_cyclestats_snapshot_data(struct gk20a *g)
 {
 	struct gr_gk20a *gr = &g->gr;
 
+	cancel_delayed_work_sync(&gr->cs_notify_work);
+
 	mutex_lock(&gr->cs_lock);
 	css_gr_free_shared_data(gr);
 	mutex_unlock(&gr->cs_lock);
@@ -95,6 +95,11 @@ struct gk20a_cs_snapshot_client {
 	u32			snapshot_size;
 	u32			perfmon_start;
 	u32			perfmon_count;
+	/* channel the client was attached from, used by the notify worker */
+	struct channel_gk20a	*ch;
+	/* optional eventfd signalled when the fifo fills up to watermark */
+	struct eventfd_ctx	*notify;
+	u32			notify_watermark;
 };
 
 /* should correlate with size of gk20a_cs_snapshot_fifo_entry::perfmon_id */
@@ -112,6 +117,10 @@ struct gk20a_cs_snapshot {
 	struct gk20a_cs_snapshot_fifo_entry	*hw_snapshot;
 	struct gk20a_cs_snapshot_fifo_entry	*hw_end;
 	struct gk20a_cs_snapshot_fifo_entry	*hw_get;
+	/* direct perfmon id -> owning client lookup */
+	struct gk20a_cs_snapshot_client	*pm_clients[CSS_MAX_PERFMON_IDS];
+	/* number of clients with eventfd notification enabled */
+	u32			notify_clients;
 };
 
 void gk20a_init_css_ops(struct gpu_ops *gops);
@@ -543,33 +543,41 @@ void gk20a_ctxsw_trace_cleanup(struct gk20a *g)
 #endif
 }
 
-int gk20a_ctxsw_trace_write(struct gk20a *g,
-		struct nvgpu_ctxsw_trace_entry *entry)
+/*
+ * Appends @num entries, all for the vmid of the first one, to the user ring.
+ * The lock is taken and write_idx published once for the whole batch, with
+ * a single barrier ordering all the records before the index update.
+ */
+int gk20a_ctxsw_trace_write_n(struct gk20a *g,
+		struct nvgpu_ctxsw_trace_entry *entries, int num)
 {
 	struct nvgpu_ctxsw_ring_header *hdr;
+	struct nvgpu_ctxsw_trace_entry *entry;
 	struct gk20a_ctxsw_dev *dev;
 	int ret = 0;
 	const char *reason;
 	u32 write_idx;
+	u32 written = 0;
+	int i;
 
-	if (!g->ctxsw_trace)
+	if (!g->ctxsw_trace || !num)
 		return 0;
 
-	if (unlikely(entry->vmid >= GK20A_CTXSW_TRACE_NUM_DEVS))
+	if (unlikely(entries->vmid >= GK20A_CTXSW_TRACE_NUM_DEVS))
 		return -ENODEV;
 
-	dev = &g->ctxsw_trace->devs[entry->vmid];
+	dev = &g->ctxsw_trace->devs[entries->vmid];
 	hdr = dev->hdr;
 
 	gk20a_dbg(gpu_dbg_fn | gpu_dbg_ctxsw,
-		"dev=%p hdr=%p", dev, hdr);
+		"dev=%p hdr=%p num=%d", dev, hdr, num);
 
 	mutex_lock(&dev->write_lock);
 
 	if (unlikely(!hdr)) {
 		/* device has been released */
-		ret = -ENODEV;
-		goto done;
+		mutex_unlock(&dev->write_lock);
+		return -ENODEV;
 	}
 
 	write_idx = hdr->write_idx;
@@ -577,68 +585,67 @@ int gk20a_ctxsw_trace_write(struct gk20a *g,
 		gk20a_err(dev_from_gk20a(dev->g),
 			"write_idx=%u out of range [0..%u]",
 			write_idx, dev->num_ents);
-		ret = -ENOSPC;
-		reason = "write_idx out of range";
-		goto disable;
-	}
-
-	entry->seqno = hdr->write_seqno++;
-
-	if (!dev->write_enabled) {
-		ret = -EBUSY;
-		reason = "write disabled";
-		goto drop;
-	}
-
-	if (unlikely(ring_is_full(hdr))) {
-		ret = -ENOSPC;
-		reason = "user fifo full";
-		goto drop;
-	}
-
-	if (!NVGPU_CTXSW_FILTER_ISSET(entry->tag, &dev->filter)) {
-		reason = "filtered out";
-		goto filter;
+		hdr->drop_count += num;
+		mutex_unlock(&dev->write_lock);
+		g->ops.fecs_trace.disable(g);
+		return -ENOSPC;
 	}
 
-	gk20a_dbg(gpu_dbg_ctxsw,
-		"seqno=%d context_id=%08x pid=%lld tag=%x timestamp=%llx",
-		entry->seqno, entry->context_id, entry->pid,
-		entry->tag, entry->timestamp);
-
-	dev->ents[write_idx] = *entry;
-
-	/* ensure record is written before updating write index */
-	smp_wmb();
-
-	write_idx++;
-	if (unlikely(write_idx >= hdr->num_ents))
-		write_idx = 0;
-	hdr->write_idx = write_idx;
-	gk20a_dbg(gpu_dbg_ctxsw, "added: read=%d write=%d len=%d",
-		hdr->read_idx, hdr->write_idx, ring_len(hdr));
-
-	mutex_unlock(&dev->write_lock);
-	return ret;
-
-disable:
-	g->ops.fecs_trace.disable(g);
-
-drop:
-	hdr->drop_count++;
+	for (i = 0; i < num; i++) {
+		entry = &entries[i];
+		entry->seqno = hdr->write_seqno++;
+
+		if (!dev->write_enabled) {
+			ret = -EBUSY;
+			reason = "write disabled";
+			hdr->drop_count++;
+		} else if (unlikely(((write_idx + 1) % hdr->num_ents) ==
+				    hdr->read_idx)) {
+			ret = -ENOSPC;
+			reason = "user fifo full";
+			hdr->drop_count++;
+		} else if (!NVGPU_CTXSW_FILTER_ISSET(entry->tag,
+						     &dev->filter)) {
+			reason = "filtered out";
+		} else {
+			gk20a_dbg(gpu_dbg_ctxsw,
+				"seqno=%d context_id=%08x pid=%lld tag=%x timestamp=%llx",
+				entry->seqno, entry->context_id, entry->pid,
+				entry->tag, entry->timestamp);
+
+			dev->ents[write_idx] = *entry;
+			write_idx++;
+			if (unlikely(write_idx >= hdr->num_ents))
+				write_idx = 0;
+			written++;
+			continue;
+		}
 
-filter:
-	gk20a_dbg(gpu_dbg_ctxsw,
+		gk20a_dbg(gpu_dbg_ctxsw,
 			"dropping seqno=%d context_id=%08x pid=%lld "
 			"tag=%x time=%llx (%s)",
 			entry->seqno, entry->context_id, entry->pid,
 			entry->tag, entry->timestamp, reason);
+	}
+
+	if (written) {
+		/* ensure records are written before updating write index */
+		smp_wmb();
+		hdr->write_idx = write_idx;
+		gk20a_dbg(gpu_dbg_ctxsw, "added %u: read=%d write=%d len=%d",
+			written, hdr->read_idx, hdr->write_idx, ring_len(hdr));
+	}
 
-done:
 	mutex_unlock(&dev->write_lock);
 	return ret;
 }
 
+int gk20a_ctxsw_trace_write(struct gk20a *g,
+		struct nvgpu_ctxsw_trace_entry *entry)
+{
+	return gk20a_ctxsw_trace_write_n(g, entry, 1);
+}
+
 void gk20a_ctxsw_trace_wake_up(struct gk20a *g, int vmid)
 {
 	struct gk20a_ctxsw_dev *dev;
@@ -37,6 +37,8 @@ int gk20a_ctxsw_dev_mmap(struct file *, struct vm_area_struct *);
 int gk20a_ctxsw_trace_init(struct gk20a *);
 void gk20a_ctxsw_trace_cleanup(struct gk20a *);
 int gk20a_ctxsw_trace_write(struct gk20a *, struct nvgpu_ctxsw_trace_entry *);
+int gk20a_ctxsw_trace_write_n(struct gk20a *,
+		struct nvgpu_ctxsw_trace_entry *, int num);
 void gk20a_ctxsw_trace_wake_up(struct gk20a *g, int vmid);
 void gk20a_ctxsw_trace_init_ops(struct gpu_ops *ops);
 
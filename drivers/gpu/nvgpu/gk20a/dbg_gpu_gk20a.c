@@ -117,6 +117,7 @@ static int gk20a_dbg_gpu_do_dev_open(struct inode *inode,
 	INIT_LIST_HEAD(&dbg_session->ch_list);
 	mutex_init(&dbg_session->ch_list_lock);
 	mutex_init(&dbg_session->ioctl_lock);
+	hash_init(dbg_session->ctx_offset_cache);
 	dbg_session->dbg_events.events_enabled = false;
 	dbg_session->dbg_events.num_pending_events = 0;
 
@@ -477,6 +478,7 @@ int gk20a_dbg_gpu_dev_release(struct inode *inode, struct file *filp)
 	nvgpu_dbg_timeout_enable(dbg_s, NVGPU_DBG_GPU_IOCTL_TIMEOUT_ENABLE);
 	mutex_unlock(&g->dbg_sessions_lock);
 
+	gk20a_regops_session_cleanup(dbg_s);
 	kfree(dbg_s);
 	return 0;
 }
@@ -547,6 +549,9 @@ static int dbg_bind_channel_gk20a(struct dbg_session_gk20a *dbg_s,
 static int nvgpu_ioctl_channel_reg_ops(struct dbg_session_gk20a *dbg_s,
 				struct nvgpu_dbg_gpu_exec_reg_ops_args *args);
 
+static bool gr_context_info_available(struct dbg_session_gk20a *dbg_s,
+				      struct gr_gk20a *gr);
+
 static int nvgpu_ioctl_powergate_gk20a(struct dbg_session_gk20a *dbg_s,
 				struct nvgpu_dbg_gpu_powergate_args *args);
 
@@ -869,6 +874,107 @@ fail_dmabuf_put:
 	return err;
 }
 
+static int nvgpu_dbg_gpu_ioctl_set_ctx_sample_program(
+		struct dbg_session_gk20a *dbg_s,
+		struct nvgpu_dbg_gpu_set_ctx_sample_program_args *args)
+{
+	struct device *dev = dbg_s->dev;
+	struct gk20a *g = get_gk20a(dbg_s->dev);
+	struct nvgpu_dbg_gpu_reg_op *ops = NULL;
+	u64 ops_size = sizeof(ops[0]) * args->num_ops;
+	int err;
+
+	if (args->num_ops > SZ_4K / sizeof(ops[0]))
+		return -EINVAL;
+
+	if (!args->num_ops) {
+		mutex_lock(&g->dbg_sessions_lock);
+		err = gk20a_regops_set_ctx_sample_program(dbg_s, NULL, 0);
+		mutex_unlock(&g->dbg_sessions_lock);
+		return err;
+	}
+
+	if (!nvgpu_dbg_gpu_get_session_channel(dbg_s)) {
+		gk20a_err(dev, "bind a channel before setting a sample program");
+		return -EINVAL;
+	}
+
+	if (!gk20a_gpu_is_virtual(dbg_s->dev) &&
+		!gr_context_info_available(dbg_s, &g->gr)) {
+		gk20a_err(dev, "gr context data not available\n");
+		return -ENODEV;
+	}
+
+	ops = kzalloc(ops_size, GFP_KERNEL);
+	if (!ops)
+		return -ENOMEM;
+
+	if (copy_from_user(ops, (void __user *)(uintptr_t)args->ops,
+			   ops_size)) {
+		err = -EFAULT;
+		goto clean_up;
+	}
+
+	mutex_lock(&g->dbg_sessions_lock);
+	err = gk20a_regops_set_ctx_sample_program(dbg_s, ops, args->num_ops);
+	mutex_unlock(&g->dbg_sessions_lock);
+
+	/* per-op status, also when the program was rejected */
+	if (copy_to_user((void __user *)(uintptr_t)args->ops, ops, ops_size)
+	    && !err)
+		err = -EFAULT;
+
+clean_up:
+	kfree(ops);
+	return err;
+}
+
+static int nvgpu_dbg_gpu_ioctl_ctx_sample(struct dbg_session_gk20a *dbg_s,
+		struct nvgpu_dbg_gpu_ctx_sample_args *args)
+{
+	struct gk20a *g = get_gk20a(dbg_s->dev);
+	bool is_pg_disabled = false;
+	int err = 0, powergate_err = 0;
+	u64 *values;
+
+	if (!dbg_s->ctx_sample_prog ||
+	    args->num_values != dbg_s->ctx_sample_prog->num_entries)
+		return -EINVAL;
+
+	values = kcalloc(args->num_values, sizeof(*values), GFP_KERNEL);
+	if (!values)
+		return -ENOMEM;
+
+	mutex_lock(&g->dbg_sessions_lock);
+
+	if (!dbg_s->is_pg_disabled) {
+		powergate_err = g->ops.dbg_session_ops.dbg_set_powergate(dbg_s,
+					NVGPU_DBG_GPU_POWERGATE_MODE_DISABLE);
+		is_pg_disabled = true;
+	}
+
+	if (!powergate_err) {
+		err = gk20a_regops_ctx_sample(dbg_s, values);
+		/* enable powergate, if previously disabled */
+		if (is_pg_disabled)
+			powergate_err =
+				g->ops.dbg_session_ops.dbg_set_powergate(dbg_s,
+					NVGPU_DBG_GPU_POWERGATE_MODE_ENABLE);
+	}
+
+	mutex_unlock(&g->dbg_sessions_lock);
+
+	if (!err && powergate_err)
+		err = powergate_err;
+
+	if (!err && copy_to_user((void __user *)(uintptr_t)args->values,
+				 values, args->num_values * sizeof(*values)))
+		err = -EFAULT;
+
+	kfree(values);
+	return err;
+}
+
 long gk20a_dbg_gpu_dev_ioctl(struct file *filp, unsigned int cmd,
 			     unsigned long arg)
 {
@@ -999,6 +1105,16 @@ long gk20a_dbg_gpu_dev_ioctl(struct file *filp, unsigned int cmd,
 			(struct nvgpu_dbg_gpu_access_fb_memory_args *)buf);
 		break;
 
+	case NVGPU_DBG_GPU_IOCTL_SET_CTX_SAMPLE_PROGRAM:
+		err = nvgpu_dbg_gpu_ioctl_set_ctx_sample_program(dbg_s,
+		   (struct nvgpu_dbg_gpu_set_ctx_sample_program_args *)buf);
+		break;
+
+	case NVGPU_DBG_GPU_IOCTL_CTX_SAMPLE:
+		err = nvgpu_dbg_gpu_ioctl_ctx_sample(dbg_s,
+			(struct nvgpu_dbg_gpu_ctx_sample_args *)buf);
+		break;
+
 	default:
 		gk20a_err(dev_from_gk20a(g),
 			   "unrecognized dbg gpu ioctl cmd: 0x%x",
@@ -17,6 +17,7 @@
  */
 #ifndef DBG_GPU_GK20A_H
 #define DBG_GPU_GK20A_H
+#include <linux/hashtable.h>
 #include <linux/poll.h>
 
 /* module debug driver interface */
@@ -61,6 +62,16 @@ struct dbg_session_gk20a {
 	struct regops_whitelist *global;
 	struct regops_whitelist *per_context;
 
+	/*
+	 * Ctx regop offsets already checked against the ctx buffer layout,
+	 * so that repeated sampling skips gr_gk20a_get_ctx_buffer_offsets().
+	 */
+	DECLARE_HASHTABLE(ctx_offset_cache, 6);
+	u32 ctx_offset_cache_entries;
+
+	/* set with NVGPU_DBG_GPU_IOCTL_SET_CTX_SAMPLE_PROGRAM */
+	struct gr_ctx_sample_program *ctx_sample_prog;
+
 	/* gpu module vagaries */
 	struct device             *dev;
 	struct gk20a              *g;
@@ -480,7 +480,9 @@ void gk20a_debug_init(struct device *dev, const char *debugfs_symlink)
 	gk20a_alloc_debugfs_init(g->dev);
 	gk20a_mm_debugfs_init(g->dev);
 	gk20a_fifo_debugfs_init(g->dev);
+	gk20a_mc_debugfs_init(g->dev);
 	gk20a_sched_debugfs_init(g->dev);
+	gk20a_semaphore_debugfs_init(g->dev);
 #endif
 
 }
@@ -39,6 +39,8 @@
 #define GK20A_FECS_TRACE_HASH_BITS		8 /* 2^8 */
 #define GK20A_FECS_TRACE_FRAME_PERIOD_NS	(1000000000ULL/60ULL)
 #define GK20A_FECS_TRACE_PTIMER_SHIFT		5
+/* user ring entries staged by a poll before they are published */
+#define GK20A_FECS_TRACE_STAGING_ENTRIES	256
 
 struct gk20a_fecs_trace_record {
 	u32 magic_lo;
@@ -54,15 +56,21 @@ struct gk20a_fecs_trace_hash_ent {
 	u32 context_ptr;
 	pid_t pid;
 	struct hlist_node node;
+	struct rcu_head rcu;
 };
 
 struct gk20a_fecs_trace {
 
 	struct mem_desc trace_buf;
+	/* lookups are RCU protected, hash_lock serialises updates */
 	DECLARE_HASHTABLE(pid_hash_table, GK20A_FECS_TRACE_HASH_BITS);
 	struct mutex hash_lock;
 	struct mutex poll_lock;
 	struct task_struct *poll_task;
+
+	/* converted entries not yet pushed to the user ring, poll_lock */
+	struct nvgpu_ctxsw_trace_entry *staging;
+	int num_staged;
 };
 
 #ifdef CONFIG_GK20A_CTXSW_TRACE
@@ -133,14 +141,14 @@ void gk20a_fecs_trace_hash_dump(struct gk20a *g)
 
 	gk20a_dbg(gpu_dbg_ctxsw, "dumping hash table");
 
-	mutex_lock(&trace->hash_lock);
-	hash_for_each(trace->pid_hash_table, bkt, ent, node)
+	rcu_read_lock();
+	hash_for_each_rcu(trace->pid_hash_table, bkt, ent, node)
 	{
 		gk20a_dbg(gpu_dbg_ctxsw, " ent=%p bkt=%x context_ptr=%x pid=%d",
 			ent, bkt, ent->context_ptr, ent->pid);
 
 	}
-	mutex_unlock(&trace->hash_lock);
+	rcu_read_unlock();
 }
 
 static int gk20a_fecs_trace_hash_add(struct gk20a *g, u32 context_ptr, pid_t pid)
@@ -162,7 +170,7 @@ static int gk20a_fecs_trace_hash_add(struct gk20a *g, u32 context_ptr, pid_t pid
 	he->context_ptr = context_ptr;
 	he->pid = pid;
 	mutex_lock(&trace->hash_lock);
-	hash_add(trace->pid_hash_table, &he->node, context_ptr);
+	hash_add_rcu(trace->pid_hash_table, &he->node, context_ptr);
 	mutex_unlock(&trace->hash_lock);
 	return 0;
 }
@@ -180,11 +188,11 @@ static void gk20a_fecs_trace_hash_del(struct gk20a *g, u32 context_ptr)
 	hash_for_each_possible_safe(trace->pid_hash_table, ent, tmp, node,
 		context_ptr) {
 		if (ent->context_ptr == context_ptr) {
-			hash_del(&ent->node);
+			hash_del_rcu(&ent->node);
 			gk20a_dbg(gpu_dbg_ctxsw,
 				"freed hash entry=%p context_ptr=%x", ent,
 				ent->context_ptr);
-			kfree(ent);
+			kfree_rcu(ent, rcu);
 			break;
 		}
 	}
@@ -202,8 +210,8 @@ static void gk20a_fecs_trace_free_hash_table(struct gk20a *g)
 
 	mutex_lock(&trace->hash_lock);
 	hash_for_each_safe(trace->pid_hash_table, bkt, tmp, ent, node) {
-		hash_del(&ent->node);
-		kfree(ent);
+		hash_del_rcu(&ent->node);
+		kfree_rcu(ent, rcu);
 	}
 	mutex_unlock(&trace->hash_lock);
 
@@ -215,8 +223,9 @@ static pid_t gk20a_fecs_trace_find_pid(struct gk20a *g, u32 context_ptr)
 	struct gk20a_fecs_trace *trace = g->fecs_trace;
 	pid_t pid = 0;
 
-	mutex_lock(&trace->hash_lock);
-	hash_for_each_possible(trace->pid_hash_table, ent, node, context_ptr) {
+	rcu_read_lock();
+	hash_for_each_possible_rcu(trace->pid_hash_table, ent, node,
+				   context_ptr) {
 		if (ent->context_ptr == context_ptr) {
 			gk20a_dbg(gpu_dbg_ctxsw,
 				"found context_ptr=%x -> pid=%d",
@@ -225,14 +234,26 @@ static pid_t gk20a_fecs_trace_find_pid(struct gk20a *g, u32 context_ptr)
 			break;
 		}
 	}
-	mutex_unlock(&trace->hash_lock);
+	rcu_read_unlock();
 
 	return pid;
 }
 
+/* pushes the staged entries to the user ring in one batch */
+static void gk20a_fecs_trace_flush_staging(struct gk20a *g)
+{
+	struct gk20a_fecs_trace *trace = g->fecs_trace;
+
+	if (!trace->num_staged)
+		return;
+
+	gk20a_ctxsw_trace_write_n(g, trace->staging, trace->num_staged);
+	trace->num_staged = 0;
+}
+
 /*
- * Converts HW entry format to userspace-facing format and pushes it to the
- * queue.
+ * Converts HW entry format to userspace-facing format and stages it for the
+ * queue. Called with poll_lock held.
  */
 static int gk20a_fecs_trace_ring_read(struct gk20a *g, int index)
 {
@@ -310,10 +331,11 @@ static int gk20a_fecs_trace_ring_read(struct gk20a *g, int index)
 		if (!entry.context_id)
 			continue;
 
-		gk20a_ctxsw_trace_write(g, &entry);
+		if (trace->num_staged == GK20A_FECS_TRACE_STAGING_ENTRIES)
+			gk20a_fecs_trace_flush_staging(g);
+		trace->staging[trace->num_staged++] = entry;
 	}
 
-	gk20a_ctxsw_trace_wake_up(g, vmid);
 	return 0;
 }
 
@@ -355,9 +377,15 @@ static int gk20a_fecs_trace_poll(struct gk20a *g)
 
 		/* Get to next record. */
 		read = (read + 1) & (GK20A_FECS_TRACE_NUM_RECORDS - 1);
-		gk20a_fecs_trace_set_read_index(g, read);
 	}
 
+	/* hand the records back to FECS once they have all been copied */
+	gk20a_fecs_trace_set_read_index(g, read);
+
+	/* for now, only one VM */
+	gk20a_fecs_trace_flush_staging(g);
+	gk20a_ctxsw_trace_wake_up(g, 0);
+
 done:
 	mutex_unlock(&trace->poll_lock);
 	gk20a_idle(g->dev);
@@ -568,6 +596,13 @@ static int gk20a_fecs_trace_init(struct gk20a *g)
 		goto clean;
 	}
 
+	trace->staging = kcalloc(GK20A_FECS_TRACE_STAGING_ENTRIES,
+				 sizeof(*trace->staging), GFP_KERNEL);
+	if (!trace->staging) {
+		err = -ENOMEM;
+		goto clean_ring;
+	}
+
 	mutex_init(&trace->poll_lock);
 	mutex_init(&trace->hash_lock);
 	hash_init(trace->pid_hash_table);
@@ -575,6 +610,8 @@ static int gk20a_fecs_trace_init(struct gk20a *g)
 	gk20a_fecs_trace_debugfs_init(g);
 	return 0;
 
+clean_ring:
+	gk20a_fecs_trace_free_ring(g);
 clean:
 	kfree(trace);
 	g->fecs_trace = NULL;
@@ -679,6 +716,7 @@ static int gk20a_fecs_trace_deinit(struct gk20a *g)
 	kthread_stop(trace->poll_task);
 	gk20a_fecs_trace_free_ring(g);
 	gk20a_fecs_trace_free_hash_table(g);
+	kfree(trace->staging);
 
 	kfree(g->fecs_trace);
 	g->fecs_trace = NULL;
@@ -305,6 +305,33 @@ int gk20a_fifo_engine_enum_from_type(struct gk20a *g, u32 engine_type,
 	return ret;
 }
 
+/*
+ * Build the mc_intr bit -> engines lookup used by the ISR threads, so that
+ * they only visit the engines whose interrupt is actually pending.
+ */
+static void gk20a_fifo_init_engine_intr_table(struct fifo_gk20a *f)
+{
+	u32 i;
+	unsigned long bit;
+
+	f->engine_intr_mask = 0;
+	memset(f->intr_bit_engines, 0, sizeof(f->intr_bit_engines));
+
+	/* the per-bit engine masks are u32 */
+	WARN_ON(f->num_engines > 32);
+
+	for (i = 0; i < min_t(u32, f->num_engines, 32); i++) {
+		u32 active_engine_id = f->active_engines_list[i];
+		unsigned long intr_mask =
+			f->engine_info[active_engine_id].intr_mask;
+
+		for_each_set_bit(bit, &intr_mask, 32) {
+			f->intr_bit_engines[bit] |= BIT(i);
+			f->engine_intr_mask |= BIT(bit);
+		}
+	}
+}
+
 int gk20a_fifo_init_engine_info(struct fifo_gk20a *f)
 {
 	struct gk20a *g = f->g;
@@ -422,6 +449,8 @@ int gk20a_fifo_init_engine_info(struct fifo_gk20a *f)
 		}
 	}
 
+	gk20a_fifo_init_engine_intr_table(f);
+
 	return 0;
 }
 
@@ -491,6 +520,7 @@ static void gk20a_remove_fifo_support(struct fifo_gk20a *f)
 
 	vfree(f->channel);
 	vfree(f->tsg);
+	kfree(f->sema_wakeup_map);
 	if (g->ops.mm.is_bar1_supported(g))
 		gk20a_gmmu_unmap_free(&g->mm.bar1.vm, &f->userd);
 	else
@@ -632,6 +662,12 @@ static int init_runlist(struct gk20a *g, struct fifo_gk20a *f)
 		}
 		mutex_init(&runlist->mutex);
 
+		for (i = 0; i < NVGPU_RUNLIST_INTERLEAVE_NUM_LEVELS; i++) {
+			INIT_LIST_HEAD(&runlist->level_chs[i]);
+			INIT_LIST_HEAD(&runlist->level_tsgs[i]);
+		}
+		runlist->levels_valid = false;
+
 		/* None of buffers is pinned if this value doesn't change.
 		    Otherwise, one of them (cur_buffer) must have been pinned. */
 		runlist->cur_buffer = MAX_RUNLIST_BUFFERS;
@@ -791,6 +827,8 @@ static int gk20a_init_fifo_setup_sw(struct gk20a *g)
 
 	mutex_init(&f->intr.isr.mutex);
 	mutex_init(&f->gr_reset_mutex);
+	spin_lock_init(&f->inst_hash_lock);
+	hash_init(f->inst_hash);
 	gk20a_init_fifo_pbdma_intr_descs(f); /* just filling in data/tables */
 
 	f->num_channels = g->ops.fifo.get_num_fifos(g);
@@ -803,6 +841,8 @@ static int gk20a_init_fifo_setup_sw(struct gk20a *g)
 
 	f->channel = vzalloc(f->num_channels * sizeof(*f->channel));
 	f->tsg = vzalloc(f->num_channels * sizeof(*f->tsg));
+	f->sema_wakeup_map = kcalloc(BITS_TO_LONGS(f->num_channels),
+				sizeof(unsigned long), GFP_KERNEL);
 	f->pbdma_map = kzalloc(f->num_pbdma * sizeof(*f->pbdma_map),
 				GFP_KERNEL);
 	f->engine_info = kzalloc(f->max_engines * sizeof(*f->engine_info),
@@ -810,8 +850,8 @@ static int gk20a_init_fifo_setup_sw(struct gk20a *g)
 	f->active_engines_list = kzalloc(f->max_engines * sizeof(u32),
 				GFP_KERNEL);
 
-	if (!(f->channel && f->pbdma_map && f->engine_info &&
-		f->active_engines_list)) {
+	if (!(f->channel && f->sema_wakeup_map && f->pbdma_map &&
+		f->engine_info && f->active_engines_list)) {
 		err = -ENOMEM;
 		goto clean_up;
 	}
@@ -874,6 +914,8 @@ clean_up:
 	f->channel = NULL;
 	vfree(f->tsg);
 	f->tsg = NULL;
+	kfree(f->sema_wakeup_map);
+	f->sema_wakeup_map = NULL;
 	kfree(f->pbdma_map);
 	f->pbdma_map = NULL;
 	kfree(f->engine_info);
@@ -970,30 +1012,63 @@ int gk20a_init_fifo_support(struct gk20a *g)
 	return err;
 }
 
+void gk20a_fifo_inst_hash_add(struct gk20a *g, struct channel_gk20a *ch)
+{
+	struct fifo_gk20a *f = &g->fifo;
+
+	ch->inst_ptr = (u32)(gk20a_mm_inst_block_addr(g, &ch->inst_block) >>
+			ram_in_base_shift_v());
+
+	spin_lock(&f->inst_hash_lock);
+	hash_add(f->inst_hash, &ch->inst_hash_node, ch->inst_ptr);
+	spin_unlock(&f->inst_hash_lock);
+}
+
+void gk20a_fifo_inst_hash_del(struct gk20a *g, struct channel_gk20a *ch)
+{
+	struct fifo_gk20a *f = &g->fifo;
+
+	spin_lock(&f->inst_hash_lock);
+	hash_del(&ch->inst_hash_node);
+	spin_unlock(&f->inst_hash_lock);
+}
+
+/*
+ * inst_ptr is the instance block address shifted by ram_in_base_shift_v().
+ * Only alive channels are returned, with a reference that the caller must
+ * put back.
+ */
+struct channel_gk20a *gk20a_fifo_channel_from_inst_ptr(struct gk20a *g,
+		u32 inst_ptr)
+{
+	struct fifo_gk20a *f = &g->fifo;
+	struct channel_gk20a *ch, *ret = NULL;
+
+	spin_lock(&f->inst_hash_lock);
+	hash_for_each_possible(f->inst_hash, ch, inst_hash_node, inst_ptr) {
+		if (ch->inst_ptr == inst_ptr) {
+			ret = gk20a_channel_get(ch);
+			break;
+		}
+	}
+	if (ret)
+		f->inst_lookup_hits++;
+	else
+		f->inst_lookup_misses++;
+	spin_unlock(&f->inst_hash_lock);
+
+	return ret;
+}
+
 /* return with a reference to the channel, caller must put it back */
 static struct channel_gk20a *
 channel_from_inst_ptr(struct fifo_gk20a *f, u64 inst_ptr)
 {
-	struct gk20a *g = f->g;
-	unsigned int ci;
 	if (unlikely(!f->channel))
 		return NULL;
-	for (ci = 0; ci < f->num_channels; ci++) {
-		struct channel_gk20a *ch;
-		u64 ch_inst_ptr;
-
-		ch = gk20a_channel_get(&f->channel[ci]);
-		/* only alive channels are searched */
-		if (!ch)
-			continue;
-
-		ch_inst_ptr = gk20a_mm_inst_block_addr(g, &ch->inst_block);
-		if (inst_ptr == ch_inst_ptr)
-			return ch;
 
-		gk20a_channel_put(ch);
-	}
-	return NULL;
+	return gk20a_fifo_channel_from_inst_ptr(f->g,
+			(u32)(inst_ptr >> ram_in_base_shift_v()));
 }
 
 /* fault info/descriptions.
@@ -2840,16 +2915,254 @@ int gk20a_fifo_set_runlist_interleave(struct gk20a *g,
 				u32 runlist_id,
 				u32 new_level)
 {
+	struct fifo_gk20a *f = &g->fifo;
+	u32 rl_id;
+
 	gk20a_dbg_fn("");
 
-	if (is_tsg)
-		g->fifo.tsg[id].interleave_level = new_level;
-	else
-		g->fifo.channel[id].interleave_level = new_level;
+	if (is_tsg) {
+		f->tsg[id].interleave_level = new_level;
+		rl_id = f->tsg[id].runlist_id;
+	} else {
+		f->channel[id].interleave_level = new_level;
+		rl_id = f->channel[id].runlist_id;
+	}
+
+	/* level lists no longer match; resort them on the next update */
+	if (gk20a_fifo_is_valid_runlist_id(g, rl_id))
+		ACCESS_ONCE(f->runlist_info[rl_id].levels_valid) = false;
 
 	return 0;
 }
 
+/* insert @entry into @head keeping the list sorted by ascending @id */
+static void gk20a_runlist_level_insert(struct list_head *head,
+				struct list_head *entry, u32 id,
+				u32 (*id_of)(struct list_head *))
+{
+	struct list_head *pos;
+
+	list_for_each_prev(pos, head) {
+		if (id_of(pos) < id)
+			break;
+	}
+	list_add(entry, pos);
+}
+
+static u32 gk20a_runlist_level_chid(struct list_head *entry)
+{
+	return list_entry(entry, struct channel_gk20a,
+			  runlist_level_entry)->hw_chid;
+}
+
+static u32 gk20a_runlist_level_tsgid(struct list_head *entry)
+{
+	return list_entry(entry, struct tsg_gk20a,
+			  runlist_level_entry)->tsgid;
+}
+
+static void gk20a_runlist_level_add_ch(struct fifo_runlist_info_gk20a *runlist,
+				       struct channel_gk20a *ch)
+{
+	if (!list_empty(&ch->runlist_level_entry))
+		return;
+
+	gk20a_runlist_level_insert(&runlist->level_chs[ch->interleave_level],
+				   &ch->runlist_level_entry, ch->hw_chid,
+				   gk20a_runlist_level_chid);
+}
+
+static void gk20a_runlist_level_add_tsg(struct fifo_runlist_info_gk20a *runlist,
+					struct tsg_gk20a *tsg)
+{
+	if (!list_empty(&tsg->runlist_level_entry))
+		return;
+
+	gk20a_runlist_level_insert(&runlist->level_tsgs[tsg->interleave_level],
+				   &tsg->runlist_level_entry, tsg->tsgid,
+				   gk20a_runlist_level_tsgid);
+}
+
+/* repopulate the per-level lists from the active channel/TSG bitmaps */
+static void gk20a_runlist_rebuild_levels_locked(struct fifo_gk20a *f,
+				struct fifo_runlist_info_gk20a *runlist)
+{
+	struct list_head *pos, *n;
+	u32 chid, tsgid, level;
+
+	for (level = 0; level < NVGPU_RUNLIST_INTERLEAVE_NUM_LEVELS; level++) {
+		list_for_each_safe(pos, n, &runlist->level_chs[level])
+			list_del_init(pos);
+		list_for_each_safe(pos, n, &runlist->level_tsgs[level])
+			list_del_init(pos);
+	}
+
+	/* ids come out of the bitmaps in ascending order */
+	for_each_set_bit(chid, runlist->active_channels, f->num_channels) {
+		struct channel_gk20a *ch = &f->channel[chid];
+
+		if (gk20a_is_channel_marked_as_tsg(ch))
+			continue;
+
+		list_add_tail(&ch->runlist_level_entry,
+			      &runlist->level_chs[ch->interleave_level]);
+	}
+
+	for_each_set_bit(tsgid, runlist->active_tsgs, f->num_channels) {
+		struct tsg_gk20a *tsg = &f->tsg[tsgid];
+
+		list_add_tail(&tsg->runlist_level_entry,
+			      &runlist->level_tsgs[tsg->interleave_level]);
+	}
+
+	runlist->levels_valid = true;
+	f->runlist_full_rebuilds++;
+}
+
+/*
+ * Same walk as gk20a_runlist_construct_locked(), but driven by the per-level
+ * lists so the cost is linear in the number of emitted entries instead of
+ * rescanning both active bitmaps at every recursion step.
+ */
+static u32 *gk20a_runlist_construct_levels_locked(struct fifo_gk20a *f,
+				struct fifo_runlist_info_gk20a *runlist,
+				u32 cur_level,
+				u32 *runlist_entry,
+				bool interleave_enabled,
+				bool prev_empty,
+				u32 *entries_left)
+{
+	bool last_level = cur_level == NVGPU_RUNLIST_INTERLEAVE_LEVEL_HIGH;
+	struct channel_gk20a *ch;
+	struct tsg_gk20a *tsg;
+	bool skip_next = false;
+	u32 count = 0;
+	u32 runlist_entry_words = f->runlist_entry_size / sizeof(u32);
+
+	list_for_each_entry(ch, &runlist->level_chs[cur_level],
+			    runlist_level_entry) {
+		if (!last_level && !skip_next) {
+			runlist_entry = gk20a_runlist_construct_levels_locked(f,
+							runlist,
+							cur_level + 1,
+							runlist_entry,
+							interleave_enabled,
+							false,
+							entries_left);
+			if (!runlist_entry)
+				return NULL;
+			if (!interleave_enabled)
+				skip_next = true;
+		}
+
+		if (!(*entries_left))
+			return NULL;
+
+		f->g->ops.fifo.get_ch_runlist_entry(ch, runlist_entry);
+		runlist_entry += runlist_entry_words;
+		count++;
+		(*entries_left)--;
+	}
+
+	list_for_each_entry(tsg, &runlist->level_tsgs[cur_level],
+			    runlist_level_entry) {
+		if (!last_level && !skip_next) {
+			runlist_entry = gk20a_runlist_construct_levels_locked(f,
+							runlist,
+							cur_level + 1,
+							runlist_entry,
+							interleave_enabled,
+							false,
+							entries_left);
+			if (!runlist_entry)
+				return NULL;
+			if (!interleave_enabled)
+				skip_next = true;
+		}
+
+		if (!(*entries_left))
+			return NULL;
+
+		f->g->ops.fifo.get_tsg_runlist_entry(tsg, runlist_entry);
+		runlist_entry += runlist_entry_words;
+		count++;
+		(*entries_left)--;
+
+		mutex_lock(&tsg->ch_list_lock);
+		list_for_each_entry(ch, &tsg->ch_list, ch_entry) {
+			if (!test_bit(ch->hw_chid,
+				      runlist->active_channels))
+				continue;
+
+			if (!(*entries_left)) {
+				mutex_unlock(&tsg->ch_list_lock);
+				return NULL;
+			}
+
+			f->g->ops.fifo.get_ch_runlist_entry(ch, runlist_entry);
+			runlist_entry += runlist_entry_words;
+			(*entries_left)--;
+		}
+		mutex_unlock(&tsg->ch_list_lock);
+	}
+
+	if (!count && !last_level)
+		runlist_entry = gk20a_runlist_construct_levels_locked(f,
+							runlist,
+							cur_level + 1,
+							runlist_entry,
+							interleave_enabled,
+							true,
+							entries_left);
+
+	if (runlist_entry &&
+	    interleave_enabled && count && !prev_empty && !last_level)
+		runlist_entry = gk20a_runlist_construct_levels_locked(f,
+							runlist,
+							cur_level + 1,
+							runlist_entry,
+							interleave_enabled,
+							false,
+							entries_left);
+	return runlist_entry;
+}
+
+/*
+ * Debug aid (fifo/runlist_verify): rebuild with the bitmap walker into a
+ * scratch buffer and compare with what the level lists produced.
+ */
+static void gk20a_runlist_verify_locked(struct gk20a *g,
+				struct fifo_runlist_info_gk20a *runlist,
+				u32 *runlist_entry_base, u32 count)
+{
+	struct fifo_gk20a *f = &g->fifo;
+	u32 max_entries = f->num_runlist_entries;
+	size_t size = f->runlist_entry_size * f->num_runlist_entries;
+	u32 *ref, *ref_end;
+	u32 ref_count;
+
+	ref = vzalloc(size);
+	if (!ref)
+		return;
+
+	ref_end = gk20a_runlist_construct_locked(f, runlist, 0, ref,
+						 g->runlist_interleave,
+						 true, &max_entries);
+	ref_count = ref_end ? (ref_end - ref) /
+		(f->runlist_entry_size / sizeof(u32)) : 0;
+
+	if (ref_count != count ||
+	    memcmp(ref, runlist_entry_base, count * f->runlist_entry_size)) {
+		gk20a_err(dev_from_gk20a(g),
+			"runlist mismatch: %u entries, expected %u",
+			count, ref_count);
+		f->runlist_verify_mismatches++;
+		runlist->levels_valid = false;
+	}
+
+	vfree(ref);
+}
+
 static int gk20a_fifo_update_runlist_locked(struct gk20a *g, u32 runlist_id,
 					    u32 hw_chid, bool add,
 					    bool wait_for_finish)
@@ -2889,6 +3202,19 @@ static int gk20a_fifo_update_runlist_locked(struct gk20a *g, u32 runlist_id,
 				clear_bit(f->channel[hw_chid].tsgid,
 					runlist->active_tsgs);
 		}
+
+		/* patch only the level list entry that changed */
+		if (runlist->levels_valid) {
+			if (add && tsg)
+				gk20a_runlist_level_add_tsg(runlist, tsg);
+			else if (add)
+				gk20a_runlist_level_add_ch(runlist, ch);
+			else if (!tsg)
+				list_del_init(&ch->runlist_level_entry);
+			else if (!tsg->num_active_channels)
+				list_del_init(&tsg->runlist_level_entry);
+			f->runlist_incr_updates++;
+		}
 	}
 
 	old_buf = runlist->cur_buffer;
@@ -2916,7 +3242,11 @@ static int gk20a_fifo_update_runlist_locked(struct gk20a *g, u32 runlist_id,
 		u32 max_entries = f->num_runlist_entries;
 		u32 *runlist_end;
 
-		runlist_end = gk20a_runlist_construct_locked(f,
+		/* resume and interleave/timeslice changes resync the lists */
+		if (!runlist->levels_valid || hw_chid == FIFO_INVAL_CHANNEL_ID)
+			gk20a_runlist_rebuild_levels_locked(f, runlist);
+
+		runlist_end = gk20a_runlist_construct_levels_locked(f,
 						runlist,
 						0,
 						runlist_entry_base,
@@ -2929,6 +3259,10 @@ static int gk20a_fifo_update_runlist_locked(struct gk20a *g, u32 runlist_id,
 		}
 		count = (runlist_end - runlist_entry_base) / runlist_entry_words;
 		WARN_ON(count > f->num_runlist_entries);
+
+		if (f->runlist_verify)
+			gk20a_runlist_verify_locked(g, runlist,
+						    runlist_entry_base, count);
 	} else	/* suspend to remove all channels */
 		count = 0;
 
@@ -3260,6 +3594,25 @@ void gk20a_fifo_debugfs_init(struct device *dev)
 	debugfs_create_file("sched", 0600, fifo_root, g,
 		&gk20a_fifo_sched_debugfs_fops);
 
+	debugfs_create_bool("runlist_verify", S_IRUGO|S_IWUSR, fifo_root,
+		&g->fifo.runlist_verify);
+	debugfs_create_u32("runlist_incr_updates", S_IRUGO, fifo_root,
+		&g->fifo.runlist_incr_updates);
+	debugfs_create_u32("runlist_full_rebuilds", S_IRUGO, fifo_root,
+		&g->fifo.runlist_full_rebuilds);
+	debugfs_create_u32("runlist_verify_mismatches", S_IRUGO, fifo_root,
+		&g->fifo.runlist_verify_mismatches);
+	debugfs_create_u32("sema_wakeup_calls", S_IRUGO, fifo_root,
+		&g->fifo.sema_wakeup_calls);
+	debugfs_create_u32("sema_wakeup_visited", S_IRUGO, fifo_root,
+		&g->fifo.sema_wakeup_visited);
+	debugfs_create_u32("sema_wakeup_woken", S_IRUGO, fifo_root,
+		&g->fifo.sema_wakeup_woken);
+	debugfs_create_u32("inst_lookup_hits", S_IRUGO, fifo_root,
+		&g->fifo.inst_lookup_hits);
+	debugfs_create_u32("inst_lookup_misses", S_IRUGO, fifo_root,
+		&g->fifo.inst_lookup_misses);
+
 }
 #endif /* CONFIG_DEBUG_FS */
 
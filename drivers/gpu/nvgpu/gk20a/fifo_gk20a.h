@@ -21,6 +21,8 @@
 #ifndef __FIFO_GK20A_H__
 #define __FIFO_GK20A_H__
 
+#include <linux/hashtable.h>
+
 #include "channel_gk20a.h"
 #include "tsg_gk20a.h"
 
@@ -30,6 +32,9 @@
 #define FIFO_INVAL_CHANNEL_ID	((u32)~0)
 #define FIFO_INVAL_TSG_ID	((u32)~0)
 
+/* log2 of the number of buckets in fifo_gk20a.inst_hash */
+#define FIFO_INST_HASH_BITS	7
+
 /* generally corresponds to the "pbdma" engine */
 
 struct fifo_runlist_info_gk20a {
@@ -42,6 +47,16 @@ struct fifo_runlist_info_gk20a {
 	bool stopped;
 	bool support_tsg;
 	struct mutex mutex; /* protect channel preempt and runlist upate */
+
+	/*
+	 * Bare channels and TSGs on this runlist, sorted by id and bucketed
+	 * per interleave level. Patched on each channel add/remove so that
+	 * building the runlist does not rescan the active bitmaps. Rebuilt
+	 * from the bitmaps when levels_valid is cleared.
+	 */
+	struct list_head level_chs[NVGPU_RUNLIST_INTERLEAVE_NUM_LEVELS];
+	struct list_head level_tsgs[NVGPU_RUNLIST_INTERLEAVE_NUM_LEVELS];
+	bool levels_valid;
 };
 
 enum {
@@ -110,6 +125,13 @@ struct fifo_gk20a {
 	u32 num_engines;
 	u32 *active_engines_list;
 
+	/*
+	 * mc_intr bit -> mask of the active_engines_list indices that use it,
+	 * as engines may share a bit; see gk20a_fifo_init_engine_info
+	 */
+	u32 intr_bit_engines[32];
+	u32 engine_intr_mask;
+
 	struct fifo_runlist_info_gk20a *runlist_info;
 	u32 max_runlists;
 
@@ -148,6 +170,35 @@ struct fifo_gk20a {
 	unsigned long deferred_fault_engines;
 	bool deferred_reset_pending;
 	struct mutex deferred_reset_mutex;
+
+	/* runlist construction stats, see level_chs/level_tsgs */
+	u32 runlist_incr_updates;
+	u32 runlist_full_rebuilds;
+	u32 runlist_verify_mismatches;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,4,0)
+	u32 runlist_verify;
+#else
+	bool runlist_verify;
+#endif
+
+	/*
+	 * Channels that may be waiting on a semaphore release, indexed by
+	 * hw_chid. Only these are visited by gk20a_channel_semaphore_wakeup().
+	 */
+	unsigned long *sema_wakeup_map;
+	u32 sema_wakeup_calls;
+	u32 sema_wakeup_visited;
+	u32 sema_wakeup_woken;
+
+	/*
+	 * Channels with an instance block, keyed by the block address shifted
+	 * by ram_in_base_shift_v() as reported in MMU fault info and
+	 * gr_fecs_current_ctx_r().
+	 */
+	DECLARE_HASHTABLE(inst_hash, FIFO_INST_HASH_BITS);
+	spinlock_t inst_hash_lock;
+	u32 inst_lookup_hits;
+	u32 inst_lookup_misses;
 };
 
 static inline const char *gk20a_fifo_interleave_level_name(u32 interleave_level)
@@ -224,6 +275,10 @@ bool gk20a_fifo_set_ctx_mmu_error_ch(struct gk20a *g,
 
 struct channel_gk20a *gk20a_fifo_channel_from_hw_chid(struct gk20a *g,
 		u32 hw_chid);
+struct channel_gk20a *gk20a_fifo_channel_from_inst_ptr(struct gk20a *g,
+		u32 inst_ptr);
+void gk20a_fifo_inst_hash_add(struct gk20a *g, struct channel_gk20a *ch);
+void gk20a_fifo_inst_hash_del(struct gk20a *g, struct channel_gk20a *ch);
 
 void gk20a_fifo_issue_preempt(struct gk20a *g, u32 id, bool is_tsg);
 int gk20a_fifo_set_runlist_interleave(struct gk20a *g,
@@ -58,6 +58,7 @@
 #include "gk20a_scale.h"
 #include "ctxsw_trace_gk20a.h"
 #include "dbg_gpu_gk20a.h"
+#include "regops_gk20a.h"
 #include "gk20a_allocator.h"
 #include "hal.h"
 #include "vgpu/vgpu.h"
@@ -670,10 +671,21 @@ void gk20a_pbus_isr(struct gk20a *g)
 	gk20a_writel(g, bus_intr_0_r(), val);
 }
 
+/*
+ * Stalling interrupt thread body, shared by every bus front end so that
+ * intr_stall_task is known whichever of them requested the irq.
+ */
+irqreturn_t gk20a_isr_thread_stall(struct gk20a *g)
+{
+	g->intr_stall_task = current;
+	return g->ops.mc.isr_thread_stall(g);
+}
+
 static irqreturn_t gk20a_intr_thread_stall(int irq, void *dev_id)
 {
 	struct gk20a *g = dev_id;
-	return g->ops.mc.isr_thread_stall(g);
+
+	return gk20a_isr_thread_stall(g);
 }
 
 static irqreturn_t gk20a_intr_thread_nonstall(int irq, void *dev_id)
@@ -708,6 +720,8 @@ void gk20a_remove_support(struct device *dev)
 	if (g->sim.remove_support)
 		g->sim.remove_support(&g->sim);
 
+	gk20a_regops_free_whitelist_index(g);
+
 	/* free mappings to registers, etc */
 
 	if (g->regs) {
@@ -41,6 +41,7 @@ struct acr_desc;
 #include "clk_gk20a.h"
 #include "ce2_gk20a.h"
 #include "fifo_gk20a.h"
+#include "mc_gk20a.h"
 #include "tsg_gk20a.h"
 #include "gr_gk20a.h"
 #include "sim_gk20a.h"
@@ -564,6 +565,8 @@ struct gpu_ops {
 		void (*l2_flush)(struct gk20a *g, bool invalidate);
 		void (*cbc_clean)(struct gk20a *g);
 		void (*tlb_invalidate)(struct vm_gk20a *vm);
+		void (*mapping_batch_flush)(struct vm_gk20a *vm,
+				struct vm_gk20a_mapping_batch *batch);
 		void (*set_big_page_size)(struct gk20a *g,
 					  struct mem_desc *mem, int size);
 		u32 (*get_big_page_sizes)(void);
@@ -861,6 +864,7 @@ struct gk20a {
 	struct dentry *debugfs_timeslice_high_priority_us;
 	struct dentry *debugfs_runlist_interleave;
 	struct dentry *debugfs_allocators;
+	struct dentry *debugfs_alloc_record;
 	struct dentry *debugfs_xve;
 #endif
 	struct gk20a_ctxsw_ucode_info ctxsw_ucode_info;
@@ -873,6 +877,7 @@ struct gk20a {
 	/* held while manipulating # of debug/profiler sessions present */
 	/* also prevents debug sessions from attaching until released */
 	struct mutex dbg_sessions_lock;
+	struct regop_whitelist_index *regop_wl_index;
 	int dbg_powergating_disabled_refcount; /*refcount for pg disable */
 	int dbg_timeout_disabled_refcount; /*refcount for timeout disable */
 
@@ -948,10 +953,14 @@ struct gk20a {
 
 	atomic_t sw_irq_stall_last_handled;
 	wait_queue_head_t sw_irq_stall_last_handled_wq;
+	/* thread servicing stalling interrupts */
+	struct task_struct *intr_stall_task;
 
 	atomic_t sw_irq_nonstall_last_handled;
 	wait_queue_head_t sw_irq_nonstall_last_handled_wq;
 
+	struct gk20a_mc_intr_stats mc_intr_stats;
+
 	struct devfreq *devfreq;
 
 	struct gk20a_scale_profile *scale_profile;
@@ -1258,6 +1267,7 @@ int __gk20a_do_unidle(struct device *dev);
 int gk20a_init_gpu_characteristics(struct gk20a *g);
 
 void gk20a_pbus_isr(struct gk20a *g);
+irqreturn_t gk20a_isr_thread_stall(struct gk20a *g);
 
 int gk20a_user_init(struct device *dev, const char *interface_name,
 		    struct class *class);
@@ -18,6 +18,9 @@
 
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
 
 #include "gk20a.h"
 #include "mm_gk20a.h"
@@ -25,6 +28,71 @@
 #include "gk20a_allocator.h"
 
 u32 gk20a_alloc_tracing_on;
+u32 gk20a_alloc_profiling_on;
+
+/*
+ * While recording, an allocator logs its operations to a ring. Reading
+ * allocators/record/<name> back gives a trace that allocators/replay accepts.
+ */
+#define GK20A_ALLOC_REC_ENTRIES		4096
+
+struct gk20a_alloc_rec {
+	enum gk20a_alloc_op op;
+	u64 addr;
+	u64 len;
+	u64 ret;
+};
+
+static const char * const gk20a_alloc_op_names[GK20A_ALLOC_OP_MAX] = {
+	[GK20A_ALLOC_OP_ALLOC]		= "alloc",
+	[GK20A_ALLOC_OP_FREE]		= "free",
+	[GK20A_ALLOC_OP_ALLOC_FIXED]	= "alloc_fixed",
+	[GK20A_ALLOC_OP_FREE_FIXED]	= "free_fixed",
+};
+
+static inline u64 __alloc_prof_start(void)
+{
+	return gk20a_alloc_profiling_on ? ktime_to_ns(ktime_get()) : 0;
+}
+
+static void __alloc_prof_end(struct gk20a_allocator *a,
+			     enum gk20a_alloc_op op, u64 start_ns, bool failed)
+{
+	struct gk20a_alloc_op_stats *st = &a->op_stats[op];
+	u64 delta_ns;
+
+	if (!start_ns)
+		return;
+
+	delta_ns = ktime_to_ns(ktime_get()) - start_ns;
+
+	atomic64_inc(&st->calls);
+	if (failed)
+		atomic64_inc(&st->failures);
+	atomic64_add(delta_ns, &st->total_ns);
+	if (delta_ns > st->max_ns)
+		st->max_ns = delta_ns;
+}
+
+static void __alloc_record(struct gk20a_allocator *a, enum gk20a_alloc_op op,
+			   u64 addr, u64 len, u64 ret)
+{
+	struct gk20a_alloc_rec *rec;
+	unsigned long flags;
+
+	if (likely(!a->recording))
+		return;
+
+	spin_lock_irqsave(&a->rec_lock, flags);
+	if (a->recording) {
+		rec = &a->rec_buf[a->rec_head++ % GK20A_ALLOC_REC_ENTRIES];
+		rec->op = op;
+		rec->addr = addr;
+		rec->len = len;
+		rec->ret = ret;
+	}
+	spin_unlock_irqrestore(&a->rec_lock, flags);
+}
 
 u64 gk20a_alloc_length(struct gk20a_allocator *a)
 {
@@ -68,20 +136,38 @@ u64 gk20a_alloc_space(struct gk20a_allocator *a)
 
 u64 gk20a_alloc(struct gk20a_allocator *a, u64 len)
 {
-	return a->ops->alloc(a, len);
+	u64 start_ns = __alloc_prof_start();
+	u64 addr = a->ops->alloc(a, len);
+
+	__alloc_prof_end(a, GK20A_ALLOC_OP_ALLOC, start_ns, !addr);
+	__alloc_record(a, GK20A_ALLOC_OP_ALLOC, 0, len, addr);
+
+	return addr;
 }
 
 void gk20a_free(struct gk20a_allocator *a, u64 addr)
 {
+	u64 start_ns = __alloc_prof_start();
+
 	a->ops->free(a, addr);
+
+	__alloc_prof_end(a, GK20A_ALLOC_OP_FREE, start_ns, false);
+	__alloc_record(a, GK20A_ALLOC_OP_FREE, addr, 0, 0);
 }
 
 u64 gk20a_alloc_fixed(struct gk20a_allocator *a, u64 base, u64 len)
 {
-	if (a->ops->alloc_fixed)
-		return a->ops->alloc_fixed(a, base, len);
+	u64 start_ns, addr;
 
-	return 0;
+	if (!a->ops->alloc_fixed)
+		return 0;
+
+	start_ns = __alloc_prof_start();
+	addr = a->ops->alloc_fixed(a, base, len);
+	__alloc_prof_end(a, GK20A_ALLOC_OP_ALLOC_FIXED, start_ns, !addr);
+	__alloc_record(a, GK20A_ALLOC_OP_ALLOC_FIXED, base, len, addr);
+
+	return addr;
 }
 
 void gk20a_free_fixed(struct gk20a_allocator *a, u64 base, u64 len)
@@ -91,8 +177,13 @@ void gk20a_free_fixed(struct gk20a_allocator *a, u64 base, u64 len)
 	 * nothing. The alternative would be to fall back on the regular
 	 * free but that may be harmful in unexpected ways.
 	 */
-	if (a->ops->free_fixed)
+	if (a->ops->free_fixed) {
+		u64 start_ns = __alloc_prof_start();
+
 		a->ops->free_fixed(a, base, len);
+		__alloc_prof_end(a, GK20A_ALLOC_OP_FREE_FIXED, start_ns, false);
+		__alloc_record(a, GK20A_ALLOC_OP_FREE_FIXED, base, len, 0);
+	}
 }
 
 int gk20a_alloc_reserve_carveout(struct gk20a_allocator *a,
@@ -114,6 +205,8 @@ void gk20a_alloc_release_carveout(struct gk20a_allocator *a,
 void gk20a_alloc_destroy(struct gk20a_allocator *a)
 {
 	a->ops->fini(a);
+	/* fini removed the debugfs files, nothing can start a recording */
+	vfree(a->rec_buf);
 	memset(a, 0, sizeof(*a));
 }
 
@@ -139,6 +232,7 @@ int __gk20a_alloc_common_init(struct gk20a_allocator *a,
 	a->debug = dbg;
 
 	mutex_init(&a->lock);
+	spin_lock_init(&a->rec_lock);
 
 	strlcpy(a->name, name, sizeof(a->name));
 
@@ -152,11 +246,34 @@ void gk20a_alloc_print_stats(struct gk20a_allocator *__a,
 }
 
 #ifdef CONFIG_DEBUG_FS
+static void __alloc_print_op_stats(struct gk20a_allocator *a,
+				   struct seq_file *s)
+{
+	int op;
+
+	seq_puts(s, "\nOp profile (see allocators/profiling):\n");
+	seq_puts(s, "  op            calls        failures     avg(ns)    max(ns)\n");
+	for (op = 0; op < GK20A_ALLOC_OP_MAX; op++) {
+		struct gk20a_alloc_op_stats *st = &a->op_stats[op];
+		u64 calls = atomic64_read(&st->calls);
+
+		if (!calls)
+			continue;
+
+		seq_printf(s, "  %-13s %-12llu %-12llu %-10llu %llu\n",
+			   gk20a_alloc_op_names[op], calls,
+			   (u64)atomic64_read(&st->failures),
+			   div64_u64(atomic64_read(&st->total_ns), calls),
+			   st->max_ns);
+	}
+}
+
 static int __alloc_show(struct seq_file *s, void *unused)
 {
 	struct gk20a_allocator *a = s->private;
 
 	gk20a_alloc_print_stats(a, s, 1);
+	__alloc_print_op_stats(a, s);
 
 	return 0;
 }
@@ -172,6 +289,118 @@ static const struct file_operations __alloc_fops = {
 	.llseek = seq_lseek,
 	.release = single_release,
 };
+
+/*
+ * Prints the recorded ops, oldest first, in the format allocators/replay
+ * reads. The value an alloc returned is used as the id its free refers to.
+ */
+static int __alloc_record_show(struct seq_file *s, void *unused)
+{
+	struct gk20a_allocator *a = s->private;
+	struct gk20a_alloc_rec *rec;
+	u64 i, first;
+
+	spin_lock_irq(&a->rec_lock);
+	if (!a->rec_buf)
+		goto out;
+
+	first = a->rec_head > GK20A_ALLOC_REC_ENTRIES ?
+		a->rec_head - GK20A_ALLOC_REC_ENTRIES : 0;
+
+	seq_printf(s, "# %s: %llu ops (%s)\n", a->name, a->rec_head,
+		   a->recording ? "recording" : "stopped");
+	if (first)
+		seq_printf(s, "# %llu oldest ops dropped\n", first);
+
+	for (i = first; i < a->rec_head; i++) {
+		rec = &a->rec_buf[i % GK20A_ALLOC_REC_ENTRIES];
+
+		switch (rec->op) {
+		case GK20A_ALLOC_OP_ALLOC:
+			seq_printf(s, "a 0x%llx 0x%llx\n", rec->ret, rec->len);
+			break;
+		case GK20A_ALLOC_OP_FREE:
+			seq_printf(s, "f 0x%llx\n", rec->addr);
+			break;
+		case GK20A_ALLOC_OP_ALLOC_FIXED:
+			seq_printf(s, "af 0x%llx 0x%llx 0x%llx\n",
+				   rec->ret, rec->addr, rec->len);
+			break;
+		case GK20A_ALLOC_OP_FREE_FIXED:
+			seq_printf(s, "ff 0x%llx 0x%llx\n",
+				   rec->addr, rec->len);
+			break;
+		default:
+			break;
+		}
+	}
+out:
+	spin_unlock_irq(&a->rec_lock);
+	return 0;
+}
+
+static int __alloc_record_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, __alloc_record_show, inode->i_private);
+}
+
+/*
+ * Writing "start" begins a fresh recording; writing "stop" ends it but
+ * keeps it for reading.
+ */
+static ssize_t __alloc_record_write(struct file *file,
+				    const char __user *user_buf,
+				    size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct gk20a_allocator *a = s->private;
+	struct gk20a_alloc_rec *buf = NULL;
+	char cmd[8];
+	size_t len = min(count, sizeof(cmd) - 1);
+
+	if (copy_from_user(cmd, user_buf, len))
+		return -EFAULT;
+	cmd[len] = '\0';
+	strim(cmd);
+
+	if (!strcmp(cmd, "stop")) {
+		spin_lock_irq(&a->rec_lock);
+		a->recording = false;
+		spin_unlock_irq(&a->rec_lock);
+		return count;
+	}
+
+	if (strcmp(cmd, "start"))
+		return -EINVAL;
+
+	if (!a->rec_buf) {
+		buf = vzalloc(GK20A_ALLOC_REC_ENTRIES * sizeof(*buf));
+		if (!buf)
+			return -ENOMEM;
+	}
+
+	spin_lock_irq(&a->rec_lock);
+	if (!a->rec_buf) {
+		a->rec_buf = buf;
+		buf = NULL;
+	}
+	a->rec_head = 0;
+	a->recording = true;
+	spin_unlock_irq(&a->rec_lock);
+
+	/* lost a race with another start */
+	vfree(buf);
+
+	return count;
+}
+
+static const struct file_operations __alloc_record_fops = {
+	.open = __alloc_record_open,
+	.read = seq_read,
+	.write = __alloc_record_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 #endif
 
 void gk20a_init_alloc_debug(struct gk20a *g, struct gk20a_allocator *a)
@@ -183,6 +412,10 @@ void gk20a_init_alloc_debug(struct gk20a *g, struct gk20a_allocator *a)
 	a->debugfs_entry = debugfs_create_file(a->name, S_IRUGO,
 					       g->debugfs_allocators,
 					       a, &__alloc_fops);
+	if (!IS_ERR_OR_NULL(g->debugfs_alloc_record))
+		a->debugfs_rec_entry = debugfs_create_file(a->name, 0664,
+						g->debugfs_alloc_record,
+						a, &__alloc_record_fops);
 #endif
 }
 
@@ -191,6 +424,12 @@ void gk20a_fini_alloc_debug(struct gk20a_allocator *a)
 #ifdef CONFIG_DEBUG_FS
 	if (!IS_ERR_OR_NULL(a->debugfs_entry))
 		debugfs_remove(a->debugfs_entry);
+	if (!IS_ERR_OR_NULL(a->debugfs_rec_entry))
+		debugfs_remove(a->debugfs_rec_entry);
+	/* make sure no further op lands in the ring */
+	spin_lock_irq(&a->rec_lock);
+	a->recording = false;
+	spin_unlock_irq(&a->rec_lock);
 #endif
 }
 
@@ -207,5 +446,11 @@ void gk20a_alloc_debugfs_init(struct device *dev)
 
 	debugfs_create_u32("tracing", 0664, g->debugfs_allocators,
 			   &gk20a_alloc_tracing_on);
+	debugfs_create_u32("profiling", 0664, g->debugfs_allocators,
+			   &gk20a_alloc_profiling_on);
+	g->debugfs_alloc_record = debugfs_create_dir("record",
+						     g->debugfs_allocators);
+
+	gk20a_alloc_replay_debugfs_init(g);
 #endif
 }
@@ -72,6 +72,27 @@ struct gk20a_allocator_ops {
 			    struct seq_file *s, int lock);
 };
 
+/*
+ * Per-operation timing collected by the generic gk20a_alloc()/gk20a_free()
+ * wrappers when gk20a_alloc_profiling_on is set.
+ */
+enum gk20a_alloc_op {
+	GK20A_ALLOC_OP_ALLOC,
+	GK20A_ALLOC_OP_FREE,
+	GK20A_ALLOC_OP_ALLOC_FIXED,
+	GK20A_ALLOC_OP_FREE_FIXED,
+	GK20A_ALLOC_OP_MAX,
+};
+
+struct gk20a_alloc_op_stats {
+	atomic64_t calls;
+	atomic64_t failures;
+	atomic64_t total_ns;
+	u64 max_ns;				/* Best effort. */
+};
+
+struct gk20a_alloc_rec;
+
 struct gk20a_allocator {
 	char name[32];
 	struct mutex lock;
@@ -81,6 +102,18 @@ struct gk20a_allocator {
 
 	struct dentry *debugfs_entry;
 	bool debug;				/* Control for debug msgs. */
+
+	struct gk20a_alloc_op_stats op_stats[GK20A_ALLOC_OP_MAX];
+
+	/*
+	 * Op ring for allocators/record/<name>; allocated on the first
+	 * "start" and freed by gk20a_alloc_destroy().
+	 */
+	spinlock_t rec_lock;
+	bool recording;
+	struct gk20a_alloc_rec *rec_buf;
+	u64 rec_head;
+	struct dentry *debugfs_rec_entry;
 };
 
 struct gk20a_alloc_carveout {
@@ -256,8 +289,12 @@ static inline void gk20a_alloc_disable_dbg(struct gk20a_allocator *a)
  * Debug stuff.
  */
 extern u32 gk20a_alloc_tracing_on;
+extern u32 gk20a_alloc_profiling_on;
 
 void gk20a_alloc_debugfs_init(struct device *dev);
+#ifdef CONFIG_DEBUG_FS
+void gk20a_alloc_replay_debugfs_init(struct gk20a *g);
+#endif
 
 #define gk20a_alloc_trace_func()			\
 	do {						\
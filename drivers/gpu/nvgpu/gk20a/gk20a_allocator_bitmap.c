@@ -318,6 +318,8 @@ static void gk20a_bitmap_alloc_destroy(struct gk20a_allocator *__a)
 	struct gk20a_bitmap_alloc *alloc;
 	struct rb_node *node;
 
+	gk20a_fini_alloc_debug(__a);
+
 	/*
 	 * Kill any outstanding allocations.
 	 */
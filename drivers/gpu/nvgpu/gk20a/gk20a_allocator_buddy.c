@@ -163,14 +163,16 @@ static void balloc_blist_add(struct gk20a_buddy_allocator *a,
 			     struct gk20a_buddy *b)
 {
 	__balloc_buddy_list_add(a, b, balloc_get_order_list(a, b->order));
-	a->buddy_list_len[b->order]++;
+	if (a->buddy_list_len[b->order]++ == 0)
+		__set_bit(b->order, &a->buddy_list_mask);
 }
 
 static void balloc_blist_rem(struct gk20a_buddy_allocator *a,
 			     struct gk20a_buddy *b)
 {
 	__balloc_buddy_list_rem(a, b);
-	a->buddy_list_len[b->order]--;
+	if (--a->buddy_list_len[b->order] == 0)
+		__clear_bit(b->order, &a->buddy_list_mask);
 }
 
 static u64 balloc_get_order(struct gk20a_buddy_allocator *a, u64 len)
@@ -211,6 +213,16 @@ static int balloc_init_lists(struct gk20a_buddy_allocator *a)
 	for (i = 0; i < GPU_BALLOC_ORDER_LIST_LEN; i++)
 		INIT_LIST_HEAD(balloc_get_order_list(a, i));
 
+	/* Count the top level buddies so they can be indexed. */
+	for (i = 0; bstart < bend; i++)
+		bstart += balloc_order_to_len(a,
+				__balloc_max_order_in(a, bstart, bend));
+
+	a->roots = kcalloc(i, sizeof(*a->roots), GFP_KERNEL);
+	if (!a->roots)
+		return -ENOMEM;
+
+	bstart = a->start;
 	while (bstart < bend) {
 		order = __balloc_max_order_in(a, bstart, bend);
 
@@ -219,12 +231,17 @@ static int balloc_init_lists(struct gk20a_buddy_allocator *a)
 			goto cleanup;
 
 		balloc_blist_add(a, buddy);
+		a->roots[a->nr_roots++] = buddy;
 		bstart += balloc_order_to_len(a, order);
 	}
 
 	return 0;
 
 cleanup:
+	kfree(a->roots);
+	a->roots = NULL;
+	a->nr_roots = 0;
+
 	for (i = 0; i < GPU_BALLOC_ORDER_LIST_LEN; i++) {
 		if (!list_empty(balloc_get_order_list(a, i))) {
 			buddy = list_first_entry(balloc_get_order_list(a, i),
@@ -303,6 +320,7 @@ static void gk20a_buddy_allocator_destroy(struct gk20a_allocator *__a)
 		}
 	}
 
+	kfree(a->roots);
 	kfree(a);
 
 	alloc_unlock(__a);
@@ -501,13 +519,21 @@ static struct gk20a_buddy *__balloc_find_buddy(struct gk20a_buddy_allocator *a,
 static u64 __balloc_do_alloc(struct gk20a_buddy_allocator *a,
 			     u64 order, int pte_size)
 {
-	u64 split_order;
+	unsigned long split_order;
 	struct gk20a_buddy *bud = NULL;
 
-	split_order = order;
-	while (split_order <= a->max_order &&
-	       !(bud = __balloc_find_buddy(a, split_order, pte_size)))
-		split_order++;
+	/* Only look at orders that actually have free buddies. */
+	a->nr_allocs++;
+	for (split_order = find_next_bit(&a->buddy_list_mask,
+					 a->max_order + 1, order);
+	     split_order <= a->max_order;
+	     split_order = find_next_bit(&a->buddy_list_mask,
+					 a->max_order + 1, split_order + 1)) {
+		a->alloc_orders_probed++;
+		bud = __balloc_find_buddy(a, split_order, pte_size);
+		if (bud)
+			break;
+	}
 
 	/* Out of memory! */
 	if (!bud)
@@ -529,33 +555,29 @@ static u64 __balloc_do_alloc(struct gk20a_buddy_allocator *a,
  * See if the passed range is actually available for allocation. If so, then
  * return 1, otherwise return 0.
  *
- * TODO: Right now this uses the unoptimal approach of going through all
- * outstanding allocations and checking their base/ends. This could be better.
+ * Allocated buddies never overlap so the only one that can intersect
+ * [base, end) is the one with the highest start address below @end. Find it
+ * with a single descent of the RB tree.
  */
 static int balloc_is_range_free(struct gk20a_buddy_allocator *a,
 				u64 base, u64 end)
 {
-	struct rb_node *node;
-	struct gk20a_buddy *bud;
-
-	node = rb_first(&a->alloced_buddies);
-	if (!node)
-		return 1; /* No allocs yet. */
-
-	bud = container_of(node, struct gk20a_buddy, alloced_entry);
-
-	while (bud->start < end) {
-		if ((bud->start > base && bud->start < end) ||
-		    (bud->end   > base && bud->end   < end))
-			return 0;
+	struct rb_node *node = a->alloced_buddies.rb_node;
+	struct gk20a_buddy *bud, *last = NULL;
 
-		node = rb_next(node);
-		if (!node)
-			break;
+	while (node) {
 		bud = container_of(node, struct gk20a_buddy, alloced_entry);
+		a->fixed_nodes_walked++;
+
+		if (bud->start < end) {
+			last = bud;
+			node = node->rb_right;
+		} else {
+			node = node->rb_left;
+		}
 	}
 
-	return 1;
+	return !last || last->end <= base;
 }
 
 static void balloc_alloc_fixed(struct gk20a_buddy_allocator *a,
@@ -617,23 +639,28 @@ static struct gk20a_fixed_alloc *balloc_free_fixed(
 }
 
 /*
- * Find the parent range - doesn't necessarily need the parent to actually exist
- * as a buddy. Finding an existing parent comes later...
+ * Find the top level buddy containing @base.
  */
-static void __balloc_get_parent_range(struct gk20a_buddy_allocator *a,
-				      u64 base, u64 order,
-				      u64 *pbase, u64 *porder)
+static struct gk20a_buddy *balloc_find_root(struct gk20a_buddy_allocator *a,
+					    u64 base)
 {
-	u64 base_mask;
-	u64 shifted_base = balloc_base_shift(a, base);
+	int lo = 0, hi = a->nr_roots - 1;
+
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		struct gk20a_buddy *root = a->roots[mid];
 
-	order++;
-	base_mask = ~((a->blk_size << order) - 1);
+		a->fixed_nodes_walked++;
 
-	shifted_base &= base_mask;
+		if (base < root->start)
+			hi = mid - 1;
+		else if (base >= root->end)
+			lo = mid + 1;
+		else
+			return root;
+	}
 
-	*pbase = balloc_base_unshift(a, shifted_base);
-	*porder = order;
+	return NULL;
 }
 
 /*
@@ -643,38 +670,23 @@ static void __balloc_get_parent_range(struct gk20a_buddy_allocator *a,
 static struct gk20a_buddy *__balloc_make_fixed_buddy(
 	struct gk20a_buddy_allocator *a, u64 base, u64 order)
 {
-	struct gk20a_buddy *bud = NULL;
-	struct list_head *order_list;
-	u64 cur_order = order, cur_base = base;
+	struct gk20a_buddy *bud;
 
 	/*
 	 * Algo:
-	 *  1. Keep jumping up a buddy order until we find the real buddy that
-	 *     this buddy exists in.
-	 *  2. Then work our way down through the buddy tree until we hit a dead
-	 *     end.
+	 *  1. Find the top level buddy containing @base and walk down through
+	 *     the split buddies to the unsplit buddy that covers @base.
+	 *  2. That buddy must be free and at least as big as the one we need.
 	 *  3. Start splitting buddies until we split to the one we need to
 	 *     make.
 	 */
-	while (cur_order <= a->max_order) {
-		int found = 0;
-
-		order_list = balloc_get_order_list(a, cur_order);
-		list_for_each_entry(bud, order_list, buddy_entry) {
-			if (bud->start == cur_base) {
-				found = 1;
-				break;
-			}
-		}
-
-		if (found)
-			break;
-
-		__balloc_get_parent_range(a, cur_base, cur_order,
-					  &cur_base, &cur_order);
+	bud = balloc_find_root(a, base);
+	while (bud && buddy_is_split(bud)) {
+		a->fixed_nodes_walked++;
+		bud = base < bud->right->start ? bud->left : bud->right;
 	}
 
-	if (cur_order > a->max_order) {
+	if (!bud || buddy_is_alloced(bud) || bud->order < order) {
 		alloc_dbg(balloc_owner(a), "No buddy for range ???\n");
 		return NULL;
 	}
@@ -756,6 +768,11 @@ static u64 __balloc_do_alloc_fixed(struct gk20a_buddy_allocator *a,
 	return base;
 
 err_and_cleanup:
+	/*
+	 * Give the buddies back the way __balloc_do_free_fixed() does: they
+	 * are still children of split parents, which the fixed walk goes
+	 * through, so they must be merged rather than freed.
+	 */
 	while (!list_empty(&falloc->buddies)) {
 		struct gk20a_buddy *bud = list_first_entry(&falloc->buddies,
 							   struct gk20a_buddy,
@@ -763,7 +780,8 @@ err_and_cleanup:
 
 		__balloc_buddy_list_rem(a, bud);
 		balloc_free_buddy(a, bud->start);
-		kmem_cache_free(buddy_cache, bud);
+		balloc_blist_add(a, bud);
+		balloc_coalesce(a, bud);
 	}
 
 	return 0;
@@ -896,6 +914,7 @@ static u64 __gk20a_balloc_fixed_buddy(struct gk20a_allocator *__a,
 	}
 
 	balloc_alloc_fixed(a, falloc);
+	a->nr_fixed_allocs++;
 
 	list_for_each_entry(bud, &falloc->buddies, buddy_entry)
 		real_bytes += (bud->end - bud->start);
@@ -1175,6 +1194,20 @@ static void gk20a_buddy_print_stats(struct gk20a_allocator *__a,
 	__alloc_pstat(s, __a, "Bytes freed:            %llu\n",
 		      a->bytes_freed);
 
+	__alloc_pstat(s, __a, "\n");
+	__alloc_pstat(s, __a, "Search cost:\n");
+	__alloc_pstat(s, __a, "  allocs             %llu\n", a->nr_allocs);
+	__alloc_pstat(s, __a, "  orders probed      %llu (avg x100 %llu)\n",
+		      a->alloc_orders_probed,
+		      a->nr_allocs ?
+		      div64_u64(a->alloc_orders_probed * 100, a->nr_allocs) : 0);
+	__alloc_pstat(s, __a, "  fixed allocs       %llu\n", a->nr_fixed_allocs);
+	__alloc_pstat(s, __a, "  fixed nodes walked %llu (avg x100 %llu)\n",
+		      a->fixed_nodes_walked,
+		      a->nr_fixed_allocs ?
+		      div64_u64(a->fixed_nodes_walked * 100,
+				a->nr_fixed_allocs) : 0);
+
 	if (lock)
 		alloc_unlock(__a);
 }
@@ -17,6 +17,7 @@
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/bitops.h>
+#include <linux/log2.h>
 #include <linux/mm.h>
 
 #include "gk20a_allocator.h"
@@ -81,6 +82,87 @@ static inline void del_slab_page_from_full(struct page_alloc_slab *slab,
 	page->state = SP_NONE;
 }
 
+/*
+ * Returns the free cache bucket for a chunk of @len bytes or NULL if chunks of
+ * that size are not cached.
+ */
+static struct page_alloc_free_cache *__palloc_cache_bucket(
+	struct gk20a_page_allocator *a, u64 len)
+{
+	u64 pages = len >> a->page_shift;
+	int order;
+
+	if (!pages || !is_power_of_2(pages) || pages << a->page_shift != len)
+		return NULL;
+
+	order = __ffs(pages);
+	if (order >= PAGE_ALLOC_CACHE_ORDERS)
+		return NULL;
+
+	return &a->free_cache[order];
+}
+
+/*
+ * Allocate a chunk of @len bytes, preferring a recently freed chunk of the same
+ * size over a trip through the source allocator.
+ */
+static u64 __palloc_chunk_alloc(struct gk20a_page_allocator *a, u64 len)
+{
+	struct page_alloc_free_cache *bucket = __palloc_cache_bucket(a, len);
+
+	if (bucket) {
+		if (bucket->nr) {
+			a->nr_cache_hits++;
+			a->cached_bytes -= len;
+			return bucket->chunks[--bucket->nr];
+		}
+		a->nr_cache_misses++;
+	}
+
+	return gk20a_alloc(&a->source_allocator, len);
+}
+
+static void __palloc_chunk_free(struct gk20a_page_allocator *a,
+				u64 base, u64 len)
+{
+	struct page_alloc_free_cache *bucket = __palloc_cache_bucket(a, len);
+
+	if (bucket && bucket->nr < PAGE_ALLOC_CACHE_DEPTH) {
+		bucket->chunks[bucket->nr++] = base;
+		a->cached_bytes += len;
+		return;
+	}
+
+	gk20a_free(&a->source_allocator, base);
+}
+
+/*
+ * Give every cached chunk back to the source allocator so that it can merge
+ * them again. Returns the number of chunks released.
+ */
+static int __palloc_cache_drain(struct gk20a_page_allocator *a)
+{
+	int order, drained = 0;
+
+	for (order = 0; order < PAGE_ALLOC_CACHE_ORDERS; order++) {
+		struct page_alloc_free_cache *bucket = &a->free_cache[order];
+
+		while (bucket->nr) {
+			gk20a_free(&a->source_allocator,
+				   bucket->chunks[--bucket->nr]);
+			drained++;
+		}
+	}
+
+	if (drained) {
+		a->cached_bytes = 0;
+		a->nr_cache_drains++;
+		palloc_dbg(a, "Drained %d cached chunks\n", drained);
+	}
+
+	return drained;
+}
+
 static u64 gk20a_page_alloc_length(struct gk20a_allocator *a)
 {
 	struct gk20a_page_allocator *va = a->priv;
@@ -113,15 +195,21 @@ static u64 gk20a_page_alloc_space(struct gk20a_allocator *a)
 {
 	struct gk20a_page_allocator *va = a->priv;
 
-	return gk20a_alloc_space(&va->source_allocator);
+	return gk20a_alloc_space(&va->source_allocator) + va->cached_bytes;
 }
 
 static int gk20a_page_reserve_co(struct gk20a_allocator *a,
 				 struct gk20a_alloc_carveout *co)
 {
 	struct gk20a_page_allocator *va = a->priv;
+	int err;
 
-	return gk20a_alloc_reserve_carveout(&va->source_allocator, co);
+	alloc_lock(a);
+	__palloc_cache_drain(va);
+	err = gk20a_alloc_reserve_carveout(&va->source_allocator, co);
+	alloc_unlock(a);
+
+	return err;
 }
 
 static void gk20a_page_release_co(struct gk20a_allocator *a,
@@ -145,7 +233,7 @@ static void __gk20a_free_pages(struct gk20a_page_allocator *a,
 		list_del(&chunk->list_entry);
 
 		if (free_buddy_alloc)
-			gk20a_free(&a->source_allocator, chunk->base);
+			__palloc_chunk_free(a, chunk->base, chunk->length);
 		kfree(chunk);
 	}
 
@@ -220,7 +308,7 @@ static struct page_alloc_slab_page *alloc_slab_page(
 
 	memset(slab_page, 0, sizeof(*slab_page));
 
-	slab_page->page_addr = gk20a_alloc(&a->source_allocator, a->page_size);
+	slab_page->page_addr = __palloc_chunk_alloc(a, a->page_size);
 	if (!slab_page->page_addr) {
 		kfree(slab_page);
 		palloc_dbg(a, "OOM: vidmem is full!\n");
@@ -251,7 +339,7 @@ static void free_slab_page(struct gk20a_page_allocator *a,
 	       slab_page->nr_objects_alloced != 0 ||
 	       slab_page->bitmap != 0);
 
-	gk20a_free(&a->source_allocator, slab_page->page_addr);
+	__palloc_chunk_free(a, slab_page->page_addr, a->page_size);
 	a->pages_freed++;
 
 	kmem_cache_free(page_alloc_slab_page_cache, slab_page);
@@ -476,8 +564,7 @@ static struct gk20a_page_alloc *__do_gk20a_alloc_pages(
 		 * allocator (i.e the allocator is OOM).
 		 */
 		do {
-			chunk_addr = gk20a_alloc(&a->source_allocator,
-						 chunk_len);
+			chunk_addr = __palloc_chunk_alloc(a, chunk_len);
 
 			/* Divide by 2 and try again */
 			if (!chunk_addr) {
@@ -497,7 +584,7 @@ static struct gk20a_page_alloc *__do_gk20a_alloc_pages(
 
 		c = kmem_cache_alloc(page_alloc_chunk_cache, GFP_KERNEL);
 		if (!c) {
-			gk20a_free(&a->source_allocator, chunk_addr);
+			__palloc_chunk_free(a, chunk_addr, chunk_len);
 			goto fail_cleanup;
 		}
 
@@ -522,7 +609,7 @@ fail_cleanup:
 		c = list_first_entry(&alloc->alloc_chunks,
 				     struct page_alloc_chunk, list_entry);
 		list_del(&c->list_entry);
-		gk20a_free(&a->source_allocator, c->base);
+		__palloc_chunk_free(a, c->base, c->length);
 		kfree(c);
 	}
 	kfree(alloc);
@@ -557,6 +644,16 @@ static struct gk20a_page_alloc *__gk20a_alloc_pages(
 	return alloc;
 }
 
+static struct gk20a_page_alloc *__gk20a_page_alloc_locked(
+	struct gk20a_page_allocator *a, u64 real_len)
+{
+	if (a->flags & GPU_ALLOC_4K_VIDMEM_PAGES &&
+	    real_len <= (a->page_size / 2))
+		return __gk20a_alloc_slab(a, real_len);
+
+	return __gk20a_alloc_pages(a, real_len);
+}
+
 /*
  * Allocate enough pages to satisfy @len. Page size is determined at
  * initialization of the allocator.
@@ -581,11 +678,14 @@ static u64 gk20a_page_alloc(struct gk20a_allocator *__a, u64 len)
 		roundup_pow_of_two(len) : len;
 
 	alloc_lock(__a);
-	if (a->flags & GPU_ALLOC_4K_VIDMEM_PAGES &&
-	    real_len <= (a->page_size / 2))
-		alloc = __gk20a_alloc_slab(a, real_len);
-	else
-		alloc = __gk20a_alloc_pages(a, real_len);
+	alloc = __gk20a_page_alloc_locked(a, real_len);
+
+	/*
+	 * Cached chunks can keep the buddy allocator from merging; give them
+	 * back and try once more before failing.
+	 */
+	if (!alloc && __palloc_cache_drain(a))
+		alloc = __gk20a_page_alloc_locked(a, real_len);
 
 	if (!alloc) {
 		alloc_unlock(__a);
@@ -658,6 +758,9 @@ static struct gk20a_page_alloc *__gk20a_alloc_pages_fixed(
 		goto fail;
 
 	alloc->base = gk20a_alloc_fixed(&a->source_allocator, base, length);
+	if (!alloc->base && __palloc_cache_drain(a))
+		alloc->base = gk20a_alloc_fixed(&a->source_allocator,
+						base, length);
 	if (!alloc->base) {
 		WARN(1, "gk20a: failed to fixed alloc pages @ 0x%010llx", base);
 		goto fail;
@@ -756,6 +859,9 @@ static void gk20a_page_allocator_destroy(struct gk20a_allocator *__a)
 	struct gk20a_page_allocator *a = page_allocator(__a);
 
 	alloc_lock(__a);
+	gk20a_fini_alloc_debug(__a);
+	__palloc_cache_drain(a);
+	gk20a_alloc_destroy(&a->source_allocator);
 	kfree(a);
 	__a->priv = NULL;
 	alloc_unlock(__a);
@@ -781,6 +887,17 @@ static void gk20a_page_print_stats(struct gk20a_allocator *__a,
 	__alloc_pstat(s, __a, "  pages freed    %lld\n", a->pages_freed);
 	__alloc_pstat(s, __a, "\n");
 
+	__alloc_pstat(s, __a, "Free chunk cache:\n");
+	__alloc_pstat(s, __a, "  hits           %lld\n", a->nr_cache_hits);
+	__alloc_pstat(s, __a, "  misses         %lld\n", a->nr_cache_misses);
+	__alloc_pstat(s, __a, "  drains         %lld\n", a->nr_cache_drains);
+	__alloc_pstat(s, __a, "  cached bytes   0x%llx\n", a->cached_bytes);
+	for (i = 0; i < PAGE_ALLOC_CACHE_ORDERS; i++)
+		__alloc_pstat(s, __a, "  0x%-12llx  %d/%d\n",
+			      a->page_size << i, a->free_cache[i].nr,
+			      PAGE_ALLOC_CACHE_DEPTH);
+	__alloc_pstat(s, __a, "\n");
+
 	/*
 	 * Slab info.
 	 */
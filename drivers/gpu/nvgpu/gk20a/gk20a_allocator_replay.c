@@ -0,0 +1,631 @@
+/*
+ * gk20a allocator trace replay
+ *
+ * Copyright (c) 2016, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/hashtable.h>
+#include <linux/hash.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+
+#include "gk20a.h"
+#include "gk20a_allocator.h"
+
+/*
+ * allocators/replay runs an allocation trace against a scratch allocator
+ * that is not used by the GPU. A trace is written as lines of:
+ *
+ *   init <buddy|bitmap|page> <base> <length> <blk_size> [flags]
+ *   threads <n>
+ *   a <id> <len>               alloc, remembered as id
+ *   f <id>                     free
+ *   af <id> <base> <len>       alloc_fixed, remembered as id
+ *   ff <id> <len>              free_fixed
+ *   reset                      drop the loaded ops
+ *   run
+ *
+ * Numbers are hex. The a/f/af/ff lines are what allocators/record/<name>
+ * prints. The ops are split between the threads by id, so each allocation
+ * is made and freed by one thread and every op runs once; the threads share
+ * the allocator, so more than one of them measures contention. With more
+ * than one thread the interleaving differs from the recording, and an
+ * alloc that only fit in the recorded order may fail. Reading the file
+ * prints the last run.
+ */
+
+#define ALLOC_REPLAY_MAX_OPS		65536
+#define ALLOC_REPLAY_MAX_THREADS	16
+#define ALLOC_REPLAY_HASH_BITS		10
+
+enum alloc_replay_type {
+	ALLOC_REPLAY_BUDDY,
+	ALLOC_REPLAY_BITMAP,
+	ALLOC_REPLAY_PAGE,
+};
+
+static const char * const alloc_replay_type_names[] = {
+	[ALLOC_REPLAY_BUDDY]	= "buddy",
+	[ALLOC_REPLAY_BITMAP]	= "bitmap",
+	[ALLOC_REPLAY_PAGE]	= "page",
+};
+
+struct alloc_replay_op {
+	enum gk20a_alloc_op op;
+	u64 id;
+	u64 base;
+	u64 len;
+};
+
+struct alloc_replay_ent {
+	struct hlist_node node;
+	u64 id;
+	u64 addr;
+	u64 len;
+};
+
+struct alloc_replay;
+
+struct alloc_replay_thread {
+	struct alloc_replay *r;
+	u32 index;
+	struct completion done;
+	DECLARE_HASHTABLE(live, ALLOC_REPLAY_HASH_BITS);
+	u64 *lat_ns;
+	u32 nr_lat;
+	u64 failures;
+	u64 unmatched;
+	u64 live_bytes;
+};
+
+struct alloc_replay {
+	struct mutex lock;
+	struct gk20a *g;
+
+	/* configuration and loaded trace */
+	enum alloc_replay_type type;
+	u64 base, length, blk_size, flags;
+	bool configured;
+	u32 nr_threads;
+	struct alloc_replay_op *ops;
+	u32 nr_ops;
+	bool overflow;
+
+	/* partial line carried over between writes */
+	char line[128];
+	size_t line_len;
+
+	/* used while running */
+	struct gk20a_allocator a;
+	struct completion go;
+
+	/* last run */
+	int err;
+	bool ran;
+	u32 run_ops;
+	u32 run_threads;
+	u64 elapsed_ns;
+	u64 p50_ns, p99_ns, max_ns;
+	u64 failures, unmatched;
+	u64 space_before, space_after, space_expected;
+	u64 largest_free;
+};
+
+static struct alloc_replay_ent *alloc_replay_find(
+		struct alloc_replay_thread *t, u64 id)
+{
+	struct alloc_replay_ent *ent;
+
+	hash_for_each_possible(t->live, ent, node, id)
+		if (ent->id == id)
+			return ent;
+
+	return NULL;
+}
+
+static void alloc_replay_one(struct alloc_replay_thread *t,
+			     struct alloc_replay_op *op)
+{
+	struct gk20a_allocator *a = &t->r->a;
+	struct alloc_replay_ent *ent = NULL;
+	u64 start, addr = 0;
+
+	if (op->op == GK20A_ALLOC_OP_FREE ||
+	    op->op == GK20A_ALLOC_OP_FREE_FIXED) {
+		ent = alloc_replay_find(t, op->id);
+		if (!ent) {
+			/* its alloc failed, or was never recorded */
+			t->unmatched++;
+			return;
+		}
+		hash_del(&ent->node);
+	} else {
+		ent = kzalloc(sizeof(*ent), GFP_KERNEL);
+		if (!ent) {
+			t->failures++;
+			return;
+		}
+	}
+
+	start = ktime_to_ns(ktime_get());
+	switch (op->op) {
+	case GK20A_ALLOC_OP_ALLOC:
+		addr = gk20a_alloc(a, op->len);
+		break;
+	case GK20A_ALLOC_OP_ALLOC_FIXED:
+		addr = gk20a_alloc_fixed(a, op->base, op->len);
+		break;
+	case GK20A_ALLOC_OP_FREE:
+		gk20a_free(a, ent->addr);
+		break;
+	case GK20A_ALLOC_OP_FREE_FIXED:
+		gk20a_free_fixed(a, ent->addr, ent->len);
+		break;
+	default:
+		break;
+	}
+	t->lat_ns[t->nr_lat++] = ktime_to_ns(ktime_get()) - start;
+
+	if (op->op == GK20A_ALLOC_OP_FREE ||
+	    op->op == GK20A_ALLOC_OP_FREE_FIXED) {
+		t->live_bytes -= ent->len;
+		kfree(ent);
+		return;
+	}
+
+	if (!addr) {
+		t->failures++;
+		kfree(ent);
+		return;
+	}
+
+	ent->id = op->id;
+	ent->addr = addr;
+	ent->len = op->len;
+	hash_add(t->live, &ent->node, ent->id);
+	t->live_bytes += ent->len;
+}
+
+static int alloc_replay_thread_fn(void *data)
+{
+	struct alloc_replay_thread *t = data;
+	struct alloc_replay *r = t->r;
+	u32 i;
+
+	wait_for_completion(&r->go);
+
+	for (i = 0; i < r->nr_ops; i++)
+		if (hash_64(r->ops[i].id, 32) % r->nr_threads == t->index)
+			alloc_replay_one(t, &r->ops[i]);
+
+	complete(&t->done);
+	return 0;
+}
+
+static void alloc_replay_release_live(struct alloc_replay *r,
+				      struct alloc_replay_thread *t)
+{
+	struct alloc_replay_ent *ent;
+	struct hlist_node *tmp;
+	int bkt;
+
+	hash_for_each_safe(t->live, bkt, tmp, ent, node) {
+		hash_del(&ent->node);
+		gk20a_free(&r->a, ent->addr);
+		kfree(ent);
+	}
+}
+
+/*
+ * Largest single block the allocator can still hand out, found by halving
+ * the request. Fixed layouts are rare enough that this is not worth an op.
+ * Not meaningful for the page allocator, which need not hand out contiguous
+ * space.
+ */
+static u64 alloc_replay_largest_free(struct alloc_replay *r, u64 space)
+{
+	u64 lo = 0, hi = space / r->blk_size, mid, addr;
+
+	while (lo < hi) {
+		mid = lo + DIV_ROUND_UP(hi - lo, 2);
+		addr = gk20a_alloc(&r->a, mid * r->blk_size);
+		if (addr) {
+			gk20a_free(&r->a, addr);
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return lo * r->blk_size;
+}
+
+static int alloc_replay_cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int alloc_replay_init_allocator(struct alloc_replay *r)
+{
+	memset(&r->a, 0, sizeof(r->a));
+
+	switch (r->type) {
+	case ALLOC_REPLAY_BUDDY:
+		return gk20a_buddy_allocator_init(r->g, &r->a, "replay_bench",
+						  r->base, r->length,
+						  r->blk_size, r->flags);
+	case ALLOC_REPLAY_BITMAP:
+		return gk20a_bitmap_allocator_init(r->g, &r->a, "replay_bench",
+						   r->base, r->length,
+						   r->blk_size, r->flags);
+	case ALLOC_REPLAY_PAGE:
+		return gk20a_page_allocator_init(r->g, &r->a, "replay_bench",
+						 r->base, r->length,
+						 r->blk_size, r->flags);
+	}
+
+	return -EINVAL;
+}
+
+static int alloc_replay_run(struct alloc_replay *r)
+{
+	struct alloc_replay_thread *threads;
+	struct task_struct *task;
+	u64 *lat = NULL, live_bytes = 0, start;
+	u32 nr_lat = 0, i, started = 0;
+	int err;
+
+	if (!r->configured || !r->nr_ops)
+		return -EINVAL;
+
+	err = alloc_replay_init_allocator(r);
+	if (err)
+		return err;
+
+	threads = kcalloc(r->nr_threads, sizeof(*threads), GFP_KERNEL);
+	if (!threads) {
+		err = -ENOMEM;
+		goto out_destroy;
+	}
+
+	for (i = 0; i < r->nr_threads; i++) {
+		threads[i].r = r;
+		threads[i].index = i;
+		init_completion(&threads[i].done);
+		hash_init(threads[i].live);
+		threads[i].lat_ns = vzalloc(r->nr_ops * sizeof(u64));
+		if (!threads[i].lat_ns) {
+			err = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	r->space_before = gk20a_alloc_space(&r->a);
+	init_completion(&r->go);
+
+	for (i = 0; i < r->nr_threads; i++) {
+		task = kthread_run(alloc_replay_thread_fn, &threads[i],
+				   "nvgpu_alloc_replay%u", i);
+		if (IS_ERR(task)) {
+			err = PTR_ERR(task);
+			break;
+		}
+		started++;
+	}
+
+	/* release everyone together so the threads actually contend */
+	start = ktime_to_ns(ktime_get());
+	complete_all(&r->go);
+	for (i = 0; i < started; i++)
+		wait_for_completion(&threads[i].done);
+	r->elapsed_ns = ktime_to_ns(ktime_get()) - start;
+
+	if (err)
+		goto out_release;
+
+	r->failures = 0;
+	r->unmatched = 0;
+	for (i = 0; i < r->nr_threads; i++) {
+		r->failures += threads[i].failures;
+		r->unmatched += threads[i].unmatched;
+		live_bytes += threads[i].live_bytes;
+		nr_lat += threads[i].nr_lat;
+	}
+
+	/* what is still allocated at the end is the fragmenting load */
+	r->space_after = gk20a_alloc_space(&r->a);
+	r->space_expected = r->space_before > live_bytes ?
+			    r->space_before - live_bytes : 0;
+	r->largest_free = r->type == ALLOC_REPLAY_PAGE ? 0 :
+			  alloc_replay_largest_free(r, r->space_after);
+
+	r->p50_ns = r->p99_ns = r->max_ns = 0;
+	lat = vmalloc(max_t(u32, nr_lat, 1) * sizeof(u64));
+	if (lat && nr_lat) {
+		nr_lat = 0;
+		for (i = 0; i < r->nr_threads; i++) {
+			memcpy(&lat[nr_lat], threads[i].lat_ns,
+			       threads[i].nr_lat * sizeof(u64));
+			nr_lat += threads[i].nr_lat;
+		}
+		sort(lat, nr_lat, sizeof(u64), alloc_replay_cmp_u64, NULL);
+		r->p50_ns = lat[nr_lat / 2];
+		r->p99_ns = lat[div_u64((u64)nr_lat * 99, 100)];
+		r->max_ns = lat[nr_lat - 1];
+	}
+	vfree(lat);
+
+	r->run_ops = nr_lat;
+	r->run_threads = r->nr_threads;
+
+out_release:
+	for (i = 0; i < r->nr_threads; i++)
+		alloc_replay_release_live(r, &threads[i]);
+out_free:
+	for (i = 0; i < r->nr_threads; i++)
+		vfree(threads[i].lat_ns);
+	kfree(threads);
+out_destroy:
+	gk20a_alloc_destroy(&r->a);
+	return err;
+}
+
+static int alloc_replay_add_op(struct alloc_replay *r,
+			       enum gk20a_alloc_op op,
+			       u64 id, u64 base, u64 len)
+{
+	struct alloc_replay_op *o;
+
+	if (!r->ops) {
+		r->ops = vzalloc(ALLOC_REPLAY_MAX_OPS * sizeof(*r->ops));
+		if (!r->ops)
+			return -ENOMEM;
+	}
+
+	if (r->nr_ops == ALLOC_REPLAY_MAX_OPS) {
+		r->overflow = true;
+		return 0;
+	}
+
+	o = &r->ops[r->nr_ops++];
+	o->op = op;
+	o->id = id;
+	o->base = base;
+	o->len = len;
+
+	return 0;
+}
+
+static int alloc_replay_parse_line(struct alloc_replay *r, char *line)
+{
+	char cmd[8], type[8];
+	char *args;
+	u64 a, b, c, d = 0;
+	unsigned int i;
+	int n;
+	u32 nr;
+
+	line = strim(line);
+	if (!*line || *line == '#')
+		return 0;
+
+	if (sscanf(line, "%7s", cmd) != 1)
+		return -EINVAL;
+	args = line + strlen(cmd);
+
+	if (!strcmp(cmd, "a")) {
+		if (sscanf(args, "%llx %llx", &a, &b) != 2)
+			return -EINVAL;
+		return alloc_replay_add_op(r, GK20A_ALLOC_OP_ALLOC, a, 0, b);
+	}
+
+	if (!strcmp(cmd, "f")) {
+		if (sscanf(args, "%llx", &a) != 1)
+			return -EINVAL;
+		return alloc_replay_add_op(r, GK20A_ALLOC_OP_FREE, a, 0, 0);
+	}
+
+	if (!strcmp(cmd, "af")) {
+		if (sscanf(args, "%llx %llx %llx", &a, &b, &c) != 3)
+			return -EINVAL;
+		return alloc_replay_add_op(r, GK20A_ALLOC_OP_ALLOC_FIXED,
+					   a, b, c);
+	}
+
+	if (!strcmp(cmd, "ff")) {
+		if (sscanf(args, "%llx %llx", &a, &b) != 2)
+			return -EINVAL;
+		return alloc_replay_add_op(r, GK20A_ALLOC_OP_FREE_FIXED,
+					   a, 0, b);
+	}
+
+	if (!strcmp(cmd, "reset")) {
+		r->nr_ops = 0;
+		r->overflow = false;
+		return 0;
+	}
+
+	if (!strcmp(cmd, "run")) {
+		r->ran = true;
+		r->err = alloc_replay_run(r);
+		return 0;
+	}
+
+	if (!strcmp(cmd, "threads")) {
+		if (sscanf(args, "%u", &nr) != 1 ||
+		    nr < 1 || nr > ALLOC_REPLAY_MAX_THREADS)
+			return -EINVAL;
+		r->nr_threads = nr;
+		return 0;
+	}
+
+	if (!strcmp(cmd, "init")) {
+		n = sscanf(args, "%7s %llx %llx %llx %llx",
+			   type, &a, &b, &c, &d);
+		if (n < 4)
+			return -EINVAL;
+
+		for (i = 0; i < ARRAY_SIZE(alloc_replay_type_names); i++)
+			if (!strcmp(type, alloc_replay_type_names[i]))
+				break;
+		/* GVA space buddies need a VM to place PTE sizes against */
+		if (i == ARRAY_SIZE(alloc_replay_type_names) || !c ||
+		    (d & GPU_ALLOC_GVA_SPACE))
+			return -EINVAL;
+
+		r->type = i;
+		r->base = a;
+		r->length = b;
+		r->blk_size = c;
+		r->flags = d;
+		r->configured = true;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static ssize_t alloc_replay_write(struct file *file,
+				  const char __user *user_buf,
+				  size_t count, loff_t *ppos)
+{
+	struct alloc_replay *r = file_inode(file)->i_private;
+	char chunk[256];
+	size_t done = 0, len, i;
+	int err = 0;
+
+	mutex_lock(&r->lock);
+	while (done < count) {
+		len = min(count - done, sizeof(chunk));
+		if (copy_from_user(chunk, user_buf + done, len)) {
+			err = -EFAULT;
+			break;
+		}
+
+		for (i = 0; i < len && !err; i++) {
+			if (chunk[i] != '\n') {
+				if (r->line_len < sizeof(r->line) - 1)
+					r->line[r->line_len++] = chunk[i];
+				continue;
+			}
+			r->line[r->line_len] = '\0';
+			r->line_len = 0;
+			err = alloc_replay_parse_line(r, r->line);
+		}
+		if (err)
+			break;
+		done += len;
+	}
+	mutex_unlock(&r->lock);
+
+	return err ? err : count;
+}
+
+static int alloc_replay_show(struct seq_file *s, void *unused)
+{
+	struct alloc_replay *r = s->private;
+
+	mutex_lock(&r->lock);
+
+	if (r->configured)
+		seq_printf(s, "allocator:          %s base 0x%llx length 0x%llx blk 0x%llx flags 0x%llx\n",
+			   alloc_replay_type_names[r->type], r->base,
+			   r->length, r->blk_size, r->flags);
+	else
+		seq_puts(s, "allocator:          (no init line yet)\n");
+	seq_printf(s, "loaded ops:         %u%s\n", r->nr_ops,
+		   r->overflow ? " (truncated)" : "");
+	seq_printf(s, "threads:            %u\n", r->nr_threads);
+
+	if (!r->ran)
+		goto out;
+
+	if (r->err) {
+		seq_printf(s, "last run failed:    %d\n", r->err);
+		goto out;
+	}
+
+	seq_printf(s, "ops run:            %u over %u thread(s)\n",
+		   r->run_ops, r->run_threads);
+	seq_printf(s, "elapsed (ns):       %llu\n", r->elapsed_ns);
+	seq_printf(s, "ops/sec:            %llu\n",
+		   r->elapsed_ns ?
+		   div64_u64((u64)r->run_ops * NSEC_PER_SEC, r->elapsed_ns) : 0);
+	seq_printf(s, "latency p50 (ns):   %llu\n", r->p50_ns);
+	seq_printf(s, "latency p99 (ns):   %llu\n", r->p99_ns);
+	seq_printf(s, "latency max (ns):   %llu\n", r->max_ns);
+	seq_printf(s, "failed allocs:      %llu\n", r->failures);
+	seq_printf(s, "unmatched frees:    %llu\n", r->unmatched);
+	seq_printf(s, "space before:       0x%llx\n", r->space_before);
+	seq_printf(s, "space after:        0x%llx\n", r->space_after);
+	/* gk20a_alloc_space() against what the trace left allocated */
+	seq_printf(s, "space expected:     0x%llx\n", r->space_expected);
+	if (r->type == ALLOC_REPLAY_PAGE)
+		goto out;
+	seq_printf(s, "largest free block: 0x%llx\n", r->largest_free);
+	seq_printf(s, "fragmentation (x100): %llu\n",
+		   r->space_after ?
+		   100 - div64_u64(r->largest_free * 100, r->space_after) : 0);
+out:
+	mutex_unlock(&r->lock);
+	return 0;
+}
+
+static int alloc_replay_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, alloc_replay_show, inode->i_private);
+}
+
+static const struct file_operations alloc_replay_fops = {
+	.open		= alloc_replay_open,
+	.read		= seq_read,
+	.write		= alloc_replay_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void alloc_replay_free(void *data)
+{
+	struct alloc_replay *r = data;
+
+	vfree(r->ops);
+}
+
+void gk20a_alloc_replay_debugfs_init(struct gk20a *g)
+{
+	struct alloc_replay *r;
+
+	r = devm_kzalloc(g->dev, sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return;
+
+	mutex_init(&r->lock);
+	r->g = g;
+	r->nr_threads = 1;
+
+	if (devm_add_action(g->dev, alloc_replay_free, r))
+		return;
+
+	debugfs_create_file("replay", 0664, g->debugfs_allocators, r,
+			    &alloc_replay_fops);
+}
@@ -1703,7 +1703,7 @@ restore_fe_go_idle:
 			goto clean_up;
 		}
 
-		gk20a_mem_rd_n(g, gold_mem, 0,
+		gk20a_mem_rd_n_bulk(g, gold_mem, 0,
 				gr->ctx_vars.local_golden_image,
 				gr->ctx_vars.golden_image_size);
 	}
@@ -1936,7 +1936,7 @@ int gr_gk20a_load_golden_ctx_image(struct gk20a *g,
 	if (gk20a_mem_begin(g, mem))
 		return -ENOMEM;
 
-	gk20a_mem_wr_n(g, mem, 0,
+	gk20a_mem_wr_n_bulk(g, mem, 0,
 			gr->ctx_vars.local_golden_image,
 			gr->ctx_vars.golden_image_size);
 
@@ -2110,11 +2110,11 @@ static int gr_gk20a_copy_ctxsw_ucode_segments(
 {
 	unsigned int i;
 
-	gk20a_mem_wr_n(g, dst, segments->boot.offset, bootimage,
+	gk20a_mem_wr_n_bulk(g, dst, segments->boot.offset, bootimage,
 			segments->boot.size);
-	gk20a_mem_wr_n(g, dst, segments->code.offset, code,
+	gk20a_mem_wr_n_bulk(g, dst, segments->code.offset, code,
 			segments->code.size);
-	gk20a_mem_wr_n(g, dst, segments->data.offset, data,
+	gk20a_mem_wr_n_bulk(g, dst, segments->data.offset, data,
 			segments->data.size);
 
 	/* compute a "checksum" for the boot binary to detect its version */
@@ -3180,16 +3180,34 @@ out:
 int gk20a_comptag_allocator_init(struct gk20a_comptag_allocator *allocator,
 		unsigned long size)
 {
+	struct gk20a_comptag_extent *e;
+
 	mutex_init(&allocator->lock);
+	allocator->free_by_addr = RB_ROOT;
+	allocator->free_by_size = RB_ROOT;
+	memset(&allocator->stats, 0, sizeof(allocator->stats));
 	/*
-	 * 0th comptag is special and is never used. The base for this bitmap
-	 * is 1, and its size is one less than the size of comptag store.
+	 * 0th comptag is special and is never used. Lines start at 1, and
+	 * there is one less of them than the size of comptag store.
 	 */
 	size--;
-	allocator->bitmap = vzalloc(BITS_TO_LONGS(size) * sizeof(long));
-	if (!allocator->bitmap)
-		return -ENOMEM;
 	allocator->size = size;
+	if (!size)
+		return 0;
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return -ENOMEM;
+	e->start = 1;
+	e->len = size;
+
+	rb_link_node(&e->addr_node, NULL, &allocator->free_by_addr.rb_node);
+	rb_insert_color(&e->addr_node, &allocator->free_by_addr);
+	rb_link_node(&e->size_node, NULL, &allocator->free_by_size.rb_node);
+	rb_insert_color(&e->size_node, &allocator->free_by_size);
+
+	allocator->stats.free_lines = size;
+	allocator->stats.free_extents = 1;
 	return 0;
 }
 
@@ -3200,8 +3218,14 @@ void gk20a_comptag_allocator_destroy(struct gk20a_comptag_allocator *allocator)
 	 * init stage); no users should be active, so taking the mutex is
 	 * unnecessary here.
 	 */
+	struct gk20a_comptag_extent *e, *tmp;
+
+	rbtree_postorder_for_each_entry_safe(e, tmp,
+			&allocator->free_by_addr, addr_node)
+		kfree(e);
+	allocator->free_by_addr = RB_ROOT;
+	allocator->free_by_size = RB_ROOT;
 	allocator->size = 0;
-	vfree(allocator->bitmap);
 }
 
 static void gk20a_remove_gr_support(struct gr_gk20a *gr)
@@ -4951,7 +4975,7 @@ static int gk20a_init_gr_setup_sw(struct gk20a *g)
 	gr->g = g;
 
 #if defined(CONFIG_GK20A_CYCLE_STATS)
-	mutex_init(&g->gr.cs_lock);
+	gr_gk20a_init_cyclestats_snapshot(g);
 #endif
 
 	err = gr_gk20a_init_gr_config(g, gr);
@@ -5669,7 +5693,8 @@ static int gk20a_gr_handle_notify_pending(struct gk20a *g,
  * Also used by regops to translate current ctx to chid and tsgid.
  * For performance, we don't want to go through 128 channels every time.
  * curr_ctx should be the value read from gr_fecs_current_ctx_r().
- * A small tlb is used here to cache translation.
+ * A small tlb is used here to cache translation, misses go to the fifo
+ * inst_hash.
  *
  * Returned channel must be freed with gk20a_channel_put() */
 static struct channel_gk20a *gk20a_gr_get_channel_from_ctx(
@@ -5702,25 +5727,14 @@ static struct channel_gk20a *gk20a_gr_get_channel_from_ctx(
 	}
 
 	/* slow path */
-	for (chid = 0; chid < f->num_channels; chid++) {
-		struct channel_gk20a *ch = &f->channel[chid];
-		if (!gk20a_channel_get(ch))
-			continue;
-
-		if ((u32)(gk20a_mm_inst_block_addr(g, &ch->inst_block) >>
-					ram_in_base_shift_v()) ==
-				gr_fecs_current_ctx_ptr_v(curr_ctx)) {
-			tsgid = ch->tsgid;
-			/* found it */
-			ret = ch;
-			break;
-		}
-		gk20a_channel_put(ch);
-	}
-
+	ret = gk20a_fifo_channel_from_inst_ptr(g,
+			gr_fecs_current_ctx_ptr_v(curr_ctx));
 	if (!ret)
 		goto unlock;
 
+	chid = ret->hw_chid;
+	tsgid = ret->tsgid;
+
 	/* add to free tlb entry */
 	for (i = 0; i < GR_CHANNEL_MAP_TLB_SIZE; i++) {
 		if (gr->chid_tlb[i].curr_ctx == 0) {
@@ -6733,7 +6747,7 @@ int gr_gk20a_get_ctx_buffer_offsets(struct gk20a *g,
 	priv_registers = kzalloc(sizeof(u32) * potential_offsets, GFP_KERNEL);
 	if (!priv_registers) {
 		gk20a_dbg_fn("failed alloc for potential_offsets=%d", potential_offsets);
-		err = PTR_ERR(priv_registers);
+		err = -ENOMEM;
 		goto cleanup;
 	}
 	memset(offsets,      0, sizeof(u32) * max_offsets);
@@ -8307,6 +8321,281 @@ int gr_gk20a_exec_ctx_ops(struct channel_gk20a *ch,
 	return err;
 }
 
+static void gr_ctx_sample_add_word(struct gk20a_mem_access *words, u32 *num,
+				   u32 w)
+{
+	u32 i;
+
+	/* lists are short and built once */
+	for (i = 0; i < *num; i++)
+		if (words[i].w == w)
+			return;
+
+	words[*num].w = w;
+	words[*num].data = 0;
+	(*num)++;
+}
+
+static int gr_ctx_sample_word_cmp(const void *a, const void *b)
+{
+	const struct gk20a_mem_access *x = a;
+	const struct gk20a_mem_access *y = b;
+
+	if (x->w < y->w)
+		return -1;
+	return x->w > y->w;
+}
+
+static u32 gr_ctx_sample_word_index(struct gk20a_mem_access *words, u32 num,
+				    u32 w)
+{
+	struct gk20a_mem_access key = { .w = w };
+	struct gk20a_mem_access *found;
+
+	found = bsearch(&key, words, num, sizeof(*words),
+			gr_ctx_sample_word_cmp);
+
+	return found - words;
+}
+
+void gr_gk20a_ctx_sample_program_free(struct gr_ctx_sample_program *prog)
+{
+	if (!prog)
+		return;
+
+	kfree(prog->entries);
+	kfree(prog->gr_words);
+	kfree(prog->pm_words);
+	kfree(prog);
+}
+
+/*
+ * Resolve the context image offsets of a set of ctx read ops once, so that
+ * gr_gk20a_ctx_sample() does not have to rebuild the priv address tables
+ * for every sample. The ops must already be validated against the
+ * whitelists; quad ops are not supported.
+ */
+int gr_gk20a_ctx_sample_program_build(struct gk20a *g,
+		struct nvgpu_dbg_gpu_reg_op *ops, u32 num_ops,
+		struct gr_ctx_sample_program **out)
+{
+	struct gr_gk20a *gr = &g->gr;
+	u32 max_offsets = gr->max_gpc_count * gr->max_tpc_per_gpc_count;
+	struct gr_ctx_sample_program *prog;
+	u32 *offsets = NULL, *offset_addrs;
+	u32 i, num_offsets;
+	int err = 0;
+
+	prog = kzalloc(sizeof(*prog), GFP_KERNEL);
+	if (!prog)
+		return -ENOMEM;
+
+	prog->entries = kcalloc(num_ops, sizeof(*prog->entries), GFP_KERNEL);
+	prog->gr_words = kcalloc(2 * num_ops, sizeof(*prog->gr_words),
+				 GFP_KERNEL);
+	prog->pm_words = kcalloc(2 * num_ops, sizeof(*prog->pm_words),
+				 GFP_KERNEL);
+	/* they're the same size, so just use one alloc for both */
+	offsets = kzalloc(2 * sizeof(u32) * max_offsets, GFP_KERNEL);
+	if (!prog->entries || !prog->gr_words || !prog->pm_words ||
+	    !offsets) {
+		err = -ENOMEM;
+		goto fail;
+	}
+	offset_addrs = offsets + max_offsets;
+
+	for (i = 0; i < num_ops; i++) {
+		struct gr_ctx_sample_entry *e = &prog->entries[i];
+		struct gk20a_mem_access *words;
+		u32 *num_words;
+
+		if (!reg_op_is_read(ops[i].op) ||
+		    !reg_op_is_gr_ctx(ops[i].type) ||
+		    ops[i].type == REGOP(TYPE_GR_CTX_QUAD)) {
+			ops[i].status = REGOP(STATUS_UNSUPPORTED_OP);
+			err = -EINVAL;
+			continue;
+		}
+
+		err = gr_gk20a_get_ctx_buffer_offsets(g, ops[i].offset,
+				max_offsets, offsets, offset_addrs,
+				&num_offsets, false, 0);
+		if (err) {
+			err = gr_gk20a_get_pm_ctx_buffer_offsets(g,
+					ops[i].offset, max_offsets,
+					offsets, offset_addrs, &num_offsets);
+			e->pm_ctx = true;
+		}
+		if (err || !num_offsets) {
+			ops[i].status = REGOP(STATUS_INVALID_OFFSET);
+			err = -EINVAL;
+			continue;
+		}
+
+		e->priv_addr = ops[i].offset;
+		e->is_64 = ops[i].op == REGOP(READ_64);
+
+		/* same sanity check as gr_gk20a_exec_ctx_ops(), plus the hi word */
+		if (offsets[0] + (e->is_64 ? 4 : 0) >=
+		    (e->pm_ctx ? gr->ctx_vars.pm_ctxsw_image_size :
+				 gr->ctx_vars.golden_image_size)) {
+			ops[i].status = REGOP(STATUS_INVALID_OFFSET);
+			err = -EINVAL;
+			continue;
+		}
+
+		e->word_lo = offsets[0] / sizeof(u32);
+		e->word_hi = e->word_lo + 1;
+
+		words = e->pm_ctx ? prog->pm_words : prog->gr_words;
+		num_words = e->pm_ctx ? &prog->num_pm_words :
+					&prog->num_gr_words;
+		gr_ctx_sample_add_word(words, num_words, e->word_lo);
+		if (e->is_64)
+			gr_ctx_sample_add_word(words, num_words, e->word_hi);
+
+		ops[i].status = REGOP(STATUS_SUCCESS);
+	}
+
+	/* any failed op fails the whole program */
+	for (i = 0; i < num_ops; i++)
+		if (ops[i].status != REGOP(STATUS_SUCCESS))
+			err = -EINVAL;
+	if (err)
+		goto fail;
+
+	/*
+	 * Sorted unique words come back from gk20a_mem_rd32_batch() in the
+	 * same order, so entries can refer to them by index.
+	 */
+	sort(prog->gr_words, prog->num_gr_words, sizeof(*prog->gr_words),
+	     gr_ctx_sample_word_cmp, NULL);
+	sort(prog->pm_words, prog->num_pm_words, sizeof(*prog->pm_words),
+	     gr_ctx_sample_word_cmp, NULL);
+
+	for (i = 0; i < num_ops; i++) {
+		struct gr_ctx_sample_entry *e = &prog->entries[i];
+		struct gk20a_mem_access *words = e->pm_ctx ?
+			prog->pm_words : prog->gr_words;
+		u32 num_words = e->pm_ctx ? prog->num_pm_words :
+					    prog->num_gr_words;
+
+		e->word_lo = gr_ctx_sample_word_index(words, num_words,
+						      e->word_lo);
+		if (e->is_64)
+			e->word_hi = gr_ctx_sample_word_index(words,
+						num_words, e->word_hi);
+	}
+
+	prog->num_entries = num_ops;
+	kfree(offsets);
+	*out = prog;
+
+	gk20a_dbg(gpu_dbg_gpu_dbg, "ctx sample program: %u ops, %u+%u words",
+		  num_ops, prog->num_gr_words, prog->num_pm_words);
+
+	return 0;
+
+fail:
+	kfree(offsets);
+	gr_gk20a_ctx_sample_program_free(prog);
+	return err;
+}
+
+/*
+ * Read every register of a sample program. ctxsw is only held off for the
+ * register reads or the two batched image reads; the values are assembled
+ * afterwards.
+ */
+int gr_gk20a_ctx_sample(struct channel_gk20a *ch,
+		struct gr_ctx_sample_program *prog, u64 *values)
+{
+	struct gk20a *g = ch->g;
+	struct channel_ctx_gk20a *ch_ctx = &ch->ch_ctx;
+	bool gr_ctx_ready = false, pm_ctx_ready = false;
+	bool ch_is_curr_ctx = false;
+	u32 i, lo, hi;
+	int err, tmp_err;
+
+	err = gr_gk20a_disable_ctxsw(g);
+	if (err) {
+		gk20a_err(dev_from_gk20a(g), "unable to stop gr ctxsw");
+		return err;
+	}
+
+	ch_is_curr_ctx = gk20a_is_channel_ctx_resident(ch);
+
+	if (ch_is_curr_ctx) {
+		for (i = 0; i < prog->num_entries; i++) {
+			struct gr_ctx_sample_entry *e = &prog->entries[i];
+
+			lo = gk20a_readl(g, e->priv_addr);
+			hi = e->is_64 ? gk20a_readl(g, e->priv_addr + 4) : 0;
+			values[i] = ((u64)hi << 32) | lo;
+		}
+		goto enable;
+	}
+
+	if (prog->num_gr_words) {
+		if (gk20a_mem_begin(g, &ch_ctx->gr_ctx->mem)) {
+			err = -ENOMEM;
+			goto enable;
+		}
+		gr_ctx_ready = true;
+	}
+
+	if (prog->num_pm_words) {
+		/* Make sure ctx buffer was initialized */
+		if (!ch_ctx->pm_ctx.mem.pages) {
+			gk20a_err(dev_from_gk20a(g), "Invalid ctx buffer");
+			err = -EINVAL;
+			goto end;
+		}
+		if (gk20a_mem_begin(g, &ch_ctx->pm_ctx.mem)) {
+			err = -ENOMEM;
+			goto end;
+		}
+		pm_ctx_ready = true;
+	}
+
+	g->ops.mm.l2_flush(g, true);
+
+	if (gr_ctx_ready)
+		gk20a_mem_rd32_batch(g, &ch_ctx->gr_ctx->mem,
+				     prog->gr_words, prog->num_gr_words);
+	if (pm_ctx_ready)
+		gk20a_mem_rd32_batch(g, &ch_ctx->pm_ctx.mem,
+				     prog->pm_words, prog->num_pm_words);
+
+end:
+	if (gr_ctx_ready)
+		gk20a_mem_end(g, &ch_ctx->gr_ctx->mem);
+	if (pm_ctx_ready)
+		gk20a_mem_end(g, &ch_ctx->pm_ctx.mem);
+
+enable:
+	tmp_err = gr_gk20a_enable_ctxsw(g);
+	if (tmp_err) {
+		gk20a_err(dev_from_gk20a(g), "unable to restart ctxsw!\n");
+		err = tmp_err;
+	}
+
+	if (err || ch_is_curr_ctx)
+		return err;
+
+	for (i = 0; i < prog->num_entries; i++) {
+		struct gr_ctx_sample_entry *e = &prog->entries[i];
+		struct gk20a_mem_access *words = e->pm_ctx ?
+			prog->pm_words : prog->gr_words;
+
+		lo = words[e->word_lo].data;
+		hi = e->is_64 ? words[e->word_hi].data : 0;
+		values[i] = ((u64)hi << 32) | lo;
+	}
+
+	return 0;
+}
+
 static void gr_gk20a_cb_size_default(struct gk20a *g)
 {
 	struct gr_gk20a *gr = &g->gr;
@@ -19,6 +19,7 @@
 #define GR_GK20A_H
 
 #include <linux/slab.h>
+#include <linux/rbtree.h>
 #ifdef CONFIG_ARCH_TEGRA_18x_SOC
 #include "gr_t18x.h"
 #endif
@@ -204,6 +205,14 @@ struct nvgpu_preemption_modes_rec {
 	u32 default_compute_preempt_mode; /* default mode */
 };
 
+/* a run of free comptag lines, linked in both allocator trees */
+struct gk20a_comptag_extent {
+	struct rb_node addr_node;
+	struct rb_node size_node;
+	u32 start;
+	u32 len;
+};
+
 struct gr_gk20a {
 	struct gk20a *g;
 	struct {
@@ -319,10 +328,25 @@ struct gr_gk20a {
 	struct compbit_store_desc compbit_store;
 	struct gk20a_comptag_allocator {
 		struct mutex lock;
-		/* this bitmap starts at ctag 1. 0th cannot be taken */
-		unsigned long *bitmap;
-		/* size of bitmap, not max ctags, so one less */
+		/*
+		 * Free extents ordered by start line, and by length then start
+		 * line. Lines start at ctag 1; the 0th cannot be taken.
+		 */
+		struct rb_root free_by_addr;
+		struct rb_root free_by_size;
+		/* usable lines, not max ctags, so one less */
 		unsigned long size;
+		struct {
+			unsigned long free_lines;
+			unsigned long free_extents;
+			u64 allocs;
+			u64 frees;
+			u64 failures;
+			/* failures with enough free lines, but not in one run */
+			u64 frag_failures;
+			u64 search_steps;
+			u64 max_search_steps;
+		} stats;
 	} comp_tags;
 
 	struct gr_zcull_gk20a zcull;
@@ -358,6 +382,7 @@ struct gr_gk20a {
 #if defined(CONFIG_GK20A_CYCLE_STATS)
 	struct mutex			cs_lock;
 	struct gk20a_cs_snapshot	*cs_data;
+	struct delayed_work		cs_notify_work;
 #endif
 };
 
@@ -522,6 +547,32 @@ struct nvgpu_dbg_gpu_reg_op;
 int gr_gk20a_exec_ctx_ops(struct channel_gk20a *ch,
 			  struct nvgpu_dbg_gpu_reg_op *ctx_ops, u32 num_ops,
 			  u32 num_ctx_wr_ops, u32 num_ctx_rd_ops);
+
+/* a ctx read op resolved by gr_gk20a_ctx_sample_program_build() */
+struct gr_ctx_sample_entry {
+	u32 priv_addr;	/* read directly while the context is resident */
+	bool pm_ctx;	/* in pm_ctx rather than gr_ctx */
+	bool is_64;
+	u32 word_lo;	/* index into gr_words/pm_words */
+	u32 word_hi;
+};
+
+struct gr_ctx_sample_program {
+	u32 num_entries;
+	struct gr_ctx_sample_entry *entries;
+	/* unique words per image, sorted so one batched read covers them */
+	struct gk20a_mem_access *gr_words;
+	u32 num_gr_words;
+	struct gk20a_mem_access *pm_words;
+	u32 num_pm_words;
+};
+
+int gr_gk20a_ctx_sample_program_build(struct gk20a *g,
+		struct nvgpu_dbg_gpu_reg_op *ops, u32 num_ops,
+		struct gr_ctx_sample_program **prog);
+void gr_gk20a_ctx_sample_program_free(struct gr_ctx_sample_program *prog);
+int gr_gk20a_ctx_sample(struct channel_gk20a *ch,
+		struct gr_ctx_sample_program *prog, u64 *values);
 int gr_gk20a_get_ctx_buffer_offsets(struct gk20a *g,
 				    u32 addr,
 				    u32 max_offsets,
@@ -620,7 +671,11 @@ int gr_gk20a_css_detach(struct channel_gk20a *ch,
 				struct gk20a_cs_snapshot_client *css_client);
 int gr_gk20a_css_flush(struct channel_gk20a *ch,
 				struct gk20a_cs_snapshot_client *css_client);
+int gr_gk20a_css_set_notify(struct channel_gk20a *ch,
+				struct gk20a_cs_snapshot_client *css_client,
+				int eventfd, u32 watermark);
 
+void gr_gk20a_init_cyclestats_snapshot(struct gk20a *g);
 void gr_gk20a_free_cyclestats_snapshot_data(struct gk20a *g);
 
 #else
@@ -133,6 +133,47 @@ static void gk20a_ltc_init_cbc(struct gk20a *g, struct gr_gk20a *gr)
 
 }
 
+/*
+ * Waits for hw_op to retire on every LTS. All slices run the operation in
+ * parallel, so poll them together and only drop the ones that are done,
+ * rather than waiting out each slice in turn.
+ */
+static int gk20a_ltc_wait_cbc_ctrl(struct gk20a *g, u32 hw_op,
+				   u32 num_ltc, u32 slices_per_ltc)
+{
+	u32 ltc_stride = nvgpu_get_litter_value(g, GPU_LIT_LTC_STRIDE);
+	u32 lts_stride = nvgpu_get_litter_value(g, GPU_LIT_LTS_STRIDE);
+	u32 num_lts = num_ltc * slices_per_ltc;
+	u64 pending;
+	s32 retry = 200;
+	u32 lts, ctrl1;
+
+	if (WARN_ON(num_lts > 64))
+		num_lts = 64;
+	pending = num_lts == 64 ? ~0ULL : (1ULL << num_lts) - 1;
+
+	do {
+		for (lts = 0; lts < num_lts; lts++) {
+			if (!(pending & (1ULL << lts)))
+				continue;
+
+			ctrl1 = ltc_ltc0_lts0_cbc_ctrl1_r() +
+				(lts / slices_per_ltc) * ltc_stride +
+				(lts % slices_per_ltc) * lts_stride;
+			if (!(gk20a_readl(g, ctrl1) & hw_op))
+				pending &= ~(1ULL << lts);
+		}
+		if (!pending)
+			return 0;
+
+		retry--;
+		udelay(5);
+	} while (retry >= 0 || !tegra_platform_is_silicon());
+
+	gk20a_err(dev_from_gk20a(g), "comp tag clear timeout\n");
+	return -EBUSY;
+}
+
 #ifdef CONFIG_DEBUG_FS
 static void gk20a_ltc_sync_debugfs(struct gk20a *g)
 {
@@ -14,6 +14,9 @@
  */
 
 #include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <trace/events/gk20a.h>
 
 #include "gk20a.h"
@@ -70,13 +73,65 @@ irqreturn_t mc_gk20a_isr_nonstall(struct gk20a *g)
 	return IRQ_WAKE_THREAD;
 }
 
+static inline u64 mc_gk20a_intr_unit_start(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static void mc_gk20a_intr_unit_done(struct gk20a_mc_intr_unit_stats *stats,
+		u64 start_ns)
+{
+	u64 delta_ns = ktime_to_ns(ktime_get()) - start_ns;
+	u32 bucket = fls64(div_u64(delta_ns, NSEC_PER_USEC));
+	u64 max_ns, old;
+
+	atomic64_inc(&stats->count);
+	atomic64_add(delta_ns, &stats->total_ns);
+	atomic_inc(&stats->lat_hist[min_t(u32, bucket,
+					  MC_INTR_LAT_BUCKETS - 1)]);
+
+	/* a reset from debugfs may race with this */
+	max_ns = atomic64_read(&stats->max_ns);
+	while (delta_ns > max_ns) {
+		old = atomic64_cmpxchg(&stats->max_ns, max_ns, delta_ns);
+		if (old == max_ns)
+			break;
+		max_ns = old;
+	}
+}
+
+/*
+ * Mask of the active_engines_list indices with a pending interrupt in
+ * @mc_intr. An engine is serviced once however many of its bits are set.
+ */
+static unsigned long mc_gk20a_intr_pending_engines(struct gk20a *g,
+		u32 mc_intr)
+{
+	unsigned long intr = mc_intr & g->fifo.engine_intr_mask;
+	unsigned long engines = 0;
+	unsigned long bit;
+
+	for_each_set_bit(bit, &intr, 32)
+		engines |= g->fifo.intr_bit_engines[bit];
+
+	return engines;
+}
+
+#define mc_gk20a_intr_unit_call(stats, unit, func)			\
+	do {								\
+		u64 __start = mc_gk20a_intr_unit_start();		\
+		func;							\
+		mc_gk20a_intr_unit_done(&(stats)[unit], __start);	\
+	} while (0)
+
 irqreturn_t mc_gk20a_intr_thread_stall(struct gk20a *g)
 {
+	struct gk20a_mc_intr_unit_stats *stats = g->mc_intr_stats.stall;
+	struct fifo_engine_info_gk20a *engine_info;
 	u32 mc_intr_0;
 	int hw_irq_count;
-	u32 engine_id_idx;
-	u32 active_engine_id = 0;
-	u32 engine_enum = ENGINE_INVAL_GK20A;
+	unsigned long engines;
+	unsigned long idx;
 
 	gk20a_dbg(gpu_dbg_intr, "interrupt thread launched");
 
@@ -87,36 +142,44 @@ irqreturn_t mc_gk20a_intr_thread_stall(struct gk20a *g)
 
 	gk20a_dbg(gpu_dbg_intr, "stall intr %08x\n", mc_intr_0);
 
-	for (engine_id_idx = 0; engine_id_idx < g->fifo.num_engines; engine_id_idx++) {
-		active_engine_id = g->fifo.active_engines_list[engine_id_idx];
-
-		if (mc_intr_0 & g->fifo.engine_info[active_engine_id].intr_mask) {
-			engine_enum = g->fifo.engine_info[active_engine_id].engine_enum;
-			/* GR Engine */
-			if (engine_enum == ENGINE_GR_GK20A) {
-				gr_gk20a_elpg_protected_call(g, gk20a_gr_isr(g));
-			}
-
-			/* CE Engine */
-			if (((engine_enum == ENGINE_GRCE_GK20A) ||
-				(engine_enum == ENGINE_ASYNC_CE_GK20A)) &&
-				g->ops.ce2.isr_stall){
-					g->ops.ce2.isr_stall(g,
-					g->fifo.engine_info[active_engine_id].inst_id,
-					g->fifo.engine_info[active_engine_id].pri_base);
-			}
+	engines = mc_gk20a_intr_pending_engines(g, mc_intr_0);
+	for_each_set_bit(idx, &engines, 32) {
+		engine_info = &g->fifo.engine_info[
+				g->fifo.active_engines_list[idx]];
+
+		switch (engine_info->engine_enum) {
+		case ENGINE_GR_GK20A:
+			mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_GR,
+				gr_gk20a_elpg_protected_call(g,
+						gk20a_gr_isr(g)));
+			break;
+		case ENGINE_GRCE_GK20A:
+		case ENGINE_ASYNC_CE_GK20A:
+			if (!g->ops.ce2.isr_stall)
+				break;
+			mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_CE,
+				g->ops.ce2.isr_stall(g, engine_info->inst_id,
+						engine_info->pri_base));
+			break;
+		default:
+			break;
 		}
 	}
 	if (mc_intr_0 & mc_intr_0_pfifo_pending_f())
-		gk20a_fifo_isr(g);
+		mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_FIFO,
+				gk20a_fifo_isr(g));
 	if (mc_intr_0 & mc_intr_0_pmu_pending_f())
-		gk20a_pmu_isr(g);
+		mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_PMU,
+				gk20a_pmu_isr(g));
 	if (mc_intr_0 & mc_intr_0_priv_ring_pending_f())
-		gk20a_priv_ring_isr(g);
+		mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_PRIV_RING,
+				gk20a_priv_ring_isr(g));
 	if (mc_intr_0 & mc_intr_0_ltc_pending_f())
-		g->ops.ltc.isr(g);
+		mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_LTC,
+				g->ops.ltc.isr(g));
 	if (mc_intr_0 & mc_intr_0_pbus_pending_f())
-		gk20a_pbus_isr(g);
+		mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_PBUS,
+				gk20a_pbus_isr(g));
 
 	/* sync handled irq counter before re-enabling interrupts */
 	atomic_set(&g->sw_irq_stall_last_handled, hw_irq_count);
@@ -136,11 +199,12 @@ irqreturn_t mc_gk20a_intr_thread_stall(struct gk20a *g)
 
 irqreturn_t mc_gk20a_intr_thread_nonstall(struct gk20a *g)
 {
+	struct gk20a_mc_intr_unit_stats *stats = g->mc_intr_stats.nonstall;
+	struct fifo_engine_info_gk20a *engine_info;
 	u32 mc_intr_1;
 	int hw_irq_count;
-	u32 engine_id_idx;
-	u32 active_engine_id = 0;
-	u32 engine_enum = ENGINE_INVAL_GK20A;
+	unsigned long engines;
+	unsigned long idx;
 
 	gk20a_dbg(gpu_dbg_intr, "interrupt thread launched");
 
@@ -150,28 +214,33 @@ irqreturn_t mc_gk20a_intr_thread_nonstall(struct gk20a *g)
 	gk20a_dbg(gpu_dbg_intr, "non-stall intr %08x\n", mc_intr_1);
 
 	if (mc_intr_1 & mc_intr_0_pfifo_pending_f())
-		gk20a_fifo_nonstall_isr(g);
+		mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_FIFO,
+				gk20a_fifo_nonstall_isr(g));
 	if (mc_intr_1 & mc_intr_0_priv_ring_pending_f())
-		gk20a_priv_ring_isr(g);
-
-	for (engine_id_idx = 0; engine_id_idx < g->fifo.num_engines; engine_id_idx++) {
-		active_engine_id = g->fifo.active_engines_list[engine_id_idx];
-
-		if (mc_intr_1 & g->fifo.engine_info[active_engine_id].intr_mask) {
-			engine_enum = g->fifo.engine_info[active_engine_id].engine_enum;
-			/* GR Engine */
-			if (engine_enum == ENGINE_GR_GK20A) {
-				gk20a_gr_nonstall_isr(g);
-			}
-
-			/* CE Engine */
-			if (((engine_enum == ENGINE_GRCE_GK20A) ||
-				(engine_enum == ENGINE_ASYNC_CE_GK20A)) &&
-				g->ops.ce2.isr_nonstall) {
-					g->ops.ce2.isr_nonstall(g,
-					g->fifo.engine_info[active_engine_id].inst_id,
-					g->fifo.engine_info[active_engine_id].pri_base);
-			}
+		mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_PRIV_RING,
+				gk20a_priv_ring_isr(g));
+
+	engines = mc_gk20a_intr_pending_engines(g, mc_intr_1);
+	for_each_set_bit(idx, &engines, 32) {
+		engine_info = &g->fifo.engine_info[
+				g->fifo.active_engines_list[idx]];
+
+		switch (engine_info->engine_enum) {
+		case ENGINE_GR_GK20A:
+			mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_GR,
+				gk20a_gr_nonstall_isr(g));
+			break;
+		case ENGINE_GRCE_GK20A:
+		case ENGINE_ASYNC_CE_GK20A:
+			if (!g->ops.ce2.isr_nonstall)
+				break;
+			mc_gk20a_intr_unit_call(stats, MC_INTR_UNIT_CE,
+				g->ops.ce2.isr_nonstall(g,
+						engine_info->inst_id,
+						engine_info->pri_base));
+			break;
+		default:
+			break;
 		}
 	}
 
@@ -226,6 +295,101 @@ void mc_gk20a_intr_unit_config(struct gk20a *g, bool enable,
 	}
 }
 
+#ifdef CONFIG_DEBUG_FS
+static const char * const mc_gk20a_intr_unit_names[MC_INTR_UNIT_MAX] = {
+	[MC_INTR_UNIT_GR]		= "gr",
+	[MC_INTR_UNIT_CE]		= "ce",
+	[MC_INTR_UNIT_FIFO]		= "fifo",
+	[MC_INTR_UNIT_PMU]		= "pmu",
+	[MC_INTR_UNIT_PRIV_RING]	= "priv_ring",
+	[MC_INTR_UNIT_LTC]		= "ltc",
+	[MC_INTR_UNIT_PBUS]		= "pbus",
+};
+
+static void mc_gk20a_intr_stats_print(struct seq_file *s, const char *type,
+		struct gk20a_mc_intr_unit_stats *stats)
+{
+	int unit, i;
+
+	for (unit = 0; unit < MC_INTR_UNIT_MAX; unit++) {
+		struct gk20a_mc_intr_unit_stats *st = &stats[unit];
+		u64 count = atomic64_read(&st->count);
+
+		if (!count)
+			continue;
+
+		seq_printf(s, "%-8s %-10s count %-10llu avg(ns) %-8llu max(ns) %-8llu hist(us)",
+			   type, mc_gk20a_intr_unit_names[unit], count,
+			   div64_u64(atomic64_read(&st->total_ns), count),
+			   (u64)atomic64_read(&st->max_ns));
+		for (i = 0; i < MC_INTR_LAT_BUCKETS; i++)
+			seq_printf(s, " %d", atomic_read(&st->lat_hist[i]));
+		seq_puts(s, "\n");
+	}
+}
+
+static int mc_gk20a_intr_stats_show(struct seq_file *s, void *unused)
+{
+	struct gk20a *g = s->private;
+
+	seq_puts(s, "histogram buckets: <1us <2us <4us ... >=1024us\n");
+	mc_gk20a_intr_stats_print(s, "stall", g->mc_intr_stats.stall);
+	mc_gk20a_intr_stats_print(s, "nonstall", g->mc_intr_stats.nonstall);
+
+	return 0;
+}
+
+static int mc_gk20a_intr_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mc_gk20a_intr_stats_show, inode->i_private);
+}
+
+static void mc_gk20a_intr_stats_reset(struct gk20a_mc_intr_unit_stats *stats)
+{
+	int unit, i;
+
+	for (unit = 0; unit < MC_INTR_UNIT_MAX; unit++) {
+		struct gk20a_mc_intr_unit_stats *st = &stats[unit];
+
+		atomic64_set(&st->count, 0);
+		atomic64_set(&st->total_ns, 0);
+		atomic64_set(&st->max_ns, 0);
+		for (i = 0; i < MC_INTR_LAT_BUCKETS; i++)
+			atomic_set(&st->lat_hist[i], 0);
+	}
+}
+
+static ssize_t mc_gk20a_intr_stats_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct gk20a *g = s->private;
+
+	/* any write clears the counters */
+	mc_gk20a_intr_stats_reset(g->mc_intr_stats.stall);
+	mc_gk20a_intr_stats_reset(g->mc_intr_stats.nonstall);
+
+	return count;
+}
+
+static const struct file_operations mc_gk20a_intr_stats_fops = {
+	.open		= mc_gk20a_intr_stats_open,
+	.read		= seq_read,
+	.write		= mc_gk20a_intr_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void gk20a_mc_debugfs_init(struct device *dev)
+{
+	struct gk20a_platform *platform = dev_get_drvdata(dev);
+	struct gk20a *g = get_gk20a(dev);
+
+	debugfs_create_file("intr_stats", S_IRUGO|S_IWUSR, platform->debugfs,
+			    g, &mc_gk20a_intr_stats_fops);
+}
+#endif
+
 void gk20a_init_mc(struct gpu_ops *gops)
 {
 	gops->mc.intr_enable = mc_gk20a_intr_enable;
@@ -14,6 +14,35 @@
 #ifndef MC_GK20A_H
 #define MC_GK20A_H
 struct gk20a;
+struct gpu_ops;
+struct device;
+
+enum gk20a_mc_intr_unit {
+	MC_INTR_UNIT_GR = 0,
+	MC_INTR_UNIT_CE,
+	MC_INTR_UNIT_FIFO,
+	MC_INTR_UNIT_PMU,
+	MC_INTR_UNIT_PRIV_RING,
+	MC_INTR_UNIT_LTC,
+	MC_INTR_UNIT_PBUS,
+	MC_INTR_UNIT_MAX,
+};
+
+/* bucket n counts handlers that ran for less than 2^n us */
+#define MC_INTR_LAT_BUCKETS	12
+
+/* atomic, as debugfs clears them while the ISR threads update them */
+struct gk20a_mc_intr_unit_stats {
+	atomic64_t count;
+	atomic64_t total_ns;
+	atomic64_t max_ns;
+	atomic_t lat_hist[MC_INTR_LAT_BUCKETS];
+};
+
+struct gk20a_mc_intr_stats {
+	struct gk20a_mc_intr_unit_stats stall[MC_INTR_UNIT_MAX];
+	struct gk20a_mc_intr_unit_stats nonstall[MC_INTR_UNIT_MAX];
+};
 
 void gk20a_init_mc(struct gpu_ops *gops);
 void mc_gk20a_intr_enable(struct gk20a *g);
@@ -23,4 +52,7 @@ irqreturn_t mc_gk20a_isr_stall(struct gk20a *g);
 irqreturn_t mc_gk20a_isr_nonstall(struct gk20a *g);
 irqreturn_t mc_gk20a_intr_thread_stall(struct gk20a *g);
 irqreturn_t mc_gk20a_intr_thread_nonstall(struct gk20a *g);
+#ifdef CONFIG_DEBUG_FS
+void gk20a_mc_debugfs_init(struct device *dev);
+#endif
 #endif
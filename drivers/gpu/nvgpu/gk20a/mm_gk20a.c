@@ -17,16 +17,21 @@
  */
 
 #include <linux/delay.h>
+#include <linux/debugfs.h>
 #include <linux/highmem.h>
+#include <linux/ktime.h>
 #include <linux/log2.h>
 #include <linux/nvhost.h>
 #include <linux/pm_runtime.h>
+#include <linux/random.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/nvmap.h>
 #include <linux/tegra-soc.h>
 #include <linux/vmalloc.h>
 #include <linux/dma-buf.h>
 #include <linux/lcm.h>
+#include <linux/sort.h>
 #include <linux/fdtable.h>
 #include <uapi/linux/nvgpu.h>
 #include <trace/events/gk20a.h>
@@ -57,6 +62,13 @@
  */
 #define GK20A_FORCE_PRAMIN_DEFAULT false
 
+/*
+ * Vidmem gk20a_mem_{rd,wr}_n_bulk() transfers of at least this many bytes go
+ * through a CE copy from a sysmem staging buffer instead of PRAMIN. 0 keeps
+ * everything on PRAMIN. Tunable in debugfs as "pramin_ce_threshold".
+ */
+#define GK20A_PRAMIN_CE_THRESHOLD_DEFAULT 0
+
 #if defined(CONFIG_GK20A_VIDMEM)
 static void gk20a_vidmem_clear_mem_worker(struct work_struct *work);
 #endif
@@ -148,6 +160,7 @@ static u32 gk20a_pramin_enter(struct gk20a *g, struct mem_desc *mem,
 		gk20a_writel(g, bus_bar0_window_r(), win);
 		gk20a_readl(g, bus_bar0_window_r());
 		g->mm.pramin_window = win;
+		g->mm.pramin_window_switches++;
 	}
 
 	return lo;
@@ -251,6 +264,180 @@ static inline void pramin_access_batch_set(struct gk20a *g, u32 start,
 	}
 }
 
+static int gk20a_mem_access_cmp(const void *a, const void *b)
+{
+	const struct gk20a_mem_access *x = a;
+	const struct gk20a_mem_access *y = b;
+
+	if (x->w < y->w)
+		return -1;
+	return x->w > y->w;
+}
+
+/*
+ * Like pramin_access_batched(), but for single words at arbitrary offsets.
+ * The ops must be sorted by offset; the window is entered once per run of
+ * ops that fall in the same chunk and the same 1 MB window, and only read
+ * back once at the end of the run.
+ */
+static void pramin_access_scattered(struct gk20a *g, struct mem_desc *mem,
+		struct gk20a_mem_access *ops, u32 n, bool write)
+{
+	struct gk20a_page_alloc *alloc;
+	struct page_alloc_chunk *chunk;
+	u64 chunk_start = 0, off, limit;
+	u32 byteoff, start_reg, i = 0;
+
+	alloc = get_vidmem_page_alloc(mem->sgt->sgl);
+	chunk = list_first_entry(&alloc->alloc_chunks,
+			struct page_alloc_chunk, list_entry);
+
+	while (i < n) {
+		off = (u64)ops[i].w * sizeof(u32);
+
+		while (off >= chunk_start + chunk->length) {
+			chunk_start += chunk->length;
+			chunk = list_next_entry(chunk, list_entry);
+		}
+
+		byteoff = gk20a_pramin_enter(g, mem, chunk,
+				(u32)((off - chunk_start) / sizeof(u32)));
+		start_reg = pram_data032_r(byteoff / sizeof(u32));
+		limit = min_t(u64, off + SZ_1M - (byteoff & (SZ_1M - 1)),
+				chunk_start + chunk->length);
+
+		do {
+			u32 r = start_reg +
+				(u32)((u64)ops[i].w * sizeof(u32) - off);
+
+			if (write)
+				writel_relaxed(ops[i].data, g->regs + r);
+			else
+				ops[i].data = gk20a_readl(g, r);
+			i++;
+		} while (i < n && (u64)ops[i].w * sizeof(u32) < limit);
+
+		/* read back to synchronize accesses */
+		gk20a_readl(g, start_reg);
+		gk20a_pramin_exit(g, mem, chunk);
+	}
+}
+
+/*
+ * Copy between vidmem and a sysmem staging buffer with the vidmem CE
+ * context. This sleeps, and is only worth it for transfers of at least
+ * pramin_ce_threshold bytes. Returns nonzero if the copy was not done, in
+ * which case the caller should fall back to PRAMIN.
+ */
+static int gk20a_mem_ce_copy(struct gk20a *g, struct mem_desc *mem,
+		u32 offset, void *buf, u32 size, bool write)
+{
+	struct mem_desc staging = {0};
+	struct gk20a_fence *gk20a_last_fence = NULL;
+	struct gk20a_page_alloc *alloc;
+	struct page_alloc_chunk *chunk;
+	u64 staging_addr, chunk_start = 0;
+	u32 done = 0;
+	int err = 0;
+
+	if (mem->aperture != APERTURE_VIDMEM ||
+	    g->mm.vidmem.ce_ctx_id == (u32)~0)
+		return -EINVAL;
+
+	err = gk20a_gmmu_alloc_sys(g, size, &staging);
+	if (err)
+		return err;
+
+	staging_addr = gk20a_mem_get_base_addr(g, &staging, 0);
+	if (write)
+		memcpy(staging.cpu_va, buf, size);
+
+	alloc = get_vidmem_page_alloc(mem->sgt->sgl);
+	list_for_each_entry(chunk, &alloc->alloc_chunks, list_entry) {
+		struct gk20a_fence *gk20a_fence_out = NULL;
+		u64 start, len;
+
+		if (done == size)
+			break;
+
+		if (offset + done >= chunk_start + chunk->length) {
+			chunk_start += chunk->length;
+			continue;
+		}
+
+		start = chunk->base + (offset + done - chunk_start);
+		len = min_t(u64, chunk_start + chunk->length - (offset + done),
+				size - done);
+
+		err = gk20a_ce_execute_ops(g->dev,
+			g->mm.vidmem.ce_ctx_id,
+			write ? staging_addr + done : start,
+			write ? start : staging_addr + done,
+			len,
+			0x00000000,
+			write ? (NVGPU_CE_SRC_LOCATION_NONCOHERENT_SYSMEM |
+				 NVGPU_CE_DST_LOCATION_LOCAL_FB) :
+				(NVGPU_CE_SRC_LOCATION_LOCAL_FB |
+				 NVGPU_CE_DST_LOCATION_NONCOHERENT_SYSMEM),
+			NVGPU_CE_PHYS_MODE_TRANSFER,
+			NULL,
+			0,
+			&gk20a_fence_out);
+		if (err) {
+			gk20a_err(g->dev,
+				"Failed gk20a_ce_execute_ops[%d]", err);
+			break;
+		}
+
+		if (gk20a_last_fence)
+			gk20a_fence_put(gk20a_last_fence);
+		gk20a_last_fence = gk20a_fence_out;
+
+		done += len;
+		chunk_start += chunk->length;
+	}
+
+	if (!err && done != size)
+		err = -EINVAL;
+
+	/* the staging buffer must not go away under queued copies */
+	if (gk20a_last_fence) {
+		unsigned long end_jiffies = jiffies +
+			msecs_to_jiffies(gk20a_get_gr_idle_timeout(g));
+		int wait_err;
+
+		do {
+			unsigned int timeout = jiffies_to_msecs(end_jiffies - jiffies);
+			wait_err = gk20a_fence_wait(gk20a_last_fence,
+					timeout);
+		} while ((wait_err == -ERESTARTSYS) &&
+			 time_before(jiffies, end_jiffies));
+
+		gk20a_fence_put(gk20a_last_fence);
+		if (wait_err) {
+			gk20a_err(g->dev,
+				"fence wait failed for CE execute ops");
+			if (!err)
+				err = wait_err;
+		}
+	}
+
+	if (!err && !write)
+		memcpy(buf, staging.cpu_va, size);
+
+	gk20a_gmmu_free(g, &staging);
+
+	return err;
+}
+
+static inline bool gk20a_mem_use_ce(struct gk20a *g, struct mem_desc *mem,
+		u32 size)
+{
+	return mem->aperture == APERTURE_VIDMEM &&
+		g->mm.pramin_ce_threshold &&
+		size >= g->mm.pramin_ce_threshold;
+}
+
 u32 gk20a_mem_rd32(struct gk20a *g, struct mem_desc *mem, u32 w)
 {
 	u32 data = 0;
@@ -368,6 +555,80 @@ void gk20a_mem_wr_n(struct gk20a *g, struct mem_desc *mem, u32 offset,
 	}
 }
 
+/*
+ * Bulk copies for callers that may sleep and are not on the CE submit path,
+ * such as context image and ucode loads. Large vidmem transfers go through
+ * the CE; anything else, or a failed CE copy, takes the PRAMIN path.
+ */
+void gk20a_mem_rd_n_bulk(struct gk20a *g, struct mem_desc *mem,
+		u32 offset, void *dest, u32 size)
+{
+	might_sleep();
+
+	if (gk20a_mem_use_ce(g, mem, size) &&
+	    !gk20a_mem_ce_copy(g, mem, offset, dest, size, false))
+		return;
+
+	gk20a_mem_rd_n(g, mem, offset, dest, size);
+}
+
+void gk20a_mem_wr_n_bulk(struct gk20a *g, struct mem_desc *mem, u32 offset,
+		void *src, u32 size)
+{
+	might_sleep();
+
+	if (gk20a_mem_use_ce(g, mem, size) &&
+	    !gk20a_mem_ce_copy(g, mem, offset, src, size, true))
+		return;
+
+	gk20a_mem_wr_n(g, mem, offset, src, size);
+}
+
+/*
+ * Scattered word accesses. The ops are sorted by offset in place, so a batch
+ * must not write the same word twice. For vidmem, this takes the PRAMIN lock
+ * and moves the window once per 1 MB range touched instead of once per word.
+ */
+void gk20a_mem_rd32_batch(struct gk20a *g, struct mem_desc *mem,
+		struct gk20a_mem_access *ops, u32 n)
+{
+	u32 i;
+
+	if (mem->aperture == APERTURE_SYSMEM && !g->mm.force_pramin) {
+		u32 *ptr = mem->cpu_va;
+
+		WARN_ON(!ptr);
+		for (i = 0; i < n; i++)
+			ops[i].data = ptr[ops[i].w];
+	} else if (mem->aperture == APERTURE_VIDMEM || g->mm.force_pramin) {
+		sort(ops, n, sizeof(*ops), gk20a_mem_access_cmp, NULL);
+		pramin_access_scattered(g, mem, ops, n, false);
+	} else {
+		WARN_ON("Accessing unallocated mem_desc");
+	}
+}
+
+void gk20a_mem_wr32_batch(struct gk20a *g, struct mem_desc *mem,
+		struct gk20a_mem_access *ops, u32 n)
+{
+	u32 i;
+
+	if (mem->aperture == APERTURE_SYSMEM && !g->mm.force_pramin) {
+		u32 *ptr = mem->cpu_va;
+
+		WARN_ON(!ptr);
+		for (i = 0; i < n; i++)
+			ptr[ops[i].w] = ops[i].data;
+	} else if (mem->aperture == APERTURE_VIDMEM || g->mm.force_pramin) {
+		sort(ops, n, sizeof(*ops), gk20a_mem_access_cmp, NULL);
+		pramin_access_scattered(g, mem, ops, n, true);
+		if (!mem->skip_wmb)
+			wmb();
+	} else {
+		WARN_ON("Accessing unallocated mem_desc");
+	}
+}
+
 void gk20a_memset(struct gk20a *g, struct mem_desc *mem, u32 offset,
 		u32 c, u32 size)
 {
@@ -472,6 +733,8 @@ struct gk20a_dmabuf_priv {
 
 	struct gk20a_comptag_allocator *comptag_allocator;
 	struct gk20a_comptags comptags;
+	/* reserved at alloc time so that freeing the comptags cannot fail */
+	struct gk20a_comptag_extent *comptag_extent;
 
 	struct dma_buf_attachment *attach;
 	struct sg_table *sgt;
@@ -493,39 +756,215 @@ struct gk20a_vidmem_buf {
 
 static void gk20a_vm_remove_support_nofree(struct vm_gk20a *vm);
 
+static void gk20a_comptag_insert_addr(struct gk20a_comptag_allocator *allocator,
+		struct gk20a_comptag_extent *e)
+{
+	struct rb_node **new = &allocator->free_by_addr.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*new) {
+		struct gk20a_comptag_extent *cur = rb_entry(*new,
+				struct gk20a_comptag_extent, addr_node);
+
+		parent = *new;
+		if (e->start < cur->start)
+			new = &parent->rb_left;
+		else
+			new = &parent->rb_right;
+	}
+
+	rb_link_node(&e->addr_node, parent, new);
+	rb_insert_color(&e->addr_node, &allocator->free_by_addr);
+}
+
+static void gk20a_comptag_insert_size(struct gk20a_comptag_allocator *allocator,
+		struct gk20a_comptag_extent *e)
+{
+	struct rb_node **new = &allocator->free_by_size.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*new) {
+		struct gk20a_comptag_extent *cur = rb_entry(*new,
+				struct gk20a_comptag_extent, size_node);
+
+		parent = *new;
+		if (e->len < cur->len ||
+		    (e->len == cur->len && e->start < cur->start))
+			new = &parent->rb_left;
+		else
+			new = &parent->rb_right;
+	}
+
+	rb_link_node(&e->size_node, parent, new);
+	rb_insert_color(&e->size_node, &allocator->free_by_size);
+}
+
+/*
+ * Takes len lines whose first line is a multiple of align. The smallest free
+ * extent that fits is used, and the slack around the allocation stays free,
+ * so no alloc-then-trim is needed to align. *reserve gets an extent to hand
+ * back to gk20a_comptaglines_free() along with the lines.
+ */
 static int gk20a_comptaglines_alloc(struct gk20a_comptag_allocator *allocator,
-		u32 *offset, u32 len)
+		u32 *offset, u32 len, u32 align,
+		struct gk20a_comptag_extent **reserve)
 {
-	unsigned long addr;
+	struct gk20a_comptag_extent *e = NULL, *spare, *free_e;
+	struct rb_node *node;
+	u32 start = 0, lead, tail;
+	u64 steps = 0;
 	int err = 0;
 
+	if (!len || !align)
+		return -EINVAL;
+
+	/* the extent may split in two; do not fail after carving it */
+	spare = kzalloc(sizeof(*spare), GFP_KERNEL);
+	free_e = kzalloc(sizeof(*free_e), GFP_KERNEL);
+	if (!spare || !free_e) {
+		kfree(spare);
+		kfree(free_e);
+		return -ENOMEM;
+	}
+
 	mutex_lock(&allocator->lock);
-	addr = bitmap_find_next_zero_area(allocator->bitmap, allocator->size,
-			0, len, 0);
-	if (addr < allocator->size) {
-		/* number zero is reserved; bitmap base is 1 */
-		*offset = 1 + addr;
-		bitmap_set(allocator->bitmap, addr, len);
-	} else {
+
+	/* leftmost extent of at least len lines */
+	node = allocator->free_by_size.rb_node;
+	while (node) {
+		struct gk20a_comptag_extent *cur = rb_entry(node,
+				struct gk20a_comptag_extent, size_node);
+
+		if (cur->len >= len) {
+			e = cur;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	/* then the first, i.e. smallest, one that fits once aligned */
+	for (node = e ? &e->size_node : NULL; node; node = rb_next(node)) {
+		e = rb_entry(node, struct gk20a_comptag_extent, size_node);
+		start = roundup(e->start, align);
+		steps++;
+		if (start >= e->start && start - e->start <= e->len - len)
+			break;
+	}
+
+	allocator->stats.search_steps += steps;
+	if (steps > allocator->stats.max_search_steps)
+		allocator->stats.max_search_steps = steps;
+
+	if (!node) {
+		allocator->stats.failures++;
+		if (allocator->stats.free_lines >= len)
+			allocator->stats.frag_failures++;
 		err = -ENOMEM;
+		goto out;
 	}
+
+	lead = start - e->start;
+	tail = e->len - lead - len;
+
+	rb_erase(&e->size_node, &allocator->free_by_size);
+	if (lead) {
+		e->len = lead;
+		gk20a_comptag_insert_size(allocator, e);
+		if (tail) {
+			spare->start = start + len;
+			spare->len = tail;
+			gk20a_comptag_insert_addr(allocator, spare);
+			gk20a_comptag_insert_size(allocator, spare);
+			allocator->stats.free_extents++;
+			spare = NULL;
+		}
+	} else if (tail) {
+		/* the start moves forward but stays between its neighbours */
+		e->start = start + len;
+		e->len = tail;
+		gk20a_comptag_insert_size(allocator, e);
+	} else {
+		rb_erase(&e->addr_node, &allocator->free_by_addr);
+		allocator->stats.free_extents--;
+		kfree(e);
+	}
+
+	allocator->stats.free_lines -= len;
+	allocator->stats.allocs++;
+	*offset = start;
+	*reserve = free_e;
+	free_e = NULL;
+out:
 	mutex_unlock(&allocator->lock);
+	kfree(spare);
+	kfree(free_e);
 
 	return err;
 }
 
+/*
+ * Returns lines taken by gk20a_comptaglines_alloc(). @e is the extent it
+ * reserved, used if the lines do not merge with a neighbour and freed
+ * otherwise.
+ */
 static void gk20a_comptaglines_free(struct gk20a_comptag_allocator *allocator,
-		u32 offset, u32 len)
+		u32 offset, u32 len, struct gk20a_comptag_extent *e)
 {
-	/* number zero is reserved; bitmap base is 1 */
-	u32 addr = offset - 1;
+	struct gk20a_comptag_extent *prev = NULL, *next = NULL;
+	struct rb_node *node;
+
 	WARN_ON(offset == 0);
-	WARN_ON(addr > allocator->size);
-	WARN_ON(addr + len > allocator->size);
+	WARN_ON(offset - 1 + len > allocator->size);
 
 	mutex_lock(&allocator->lock);
-	bitmap_clear(allocator->bitmap, addr, len);
+
+	node = allocator->free_by_addr.rb_node;
+	while (node) {
+		struct gk20a_comptag_extent *cur = rb_entry(node,
+				struct gk20a_comptag_extent, addr_node);
+
+		if (cur->start < offset) {
+			prev = cur;
+			node = node->rb_right;
+		} else {
+			next = cur;
+			node = node->rb_left;
+		}
+	}
+
+	WARN_ON(prev && prev->start + prev->len > offset);
+	WARN_ON(next && next->start < offset + len);
+
+	if (prev && prev->start + prev->len == offset) {
+		rb_erase(&prev->size_node, &allocator->free_by_size);
+		prev->len += len;
+		if (next && next->start == offset + len) {
+			rb_erase(&next->size_node, &allocator->free_by_size);
+			rb_erase(&next->addr_node, &allocator->free_by_addr);
+			prev->len += next->len;
+			allocator->stats.free_extents--;
+			kfree(next);
+		}
+		gk20a_comptag_insert_size(allocator, prev);
+	} else if (next && next->start == offset + len) {
+		rb_erase(&next->size_node, &allocator->free_by_size);
+		next->start = offset;
+		next->len += len;
+		gk20a_comptag_insert_size(allocator, next);
+	} else {
+		e->start = offset;
+		e->len = len;
+		gk20a_comptag_insert_addr(allocator, e);
+		gk20a_comptag_insert_size(allocator, e);
+		allocator->stats.free_extents++;
+		e = NULL;
+	}
+
+	allocator->stats.free_lines += len;
+	allocator->stats.frees++;
 	mutex_unlock(&allocator->lock);
+	kfree(e);
 }
 
 static void gk20a_mm_delete_priv(void *_priv)
@@ -539,7 +978,8 @@ static void gk20a_mm_delete_priv(void *_priv)
 		BUG_ON(!priv->comptag_allocator);
 		gk20a_comptaglines_free(priv->comptag_allocator,
 				priv->comptags.offset,
-				priv->comptags.allocated_lines);
+				priv->comptags.allocated_lines,
+				priv->comptag_extent);
 	}
 
 	/* Free buffer states */
@@ -621,6 +1061,123 @@ void gk20a_get_comptags(struct device *dev, struct dma_buf *dmabuf,
 	*comptags = priv->comptags;
 }
 
+static void gk20a_set_comptags_clear_ticket(struct device *dev,
+					    struct dma_buf *dmabuf, u64 ticket)
+{
+	struct gk20a_dmabuf_priv *priv = dma_buf_get_drvdata(dmabuf, dev);
+
+	if (!priv)
+		return;
+
+	mutex_lock(&priv->lock);
+	priv->comptags.clear_ticket = ticket;
+	mutex_unlock(&priv->lock);
+}
+
+/*
+ * Queues a clear of comptag lines min..max (inclusive). Returns the ticket to
+ * pass to gk20a_ctag_clear_wait() before the GPU may use those lines.
+ */
+u64 gk20a_ctag_clear_queue(struct gk20a *g, u32 min, u32 max)
+{
+	struct mm_gk20a *mm = &g->mm;
+	u32 clear_min = min, clear_max = max;
+	u64 ticket;
+	int i;
+
+	mutex_lock(&mm->ctag_clear.lock);
+	while (1) {
+		/* fold in every range that overlaps or touches this one */
+		for (i = 0; i < mm->ctag_clear.num_ranges; i++) {
+			u32 r_min = mm->ctag_clear.ranges[i].min;
+			u32 r_max = mm->ctag_clear.ranges[i].max;
+
+			if (r_min > clear_max + 1 || clear_min > r_max + 1)
+				continue;
+
+			clear_min = min(clear_min, r_min);
+			clear_max = max(clear_max, r_max);
+			mm->ctag_clear.ranges[i] = mm->ctag_clear.ranges[
+				--mm->ctag_clear.num_ranges];
+			i = -1;
+		}
+
+		if (mm->ctag_clear.num_ranges < GK20A_CTAG_CLEAR_RANGES)
+			break;
+
+		/* full of disjoint ranges; let the worker drain them */
+		mutex_unlock(&mm->ctag_clear.lock);
+		flush_work(&mm->ctag_clear.worker);
+		mutex_lock(&mm->ctag_clear.lock);
+	}
+
+	/* the worker drops this when it takes the ranges */
+	if (!mm->ctag_clear.num_ranges)
+		gk20a_busy_noresume(g->dev);
+
+	i = mm->ctag_clear.num_ranges++;
+	mm->ctag_clear.ranges[i].min = clear_min;
+	mm->ctag_clear.ranges[i].max = clear_max;
+	ticket = ++mm->ctag_clear.queued;
+	mutex_unlock(&mm->ctag_clear.lock);
+
+	schedule_work(&mm->ctag_clear.worker);
+
+	trace_gk20a_ltc_cbc_clear_queue(dev_name(g->dev), min, max,
+					clear_min, clear_max, ticket);
+
+	return ticket;
+}
+
+static void gk20a_ctag_clear_worker(struct work_struct *work)
+{
+	struct mm_gk20a *mm = container_of(work, struct mm_gk20a,
+					   ctag_clear.worker);
+	struct gk20a *g = mm->g;
+	struct {
+		u32 min;
+		u32 max;
+	} ranges[GK20A_CTAG_CLEAR_RANGES];
+	int num_ranges, i;
+	u64 ticket;
+
+	mutex_lock(&mm->ctag_clear.lock);
+	num_ranges = mm->ctag_clear.num_ranges;
+	memcpy(ranges, mm->ctag_clear.ranges,
+	       num_ranges * sizeof(ranges[0]));
+	mm->ctag_clear.num_ranges = 0;
+	ticket = mm->ctag_clear.queued;
+	mutex_unlock(&mm->ctag_clear.lock);
+
+	if (!num_ranges)
+		return;
+
+	for (i = 0; i < num_ranges; i++)
+		g->ops.ltc.cbc_ctrl(g, gk20a_cbc_op_clear,
+				    ranges[i].min, ranges[i].max);
+
+	atomic64_set(&mm->ctag_clear.done, ticket);
+	wake_up_all(&mm->ctag_clear.wq);
+
+	gk20a_idle(g->dev);
+}
+
+void gk20a_ctag_clear_wait(struct gk20a *g, u64 ticket)
+{
+	struct mm_gk20a *mm = &g->mm;
+	ktime_t start;
+
+	if (atomic64_read(&mm->ctag_clear.done) >= ticket)
+		return;
+
+	start = ktime_get();
+	wait_event(mm->ctag_clear.wq,
+		   atomic64_read(&mm->ctag_clear.done) >= ticket);
+
+	trace_gk20a_ltc_cbc_clear_wait(dev_name(g->dev), ticket,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
 static int gk20a_alloc_comptags(struct gk20a *g,
 				struct device *dev,
 				struct dma_buf *dmabuf,
@@ -633,7 +1190,6 @@ static int gk20a_alloc_comptags(struct gk20a *g,
 	u32 ctaglines_allocsize;
 	u32 ctagline_align;
 	u32 offset;
-	u32 alignment_lines;
 	const u32 aggregate_cacheline_sz =
 		g->gr.cacheline_size * g->gr.slices_per_ltc *
 		g->ltc_count;
@@ -652,31 +1208,26 @@ static int gk20a_alloc_comptags(struct gk20a *g,
 	} else {
 		/*
 		 * For security, align the allocation on a page, and reserve
-		 * whole pages. Unfortunately, we cannot ask the allocator to
-		 * align here, since compbits per cacheline is not always a
-		 * power of two. So, we just have to allocate enough extra that
-		 * we're guaranteed to find a ctagline inside the allocation so
-		 * that: 1) it is the first ctagline in a cacheline that starts
-		 * at a page boundary, and 2) we can add enough overallocation
-		 * that the ctaglines of the succeeding allocation are on
-		 * different page than ours.
+		 * whole pages, so that the ctaglines of the succeeding
+		 * allocation are on a different page than ours. Compbits per
+		 * cacheline is not always a power of two, so the alignment is
+		 * the first ctagline of a cacheline that starts at a page
+		 * boundary; the allocator places it natively.
 		 */
+		u32 needed_cachelines =
+			DIV_ROUND_UP(lines, g->gr.comptags_per_cacheline);
+		u32 needed_bytes = round_up(needed_cachelines *
+					    aggregate_cacheline_sz,
+					    small_pgsz);
+		u32 first_unneeded_cacheline =
+			DIV_ROUND_UP(needed_bytes, aggregate_cacheline_sz);
 
 		ctagline_align =
 			(lcm(aggregate_cacheline_sz, small_pgsz) /
 			 aggregate_cacheline_sz) *
 			g->gr.comptags_per_cacheline;
 
-		ctaglines_allocsize =
-			/* for alignment */
-			ctagline_align +
-
-			/* lines rounded up to cachelines */
-			DIV_ROUND_UP(lines, g->gr.comptags_per_cacheline) *
-			g->gr.comptags_per_cacheline +
-
-			/* trail-padding */
-			DIV_ROUND_UP(aggregate_cacheline_sz, small_pgsz) *
+		ctaglines_allocsize = first_unneeded_cacheline *
 			g->gr.comptags_per_cacheline;
 
 		if (ctaglines_allocsize < lines)
@@ -686,45 +1237,14 @@ static int gk20a_alloc_comptags(struct gk20a *g,
 	/* store the allocator so we can use it when we free the ctags */
 	priv->comptag_allocator = allocator;
 	err = gk20a_comptaglines_alloc(allocator, &offset,
-			       ctaglines_allocsize);
+			       ctaglines_allocsize, ctagline_align,
+			       &priv->comptag_extent);
 	if (err)
 		return err;
 
-	/*
-	 * offset needs to be at the start of a page/cacheline boundary;
-	 * prune the preceding ctaglines that were allocated for alignment.
-	 */
-	alignment_lines =
-		DIV_ROUND_UP(offset, ctagline_align) * ctagline_align - offset;
-	if (alignment_lines) {
-		gk20a_comptaglines_free(allocator, offset, alignment_lines);
-		offset += alignment_lines;
-		ctaglines_allocsize -= alignment_lines;
-	}
-
-	/*
-	 * check if we can prune the trailing, too; we just need to reserve
-	 * whole pages and ctagcachelines.
-	 */
 	if (user_mappable) {
-		u32 needed_cachelines =
-			DIV_ROUND_UP(lines, g->gr.comptags_per_cacheline);
-		u32 needed_bytes = round_up(needed_cachelines *
-					    aggregate_cacheline_sz,
-					    small_pgsz);
-		u32 first_unneeded_cacheline =
-			DIV_ROUND_UP(needed_bytes, aggregate_cacheline_sz);
-		u32 needed_ctaglines = first_unneeded_cacheline *
-			g->gr.comptags_per_cacheline;
 		u64 win_size;
 
-		if (needed_ctaglines < ctaglines_allocsize) {
-			gk20a_comptaglines_free(allocator,
-				offset + needed_ctaglines,
-				ctaglines_allocsize - needed_ctaglines);
-			ctaglines_allocsize = needed_ctaglines;
-		}
-
 		*ctag_map_win_ctagline = offset;
 		win_size =
 			DIV_ROUND_UP(lines, g->gr.comptags_per_cacheline) *
@@ -806,6 +1326,9 @@ static void gk20a_remove_mm_support(struct mm_gk20a *mm)
 {
 	struct gk20a *g = gk20a_from_mm(mm);
 
+	/* queued comptag clears still use the CBC and the GPU */
+	flush_work(&mm->ctag_clear.worker);
+
 	if (g->ops.mm.remove_bar2_vm)
 		g->ops.mm.remove_bar2_vm(g);
 
@@ -829,6 +1352,8 @@ static void gk20a_init_pramin(struct mm_gk20a *mm)
 	mm->pramin_window = 0;
 	spin_lock_init(&mm->pramin_window_lock);
 	mm->force_pramin = GK20A_FORCE_PRAMIN_DEFAULT;
+	mm->pramin_ce_threshold = GK20A_PRAMIN_CE_THRESHOLD_DEFAULT;
+	mm->pramin_window_switches = 0;
 }
 
 #if defined(CONFIG_GK20A_VIDMEM)
@@ -981,6 +1506,12 @@ int gk20a_init_mm_setup_sw(struct gk20a *g)
 
 	mm->g = g;
 	mutex_init(&mm->l2_op_lock);
+	mutex_init(&mm->tlb_lock);
+
+	mutex_init(&mm->ctag_clear.lock);
+	INIT_WORK(&mm->ctag_clear.worker, gk20a_ctag_clear_worker);
+	init_waitqueue_head(&mm->ctag_clear.wq);
+	atomic64_set(&mm->ctag_clear.done, 0);
 
 	/*TBD: make channel vm size configurable */
 	mm->channel.user_size = NV_MM_DEFAULT_USER_SIZE;
@@ -1450,57 +1981,42 @@ static struct vm_reserved_va_node *addr_to_reservation(struct vm_gk20a *vm,
 	return NULL;
 }
 
-int gk20a_vm_get_buffers(struct vm_gk20a *vm,
-			 struct mapped_buffer_node ***mapped_buffers,
-			 int *num_buffers)
+static void gk20a_vm_unmap_locked_kref(struct kref *ref)
 {
-	struct mapped_buffer_node *mapped_buffer;
-	struct mapped_buffer_node **buffer_list;
-	struct rb_node *node;
-	int i = 0;
-
-	if (vm->userspace_managed) {
-		*mapped_buffers = NULL;
-		*num_buffers = 0;
-		return 0;
-	}
-
-	mutex_lock(&vm->update_gmmu_lock);
-
-	buffer_list = nvgpu_alloc(sizeof(*buffer_list) *
-			      vm->num_user_mapped_buffers, true);
-	if (!buffer_list) {
-		mutex_unlock(&vm->update_gmmu_lock);
-		return -ENOMEM;
-	}
-
-	node = rb_first(&vm->mapped_buffers);
-	while (node) {
-		mapped_buffer =
-			container_of(node, struct mapped_buffer_node, node);
-		if (mapped_buffer->user_mapped) {
-			buffer_list[i] = mapped_buffer;
-			kref_get(&mapped_buffer->ref);
-			i++;
-		}
-		node = rb_next(&mapped_buffer->node);
-	}
-
-	BUG_ON(i != vm->num_user_mapped_buffers);
+	struct mapped_buffer_node *mapped_buffer =
+		container_of(ref, struct mapped_buffer_node, ref);
+	gk20a_vm_unmap_locked(mapped_buffer, mapped_buffer->vm->kref_put_batch);
+}
 
-	*num_buffers = vm->num_user_mapped_buffers;
-	*mapped_buffers = buffer_list;
+void gk20a_vm_tlb_stats_requested(struct vm_gk20a *vm)
+{
+	atomic64_inc(&gk20a_from_vm(vm)->mm.tlb_stats.requests);
+}
 
-	mutex_unlock(&vm->update_gmmu_lock);
+void gk20a_vm_tlb_stats_issued(struct vm_gk20a *vm)
+{
+	atomic64_inc(&gk20a_from_vm(vm)->mm.tlb_stats.issued);
+}
 
-	return 0;
+static void gk20a_vm_tlb_invalidate(struct vm_gk20a *vm)
+{
+	gk20a_vm_tlb_stats_issued(vm);
+	gk20a_from_vm(vm)->ops.mm.tlb_invalidate(vm);
 }
 
-static void gk20a_vm_unmap_locked_kref(struct kref *ref)
+/*
+ * Invalidates now, or at batch finish for batched updates. Every update
+ * within a batch shares the one invalidate issued when it finishes.
+ */
+static void gk20a_vm_request_tlb_invalidate(struct vm_gk20a *vm,
+		struct vm_gk20a_mapping_batch *batch)
 {
-	struct mapped_buffer_node *mapped_buffer =
-		container_of(ref, struct mapped_buffer_node, ref);
-	gk20a_vm_unmap_locked(mapped_buffer, mapped_buffer->vm->kref_put_batch);
+	gk20a_vm_tlb_stats_requested(vm);
+
+	if (!batch)
+		gk20a_vm_tlb_invalidate(vm);
+	else
+		batch->need_tlb_invalidate = true;
 }
 
 void gk20a_vm_mapping_batch_start(struct vm_gk20a_mapping_batch *mapping_batch)
@@ -1508,6 +2024,7 @@ void gk20a_vm_mapping_batch_start(struct vm_gk20a_mapping_batch *mapping_batch)
 	memset(mapping_batch, 0, sizeof(*mapping_batch));
 	mapping_batch->gpu_l2_flushed = false;
 	mapping_batch->need_tlb_invalidate = false;
+	mapping_batch->first_err_index = ~0;
 }
 
 void gk20a_vm_mapping_batch_finish_locked(
@@ -1516,10 +2033,12 @@ void gk20a_vm_mapping_batch_finish_locked(
 	 /* hanging kref_put batch pointer? */
 	WARN_ON(vm->kref_put_batch == mapping_batch);
 
-	if (mapping_batch->need_tlb_invalidate) {
-		struct gk20a *g = gk20a_from_vm(vm);
-		g->ops.mm.tlb_invalidate(vm);
-	}
+	if (gk20a_from_vm(vm)->ops.mm.mapping_batch_flush)
+		gk20a_from_vm(vm)->ops.mm.mapping_batch_flush(vm,
+							      mapping_batch);
+
+	if (mapping_batch->need_tlb_invalidate)
+		gk20a_vm_tlb_invalidate(vm);
 }
 
 void gk20a_vm_mapping_batch_finish(struct vm_gk20a *vm,
@@ -1530,29 +2049,121 @@ void gk20a_vm_mapping_batch_finish(struct vm_gk20a *vm,
 	mutex_unlock(&vm->update_gmmu_lock);
 }
 
-void gk20a_vm_put_buffers(struct vm_gk20a *vm,
-				 struct mapped_buffer_node **mapped_buffers,
-				 int num_buffers)
+/* NOTE! update_gmmu_lock must be held */
+static void gk20a_vm_buffer_set_free_locked(struct gk20a_vm_buffer_set *set)
 {
 	int i;
-	struct vm_gk20a_mapping_batch batch;
 
-	if (num_buffers == 0)
-		return;
+	for (i = 0; i < set->num_buffers; ++i)
+		kref_put(&set->buffers[i]->ref, gk20a_vm_unmap_locked_kref);
+
+	nvgpu_free(set);
+}
+
+static void gk20a_vm_buffer_set_release_locked(struct kref *ref)
+{
+	gk20a_vm_buffer_set_free_locked(
+		container_of(ref, struct gk20a_vm_buffer_set, ref));
+}
+
+/* called by kref_put_mutex() with update_gmmu_lock taken; drops it */
+static void gk20a_vm_buffer_set_release(struct kref *ref)
+{
+	struct gk20a_vm_buffer_set *set =
+		container_of(ref, struct gk20a_vm_buffer_set, ref);
+	struct vm_gk20a *vm = set->vm;
+	struct vm_gk20a_mapping_batch batch;
 
-	mutex_lock(&vm->update_gmmu_lock);
 	gk20a_vm_mapping_batch_start(&batch);
 	vm->kref_put_batch = &batch;
 
-	for (i = 0; i < num_buffers; ++i)
-		kref_put(&mapped_buffers[i]->ref,
-			 gk20a_vm_unmap_locked_kref);
+	gk20a_vm_buffer_set_free_locked(set);
 
 	vm->kref_put_batch = NULL;
 	gk20a_vm_mapping_batch_finish_locked(vm, &batch);
 	mutex_unlock(&vm->update_gmmu_lock);
+}
 
-	nvgpu_free(mapped_buffers);
+void gk20a_vm_invalidate_buffer_set_locked(struct vm_gk20a *vm)
+{
+	struct gk20a_vm_buffer_set *set = vm->buffer_set;
+
+	vm->buffer_set_gen++;
+	if (!set)
+		return;
+
+	/* clear first: releasing the set may unmap buffers and recurse */
+	vm->buffer_set = NULL;
+	kref_put(&set->ref, gk20a_vm_buffer_set_release_locked);
+}
+
+int gk20a_vm_get_buffer_set(struct vm_gk20a *vm,
+			    struct gk20a_vm_buffer_set **buffer_set)
+{
+	struct mapped_buffer_node *mapped_buffer;
+	struct gk20a_vm_buffer_set *set;
+	struct rb_node *node;
+	bool rebuilt = false;
+	int i = 0;
+
+	if (vm->userspace_managed) {
+		*buffer_set = NULL;
+		return 0;
+	}
+
+	mutex_lock(&vm->update_gmmu_lock);
+
+	set = vm->buffer_set;
+	if (!set) {
+		set = nvgpu_alloc(sizeof(*set) + sizeof(set->buffers[0]) *
+				  vm->num_user_mapped_buffers, true);
+		if (!set) {
+			mutex_unlock(&vm->update_gmmu_lock);
+			return -ENOMEM;
+		}
+
+		node = rb_first(&vm->mapped_buffers);
+		while (node) {
+			mapped_buffer = container_of(node,
+					struct mapped_buffer_node, node);
+			if (mapped_buffer->user_mapped) {
+				set->buffers[i] = mapped_buffer;
+				kref_get(&mapped_buffer->ref);
+				i++;
+			}
+			node = rb_next(&mapped_buffer->node);
+		}
+
+		BUG_ON(i != vm->num_user_mapped_buffers);
+
+		/* this initial reference belongs to vm->buffer_set */
+		kref_init(&set->ref);
+		set->vm = vm;
+		set->gen = vm->buffer_set_gen;
+		set->num_buffers = i;
+		vm->buffer_set = set;
+		rebuilt = true;
+	}
+
+	kref_get(&set->ref);
+
+	trace_gk20a_vm_get_buffer_set(vm_aspace_id(vm), set->gen,
+				      set->num_buffers, rebuilt);
+
+	mutex_unlock(&vm->update_gmmu_lock);
+
+	*buffer_set = set;
+	return 0;
+}
+
+void gk20a_vm_put_buffer_set(struct vm_gk20a *vm,
+			     struct gk20a_vm_buffer_set *buffer_set)
+{
+	if (!buffer_set)
+		return;
+
+	kref_put_mutex(&buffer_set->ref, gk20a_vm_buffer_set_release,
+		       &vm->update_gmmu_lock);
 }
 
 static void gk20a_vm_unmap_user(struct vm_gk20a *vm, u64 offset,
@@ -1571,12 +2182,25 @@ static void gk20a_vm_unmap_user(struct vm_gk20a *vm, u64 offset,
 		return;
 	}
 
+	/* the cached snapshot holds a ref, drop it before waiting below */
+	vm->kref_put_batch = batch;
+	gk20a_vm_invalidate_buffer_set_locked(vm);
+	vm->kref_put_batch = NULL;
+
 	if (mapped_buffer->flags & NVGPU_AS_MAP_BUFFER_FLAGS_FIXED_OFFSET) {
 		mutex_unlock(&vm->update_gmmu_lock);
 
 		while (retries >= 0 || !tegra_platform_is_silicon()) {
 			if (atomic_read(&mapped_buffer->ref.refcount) == 1)
 				break;
+			/* a submit meanwhile may have cached a new snapshot */
+			if (ACCESS_ONCE(vm->buffer_set)) {
+				mutex_lock(&vm->update_gmmu_lock);
+				vm->kref_put_batch = batch;
+				gk20a_vm_invalidate_buffer_set_locked(vm);
+				vm->kref_put_batch = NULL;
+				mutex_unlock(&vm->update_gmmu_lock);
+			}
 			retries--;
 			udelay(5);
 		}
@@ -1592,11 +2216,15 @@ static void gk20a_vm_unmap_user(struct vm_gk20a *vm, u64 offset,
 		return;
 	}
 
+	vm->kref_put_batch = batch;
+
 	mapped_buffer->user_mapped--;
-	if (mapped_buffer->user_mapped == 0)
+	if (mapped_buffer->user_mapped == 0) {
 		vm->num_user_mapped_buffers--;
+		/* a snapshot cached since the one dropped above still has it */
+		gk20a_vm_invalidate_buffer_set_locked(vm);
+	}
 
-	vm->kref_put_batch = batch;
 	kref_put(&mapped_buffer->ref, gk20a_vm_unmap_locked_kref);
 	vm->kref_put_batch = NULL;
 
@@ -1950,10 +2578,7 @@ u64 gk20a_locked_gmmu_map(struct vm_gk20a *vm,
 		goto fail_validate;
 	}
 
-	if (!batch)
-		g->ops.mm.tlb_invalidate(vm);
-	else
-		batch->need_tlb_invalidate = true;
+	gk20a_vm_request_tlb_invalidate(vm, batch);
 
 	return map_offset;
 fail_validate:
@@ -2010,14 +2635,11 @@ void gk20a_locked_gmmu_unmap(struct vm_gk20a *vm,
 
 	if (!batch) {
 		gk20a_mm_l2_flush(g, true);
-		g->ops.mm.tlb_invalidate(vm);
-	} else {
-		if (!batch->gpu_l2_flushed) {
-			gk20a_mm_l2_flush(g, true);
-			batch->gpu_l2_flushed = true;
-		}
-		batch->need_tlb_invalidate = true;
+	} else if (!batch->gpu_l2_flushed) {
+		gk20a_mm_l2_flush(g, true);
+		batch->gpu_l2_flushed = true;
 	}
+	gk20a_vm_request_tlb_invalidate(vm, batch);
 }
 
 static enum gk20a_aperture gk20a_dmabuf_aperture(struct gk20a *g,
@@ -2071,8 +2693,10 @@ static u64 gk20a_vm_map_duplicate_locked(struct vm_gk20a *vm,
 
 	/* mark the buffer as used */
 	if (user_mapped) {
-		if (mapped_buffer->user_mapped == 0)
+		if (mapped_buffer->user_mapped == 0) {
 			vm->num_user_mapped_buffers++;
+			gk20a_vm_invalidate_buffer_set_locked(vm);
+		}
 		mapped_buffer->user_mapped++;
 
 		/* If the mapping comes from user space, we own
@@ -2552,16 +3176,22 @@ u64 gk20a_vm_map(struct vm_gk20a *vm,
 		} else {
 			gk20a_get_comptags(d, dmabuf, &comptags);
 
-			if (g->ops.ltc.cbc_ctrl)
-				g->ops.ltc.cbc_ctrl(g, gk20a_cbc_op_clear,
-						    comptags.offset,
-						    comptags.offset +
-							comptags.allocated_lines - 1);
-			else
+			if (g->ops.ltc.cbc_ctrl) {
+				comptags.clear_ticket = gk20a_ctag_clear_queue(
+					g, comptags.offset,
+					comptags.offset +
+						comptags.allocated_lines - 1);
+				gk20a_set_comptags_clear_ticket(d, dmabuf,
+						comptags.clear_ticket);
+			} else
 				clear_ctags = true;
 		}
 	}
 
+	/* the next submit in this VM waits for the comptags to be cleared */
+	if (comptags.clear_ticket > atomic64_read(&vm->ctag_clear_ticket))
+		atomic64_set(&vm->ctag_clear_ticket, comptags.clear_ticket);
+
 	/* store the comptag info */
 	bfr.ctag_offset = comptags.offset;
 	bfr.ctag_lines = comptags.lines;
@@ -2644,8 +3274,10 @@ u64 gk20a_vm_map(struct vm_gk20a *vm,
 		goto clean_up;
 	}
 	inserted = true;
-	if (user_mapped)
+	if (user_mapped) {
 		vm->num_user_mapped_buffers++;
+		gk20a_vm_invalidate_buffer_set_locked(vm);
+	}
 
 	gk20a_dbg_info("allocated va @ 0x%llx", map_offset);
 
@@ -3049,61 +3681,181 @@ static void gk20a_gmmu_free_attr_sys(struct gk20a *g, enum dma_attr attr,
 }
 
 #if defined(CONFIG_GK20A_VIDMEM)
-static int gk20a_gmmu_clear_vidmem_mem(struct gk20a *g, struct mem_desc *mem)
+/*
+ * Freed vidmem is scrubbed in batches. The chunks of up to
+ * VIDMEM_CLEAR_BATCH_MEMS pending buffers are sorted and adjacent ranges are
+ * merged, so the CE sees a few large memsets instead of one per chunk. The
+ * CE channel executes in order, hence the last fence of a batch covers the
+ * whole batch. Up to VIDMEM_CLEAR_MAX_INFLIGHT batches stay queued on the CE.
+ * Batches are handed back to the allocator in order as their fences retire;
+ * the worker only blocks on one when the pipeline is full or drained.
+ */
+#define VIDMEM_CLEAR_BATCH_MEMS		16
+#define VIDMEM_CLEAR_MAX_INFLIGHT	4
+
+struct gk20a_vidmem_clear_batch {
+	struct list_head mems;
+	struct gk20a_fence *fence;
+	u64 bytes;
+	u64 chunks;
+	u64 memsets;
+};
+
+struct gk20a_vidmem_clear_range {
+	u64 base;
+	u64 length;
+};
+
+static int gk20a_vidmem_clear_range_cmp(const void *a, const void *b)
+{
+	const struct gk20a_vidmem_clear_range *ra = a;
+	const struct gk20a_vidmem_clear_range *rb = b;
+
+	if (ra->base < rb->base)
+		return -1;
+	return ra->base > rb->base;
+}
+
+/*
+ * Queue one memset. On success the batch fence is replaced by the new one;
+ * on failure the previous fence is kept so earlier memsets are still waited
+ * for.
+ */
+static int gk20a_vidmem_clear_memset(struct gk20a *g, u64 base, u64 length,
+				     struct gk20a_vidmem_clear_batch *batch)
 {
 	struct gk20a_fence *gk20a_fence_out = NULL;
-	struct gk20a_fence *gk20a_last_fence = NULL;
-	struct gk20a_page_alloc *alloc = NULL;
-	struct page_alloc_chunk *chunk = NULL;
+	int err;
+
+	err = gk20a_ce_execute_ops(g->dev,
+		g->mm.vidmem.ce_ctx_id,
+		0,
+		base,
+		length,
+		0x00000000,
+		NVGPU_CE_DST_LOCATION_LOCAL_FB,
+		NVGPU_CE_MEMSET,
+		NULL,
+		0,
+		&gk20a_fence_out);
+	if (err) {
+		gk20a_err(g->dev,
+			"Failed gk20a_ce_execute_ops[%d]", err);
+		return err;
+	}
+
+	if (batch->fence)
+		gk20a_fence_put(batch->fence);
+	batch->fence = gk20a_fence_out;
+	batch->memsets++;
+
+	return 0;
+}
+
+static int gk20a_vidmem_clear_batch_submit(struct gk20a *g,
+		struct gk20a_vidmem_clear_batch *batch)
+{
+	struct gk20a_vidmem_clear_range *ranges;
+	struct gk20a_page_alloc *alloc;
+	struct page_alloc_chunk *chunk;
+	struct mem_desc *mem;
+	int nr_chunks = 0, nr = 0, i;
 	int err = 0;
 
 	if (g->mm.vidmem.ce_ctx_id == (u32)~0)
 		return -EINVAL;
 
-	alloc = get_vidmem_page_alloc(mem->sgt->sgl);
-
-	list_for_each_entry(chunk, &alloc->alloc_chunks, list_entry) {
-		if (gk20a_last_fence)
-			gk20a_fence_put(gk20a_last_fence);
+	list_for_each_entry(mem, &batch->mems, clear_list_entry) {
+		alloc = get_vidmem_page_alloc(mem->sgt->sgl);
+		list_for_each_entry(chunk, &alloc->alloc_chunks, list_entry)
+			nr_chunks++;
+	}
+	batch->chunks = nr_chunks;
 
-		err = gk20a_ce_execute_ops(g->dev,
-			g->mm.vidmem.ce_ctx_id,
-			0,
-			chunk->base,
-			chunk->length,
-			0x00000000,
-			NVGPU_CE_DST_LOCATION_LOCAL_FB,
-			NVGPU_CE_MEMSET,
-			NULL,
-			0,
-			&gk20a_fence_out);
+	ranges = kmalloc_array(nr_chunks, sizeof(*ranges), GFP_KERNEL);
+	if (!ranges) {
+		/* no room to coalesce, scrub chunk by chunk */
+		list_for_each_entry(mem, &batch->mems, clear_list_entry) {
+			alloc = get_vidmem_page_alloc(mem->sgt->sgl);
+			list_for_each_entry(chunk, &alloc->alloc_chunks,
+					    list_entry) {
+				err = gk20a_vidmem_clear_memset(g, chunk->base,
+						chunk->length, batch);
+				if (err)
+					return err;
+			}
+		}
+		return 0;
+	}
 
-		if (err) {
-			gk20a_err(g->dev,
-				"Failed gk20a_ce_execute_ops[%d]", err);
-			return err;
+	list_for_each_entry(mem, &batch->mems, clear_list_entry) {
+		alloc = get_vidmem_page_alloc(mem->sgt->sgl);
+		list_for_each_entry(chunk, &alloc->alloc_chunks, list_entry) {
+			ranges[nr].base = chunk->base;
+			ranges[nr].length = chunk->length;
+			nr++;
 		}
+	}
 
-		gk20a_last_fence = gk20a_fence_out;
+	sort(ranges, nr, sizeof(*ranges), gk20a_vidmem_clear_range_cmp, NULL);
+
+	i = 0;
+	while (i < nr) {
+		u64 base = ranges[i].base;
+		u64 end = base + ranges[i].length;
+
+		for (i++; i < nr && ranges[i].base == end; i++)
+			end += ranges[i].length;
+
+		err = gk20a_vidmem_clear_memset(g, base, end - base, batch);
+		if (err)
+			break;
 	}
 
-	if (gk20a_last_fence) {
+	kfree(ranges);
+	return err;
+}
+
+static void gk20a_vidmem_clear_batch_retire(struct gk20a *g,
+		struct gk20a_vidmem_clear_batch *batch)
+{
+	struct mem_desc *mem, *tmp;
+	int err = 0;
+
+	if (batch->fence) {
 		unsigned long end_jiffies = jiffies +
 			msecs_to_jiffies(gk20a_get_gr_idle_timeout(g));
 
 		do {
 			unsigned int timeout = jiffies_to_msecs(end_jiffies - jiffies);
-			err = gk20a_fence_wait(gk20a_last_fence,
+			err = gk20a_fence_wait(batch->fence,
 					timeout);
 		} while ((err == -ERESTARTSYS) && time_before(jiffies, end_jiffies));
 
-		gk20a_fence_put(gk20a_last_fence);
+		gk20a_fence_put(batch->fence);
+		batch->fence = NULL;
 		if (err)
 			gk20a_err(g->dev,
 				"fence wait failed for CE execute ops");
 	}
 
-	return err;
+	list_for_each_entry_safe(mem, tmp, &batch->mems, clear_list_entry) {
+		list_del_init(&mem->clear_list_entry);
+		gk20a_free(mem->allocator,
+			   (u64)get_vidmem_page_alloc(mem->sgt->sgl));
+		gk20a_free_sgtable(&mem->sgt);
+
+		WARN_ON(atomic64_sub_return(mem->size,
+					&g->mm.vidmem.bytes_pending) < 0);
+		mem->size = 0;
+		mem->aperture = APERTURE_INVALID;
+
+		kfree(mem);
+	}
+
+	mutex_lock(&g->mm.vidmem.clear_list_mutex);
+	g->mm.vidmem.clear_stats.bytes += batch->bytes;
+	mutex_unlock(&g->mm.vidmem.clear_list_mutex);
 }
 #endif
 
@@ -3220,10 +3972,12 @@ static void gk20a_gmmu_free_attr_vid(struct gk20a *g, enum dma_attr attr,
 		atomic64_add(mem->size, &g->mm.vidmem.bytes_pending);
 		mutex_unlock(&g->mm.vidmem.clear_list_mutex);
 
-		if (was_empty) {
-			cancel_work_sync(&g->mm.vidmem.clear_mem_worker);
+		/*
+		 * A running worker picks the new entry up on its next pass;
+		 * otherwise this queues it again.
+		 */
+		if (was_empty)
 			schedule_work(&g->mm.vidmem.clear_mem_worker);
-		}
 	} else {
 		gk20a_memset(g, mem, 0, 0, mem->size);
 		gk20a_free(mem->allocator,
@@ -3279,18 +4033,30 @@ u64 gk20a_mem_get_base_addr(struct gk20a *g, struct mem_desc *mem,
 }
 
 #if defined(CONFIG_GK20A_VIDMEM)
-static struct mem_desc *get_pending_mem_desc(struct mm_gk20a *mm)
+static int get_pending_mem_descs(struct mm_gk20a *mm,
+		struct gk20a_vidmem_clear_batch *batch)
 {
-	struct mem_desc *mem = NULL;
+	struct mem_desc *mem;
+	u64 pending;
+	int nr = 0;
 
 	mutex_lock(&mm->vidmem.clear_list_mutex);
-	mem = list_first_entry_or_null(&mm->vidmem.clear_list_head,
-			struct mem_desc, clear_list_entry);
-	if (mem)
-		list_del_init(&mem->clear_list_entry);
+	pending = atomic64_read(&mm->vidmem.bytes_pending);
+	if (pending > mm->vidmem.clear_stats.max_pending)
+		mm->vidmem.clear_stats.max_pending = pending;
+
+	while (nr < VIDMEM_CLEAR_BATCH_MEMS) {
+		mem = list_first_entry_or_null(&mm->vidmem.clear_list_head,
+				struct mem_desc, clear_list_entry);
+		if (!mem)
+			break;
+		list_move_tail(&mem->clear_list_entry, &batch->mems);
+		batch->bytes += mem->size;
+		nr++;
+	}
 	mutex_unlock(&mm->vidmem.clear_list_mutex);
 
-	return mem;
+	return nr;
 }
 
 static void gk20a_vidmem_clear_mem_worker(struct work_struct *work)
@@ -3298,21 +4064,58 @@ static void gk20a_vidmem_clear_mem_worker(struct work_struct *work)
 	struct mm_gk20a *mm = container_of(work, struct mm_gk20a,
 					vidmem.clear_mem_worker);
 	struct gk20a *g = mm->g;
-	struct mem_desc *mem;
+	struct gk20a_vidmem_clear_batch batches[VIDMEM_CLEAR_MAX_INFLIGHT];
+	unsigned int head = 0, inflight = 0;
+	u64 start_ns = ktime_to_ns(ktime_get());
+	int nr;
 
-	while ((mem = get_pending_mem_desc(mm)) != NULL) {
-		gk20a_gmmu_clear_vidmem_mem(g, mem);
-		gk20a_free(mem->allocator,
-			   (u64)get_vidmem_page_alloc(mem->sgt->sgl));
-		gk20a_free_sgtable(&mem->sgt);
+	for (;;) {
+		struct gk20a_vidmem_clear_batch *batch =
+			&batches[(head + inflight) % VIDMEM_CLEAR_MAX_INFLIGHT];
 
-		WARN_ON(atomic64_sub_return(mem->size,
-					&g->mm.vidmem.bytes_pending) < 0);
-		mem->size = 0;
-		mem->aperture = APERTURE_INVALID;
+		memset(batch, 0, sizeof(*batch));
+		INIT_LIST_HEAD(&batch->mems);
 
-		kfree(mem);
+		nr = get_pending_mem_descs(mm, batch);
+		if (!nr)
+			break;
+
+		/* on error, what was queued is still waited for and freed */
+		gk20a_vidmem_clear_batch_submit(g, batch);
+		inflight++;
+
+		mutex_lock(&mm->vidmem.clear_list_mutex);
+		mm->vidmem.clear_stats.frees += nr;
+		mm->vidmem.clear_stats.batches++;
+		mm->vidmem.clear_stats.chunks += batch->chunks;
+		mm->vidmem.clear_stats.memsets += batch->memsets;
+		if (inflight > mm->vidmem.clear_stats.max_inflight)
+			mm->vidmem.clear_stats.max_inflight = inflight;
+		mutex_unlock(&mm->vidmem.clear_list_mutex);
+
+		/*
+		 * Hand back every batch the CE is already done with, and wait
+		 * for the oldest one only if no slot is left.
+		 */
+		while (inflight &&
+		       (inflight == VIDMEM_CLEAR_MAX_INFLIGHT ||
+			!batches[head].fence ||
+			gk20a_fence_is_expired(batches[head].fence))) {
+			gk20a_vidmem_clear_batch_retire(g, &batches[head]);
+			head = (head + 1) % VIDMEM_CLEAR_MAX_INFLIGHT;
+			inflight--;
+		}
+	}
+
+	while (inflight) {
+		gk20a_vidmem_clear_batch_retire(g, &batches[head]);
+		head = (head + 1) % VIDMEM_CLEAR_MAX_INFLIGHT;
+		inflight--;
 	}
+
+	mutex_lock(&mm->vidmem.clear_list_mutex);
+	mm->vidmem.clear_stats.busy_ns += ktime_to_ns(ktime_get()) - start_ns;
+	mutex_unlock(&mm->vidmem.clear_list_mutex);
 }
 #endif
 
@@ -3769,6 +4572,154 @@ static int update_gmmu_pte_locked(struct vm_gk20a *vm,
 	return 0;
 }
 
+/* number of PTEs staged on the stack before each gk20a_mem_wr_n() */
+#define GMMU_PTE_BATCH_SIZE	64
+
+/*
+ * Batched version of update_gmmu_pte_locked(). The bits that do not depend
+ * on the page (aperture, kind, rw and vol flags) are computed once, and
+ * PTEs are generated in runs that stop only where the scatterlist may move
+ * on to the next chunk. The words are staged in a small buffer and flushed
+ * with gk20a_mem_wr_n(), so vidmem page tables take one PRAMIN batch per
+ * GMMU_PTE_BATCH_SIZE entries instead of two accesses per page.
+ */
+static int update_gmmu_ptes_batched_locked(struct vm_gk20a *vm,
+			   struct gk20a_mm_entry *pte,
+			   u32 i, u32 count, u32 gmmu_pgsz_idx,
+			   struct scatterlist **sgl,
+			   u64 *offset,
+			   u64 *iova,
+			   u32 kind_v, u64 *ctag,
+			   bool cacheable, bool unmapped_pte,
+			   int rw_flag, bool sparse, bool priv,
+			   enum gk20a_aperture aperture)
+{
+	struct gk20a *g = gk20a_from_vm(vm);
+	int ctag_shift = ilog2(g->ops.fb.compression_page_size(g));
+	u32 page_size  = vm->gmmu_page_sizes[gmmu_pgsz_idx];
+	bool full_comp_tag_line = vm->mm->use_full_comp_tag_line;
+	u32 buf[GMMU_PTE_BATCH_SIZE * 2];
+	u32 w0_tmpl, w1_tmpl;
+	u32 first = i, n = 0;
+
+	/* invalid or sparse ptes: the same pair of words for the whole range */
+	if (!*iova) {
+		w0_tmpl = sparse ? gmmu_pte_valid_false_f() : 0;
+		w1_tmpl = sparse ? gmmu_pte_vol_true_f() : 0;
+
+		gk20a_dbg(gpu_dbg_pte, "pte=%d+%d [0x%08x, 0x%08x]",
+			  i, count, w1_tmpl, w0_tmpl);
+
+		while (count) {
+			u32 run = min_t(u32, count, GMMU_PTE_BATCH_SIZE);
+
+			for (n = 0; n < run; n++) {
+				buf[2 * n + 0] = w0_tmpl;
+				buf[2 * n + 1] = w1_tmpl;
+			}
+			gk20a_mem_wr_n(g, &pte->mem,
+				(pte->woffset + pte_from_index(first)) *
+					sizeof(u32),
+				buf, run * gmmu_pte__size_v());
+			first += run;
+			count -= run;
+		}
+		return 0;
+	}
+
+	w0_tmpl = unmapped_pte ? gmmu_pte_valid_false_f() :
+				 gmmu_pte_valid_true_f();
+	if (priv)
+		w0_tmpl |= gmmu_pte_privilege_true_f();
+
+	w1_tmpl = __gk20a_aperture_mask(g, aperture,
+			gmmu_pte_aperture_sys_mem_ncoh_f(),
+			gmmu_pte_aperture_video_memory_f()) |
+		gmmu_pte_kind_f(kind_v);
+
+	if (rw_flag == gk20a_mem_flag_read_only) {
+		w0_tmpl |= gmmu_pte_read_only_true_f();
+		w1_tmpl |= gmmu_pte_write_disable_true_f();
+	} else if (rw_flag == gk20a_mem_flag_write_only) {
+		w1_tmpl |= gmmu_pte_read_disable_true_f();
+	}
+	/* unmapped ptes store cacheable behind the write disable bit */
+	if (!cacheable)
+		w1_tmpl |= unmapped_pte ? gmmu_pte_write_disable_true_f() :
+					  gmmu_pte_vol_true_f();
+
+	gk20a_dbg(gpu_dbg_pte,
+		"pte=%d+%d iova=0x%llx kind=%d ctag=%d vol=%d [0x%08x, 0x%08x]",
+		i, count, *iova, kind_v, (u32)(*ctag >> ctag_shift),
+		!cacheable, w1_tmpl, w0_tmpl);
+
+	while (count) {
+		u32 run = count;
+		u32 k;
+
+		/* pages left before the sg chunk boundary check can fire */
+		if (*sgl) {
+			u64 left = (*sgl)->length > *offset ?
+				((*sgl)->length - *offset) / page_size : 0;
+
+			run = (u32)min_t(u64, run, max_t(u64, left, 1));
+		}
+
+		for (k = 0; k < run; k++) {
+			u32 iova_v = *iova >> gmmu_pte_address_shift_v();
+			u32 w1 = w1_tmpl |
+				gmmu_pte_comptagline_f((u32)(*ctag >> ctag_shift));
+
+			if (*ctag && full_comp_tag_line && *iova & 0x10000)
+				w1 |= gmmu_pte_comptagline_f(
+					1 << (gmmu_pte_comptagline_s() - 1));
+
+			buf[2 * n + 0] = w0_tmpl |
+				(aperture == APERTURE_SYSMEM ?
+					gmmu_pte_address_sys_f(iova_v) :
+					gmmu_pte_address_vid_f(iova_v));
+			buf[2 * n + 1] = w1;
+
+			if (*ctag)
+				*ctag += page_size;
+			*iova += page_size;
+
+			if (++n == GMMU_PTE_BATCH_SIZE) {
+				gk20a_mem_wr_n(g, &pte->mem,
+					(pte->woffset + pte_from_index(first)) *
+						sizeof(u32),
+					buf, n * gmmu_pte__size_v());
+				first += n;
+				n = 0;
+			}
+		}
+
+		count -= run;
+		*offset += (u64)run * page_size;
+
+		if (*sgl && *offset + page_size > (*sgl)->length) {
+			u64 new_iova;
+			*sgl = sg_next(*sgl);
+			if (*sgl) {
+				new_iova = sg_phys(*sgl);
+				gk20a_dbg(gpu_dbg_pte, "chunk address %llx, size %d",
+					  new_iova, (*sgl)->length);
+				if (new_iova) {
+					*offset = 0;
+					*iova = new_iova;
+				}
+			}
+		}
+	}
+
+	if (n)
+		gk20a_mem_wr_n(g, &pte->mem,
+			(pte->woffset + pte_from_index(first)) * sizeof(u32),
+			buf, n * gmmu_pte__size_v());
+
+	return 0;
+}
+
 static int update_gmmu_level_locked(struct vm_gk20a *vm,
 				    struct gk20a_mm_entry *pte,
 				    enum gmmu_pgsz_gk20a pgsz_idx,
@@ -3800,6 +4751,22 @@ static int update_gmmu_level_locked(struct vm_gk20a *vm,
 	gk20a_dbg(gpu_dbg_pte, "size_idx=%d, l: %d, [%llx,%llx], iova=%llx",
 		  pgsz_idx, lvl, gpu_va, gpu_end-1, *iova);
 
+	/* last level: write the whole range of ptes in one go */
+	if (l->update_entries && !next_l->update_entry) {
+		u32 count;
+
+		if (gpu_va >= gpu_end)
+			return 0;
+
+		count = (u32)(((gpu_end - 1) >> (u64)l->lo_bit[pgsz_idx]) -
+			      (gpu_va >> (u64)l->lo_bit[pgsz_idx]) + 1);
+
+		return l->update_entries(vm, pte, pde_i, count, pgsz_idx,
+				sgl, offset, iova,
+				kind_v, ctag, cacheable, unmapped_pte,
+				rw_flag, sparse, priv, aperture);
+	}
+
 	while (gpu_va < gpu_end) {
 		u64 next = min((gpu_va + pde_size) & ~(pde_size-1), gpu_end);
 
@@ -4062,8 +5029,10 @@ void gk20a_vm_unmap_locked(struct mapped_buffer_node *mapped_buffer,
 		list_del(&mapped_buffer->va_buffers_list);
 
 	/* keep track of mapped buffers */
-	if (mapped_buffer->user_mapped)
+	if (mapped_buffer->user_mapped) {
 		vm->num_user_mapped_buffers--;
+		gk20a_vm_invalidate_buffer_set_locked(vm);
+	}
 
 	if (mapped_buffer->own_mem_ref)
 		dma_buf_put(mapped_buffer->dmabuf);
@@ -4131,6 +5100,8 @@ static void gk20a_vm_remove_support_nofree(struct vm_gk20a *vm)
 	/* TBD: add a flag here for the unmap code to recognize teardown
 	 * and short-circuit any otherwise expensive operations. */
 
+	gk20a_vm_invalidate_buffer_set_locked(vm);
+
 	node = rb_first(&vm->mapped_buffers);
 	while (node) {
 		mapped_buffer =
@@ -4183,6 +5154,7 @@ const struct gk20a_mmu_level gk20a_mm_levels_64k[] = {
 	{.hi_bit = {25, 25},
 	 .lo_bit = {12, 16},
 	 .update_entry = update_gmmu_pte_locked,
+	 .update_entries = update_gmmu_ptes_batched_locked,
 	 .entry_size = 8},
 	{.update_entry = NULL}
 };
@@ -4195,6 +5167,7 @@ const struct gk20a_mmu_level gk20a_mm_levels_128k[] = {
 	{.hi_bit = {26, 26},
 	 .lo_bit = {12, 17},
 	 .update_entry = update_gmmu_pte_locked,
+	 .update_entries = update_gmmu_ptes_batched_locked,
 	 .entry_size = 8},
 	{.update_entry = NULL}
 };
@@ -4224,9 +5197,11 @@ static int gk20a_init_sema_pool(struct vm_gk20a *vm)
 		return -ENOMEM;
 
 	vm->sema_pool = gk20a_semaphore_pool_alloc(sema_sea);
-	if (!vm->sema_pool) {
+	if (IS_ERR(vm->sema_pool)) {
+		err = PTR_ERR(vm->sema_pool);
+		vm->sema_pool = NULL;
 		gk20a_vm_put(vm);
-		return -ENOMEM;
+		return err;
 	}
 
 	/*
@@ -4239,7 +5214,7 @@ static int gk20a_init_sema_pool(struct vm_gk20a *vm)
 	sema_sea->gpu_va = gk20a_alloc_fixed(&vm->vma[gmmu_page_size_kernel],
 					     vm->va_limit -
 					     mm->channel.kernel_size,
-					     512 * PAGE_SIZE);
+					     SEMAPHORE_SEA_VA_SIZE);
 	if (!sema_sea->gpu_va) {
 		gk20a_free(&vm->vma[gmmu_page_size_small], sema_sea->gpu_va);
 		gk20a_vm_put(vm);
@@ -4436,6 +5411,7 @@ int gk20a_init_vm(struct mm_gk20a *mm,
 	vm->mapped_buffers = RB_ROOT;
 
 	mutex_init(&vm->update_gmmu_lock);
+	atomic64_set(&vm->ctag_clear_ticket, 0);
 	kref_init(&vm->ref);
 	INIT_LIST_HEAD(&vm->reserved_va_list);
 
@@ -5229,12 +6205,13 @@ int gk20a_vm_find_buffer(struct vm_gk20a *vm, u64 gpu_va,
 void gk20a_mm_tlb_invalidate(struct vm_gk20a *vm)
 {
 	struct gk20a *g = gk20a_from_vm(vm);
+	struct mm_gk20a *mm = &g->mm;
 	struct nvgpu_timeout timeout;
+	ktime_t start;
+	s64 wait_ns, max_ns, old;
 	u32 addr_lo;
 	u32 data;
 
-	static DEFINE_MUTEX(tlb_lock);
-
 	gk20a_dbg_fn("");
 
 	/* pagetables are considered sw states which are preserved after
@@ -5246,9 +6223,11 @@ void gk20a_mm_tlb_invalidate(struct vm_gk20a *vm)
 	if (!g->power_on)
 		return;
 
+	start = ktime_get();
+
 	addr_lo = u64_lo32(gk20a_mem_get_base_addr(g, &vm->pdb.mem, 0) >> 12);
 
-	mutex_lock(&tlb_lock);
+	mutex_lock(&mm->tlb_lock);
 
 	trace_gk20a_mm_tlb_invalidate(dev_name(g->dev));
 
@@ -5262,10 +6241,10 @@ void gk20a_mm_tlb_invalidate(struct vm_gk20a *vm)
 	} while (!nvgpu_timeout_check_msg(&timeout,
 					 "wait mmu fifo space"));
 
-	if (nvgpu_timeout_peek(&timeout))
+	if (nvgpu_timeout_peek(&timeout)) {
+		mutex_unlock(&mm->tlb_lock);
 		goto out;
-
-	nvgpu_timeout_init(g, &timeout, 1000, NVGPU_TIMER_RETRY_TIMER);
+	}
 
 	gk20a_writel(g, fb_mmu_invalidate_pdb_r(),
 		fb_mmu_invalidate_pdb_addr_f(addr_lo) |
@@ -5277,6 +6256,15 @@ void gk20a_mm_tlb_invalidate(struct vm_gk20a *vm)
 		fb_mmu_invalidate_all_va_true_f() |
 		fb_mmu_invalidate_trigger_true_f());
 
+	/*
+	 * Only the pdb/trigger pair has to be atomic. Other VMs may queue
+	 * their own invalidates while we wait for the pri fifo to drain; we
+	 * then simply wait for theirs too.
+	 */
+	mutex_unlock(&mm->tlb_lock);
+
+	nvgpu_timeout_init(g, &timeout, 1000, NVGPU_TIMER_RETRY_TIMER);
+
 	do {
 		data = gk20a_readl(g, fb_mmu_ctrl_r());
 		if (fb_mmu_ctrl_pri_fifo_empty_v(data) !=
@@ -5289,7 +6277,18 @@ void gk20a_mm_tlb_invalidate(struct vm_gk20a *vm)
 	trace_gk20a_mm_tlb_invalidate_done(dev_name(g->dev));
 
 out:
-	mutex_unlock(&tlb_lock);
+	wait_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	atomic64_add(wait_ns, &mm->tlb_stats.wait_ns);
+
+	/* invalidates of different VMs finish concurrently */
+	max_ns = atomic64_read(&mm->tlb_stats.max_wait_ns);
+	while (wait_ns > max_ns) {
+		old = atomic64_cmpxchg(&mm->tlb_stats.max_wait_ns,
+				       max_ns, wait_ns);
+		if (old == max_ns)
+			break;
+		max_ns = old;
+	}
 }
 
 int gk20a_mm_suspend(struct gk20a *g)
@@ -5379,6 +6378,460 @@ static bool gk20a_mm_is_bar1_supported(struct gk20a *g)
 }
 
 #ifdef CONFIG_DEBUG_FS
+#if defined(CONFIG_GK20A_VIDMEM)
+static int gk20a_mm_vidmem_clear_stats_show(struct seq_file *s, void *unused)
+{
+	struct gk20a *g = s->private;
+	struct mm_gk20a *mm = &g->mm;
+	struct gk20a_vidmem_clear_stats st;
+
+	mutex_lock(&mm->vidmem.clear_list_mutex);
+	st = mm->vidmem.clear_stats;
+	mutex_unlock(&mm->vidmem.clear_list_mutex);
+
+	seq_printf(s, "pending bytes:      %lld\n",
+		   (long long)atomic64_read(&mm->vidmem.bytes_pending));
+	seq_printf(s, "max pending bytes:  %llu\n", st.max_pending);
+	seq_printf(s, "scrubbed bytes:     %llu\n", st.bytes);
+	seq_printf(s, "frees:              %llu\n", st.frees);
+	seq_printf(s, "batches:            %llu\n", st.batches);
+	seq_printf(s, "max in flight:      %llu\n", st.max_inflight);
+	seq_printf(s, "chunks:             %llu\n", st.chunks);
+	seq_printf(s, "memsets:            %llu\n", st.memsets);
+	seq_printf(s, "busy (ns):          %llu\n", st.busy_ns);
+	seq_printf(s, "throughput (MB/s):  %llu\n",
+		   st.busy_ns ? div64_u64(st.bytes * 1000, st.busy_ns) : 0);
+
+	return 0;
+}
+
+static int gk20a_mm_vidmem_clear_stats_open(struct inode *inode,
+					    struct file *file)
+{
+	return single_open(file, gk20a_mm_vidmem_clear_stats_show,
+			   inode->i_private);
+}
+
+static const struct file_operations gk20a_mm_vidmem_clear_stats_fops = {
+	.open		= gk20a_mm_vidmem_clear_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
+#define PRAMIN_BENCH_SIZE	SZ_2M
+
+static u64 gk20a_mm_bench_mbps(u64 bytes, u64 ns)
+{
+	return ns ? div64_u64(bytes * 1000, ns) : 0;
+}
+
+/*
+ * Write the same vidmem buffer through each access path and report MB/s:
+ * one gk20a_mem_wr32() per word, a scattered gk20a_mem_wr32_batch(), one
+ * bulk PRAMIN transfer and a CE staging copy in both directions.
+ */
+static int gk20a_mm_pramin_bench_show(struct seq_file *s, void *unused)
+{
+	struct gk20a *g = s->private;
+	struct mem_desc mem = {0};
+	struct gk20a_mem_access *ops = NULL;
+	u32 nwords = PRAMIN_BENCH_SIZE / sizeof(u32);
+	u32 *buf = NULL, *p;
+	u64 switches, t0, ns;
+	u32 i;
+	int err;
+
+	err = gk20a_busy(g->dev);
+	if (err)
+		return err;
+
+	err = gk20a_gmmu_alloc_vid(g, PRAMIN_BENCH_SIZE, &mem);
+	if (err)
+		goto out_idle;
+
+	buf = vzalloc(PRAMIN_BENCH_SIZE);
+	ops = vzalloc(nwords * sizeof(*ops));
+	if (!buf || !ops) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nwords; i++) {
+		buf[i] = i;
+		/* odd stride over a power of two visits every word once */
+		ops[i].w = (i * 4099) & (nwords - 1);
+		ops[i].data = i;
+	}
+
+	seq_printf(s, "size:             %u bytes\n", PRAMIN_BENCH_SIZE);
+
+	switches = g->mm.pramin_window_switches;
+	t0 = ktime_to_ns(ktime_get());
+	for (i = 0; i < nwords; i++)
+		gk20a_mem_wr32(g, &mem, ops[i].w, ops[i].data);
+	ns = ktime_to_ns(ktime_get()) - t0;
+	seq_printf(s, "pramin per word:  %llu MB/s (%llu window switches)\n",
+		   gk20a_mm_bench_mbps(PRAMIN_BENCH_SIZE, ns),
+		   g->mm.pramin_window_switches - switches);
+
+	switches = g->mm.pramin_window_switches;
+	t0 = ktime_to_ns(ktime_get());
+	gk20a_mem_wr32_batch(g, &mem, ops, nwords);
+	ns = ktime_to_ns(ktime_get()) - t0;
+	seq_printf(s, "pramin batched:   %llu MB/s (%llu window switches)\n",
+		   gk20a_mm_bench_mbps(PRAMIN_BENCH_SIZE, ns),
+		   g->mm.pramin_window_switches - switches);
+
+	p = buf;
+	t0 = ktime_to_ns(ktime_get());
+	pramin_access_batched(g, &mem, 0, PRAMIN_BENCH_SIZE,
+			pramin_access_batch_wr_n, &p);
+	wmb();
+	ns = ktime_to_ns(ktime_get()) - t0;
+	seq_printf(s, "pramin bulk:      %llu MB/s\n",
+		   gk20a_mm_bench_mbps(PRAMIN_BENCH_SIZE, ns));
+
+	t0 = ktime_to_ns(ktime_get());
+	err = gk20a_mem_ce_copy(g, &mem, 0, buf, PRAMIN_BENCH_SIZE, true);
+	ns = ktime_to_ns(ktime_get()) - t0;
+	if (err)
+		seq_printf(s, "ce staged write: unavailable (%d)\n", err);
+	else
+		seq_printf(s, "ce staged write:  %llu MB/s\n",
+			   gk20a_mm_bench_mbps(PRAMIN_BENCH_SIZE, ns));
+
+	t0 = ktime_to_ns(ktime_get());
+	err = gk20a_mem_ce_copy(g, &mem, 0, buf, PRAMIN_BENCH_SIZE, false);
+	ns = ktime_to_ns(ktime_get()) - t0;
+	if (err)
+		seq_printf(s, "ce staged read:  unavailable (%d)\n", err);
+	else
+		seq_printf(s, "ce staged read:   %llu MB/s\n",
+			   gk20a_mm_bench_mbps(PRAMIN_BENCH_SIZE, ns));
+
+	err = 0;
+out:
+	vfree(ops);
+	vfree(buf);
+	gk20a_gmmu_free(g, &mem);
+out_idle:
+	gk20a_idle(g->dev);
+	return err;
+}
+
+static int gk20a_mm_pramin_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, gk20a_mm_pramin_bench_show, inode->i_private);
+}
+
+static const struct file_operations gk20a_mm_pramin_bench_fops = {
+	.open		= gk20a_mm_pramin_bench_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int gk20a_mm_tlb_stats_show(struct seq_file *s, void *unused)
+{
+	struct gk20a *g = s->private;
+	u64 requests = atomic64_read(&g->mm.tlb_stats.requests);
+	u64 issued = atomic64_read(&g->mm.tlb_stats.issued);
+	u64 wait_ns = atomic64_read(&g->mm.tlb_stats.wait_ns);
+
+	seq_printf(s, "requests:       %llu\n", requests);
+	seq_printf(s, "issued:         %llu\n", issued);
+	seq_printf(s, "coalesced:      %llu\n",
+		   requests > issued ? requests - issued : 0);
+	seq_printf(s, "ratio (x100):   %llu\n",
+		   issued ? div64_u64(requests * 100, issued) : 0);
+	seq_printf(s, "avg wait (ns):  %llu\n",
+		   issued ? div64_u64(wait_ns, issued) : 0);
+	seq_printf(s, "max wait (ns):  %llu\n",
+		   (u64)atomic64_read(&g->mm.tlb_stats.max_wait_ns));
+
+	return 0;
+}
+
+static int gk20a_mm_tlb_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, gk20a_mm_tlb_stats_show, inode->i_private);
+}
+
+static const struct file_operations gk20a_mm_tlb_stats_fops = {
+	.open		= gk20a_mm_tlb_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#define COMPTAG_STATS_BUCKETS	16
+
+static int gk20a_mm_comptag_stats_show(struct seq_file *s, void *unused)
+{
+	struct gk20a *g = s->private;
+	struct gk20a_comptag_allocator *allocator = &g->gr.comp_tags;
+	u64 hist[COMPTAG_STATS_BUCKETS] = { 0 };
+	struct gk20a_comptag_extent *e;
+	struct rb_node *node;
+	unsigned long free_lines;
+	u32 largest = 0;
+	int i;
+
+	mutex_lock(&allocator->lock);
+
+	node = rb_last(&allocator->free_by_size);
+	if (node) {
+		e = rb_entry(node, struct gk20a_comptag_extent, size_node);
+		largest = e->len;
+	}
+	for (node = rb_first(&allocator->free_by_size); node;
+	     node = rb_next(node)) {
+		e = rb_entry(node, struct gk20a_comptag_extent, size_node);
+		hist[min_t(int, ilog2(e->len), COMPTAG_STATS_BUCKETS - 1)]++;
+	}
+	free_lines = allocator->stats.free_lines;
+
+	seq_printf(s, "lines:                 %lu\n", allocator->size);
+	seq_printf(s, "free lines:            %lu\n", free_lines);
+	seq_printf(s, "free extents:          %lu\n",
+		   allocator->stats.free_extents);
+	seq_printf(s, "largest extent:        %u\n", largest);
+	/* share of the free lines outside the largest extent */
+	seq_printf(s, "fragmentation (x100):  %lu\n",
+		   free_lines ? 100 - largest * 100UL / free_lines : 0);
+	seq_printf(s, "allocs:                %llu\n", allocator->stats.allocs);
+	seq_printf(s, "frees:                 %llu\n", allocator->stats.frees);
+	seq_printf(s, "failures:              %llu\n",
+		   allocator->stats.failures);
+	seq_printf(s, "fragmented failures:   %llu\n",
+		   allocator->stats.frag_failures);
+	seq_printf(s, "avg search steps:      %llu\n",
+		   allocator->stats.allocs + allocator->stats.failures ?
+		   div64_u64(allocator->stats.search_steps,
+			     allocator->stats.allocs +
+			     allocator->stats.failures) : 0);
+	seq_printf(s, "max search steps:      %llu\n",
+		   allocator->stats.max_search_steps);
+
+	mutex_unlock(&allocator->lock);
+
+	seq_puts(s, "free extents by size:\n");
+	for (i = 0; i < COMPTAG_STATS_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		seq_printf(s, "  %6u%s lines: %llu\n", 1U << i,
+			   i == COMPTAG_STATS_BUCKETS - 1 ? "+" : " ",
+			   hist[i]);
+	}
+
+	return 0;
+}
+
+static int gk20a_mm_comptag_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, gk20a_mm_comptag_stats_show,
+			   inode->i_private);
+}
+
+static const struct file_operations gk20a_mm_comptag_stats_fops = {
+	.open		= gk20a_mm_comptag_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#define COMPTAG_SELFTEST_LINES	4096
+#define COMPTAG_SELFTEST_LIVE	128
+#define COMPTAG_SELFTEST_OPS	20000
+
+struct gk20a_comptag_selftest_alloc {
+	u32 offset;
+	u32 len;
+	struct gk20a_comptag_extent *extent;
+};
+
+/*
+ * Walks the free extents and checks them against the shadow bitmap of taken
+ * lines: in range, ordered, coalesced, not overlapping anything taken, and
+ * adding up to the counters the allocator keeps.
+ */
+static int gk20a_comptag_selftest_check(struct seq_file *s,
+		struct gk20a_comptag_allocator *allocator,
+		unsigned long *taken)
+{
+	struct gk20a_comptag_extent *e;
+	struct rb_node *node;
+	unsigned long lines = 0, extents = 0, by_size = 0;
+	u32 end = 0;
+
+	for (node = rb_first(&allocator->free_by_addr); node;
+	     node = rb_next(node)) {
+		e = rb_entry(node, struct gk20a_comptag_extent, addr_node);
+		if (!e->len || e->start < 1 ||
+		    e->start - 1 + e->len > allocator->size) {
+			seq_printf(s, "extent %u+%u out of range\n",
+				   e->start, e->len);
+			return -EINVAL;
+		}
+		if (end && e->start <= end) {
+			seq_printf(s, "extent %u+%u %s the previous one\n",
+				   e->start, e->len,
+				   e->start < end ? "overlaps" : "not merged with");
+			return -EINVAL;
+		}
+		if (find_next_bit(taken, e->start + e->len, e->start) <
+		    e->start + e->len) {
+			seq_printf(s, "extent %u+%u covers taken lines\n",
+				   e->start, e->len);
+			return -EINVAL;
+		}
+		end = e->start + e->len;
+		lines += e->len;
+		extents++;
+	}
+
+	for (node = rb_first(&allocator->free_by_size); node;
+	     node = rb_next(node))
+		by_size++;
+
+	if (lines != allocator->stats.free_lines ||
+	    extents != allocator->stats.free_extents || by_size != extents ||
+	    lines + bitmap_weight(taken, allocator->size + 1) !=
+	    allocator->size) {
+		seq_printf(s, "counts: %lu lines in %lu/%lu extents, stats %lu in %lu\n",
+			   lines, extents, by_size,
+			   allocator->stats.free_lines,
+			   allocator->stats.free_extents);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Runs random aligned allocs and frees against a scratch comptag allocator,
+ * so the extent trees can be checked without touching the real comptags.
+ */
+static int gk20a_mm_comptag_selftest_show(struct seq_file *s, void *unused)
+{
+	struct gk20a_comptag_allocator *allocator;
+	struct gk20a_comptag_selftest_alloc *live, *a;
+	struct rnd_state rnd;
+	unsigned long *taken;
+	u32 seed = prandom_u32();
+	u32 nr_live = 0, i, off, len, align;
+	u64 allocs = 0, failures = 0;
+	int err;
+
+	allocator = kzalloc(sizeof(*allocator), GFP_KERNEL);
+	live = kcalloc(COMPTAG_SELFTEST_LIVE, sizeof(*live), GFP_KERNEL);
+	taken = kcalloc(BITS_TO_LONGS(COMPTAG_SELFTEST_LINES),
+			sizeof(*taken), GFP_KERNEL);
+	if (!allocator || !live || !taken) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	err = gk20a_comptag_allocator_init(allocator, COMPTAG_SELFTEST_LINES);
+	if (err)
+		goto out_free;
+
+	prandom_seed_state(&rnd, seed);
+	seq_printf(s, "seed: 0x%08x\n", seed);
+
+	for (i = 0; i < COMPTAG_SELFTEST_OPS; i++) {
+		u32 r = prandom_u32_state(&rnd);
+
+		if (nr_live == COMPTAG_SELFTEST_LIVE ||
+		    (nr_live && r % 3 == 0)) {
+			a = &live[(r >> 2) % nr_live];
+			bitmap_clear(taken, a->offset, a->len);
+			gk20a_comptaglines_free(allocator, a->offset, a->len,
+						a->extent);
+			*a = live[--nr_live];
+		} else {
+			/* mostly small buffers, now and then a large one */
+			len = 1 + (r >> 2) % ((r & 0x10000) ? 512 : 32);
+			align = 1 << ((r >> 20) % 5);
+			a = &live[nr_live];
+			err = gk20a_comptaglines_alloc(allocator, &off, len,
+						       align, &a->extent);
+			if (err == -ENOMEM) {
+				failures++;
+				err = 0;
+				continue;
+			}
+			if (err) {
+				seq_printf(s, "op %u: alloc of %u failed: %d\n",
+					   i, len, err);
+				break;
+			}
+			if (off % align || off < 1 ||
+			    off - 1 + len > allocator->size ||
+			    find_next_bit(taken, off + len, off) < off + len) {
+				seq_printf(s, "op %u: bad alloc %u+%u align %u\n",
+					   i, off, len, align);
+				err = -EINVAL;
+				break;
+			}
+			bitmap_set(taken, off, len);
+			a->offset = off;
+			a->len = len;
+			nr_live++;
+			allocs++;
+		}
+
+		if (i % 256 == 0) {
+			err = gk20a_comptag_selftest_check(s, allocator, taken);
+			if (err) {
+				seq_printf(s, "after op %u\n", i);
+				break;
+			}
+		}
+	}
+
+	while (nr_live) {
+		a = &live[--nr_live];
+		bitmap_clear(taken, a->offset, a->len);
+		gk20a_comptaglines_free(allocator, a->offset, a->len,
+					a->extent);
+	}
+
+	if (!err)
+		err = gk20a_comptag_selftest_check(s, allocator, taken);
+	if (!err && allocator->stats.free_extents != 1) {
+		seq_printf(s, "%lu extents left once all freed\n",
+			   allocator->stats.free_extents);
+		err = -EINVAL;
+	}
+
+	seq_printf(s, "allocs: %llu, failures: %llu\n", allocs, failures);
+	seq_printf(s, "%s\n", err ? "FAIL" : "PASS");
+	gk20a_comptag_allocator_destroy(allocator);
+	err = 0;
+out_free:
+	kfree(taken);
+	kfree(live);
+	kfree(allocator);
+	return err;
+}
+
+static int gk20a_mm_comptag_selftest_open(struct inode *inode,
+		struct file *file)
+{
+	return single_open(file, gk20a_mm_comptag_selftest_show,
+			   inode->i_private);
+}
+
+static const struct file_operations gk20a_mm_comptag_selftest_fops = {
+	.open		= gk20a_mm_comptag_selftest_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 void gk20a_mm_debugfs_init(struct device *dev)
 {
 	struct gk20a_platform *platform = dev_get_drvdata(dev);
@@ -5390,6 +6843,25 @@ void gk20a_mm_debugfs_init(struct device *dev)
 
 	debugfs_create_bool("force_pramin", 0664, gpu_root,
 			   &g->mm.force_pramin);
+
+	debugfs_create_u32("pramin_ce_threshold", 0664, gpu_root,
+			   &g->mm.pramin_ce_threshold);
+
+	debugfs_create_file("pramin_bench", S_IRUGO, gpu_root, g,
+			    &gk20a_mm_pramin_bench_fops);
+
+	debugfs_create_file("tlb_invalidate_stats", S_IRUGO, gpu_root, g,
+			    &gk20a_mm_tlb_stats_fops);
+
+	debugfs_create_file("comptag_stats", S_IRUGO, gpu_root, g,
+			    &gk20a_mm_comptag_stats_fops);
+
+	debugfs_create_file("comptag_selftest", S_IRUSR, gpu_root, g,
+			    &gk20a_mm_comptag_selftest_fops);
+#if defined(CONFIG_GK20A_VIDMEM)
+	debugfs_create_file("vidmem_clear_stats", S_IRUGO, gpu_root, g,
+			    &gk20a_mm_vidmem_clear_stats_fops);
+#endif
 }
 #endif
 
@@ -176,6 +176,8 @@ struct gk20a_comptags {
 	u32 lines;
 	u32 allocated_lines;
 	bool user_mappable;
+	/* the comptags are cleared once mm.ctag_clear.done reaches this */
+	u64 clear_ticket;
 };
 
 struct gk20a_mm_entry {
@@ -256,6 +258,20 @@ struct gk20a_mmu_level {
 			   bool cacheable, bool unmapped_pte,
 			   int rw_flag, bool sparse, bool priv,
 			   enum gk20a_aperture aperture);
+	/*
+	 * Optional batched form of update_entry for the last level: writes
+	 * count consecutive entries starting at index i.
+	 */
+	int (*update_entries)(struct vm_gk20a *vm,
+			   struct gk20a_mm_entry *pte,
+			   u32 i, u32 count, u32 gmmu_pgsz_idx,
+			   struct scatterlist **sgl,
+			   u64 *offset,
+			   u64 *iova,
+			   u32 kind_v, u64 *ctag,
+			   bool cacheable, bool unmapped_pte,
+			   int rw_flag, bool sparse, bool priv,
+			   enum gk20a_aperture aperture);
 	size_t entry_size;
 };
 
@@ -264,6 +280,21 @@ struct vm_gk20a_mapping_batch
 {
 	bool gpu_l2_flushed;
 	bool need_tlb_invalidate;
+
+	/*
+	 * PTE updates queued by a HAL that applies them at
+	 * mm.mapping_batch_flush time (vgpu), and the first error one hit.
+	 */
+	void *deferred_ops;
+	u32 num_deferred_ops;
+	int err;
+
+	/*
+	 * Set by the caller before each map so that a deferred failure can be
+	 * traced back to it; first_err_index is the lowest one that failed.
+	 */
+	u32 index;
+	u32 first_err_index;
 };
 
 struct vm_gk20a {
@@ -313,6 +344,35 @@ struct vm_gk20a {
 	 * Each address space needs to have a semaphore pool.
 	 */
 	struct gk20a_semaphore_pool *sema_pool;
+
+	/*
+	 * Cached snapshot of the user mapped buffers handed out to submits.
+	 * While cached it holds a reference on every user mapped buffer of
+	 * the VM, so anything waiting for a buffer's refcount to drop must
+	 * drop the cache first. Dropped whenever the set of user mappings
+	 * changes, which bumps buffer_set_gen. Protected by update_gmmu_lock.
+	 */
+	struct gk20a_vm_buffer_set *buffer_set;
+	u64 buffer_set_gen;
+
+	/*
+	 * Highest comptag clear ticket of the buffers mapped into this VM.
+	 * Submits wait for it so the GPU never sees stale compbits. Raised
+	 * under update_gmmu_lock.
+	 */
+	atomic64_t ctag_clear_ticket;
+};
+
+/*
+ * Immutable list of the user mapped buffers of a VM at one generation. The
+ * set holds one reference on each buffer; jobs hold references on the set.
+ */
+struct gk20a_vm_buffer_set {
+	struct kref ref;
+	struct vm_gk20a *vm;
+	u64 gen;
+	int num_buffers;
+	struct mapped_buffer_node *buffers[0];
 };
 
 struct gk20a;
@@ -329,6 +389,9 @@ void gk20a_mm_l2_flush(struct gk20a *g, bool invalidate);
 void gk20a_mm_cbc_clean(struct gk20a *g);
 void gk20a_mm_l2_invalidate(struct gk20a *g);
 
+/* distinct comptag ranges that can wait for one clear pass */
+#define GK20A_CTAG_CLEAR_RANGES 16
+
 struct mm_gk20a {
 	struct gk20a *g;
 
@@ -370,6 +433,40 @@ struct mm_gk20a {
 	} ce;
 
 	struct mutex l2_op_lock;
+
+	/* serialises the invalidate pdb/trigger register pair */
+	struct mutex tlb_lock;
+	/*
+	 * requests counts every map/unmap that needs an invalidate; those
+	 * made within one mapping batch share a single issued invalidate.
+	 * Both are counted by the common VM code, or by the GMMU HAL through
+	 * gk20a_vm_tlb_stats_*() where it invalidates on its own. Wait times
+	 * are only measured by gk20a_mm_tlb_invalidate().
+	 */
+	struct {
+		atomic64_t requests;
+		atomic64_t issued;
+		atomic64_t wait_ns;
+		atomic64_t max_wait_ns;
+	} tlb_stats;
+
+	/*
+	 * Comptag clears queued by gk20a_vm_map(). Overlapping and adjacent
+	 * ranges are merged and handed to the LTC by ctag_clear.worker. Each
+	 * queued range gets a ticket; it is cleared once done reaches it.
+	 */
+	struct {
+		struct mutex lock;
+		struct work_struct worker;
+		wait_queue_head_t wq;
+		struct {
+			u32 min;
+			u32 max;
+		} ranges[GK20A_CTAG_CLEAR_RANGES];
+		int num_ranges;
+		u64 queued;
+		atomic64_t done;
+	} ctag_clear;
 #ifdef CONFIG_ARCH_TEGRA_18x_SOC
 	struct mem_desc bar2_desc;
 #endif
@@ -410,6 +507,8 @@ struct mm_gk20a {
 #else
 	bool force_pramin; /* via debugfs */
 #endif
+	u32 pramin_ce_threshold; /* bytes, via debugfs */
+	u64 pramin_window_switches;
 
 	struct {
 		size_t size;
@@ -429,6 +528,18 @@ struct mm_gk20a {
 
 		struct work_struct clear_mem_worker;
 		atomic64_t bytes_pending;
+
+		/* written by clear_mem_worker, under clear_list_mutex */
+		struct gk20a_vidmem_clear_stats {
+			u64 bytes;
+			u64 busy_ns;
+			u64 frees;
+			u64 batches;
+			u64 chunks;
+			u64 memsets;
+			u64 max_inflight;
+			u64 max_pending;
+		} clear_stats;
 	} vidmem;
 };
 
@@ -522,6 +633,24 @@ void gk20a_mem_wr_n(struct gk20a *g, struct mem_desc *mem, u32 offset,
 void gk20a_memset(struct gk20a *g, struct mem_desc *mem, u32 offset,
 		u32 c, u32 size);
 
+/* as gk20a_mem_{rd,wr}_n(), may use the CE; only for sleepable bulk loads */
+void gk20a_mem_rd_n_bulk(struct gk20a *g, struct mem_desc *mem, u32 offset,
+		void *dest, u32 size);
+void gk20a_mem_wr_n_bulk(struct gk20a *g, struct mem_desc *mem, u32 offset,
+		void *src, u32 size);
+
+/* one word of a gk20a_mem_{rd,wr}32_batch() request */
+struct gk20a_mem_access {
+	u32 w;		/* offset in words */
+	u32 data;
+};
+
+/* scattered word accesses; ops get sorted by offset in place */
+void gk20a_mem_rd32_batch(struct gk20a *g, struct mem_desc *mem,
+		struct gk20a_mem_access *ops, u32 n);
+void gk20a_mem_wr32_batch(struct gk20a *g, struct mem_desc *mem,
+		struct gk20a_mem_access *ops, u32 n);
+
 #if 0 /*related to addr bits above, concern below TBD on which is accurate */
 #define bar1_instance_block_shift_gk20a() (max_physaddr_bits_gk20a() -\
 					   bus_bar1_block_ptr_s())
@@ -705,15 +834,16 @@ void gk20a_vm_unmap(struct vm_gk20a *vm, u64 offset);
 void gk20a_vm_unmap_locked(struct mapped_buffer_node *mapped_buffer,
 			   struct vm_gk20a_mapping_batch *batch);
 
-/* get reference to all currently mapped buffers */
-int gk20a_vm_get_buffers(struct vm_gk20a *vm,
-			 struct mapped_buffer_node ***mapped_buffers,
-			 int *num_buffers);
+/* get reference to a snapshot of all currently mapped buffers */
+int gk20a_vm_get_buffer_set(struct vm_gk20a *vm,
+			    struct gk20a_vm_buffer_set **buffer_set);
+
+/* put reference on the given snapshot */
+void gk20a_vm_put_buffer_set(struct vm_gk20a *vm,
+			     struct gk20a_vm_buffer_set *buffer_set);
 
-/* put references on the given buffers */
-void gk20a_vm_put_buffers(struct vm_gk20a *vm,
-			  struct mapped_buffer_node **mapped_buffers,
-			  int num_buffers);
+/* drop the cached snapshot after the user mappings changed */
+void gk20a_vm_invalidate_buffer_set_locked(struct vm_gk20a *vm);
 
 /* invalidate tlbs for the vm area */
 void gk20a_mm_tlb_invalidate(struct vm_gk20a *vm);
@@ -757,6 +887,9 @@ void gk20a_vm_mapping_batch_finish(
 void gk20a_vm_mapping_batch_finish_locked(
 	struct vm_gk20a *vm, struct vm_gk20a_mapping_batch *batch);
 
+/* tlb_stats accounting, for HALs that invalidate without tlb_invalidate */
+void gk20a_vm_tlb_stats_requested(struct vm_gk20a *vm);
+void gk20a_vm_tlb_stats_issued(struct vm_gk20a *vm);
 
 int gk20a_vidmem_buf_alloc(struct gk20a *g, size_t bytes);
 int gk20a_vidmem_get_space(struct gk20a *g, u64 *space);
@@ -789,6 +922,8 @@ int gk20a_vm_unmap_buffer(struct vm_gk20a *vm, u64 offset,
 			  struct vm_gk20a_mapping_batch *batch);
 void gk20a_get_comptags(struct device *dev, struct dma_buf *dmabuf,
 			struct gk20a_comptags *comptags);
+u64 gk20a_ctag_clear_queue(struct gk20a *g, u32 min, u32 max);
+void gk20a_ctag_clear_wait(struct gk20a *g, u64 ticket);
 dma_addr_t gk20a_mm_gpuva_to_iova_base(struct vm_gk20a *vm, u64 gpu_vaddr);
 
 int gk20a_dmabuf_alloc_drvdata(struct dma_buf *dmabuf, struct device *dev);
@@ -83,6 +83,22 @@ struct page_alloc_chunk {
 	u64 length;
 };
 
+/*
+ * Recently freed chunks are kept in a small cache, one bucket per power of two
+ * multiple of the page size, before being handed back to the source buddy
+ * allocator. Vidmem churn tends to free and re-allocate the same sizes so this
+ * lets most chunk allocs skip the buddy allocator entirely. Cached chunks are
+ * still allocated as far as the buddy allocator is concerned; the cache is
+ * drained whenever the buddy allocator can't satisfy a request.
+ */
+#define PAGE_ALLOC_CACHE_ORDERS		4
+#define PAGE_ALLOC_CACHE_DEPTH		16
+
+struct page_alloc_free_cache {
+	u64 chunks[PAGE_ALLOC_CACHE_DEPTH];
+	int nr;
+};
+
 /*
  * Struct to handle internal management of page allocation. It holds a list
  * of the chunks of pages that make up the overall allocation - much like a
@@ -134,6 +150,9 @@ struct gk20a_page_allocator {
 	struct page_alloc_slab *slabs;
 	int nr_slabs;
 
+	struct page_alloc_free_cache free_cache[PAGE_ALLOC_CACHE_ORDERS];
+	u64 cached_bytes;
+
 	u64 flags;
 
 	/*
@@ -147,6 +166,9 @@ struct gk20a_page_allocator {
 	u64 nr_slab_frees;
 	u64 pages_alloced;
 	u64 pages_freed;
+	u64 nr_cache_hits;
+	u64 nr_cache_misses;
+	u64 nr_cache_drains;
 };
 
 static inline struct gk20a_page_allocator *page_allocator(
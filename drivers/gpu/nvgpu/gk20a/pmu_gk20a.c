@@ -22,6 +22,7 @@
 #include <linux/module.h>
 #include <linux/debugfs.h>
 #include <linux/dma-mapping.h>
+#include <linux/random.h>
 #include <linux/uaccess.h>
 
 #include <nvgpu/timers.h>
@@ -43,6 +44,9 @@
 #define PMU_MEM_SCRUBBING_TIMEOUT_MAX 1000
 #define PMU_MEM_SCRUBBING_TIMEOUT_DEFAULT 10
 
+/* longest sleep between inline checks when waiting for PMU messages */
+#define PMU_MSG_WAIT_SLICE_MS 10
+
 #define gk20a_dbg_pmu(fmt, arg...) \
 	gk20a_dbg(gpu_dbg_pmu, fmt, ##arg)
 
@@ -1366,7 +1370,8 @@ int gk20a_init_pmu(struct pmu_gk20a *pmu)
 	mutex_init(&pmu->elpg_mutex);
 	mutex_init(&pmu->isr_mutex);
 	mutex_init(&pmu->pmu_copy_lock);
-	mutex_init(&pmu->pmu_seq_lock);
+	spin_lock_init(&pmu->dmem_ring.lock);
+	init_waitqueue_head(&pmu->msg_wq);
 
 	pmu->remove_support = gk20a_remove_pmu_support;
 
@@ -2012,13 +2017,32 @@ int gk20a_init_pmu(struct pmu_gk20a *pmu)
 	return 0;
 }
 
+static void pmu_account_dmem_xfer(struct pmu_gk20a *pmu, int dir,
+		u32 size, s64 start_ns)
+{
+	struct pmu_dmem_xfer_stats *stats;
+	u32 bucket = min_t(u32, ilog2(size), PMU_DMEM_XFER_BUCKETS - 1);
+
+	stats = &pmu->dmem_xfer_stats[dir][bucket];
+	stats->count++;
+	stats->bytes += size;
+	stats->ns += ktime_to_ns(ktime_get()) - start_ns;
+}
+
+/*
+ * DMEMD accesses below go to a single register and are ordered by the
+ * device mapping, so they are issued relaxed with one barrier per copy
+ * instead of one per word.
+ */
 void pmu_copy_from_dmem(struct pmu_gk20a *pmu,
 		u32 src, u8 *dst, u32 size, u8 port)
 {
 	struct gk20a *g = gk20a_from_pmu(pmu);
+	void __iomem *dmemd = g->regs + pwr_falcon_dmemd_r(port);
 	u32 i, words, bytes;
 	u32 data, addr_mask;
 	u32 *dst_u32 = (u32*)dst;
+	s64 start_ns;
 
 	if (size == 0) {
 		gk20a_err(dev_from_gk20a(g),
@@ -2033,6 +2057,7 @@ void pmu_copy_from_dmem(struct pmu_gk20a *pmu,
 	}
 
 	mutex_lock(&pmu->pmu_copy_lock);
+	start_ns = ktime_to_ns(ktime_get());
 
 	words = size >> 2;
 	bytes = size & 0x3;
@@ -2046,14 +2071,17 @@ void pmu_copy_from_dmem(struct pmu_gk20a *pmu,
 		src | pwr_falcon_dmemc_aincr_f(1));
 
 	for (i = 0; i < words; i++)
-		dst_u32[i] = gk20a_readl(g, pwr_falcon_dmemd_r(port));
+		dst_u32[i] = readl_relaxed(dmemd);
 
 	if (bytes > 0) {
-		data = gk20a_readl(g, pwr_falcon_dmemd_r(port));
+		data = readl_relaxed(dmemd);
 		for (i = 0; i < bytes; i++) {
 			dst[(words << 2) + i] = ((u8 *)&data)[i];
 		}
 	}
+	rmb();
+
+	pmu_account_dmem_xfer(pmu, PMU_DMEM_XFER_READ, size, start_ns);
 	mutex_unlock(&pmu->pmu_copy_lock);
 	return;
 }
@@ -2062,9 +2090,11 @@ void pmu_copy_to_dmem(struct pmu_gk20a *pmu,
 		u32 dst, u8 *src, u32 size, u8 port)
 {
 	struct gk20a *g = gk20a_from_pmu(pmu);
+	void __iomem *dmemd = g->regs + pwr_falcon_dmemd_r(port);
 	u32 i, words, bytes;
 	u32 data, addr_mask;
 	u32 *src_u32 = (u32*)src;
+	s64 start_ns;
 
 	if (size == 0) {
 		gk20a_err(dev_from_gk20a(g),
@@ -2079,6 +2109,7 @@ void pmu_copy_to_dmem(struct pmu_gk20a *pmu,
 	}
 
 	mutex_lock(&pmu->pmu_copy_lock);
+	start_ns = ktime_to_ns(ktime_get());
 
 	words = size >> 2;
 	bytes = size & 0x3;
@@ -2092,14 +2123,15 @@ void pmu_copy_to_dmem(struct pmu_gk20a *pmu,
 		dst | pwr_falcon_dmemc_aincw_f(1));
 
 	for (i = 0; i < words; i++)
-		gk20a_writel(g, pwr_falcon_dmemd_r(port), src_u32[i]);
+		writel_relaxed(src_u32[i], dmemd);
 
 	if (bytes > 0) {
 		data = 0;
 		for (i = 0; i < bytes; i++)
 			((u8 *)&data)[i] = src[(words << 2) + i];
-		gk20a_writel(g, pwr_falcon_dmemd_r(port), data);
+		writel_relaxed(data, dmemd);
 	}
+	wmb();
 
 	data = gk20a_readl(g, pwr_falcon_dmemc_r(port)) & addr_mask;
 	size = ALIGN(size, 4);
@@ -2108,6 +2140,8 @@ void pmu_copy_to_dmem(struct pmu_gk20a *pmu,
 			"copy failed. bytes written %d, expected %d",
 			data - dst, size);
 	}
+
+	pmu_account_dmem_xfer(pmu, PMU_DMEM_XFER_WRITE, size, start_ns);
 	mutex_unlock(&pmu->pmu_copy_lock);
 	return;
 }
@@ -2405,6 +2439,12 @@ void pmu_seq_init(struct pmu_gk20a *pmu)
 
 	for (i = 0; i < PMU_MAX_NUM_SEQUENCES; i++)
 		pmu->seq[i].id = i;
+
+	/* payloads of the old sequences are gone with them */
+	pmu->dmem_ring.head = 0;
+	pmu->dmem_ring.tail = 0;
+	pmu->dmem_ring.ent_head = 0;
+	pmu->dmem_ring.ent_tail = 0;
 }
 
 static int pmu_seq_acquire(struct pmu_gk20a *pmu,
@@ -2414,17 +2454,16 @@ static int pmu_seq_acquire(struct pmu_gk20a *pmu,
 	struct pmu_sequence *seq;
 	u32 index;
 
-	mutex_lock(&pmu->pmu_seq_lock);
-	index = find_first_zero_bit(pmu->pmu_seq_tbl,
-				sizeof(pmu->pmu_seq_tbl));
-	if (index >= sizeof(pmu->pmu_seq_tbl)) {
-		gk20a_err(dev_from_gk20a(g),
-			"no free sequence available");
-		mutex_unlock(&pmu->pmu_seq_lock);
-		return -EAGAIN;
-	}
-	set_bit(index, pmu->pmu_seq_tbl);
-	mutex_unlock(&pmu->pmu_seq_lock);
+	/* retry if a concurrent caller grabbed the same bit */
+	do {
+		index = find_first_zero_bit(pmu->pmu_seq_tbl,
+					PMU_MAX_NUM_SEQUENCES);
+		if (index >= PMU_MAX_NUM_SEQUENCES) {
+			gk20a_err(dev_from_gk20a(g),
+				"no free sequence available");
+			return -EAGAIN;
+		}
+	} while (test_and_set_bit_lock(index, pmu->pmu_seq_tbl));
 
 	seq = &pmu->seq[index];
 	seq->state = PMU_SEQ_STATE_PENDING;
@@ -2448,7 +2487,98 @@ static void pmu_seq_release(struct pmu_gk20a *pmu,
 	g->ops.pmu_ver.pmu_allocation_set_dmem_size(pmu,
 		g->ops.pmu_ver.get_pmu_seq_out_a_ptr(seq), 0);
 
-	clear_bit(seq->id, pmu->pmu_seq_tbl);
+	clear_bit_unlock(seq->id, pmu->pmu_seq_tbl);
+}
+
+static u32 pmu_dmem_ring_alloc(struct pmu_dmem_ring *ring, u32 size)
+{
+	u32 offset, addr = 0;
+
+	size = ALIGN(size, PMU_DMEM_ALLOC_ALIGNMENT);
+
+	spin_lock(&ring->lock);
+	if (!ring->size ||
+	    ring->ent_head - ring->ent_tail == PMU_DMEM_RING_ENTRIES)
+		goto out;
+
+	if (ring->head >= ring->tail) {
+		/* space up to the end, otherwise wrap to the start */
+		if (ring->head + size <= ring->size)
+			offset = ring->head;
+		else if (size < ring->tail)
+			offset = 0;
+		else
+			goto out;
+	} else if (ring->head + size < ring->tail) {
+		offset = ring->head;
+	} else {
+		goto out;
+	}
+
+	ring->ent[ring->ent_head % PMU_DMEM_RING_ENTRIES].offset = offset;
+	ring->ent[ring->ent_head % PMU_DMEM_RING_ENTRIES].freed = false;
+	ring->ent_head++;
+	ring->head = offset + size;
+	addr = ring->base + offset;
+out:
+	spin_unlock(&ring->lock);
+	return addr;
+}
+
+/* returns false if addr does not belong to the ring */
+static bool pmu_dmem_ring_free(struct pmu_dmem_ring *ring, u32 addr)
+{
+	u32 i, offset;
+
+	if (!ring->size || addr < ring->base || addr >= ring->base + ring->size)
+		return false;
+
+	offset = addr - ring->base;
+
+	spin_lock(&ring->lock);
+	for (i = ring->ent_tail; i != ring->ent_head; i++) {
+		if (ring->ent[i % PMU_DMEM_RING_ENTRIES].offset == offset &&
+		    !ring->ent[i % PMU_DMEM_RING_ENTRIES].freed) {
+			ring->ent[i % PMU_DMEM_RING_ENTRIES].freed = true;
+			break;
+		}
+	}
+	WARN_ON(i == ring->ent_head);
+
+	while (ring->ent_tail != ring->ent_head &&
+	       ring->ent[ring->ent_tail % PMU_DMEM_RING_ENTRIES].freed)
+		ring->ent_tail++;
+
+	if (ring->ent_tail == ring->ent_head) {
+		ring->head = 0;
+		ring->tail = 0;
+	} else {
+		ring->tail =
+			ring->ent[ring->ent_tail % PMU_DMEM_RING_ENTRIES].offset;
+	}
+	spin_unlock(&ring->lock);
+
+	return true;
+}
+
+/* small command payloads come from the ring, the heap is the fallback */
+static u32 pmu_payload_dmem_alloc(struct pmu_gk20a *pmu, u32 size)
+{
+	u32 addr = 0;
+
+	if (size <= PMU_DMEM_RING_MAX_PAYLOAD)
+		addr = pmu_dmem_ring_alloc(&pmu->dmem_ring, size);
+
+	if (!addr)
+		addr = (u32)gk20a_alloc(&pmu->dmem, size);
+
+	return addr;
+}
+
+static void pmu_payload_dmem_free(struct pmu_gk20a *pmu, u32 addr)
+{
+	if (!pmu_dmem_ring_free(&pmu->dmem_ring, addr))
+		gk20a_free(&pmu->dmem, addr);
 }
 
 static int pmu_queue_init(struct pmu_gk20a *pmu,
@@ -3390,8 +3520,11 @@ static int pmu_init_powergating(struct gk20a *g)
 {
 	struct pmu_gk20a *pmu = &g->pmu;
 	struct pmu_cmd cmd;
+	struct pmu_cmd elpg_cmd[2];
+	struct pmu_cmd_batch batch[2];
 	u32 seq;
 	u32 gr_engine_id;
+	u32 i;
 
 	gk20a_dbg_fn("");
 
@@ -3417,17 +3550,31 @@ static int pmu_init_powergating(struct gk20a *g)
 		g->ops.pmu.pmu_pg_grinit_param(g,
 			PMU_PG_FEATURE_GR_POWER_GATING_ENABLED);
 
-	/* init ELPG */
-	memset(&cmd, 0, sizeof(struct pmu_cmd));
-	cmd.hdr.unit_id = PMU_UNIT_PG;
-	cmd.hdr.size = PMU_CMD_HDR_SIZE + sizeof(struct pmu_pg_cmd_elpg_cmd);
-	cmd.cmd.pg.elpg_cmd.cmd_type = PMU_PG_CMD_ID_ELPG_CMD;
-	cmd.cmd.pg.elpg_cmd.engine_id = gr_engine_id;
-	cmd.cmd.pg.elpg_cmd.cmd = PMU_PG_ELPG_CMD_INIT;
+	/*
+	 * init ELPG, then disallow it initially, as the PMU ucode requires a
+	 * disallow cmd before allow cmd. Both go to the HPQ in one batch,
+	 * ahead of the LPQ stat cmd below as the PMU would take them anyway.
+	 */
+	memset(elpg_cmd, 0, sizeof(elpg_cmd));
+	memset(batch, 0, sizeof(batch));
+	for (i = 0; i < ARRAY_SIZE(elpg_cmd); i++) {
+		elpg_cmd[i].hdr.unit_id = PMU_UNIT_PG;
+		elpg_cmd[i].hdr.size = PMU_CMD_HDR_SIZE +
+			sizeof(struct pmu_pg_cmd_elpg_cmd);
+		elpg_cmd[i].cmd.pg.elpg_cmd.cmd_type = PMU_PG_CMD_ID_ELPG_CMD;
+		elpg_cmd[i].cmd.pg.elpg_cmd.engine_id = gr_engine_id;
+		batch[i].cmd = &elpg_cmd[i];
+		batch[i].callback = pmu_handle_pg_elpg_msg;
+		batch[i].cb_param = pmu;
+	}
+	elpg_cmd[0].cmd.pg.elpg_cmd.cmd = PMU_PG_ELPG_CMD_INIT;
+	elpg_cmd[1].cmd.pg.elpg_cmd.cmd = PMU_PG_ELPG_CMD_DISALLOW;
 
-	gk20a_dbg_pmu("cmd post PMU_PG_ELPG_CMD_INIT");
-	gk20a_pmu_cmd_post(g, &cmd, NULL, NULL, PMU_COMMAND_QUEUE_HPQ,
-			pmu_handle_pg_elpg_msg, pmu, &seq, ~0);
+	pmu->elpg_stat = PMU_ELPG_STAT_OFF; /* set for wait_event PMU_ELPG_STAT_OFF */
+
+	gk20a_dbg_pmu("cmd post PMU_PG_ELPG_CMD_INIT, PMU_PG_ELPG_CMD_DISALLOW");
+	gk20a_pmu_cmd_post_batch(g, batch, ARRAY_SIZE(batch),
+			PMU_COMMAND_QUEUE_HPQ, ~0);
 
 	/* alloc dmem for powergating state log */
 	pmu->stat_dmem_offset = 0;
@@ -3443,20 +3590,6 @@ static int pmu_init_powergating(struct gk20a *g)
 	gk20a_pmu_cmd_post(g, &cmd, NULL, NULL, PMU_COMMAND_QUEUE_LPQ,
 			pmu_handle_pg_stat_msg, pmu, &seq, ~0);
 
-	/* disallow ELPG initially
-	   PMU ucode requires a disallow cmd before allow cmd */
-	pmu->elpg_stat = PMU_ELPG_STAT_OFF; /* set for wait_event PMU_ELPG_STAT_OFF */
-	memset(&cmd, 0, sizeof(struct pmu_cmd));
-	cmd.hdr.unit_id = PMU_UNIT_PG;
-	cmd.hdr.size = PMU_CMD_HDR_SIZE + sizeof(struct pmu_pg_cmd_elpg_cmd);
-	cmd.cmd.pg.elpg_cmd.cmd_type = PMU_PG_CMD_ID_ELPG_CMD;
-	cmd.cmd.pg.elpg_cmd.engine_id = gr_engine_id;
-	cmd.cmd.pg.elpg_cmd.cmd = PMU_PG_ELPG_CMD_DISALLOW;
-
-	gk20a_dbg_pmu("cmd post PMU_PG_ELPG_CMD_DISALLOW");
-	gk20a_pmu_cmd_post(g, &cmd, NULL, NULL, PMU_COMMAND_QUEUE_HPQ,
-			pmu_handle_pg_elpg_msg, pmu, &seq, ~0);
-
 	if (pmu->pmu_state == PMU_STATE_INIT_RECEIVED)
 		pmu->pmu_state = PMU_STATE_ELPG_BOOTING;
 
@@ -3663,6 +3796,16 @@ static int pmu_process_init_msg(struct pmu_gk20a *pmu,
 		gk20a_bitmap_allocator_init(g, &pmu->dmem, "gk20a_pmu_dmem",
 					   start, size,
 					   PMU_DMEM_ALLOC_ALIGNMENT, 0);
+
+		/* a small slice of the heap backs the payload ring */
+		pmu->dmem_ring.size = min_t(u32,
+			PMU_DMEM_RING_ENTRIES * PMU_DMEM_RING_MAX_PAYLOAD,
+			size / PMU_DMEM_RING_HEAP_FRACTION) &
+			~(PMU_DMEM_ALLOC_ALIGNMENT - 1);
+		pmu->dmem_ring.base = (u32)gk20a_alloc(&pmu->dmem,
+					pmu->dmem_ring.size);
+		if (!pmu->dmem_ring.base)
+			pmu->dmem_ring.size = 0;
 	}
 
 	pmu->pmu_ready = true;
@@ -3753,6 +3896,62 @@ clean_up:
 	return false;
 }
 
+static void pmu_account_cmd_latency(struct pmu_gk20a *pmu,
+			struct pmu_sequence *seq)
+{
+	s64 us = ktime_us_delta(ktime_get(), seq->post_time);
+	u32 bucket = us > 0 ? ilog2(us) : 0;
+
+	bucket = min_t(u32, bucket, PMU_CMD_LATENCY_BUCKETS - 1);
+	pmu->cmd_latency_hist[bucket]++;
+}
+
+static void pmu_seq_free_payload(struct pmu_gk20a *pmu,
+			struct pmu_sequence *seq)
+{
+	struct gk20a *g = gk20a_from_pmu(pmu);
+	struct pmu_v *pv = &g->ops.pmu_ver;
+	bool in_dmem = pv->pmu_allocation_get_dmem_size(pmu,
+			pv->get_pmu_seq_in_a_ptr(seq)) != 0;
+
+	if (in_dmem)
+		pmu_payload_dmem_free(pmu,
+			pv->pmu_allocation_get_dmem_offset(pmu,
+			pv->get_pmu_seq_in_a_ptr(seq)));
+	/* out may just alias in when the payload buffers are the same */
+	if (pv->pmu_allocation_get_dmem_size(pmu,
+			pv->get_pmu_seq_out_a_ptr(seq)) != 0 &&
+	    !(in_dmem && pv->pmu_allocation_get_dmem_offset(pmu,
+			pv->get_pmu_seq_out_a_ptr(seq)) ==
+	      pv->pmu_allocation_get_dmem_offset(pmu,
+			pv->get_pmu_seq_in_a_ptr(seq))))
+		pmu_payload_dmem_free(pmu,
+			pv->pmu_allocation_get_dmem_offset(pmu,
+			pv->get_pmu_seq_out_a_ptr(seq)));
+
+	if (seq->out_mem != NULL) {
+		memset(pv->pmu_allocation_get_fb_addr(pmu,
+			pv->get_pmu_seq_out_a_ptr(seq)), 0x0,
+			pv->pmu_allocation_get_fb_size(pmu,
+				pv->get_pmu_seq_out_a_ptr(seq)));
+
+		/* out_mem may just alias in_mem */
+		if (seq->out_mem != seq->in_mem)
+			gk20a_pmu_surface_free(g, seq->out_mem);
+		seq->out_mem = NULL;
+	}
+
+	if (seq->in_mem != NULL) {
+		memset(pv->pmu_allocation_get_fb_addr(pmu,
+			pv->get_pmu_seq_in_a_ptr(seq)), 0x0,
+			pv->pmu_allocation_get_fb_size(pmu,
+				pv->get_pmu_seq_in_a_ptr(seq)));
+
+		gk20a_pmu_surface_free(g, seq->in_mem);
+		seq->in_mem = NULL;
+	}
+}
+
 static int pmu_response_handle(struct pmu_gk20a *pmu,
 			struct pmu_msg *msg)
 {
@@ -3797,40 +3996,10 @@ static int pmu_response_handle(struct pmu_gk20a *pmu,
 		}
 	} else
 		seq->callback = NULL;
-	if (pv->pmu_allocation_get_dmem_size(pmu,
-			pv->get_pmu_seq_in_a_ptr(seq)) != 0)
-		gk20a_free(&pmu->dmem,
-			pv->pmu_allocation_get_dmem_offset(pmu,
-			pv->get_pmu_seq_in_a_ptr(seq)));
-	if (pv->pmu_allocation_get_dmem_size(pmu,
-			pv->get_pmu_seq_out_a_ptr(seq)) != 0)
-		gk20a_free(&pmu->dmem,
-			pv->pmu_allocation_get_dmem_offset(pmu,
-			pv->get_pmu_seq_out_a_ptr(seq)));
-
-	if (seq->out_mem != NULL) {
-		memset(pv->pmu_allocation_get_fb_addr(pmu,
-			pv->get_pmu_seq_out_a_ptr(seq)), 0x0,
-			pv->pmu_allocation_get_fb_size(pmu,
-				pv->get_pmu_seq_out_a_ptr(seq)));
 
-		gk20a_pmu_surface_free(g, seq->out_mem);
-		if (seq->out_mem != seq->in_mem)
-			kfree(seq->out_mem);
-		else
-			seq->out_mem = NULL;
-	}
+	pmu_seq_free_payload(pmu, seq);
 
-	if (seq->in_mem != NULL) {
-		memset(pv->pmu_allocation_get_fb_addr(pmu,
-			pv->get_pmu_seq_in_a_ptr(seq)), 0x0,
-			pv->pmu_allocation_get_fb_size(pmu,
-				pv->get_pmu_seq_in_a_ptr(seq)));
-
-		gk20a_pmu_surface_free(g, seq->in_mem);
-		kfree(seq->in_mem);
-		seq->in_mem = NULL;
-	}
+	pmu_account_cmd_latency(pmu, seq);
 
 	if (seq->callback)
 		seq->callback(g, msg, seq->cb_params, seq->desc, ret);
@@ -4011,6 +4180,7 @@ static int pmu_process_message(struct pmu_gk20a *pmu)
 			g->ops.pmu.init_wpr_region(g);
 		pmu_init_perfmon(pmu);
 
+		wake_up_all(&pmu->msg_wq);
 		return 0;
 	}
 
@@ -4032,9 +4202,19 @@ static int pmu_process_message(struct pmu_gk20a *pmu)
 		}
 	}
 
+	wake_up_all(&pmu->msg_wq);
+
 	return 0;
 }
 
+/*
+ * Waits for the PMU message handler to set *var to val. The handler wakes
+ * up msg_wq from the interrupt thread, so normally we just sleep on it.
+ * When the interrupt cannot reach us (PMU ISR disabled, or we are the
+ * stalling interrupt thread ourselves) the ISR is serviced inline with a
+ * backoff poll. Each wait slice also ends with an inline check, in case
+ * the interrupt thread is blocked on a lock held by our caller.
+ */
 int pmu_wait_message_cond(struct pmu_gk20a *pmu, u32 timeout_ms,
 				 u32 *var, u32 val)
 {
@@ -4042,22 +4222,35 @@ int pmu_wait_message_cond(struct pmu_gk20a *pmu, u32 timeout_ms,
 	struct nvgpu_timeout timeout;
 	unsigned long delay = GR_IDLE_CHECK_DEFAULT;
 	u32 servicedpmuint;
+	bool use_irq;
 
 	servicedpmuint = pwr_falcon_irqstat_halt_true_f() |
 				pwr_falcon_irqstat_exterr_true_f() |
 				pwr_falcon_irqstat_swgen0_true_f();
 
+	use_irq = pmu->isr_enabled && current != g->intr_stall_task;
+
 	nvgpu_timeout_init(g, &timeout, (int)timeout_ms, NVGPU_TIMER_CPU_TIMER);
 
 	do {
-		if (*var == val)
+		if (ACCESS_ONCE(*var) == val) {
+			atomic_inc(use_irq ? &pmu->msg_wait_irq :
+					&pmu->msg_wait_polled);
 			return 0;
+		}
+
+		if (use_irq && wait_event_timeout(pmu->msg_wq,
+				ACCESS_ONCE(*var) == val,
+				msecs_to_jiffies(PMU_MSG_WAIT_SLICE_MS)))
+			continue;
 
 		if (gk20a_readl(g, pwr_falcon_irqstat_r()) & servicedpmuint)
 			gk20a_pmu_isr(g);
 
-		usleep_range(delay, delay * 2);
-		delay = min_t(u32, delay << 1, GR_IDLE_CHECK_MAX);
+		if (!use_irq) {
+			usleep_range(delay, delay * 2);
+			delay = min_t(u32, delay << 1, GR_IDLE_CHECK_MAX);
+		}
 	} while (!nvgpu_timeout_check(&timeout));
 
 	return -ETIMEDOUT;
@@ -4394,27 +4587,41 @@ invalid_cmd:
 	return false;
 }
 
-static int pmu_write_cmd(struct pmu_gk20a *pmu, struct pmu_cmd *cmd,
-			u32 queue_id, unsigned long timeout_ms)
+/* open the queue for write, waiting for the PMU to free up space */
+static int pmu_queue_open_write_timeout(struct pmu_gk20a *pmu,
+			struct pmu_queue *queue, u32 size,
+			unsigned long timeout_ms)
 {
 	struct gk20a *g = gk20a_from_pmu(pmu);
-	struct pmu_queue *queue;
 	struct nvgpu_timeout timeout;
 	int err;
 
-	gk20a_dbg_fn("");
-
-	queue = &pmu->queue[queue_id];
 	nvgpu_timeout_init(g, &timeout, (int)timeout_ms, NVGPU_TIMER_CPU_TIMER);
 
 	do {
-		err = pmu_queue_open_write(pmu, queue, cmd->hdr.size);
+		err = pmu_queue_open_write(pmu, queue, size);
 		if (err == -EAGAIN && !nvgpu_timeout_check(&timeout))
 			usleep_range(1000, 2000);
 		else
 			break;
 	} while (1);
 
+	return err;
+}
+
+static int pmu_write_cmd(struct pmu_gk20a *pmu, struct pmu_cmd *cmd,
+			u32 queue_id, unsigned long timeout_ms)
+{
+	struct gk20a *g = gk20a_from_pmu(pmu);
+	struct pmu_queue *queue;
+	int err;
+
+	gk20a_dbg_fn("");
+
+	queue = &pmu->queue[queue_id];
+
+	err = pmu_queue_open_write_timeout(pmu, queue, cmd->hdr.size,
+					timeout_ms);
 	if (err)
 		goto clean_up;
 
@@ -4480,10 +4687,14 @@ void gk20a_pmu_surface_free(struct gk20a *g, struct mem_desc *mem)
 	memset(mem, 0, sizeof(struct mem_desc));
 }
 
-int gk20a_pmu_cmd_post(struct gk20a *g, struct pmu_cmd *cmd,
+/*
+ * Validates the command, picks a sequence for it and stages its payload.
+ * The sequence is left in PMU_SEQ_STATE_PENDING.
+ */
+static int pmu_cmd_prepare(struct gk20a *g, struct pmu_cmd *cmd,
 		struct pmu_msg *msg, struct pmu_payload *payload,
-		u32 queue_id, pmu_callback callback, void* cb_param,
-		u32 *seq_desc, unsigned long timeout)
+		u32 queue_id, pmu_callback callback, void *cb_param,
+		u32 *seq_desc, struct pmu_sequence **pseq)
 {
 	struct pmu_gk20a *pmu = &g->pmu;
 	struct pmu_v *pv = &g->ops.pmu_ver;
@@ -4544,19 +4755,15 @@ int gk20a_pmu_cmd_post(struct gk20a *g, struct pmu_cmd *cmd,
 			(u16)max(payload->in.size, payload->out.size));
 
 		*(pv->pmu_allocation_get_dmem_offset_addr(pmu, in)) =
-			gk20a_alloc(&pmu->dmem,
+			pmu_payload_dmem_alloc(pmu,
 				     pv->pmu_allocation_get_dmem_size(pmu, in));
-		if (!*(pv->pmu_allocation_get_dmem_offset_addr(pmu, in)))
+		if (!*(pv->pmu_allocation_get_dmem_offset_addr(pmu, in))) {
+			err = -ENOMEM;
 			goto clean_up;
+		}
 
 		if (payload->in.fb_size != 0x0) {
-			seq->in_mem = kzalloc(sizeof(struct mem_desc),
-				GFP_KERNEL);
-			if (!seq->in_mem) {
-				err = -ENOMEM;
-				goto clean_up;
-			}
-
+			seq->in_mem = &seq->in_mem_desc;
 			gk20a_pmu_vidmem_surface_alloc(g, seq->in_mem,
 					payload->in.fb_size);
 			gk20a_pmu_surface_describe(g, seq->in_mem,
@@ -4587,19 +4794,16 @@ int gk20a_pmu_cmd_post(struct gk20a *g, struct pmu_cmd *cmd,
 
 		if (payload->in.buf != payload->out.buf) {
 			*(pv->pmu_allocation_get_dmem_offset_addr(pmu, out)) =
-				gk20a_alloc(&pmu->dmem,
+				pmu_payload_dmem_alloc(pmu,
 				    pv->pmu_allocation_get_dmem_size(pmu, out));
 			if (!*(pv->pmu_allocation_get_dmem_offset_addr(pmu,
-					out)))
+					out))) {
+				err = -ENOMEM;
 				goto clean_up;
+			}
 
 			if (payload->out.fb_size != 0x0) {
-				seq->out_mem = kzalloc(sizeof(struct mem_desc),
-					GFP_KERNEL);
-				if (!seq->out_mem) {
-					err = -ENOMEM;
-					goto clean_up;
-				}
+				seq->out_mem = &seq->out_mem_desc;
 				gk20a_pmu_vidmem_surface_alloc(g, seq->out_mem,
 					payload->out.fb_size);
 				gk20a_pmu_surface_describe(g, seq->out_mem,
@@ -4622,9 +4826,54 @@ int gk20a_pmu_cmd_post(struct gk20a *g, struct pmu_cmd *cmd,
 
 	}
 
+	*pseq = seq;
+	return 0;
+
+clean_up:
+	gk20a_dbg_fn("fail");
+	if (in && pv->pmu_allocation_get_dmem_offset(pmu, in))
+		pmu_payload_dmem_free(pmu,
+			pv->pmu_allocation_get_dmem_offset(pmu, in));
+	if (out && pv->pmu_allocation_get_dmem_offset(pmu, out) &&
+	    payload->in.buf != payload->out.buf)
+		pmu_payload_dmem_free(pmu,
+			pv->pmu_allocation_get_dmem_offset(pmu, out));
+	if (seq->in_mem)
+		gk20a_pmu_surface_free(g, seq->in_mem);
+	if (seq->out_mem && seq->out_mem != seq->in_mem)
+		gk20a_pmu_surface_free(g, seq->out_mem);
+	seq->in_mem = NULL;
+	seq->out_mem = NULL;
+
+	pmu_seq_release(pmu, seq);
+	return err;
+}
 
+/* undoes pmu_cmd_prepare() for a command that was never sent */
+static void pmu_cmd_drop(struct pmu_gk20a *pmu, struct pmu_sequence *seq)
+{
+	pmu_seq_free_payload(pmu, seq);
+	pmu_seq_release(pmu, seq);
+}
+
+int gk20a_pmu_cmd_post(struct gk20a *g, struct pmu_cmd *cmd,
+		struct pmu_msg *msg, struct pmu_payload *payload,
+		u32 queue_id, pmu_callback callback, void* cb_param,
+		u32 *seq_desc, unsigned long timeout)
+{
+	struct pmu_gk20a *pmu = &g->pmu;
+	struct pmu_sequence *seq;
+	int err;
+
+	gk20a_dbg_fn("");
+
+	err = pmu_cmd_prepare(g, cmd, msg, payload, queue_id,
+			callback, cb_param, seq_desc, &seq);
+	if (err)
+		return err;
 
 	seq->state = PMU_SEQ_STATE_USED;
+	seq->post_time = ktime_get();
 
 	err = pmu_write_cmd(pmu, cmd, queue_id, timeout);
 	if (err)
@@ -4633,17 +4882,84 @@ int gk20a_pmu_cmd_post(struct gk20a *g, struct pmu_cmd *cmd,
 	gk20a_dbg_fn("done");
 
 	return 0;
+}
 
-clean_up:
-	gk20a_dbg_fn("fail");
-	if (in)
-		gk20a_free(&pmu->dmem,
-			pv->pmu_allocation_get_dmem_offset(pmu, in));
-	if (out)
-		gk20a_free(&pmu->dmem,
-			pv->pmu_allocation_get_dmem_offset(pmu, out));
+/*
+ * Posts num commands to queue_id. Commands are pushed in chunks of up to
+ * half the queue and the queue head, which is what the PMU reacts to, is
+ * written once per chunk. On failure the commands not yet pushed are
+ * dropped with their sequences; those already pushed stay in flight.
+ */
+int gk20a_pmu_cmd_post_batch(struct gk20a *g, struct pmu_cmd_batch *batch,
+		u32 num, u32 queue_id, unsigned long timeout)
+{
+	struct pmu_gk20a *pmu = &g->pmu;
+	struct pmu_sequence *seqs[PMU_CMD_BATCH_MAX];
+	struct pmu_queue *queue;
+	u32 i, j, k, size, cmd_size;
+	int err = 0;
 
-	pmu_seq_release(pmu, seq);
+	gk20a_dbg_fn("");
+
+	if (!num || num > PMU_CMD_BATCH_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < num; i++) {
+		err = pmu_cmd_prepare(g, batch[i].cmd, batch[i].msg,
+				batch[i].payload, queue_id,
+				batch[i].callback, batch[i].cb_param,
+				&batch[i].seq_desc, &seqs[i]);
+		if (err)
+			goto clean_up;
+	}
+
+	queue = &pmu->queue[queue_id];
+
+	for (i = 0; i < num; i = j) {
+		size = 0;
+		for (j = i; j < num; j++) {
+			cmd_size = ALIGN(batch[j].cmd->hdr.size,
+					QUEUE_ALIGNMENT);
+			if (j > i && size + cmd_size > queue->size / 2)
+				break;
+			size += cmd_size;
+		}
+
+		err = pmu_queue_open_write_timeout(pmu, queue, size, timeout);
+		if (err) {
+			gk20a_err(dev_from_gk20a(g),
+				"fail to write cmd batch to queue %d",
+				queue_id);
+			goto drop_unsent;
+		}
+
+		for (k = i; k < j; k++) {
+			seqs[k]->state = PMU_SEQ_STATE_USED;
+			seqs[k]->post_time = ktime_get();
+			pmu_queue_push(pmu, queue, batch[k].cmd,
+					batch[k].cmd->hdr.size);
+		}
+
+		/* the head is already committed if only the unlock failed */
+		err = pmu_queue_close(pmu, queue, true);
+		if (err) {
+			i = j;
+			goto drop_unsent;
+		}
+	}
+
+	gk20a_dbg_fn("done");
+
+	return 0;
+
+drop_unsent:
+	for (; i < num; i++)
+		pmu_cmd_drop(pmu, seqs[i]);
+	return err;
+
+clean_up:
+	while (i-- > 0)
+		pmu_cmd_drop(pmu, seqs[i]);
 	return err;
 }
 
@@ -5330,6 +5646,200 @@ static const struct file_operations security_fops = {
 	.release	= single_release,
 };
 
+static int cmd_latency_show(struct seq_file *s, void *data)
+{
+	struct gk20a *g = s->private;
+	struct pmu_gk20a *pmu = &g->pmu;
+	int i;
+
+	seq_printf(s, "irq waits    : %d\n", atomic_read(&pmu->msg_wait_irq));
+	seq_printf(s, "polled waits : %d\n",
+			atomic_read(&pmu->msg_wait_polled));
+	seq_puts(s, "round trip (usec) : commands\n");
+	for (i = 0; i < PMU_CMD_LATENCY_BUCKETS; i++)
+		seq_printf(s, "%8u%s : %u\n", 1 << i,
+			i == PMU_CMD_LATENCY_BUCKETS - 1 ? "+" : " ",
+			pmu->cmd_latency_hist[i]);
+
+	return 0;
+}
+
+static int cmd_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cmd_latency_show, inode->i_private);
+}
+
+static const struct file_operations cmd_latency_fops = {
+	.open		= cmd_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int dmem_xfer_show(struct seq_file *s, void *data)
+{
+	struct gk20a *g = s->private;
+	struct pmu_gk20a *pmu = &g->pmu;
+	struct pmu_dmem_xfer_stats stats;
+	int dir, i;
+
+	seq_puts(s, "dir   size(B)      count        bytes   MB/s\n");
+	for (dir = 0; dir < PMU_DMEM_XFER_DIRS; dir++) {
+		for (i = 0; i < PMU_DMEM_XFER_BUCKETS; i++) {
+			mutex_lock(&pmu->pmu_copy_lock);
+			stats = pmu->dmem_xfer_stats[dir][i];
+			mutex_unlock(&pmu->pmu_copy_lock);
+
+			if (!stats.count)
+				continue;
+
+			seq_printf(s, "%s %8u%s %10llu %12llu %6llu\n",
+				dir == PMU_DMEM_XFER_READ ? "rd " : "wr ",
+				1 << i,
+				i == PMU_DMEM_XFER_BUCKETS - 1 ? "+" : " ",
+				stats.count, stats.bytes,
+				stats.ns ? div64_u64(stats.bytes * 1000,
+							stats.ns) : 0);
+		}
+	}
+
+	return 0;
+}
+
+static int dmem_xfer_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dmem_xfer_show, inode->i_private);
+}
+
+static const struct file_operations dmem_xfer_fops = {
+	.open		= dmem_xfer_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#define DMEM_RING_SELFTEST_BASE	0x800
+#define DMEM_RING_SELFTEST_SIZE	1000
+#define DMEM_RING_SELFTEST_OPS	20000
+
+/*
+ * Pushes and pops random payloads on a scratch DMEM ring, freeing them out
+ * of order, and checks that every payload lands inside the ring, aligned and
+ * clear of the live ones, and that the ring is empty again at the end. The
+ * PMU's own ring is not touched.
+ */
+static int dmem_ring_selftest_show(struct seq_file *s, void *data)
+{
+	struct pmu_dmem_ring *ring;
+	struct {
+		u32 addr;
+		u32 size;
+	} live[PMU_DMEM_RING_ENTRIES];
+	struct rnd_state rnd;
+	u32 seed = prandom_u32();
+	u32 nr_live = 0, i, j, addr, size;
+	u64 pushes = 0, full = 0;
+	int err = 0;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	spin_lock_init(&ring->lock);
+	ring->base = DMEM_RING_SELFTEST_BASE;
+	ring->size = DMEM_RING_SELFTEST_SIZE;
+
+	prandom_seed_state(&rnd, seed);
+	seq_printf(s, "seed: 0x%08x\n", seed);
+
+	for (i = 0; i < DMEM_RING_SELFTEST_OPS && !err; i++) {
+		u32 r = prandom_u32_state(&rnd);
+
+		if (nr_live && (r & 1)) {
+			/* the oldest half the time, any live one otherwise */
+			j = (r & 2) ? 0 : (r >> 2) % nr_live;
+			if (!pmu_dmem_ring_free(ring, live[j].addr)) {
+				seq_printf(s, "op %u: 0x%x not in the ring\n",
+					   i, live[j].addr);
+				err = -EINVAL;
+			}
+			nr_live--;
+			memmove(&live[j], &live[j + 1],
+				(nr_live - j) * sizeof(live[0]));
+			continue;
+		}
+
+		size = 1 + (r >> 2) % PMU_DMEM_RING_MAX_PAYLOAD;
+		addr = pmu_dmem_ring_alloc(ring, size);
+		if (!addr) {
+			if (!nr_live) {
+				seq_printf(s, "op %u: %u bytes refused by an empty ring\n",
+					   i, size);
+				err = -EINVAL;
+			}
+			full++;
+			continue;
+		}
+
+		size = ALIGN(size, PMU_DMEM_ALLOC_ALIGNMENT);
+		if (nr_live == PMU_DMEM_RING_ENTRIES ||
+		    addr % PMU_DMEM_ALLOC_ALIGNMENT ||
+		    addr < ring->base ||
+		    addr + size > ring->base + ring->size) {
+			seq_printf(s, "op %u: bad payload 0x%x+%u\n",
+				   i, addr, size);
+			err = -EINVAL;
+			break;
+		}
+		for (j = 0; j < nr_live; j++) {
+			if (addr < live[j].addr + live[j].size &&
+			    live[j].addr < addr + size) {
+				seq_printf(s, "op %u: 0x%x+%u overlaps 0x%x+%u\n",
+					   i, addr, size, live[j].addr,
+					   live[j].size);
+				err = -EINVAL;
+			}
+		}
+		live[nr_live].addr = addr;
+		live[nr_live].size = size;
+		nr_live++;
+		pushes++;
+	}
+
+	while (nr_live)
+		pmu_dmem_ring_free(ring, live[--nr_live].addr);
+
+	if (!err && (ring->head || ring->tail ||
+		     ring->ent_head != ring->ent_tail)) {
+		seq_printf(s, "not empty at the end: head %u tail %u, %u entries\n",
+			   ring->head, ring->tail,
+			   ring->ent_head - ring->ent_tail);
+		err = -EINVAL;
+	}
+	if (!err && pmu_dmem_ring_free(ring, ring->base + ring->size)) {
+		seq_puts(s, "address past the end taken as a ring payload\n");
+		err = -EINVAL;
+	}
+
+	seq_printf(s, "pushes: %llu, full: %llu\n", pushes, full);
+	seq_printf(s, "%s\n", err ? "FAIL" : "PASS");
+	kfree(ring);
+
+	return 0;
+}
+
+static int dmem_ring_selftest_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dmem_ring_selftest_show, inode->i_private);
+}
+
+static const struct file_operations dmem_ring_selftest_fops = {
+	.open		= dmem_ring_selftest_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 int gk20a_pmu_debugfs_init(struct device *dev)
 {
 	struct dentry *d;
@@ -5371,6 +5881,24 @@ int gk20a_pmu_debugfs_init(struct device *dev)
 						&security_fops);
 	if (!d)
 		goto err_out;
+
+	d = debugfs_create_file(
+		"pmu_cmd_latency", S_IRUGO, platform->debugfs, g,
+						&cmd_latency_fops);
+	if (!d)
+		goto err_out;
+
+	d = debugfs_create_file(
+		"pmu_dmem_xfer", S_IRUGO, platform->debugfs, g,
+						&dmem_xfer_fops);
+	if (!d)
+		goto err_out;
+
+	d = debugfs_create_file(
+		"pmu_dmem_ring_selftest", S_IRUSR, platform->debugfs, g,
+						&dmem_ring_selftest_fops);
+	if (!d)
+		goto err_out;
 	return 0;
 err_out:
 	pr_err("%s: Failed to make debugfs node\n", __func__);
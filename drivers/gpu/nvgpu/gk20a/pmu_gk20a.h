@@ -62,6 +62,22 @@
 #define PMU_MODE_MISMATCH_STATUS_MAILBOX_R  6
 #define PMU_MODE_MISMATCH_STATUS_VAL        0xDEADDEAD
 
+#define PMU_CMD_LATENCY_BUCKETS		16
+#define PMU_DMEM_XFER_BUCKETS		16
+
+enum {
+	PMU_DMEM_XFER_READ = 0,
+	PMU_DMEM_XFER_WRITE,
+	PMU_DMEM_XFER_DIRS,
+};
+
+/* DMEM copies of sizes [2^n, 2^(n+1)) bytes */
+struct pmu_dmem_xfer_stats {
+	u64 count;
+	u64 bytes;
+	u64 ns;
+};
+
 enum {
 	GK20A_PMU_DMAIDX_UCODE		= 0,
 	GK20A_PMU_DMAIDX_VIRT		= 1,
@@ -561,9 +577,56 @@ struct pmu_sequence {
 		struct pmu_allocation_v3 out_v3;
 	};
 	struct mem_desc *out_mem;
+	/* preallocated backing for in_mem/out_mem */
+	struct mem_desc in_mem_desc;
+	struct mem_desc out_mem_desc;
 	u8 *out_payload;
 	pmu_callback callback;
 	void* cb_params;
+	ktime_t post_time;
+};
+
+/*
+ * The ring only serves payloads up to PMU_DMEM_RING_MAX_PAYLOAD bytes (the
+ * perfmon counters and other small in/out structs); boardobj group tables
+ * and anything else bigger go straight to the heap. The ring holds
+ * PMU_DMEM_RING_ENTRIES of those, but never more than
+ * 1/PMU_DMEM_RING_HEAP_FRACTION of the heap.
+ */
+#define PMU_DMEM_RING_MAX_PAYLOAD	64
+#define PMU_DMEM_RING_ENTRIES		32
+#define PMU_DMEM_RING_HEAP_FRACTION	8
+
+/*
+ * Part of the DMEM heap handed out to command payloads in FIFO order.
+ * Payloads may complete out of order, so every allocation is tracked
+ * and the tail only moves over freed entries.
+ */
+struct pmu_dmem_ring {
+	spinlock_t lock;
+	u32 base;
+	u32 size;
+	/* offsets relative to base, head == tail only when empty */
+	u32 head;
+	u32 tail;
+	u32 ent_head;
+	u32 ent_tail;
+	struct {
+		u32 offset;
+		bool freed;
+	} ent[PMU_DMEM_RING_ENTRIES];
+};
+
+#define PMU_CMD_BATCH_MAX		16
+
+/* one command of gk20a_pmu_cmd_post_batch() */
+struct pmu_cmd_batch {
+	struct pmu_cmd *cmd;
+	struct pmu_msg *msg;
+	struct pmu_payload *payload;
+	pmu_callback callback;
+	void *cb_param;
+	u32 seq_desc;
 };
 
 struct pmu_pg_stats_v1 {
@@ -699,9 +762,9 @@ struct pmu_gk20a {
 	u32 mutex_cnt;
 
 	struct mutex pmu_copy_lock;
-	struct mutex pmu_seq_lock;
 
 	struct gk20a_allocator dmem;
+	struct pmu_dmem_ring dmem_ring;
 
 	u32 *ucode_image;
 	bool pmu_ready;
@@ -738,6 +801,16 @@ struct pmu_gk20a {
 	struct mutex isr_mutex;
 	bool isr_enabled;
 
+	/* woken up after messages from PMU have been handled */
+	wait_queue_head_t msg_wq;
+	atomic_t msg_wait_irq;
+	atomic_t msg_wait_polled;
+	/* command round trip latency in log2 buckets of usec */
+	u32 cmd_latency_hist[PMU_CMD_LATENCY_BUCKETS];
+	/* protected by pmu_copy_lock */
+	struct pmu_dmem_xfer_stats
+		dmem_xfer_stats[PMU_DMEM_XFER_DIRS][PMU_DMEM_XFER_BUCKETS];
+
 	bool zbc_ready;
 	union {
 		struct pmu_cmdline_args_v0 args_v0;
@@ -767,6 +840,9 @@ int gk20a_pmu_cmd_post(struct gk20a *g, struct pmu_cmd *cmd, struct pmu_msg *msg
 		struct pmu_payload *payload, u32 queue_id,
 		pmu_callback callback, void* cb_param,
 		u32 *seq_desc, unsigned long timeout);
+/* send several cmds to the same queue, updating the queue head once */
+int gk20a_pmu_cmd_post_batch(struct gk20a *g, struct pmu_cmd_batch *batch,
+		u32 num, u32 queue_id, unsigned long timeout);
 
 int gk20a_pmu_enable_elpg(struct gk20a *g);
 int gk20a_pmu_disable_elpg(struct gk20a *g);
@@ -19,6 +19,7 @@
 #include <linux/slab.h>
 #include <linux/err.h>
 #include <linux/bsearch.h>
+#include <linux/vmalloc.h>
 #include <uapi/linux/nvgpu.h>
 
 #include "gk20a.h"
@@ -555,42 +556,186 @@ static int validate_reg_op_info(struct dbg_session_gk20a *dbg_s,
 	return err;
 }
 
+static void regop_wl_index_mark(struct regop_whitelist_index *idx,
+		int list, u32 offset)
+{
+	u16 n;
+
+	/* offsets past the index are checked with the searches instead */
+	if (offset >= (REGOP_WL_NR_PAGES << REGOP_WL_PAGE_SHIFT))
+		return;
+
+	n = idx->page_map[offset >> REGOP_WL_PAGE_SHIFT];
+
+	if (!idx->pages) {
+		/* first pass, only count the pages */
+		if (!n)
+			idx->page_map[offset >> REGOP_WL_PAGE_SHIFT] =
+				++idx->nr_pages;
+		return;
+	}
+
+	set_bit((offset & ((1 << REGOP_WL_PAGE_SHIFT) - 1)) >> 2,
+		idx->pages[n - 1][list].words);
+}
+
+static void regop_wl_index_add_ranges(struct regop_whitelist_index *idx,
+		int list, const struct regop_offset_range *ranges, int count)
+{
+	int i;
+	u32 j;
+
+	for (i = 0; i < count; i++)
+		for (j = 0; j < ranges[i].count; j++)
+			regop_wl_index_mark(idx, list, ranges[i].base + j * 4);
+}
+
+static void regop_wl_index_add_list(struct regop_whitelist_index *idx,
+		int list, const u32 *offsets, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		regop_wl_index_mark(idx, list, offsets[i]);
+}
+
+static void regop_wl_index_add_all(struct gk20a *g,
+		struct regop_whitelist_index *idx)
+{
+	if (g->ops.regops.get_global_whitelist_ranges)
+		regop_wl_index_add_ranges(idx, REGOP_WL_GLOBAL,
+			g->ops.regops.get_global_whitelist_ranges(),
+			g->ops.regops.get_global_whitelist_ranges_count());
+	if (g->ops.regops.get_context_whitelist_ranges)
+		regop_wl_index_add_ranges(idx, REGOP_WL_CONTEXT,
+			g->ops.regops.get_context_whitelist_ranges(),
+			g->ops.regops.get_context_whitelist_ranges_count());
+	if (g->ops.regops.get_runcontrol_whitelist)
+		regop_wl_index_add_list(idx, REGOP_WL_RUNCONTROL,
+			g->ops.regops.get_runcontrol_whitelist(),
+			g->ops.regops.get_runcontrol_whitelist_count());
+	if (g->ops.regops.get_qctl_whitelist)
+		regop_wl_index_add_list(idx, REGOP_WL_QCTL,
+			g->ops.regops.get_qctl_whitelist(),
+			g->ops.regops.get_qctl_whitelist_count());
+}
+
+/*
+ * Build the whitelist index on first use. Allocation failure is not fatal,
+ * the searches below are used instead.
+ */
+static struct regop_whitelist_index *regop_wl_index_get(struct gk20a *g)
+{
+	struct regop_whitelist_index *idx = READ_ONCE(g->regop_wl_index);
+
+	if (idx)
+		return idx;
+
+	idx = vzalloc(sizeof(*idx));
+	if (!idx)
+		return NULL;
+
+	regop_wl_index_add_all(g, idx);
+
+	idx->pages = vzalloc(max_t(u32, idx->nr_pages, 1) *
+			     sizeof(*idx->pages));
+	if (!idx->pages) {
+		vfree(idx);
+		return NULL;
+	}
+
+	regop_wl_index_add_all(g, idx);
+
+	gk20a_dbg(gpu_dbg_gpu_dbg, "regop whitelist index: %u pages",
+		  idx->nr_pages);
+
+	if (cmpxchg(&g->regop_wl_index, NULL, idx)) {
+		vfree(idx->pages);
+		vfree(idx);
+		idx = g->regop_wl_index;
+	}
+
+	return idx;
+}
+
+void gk20a_regops_free_whitelist_index(struct gk20a *g)
+{
+	struct regop_whitelist_index *idx = g->regop_wl_index;
+
+	if (!idx)
+		return;
+
+	g->regop_wl_index = NULL;
+	vfree(idx->pages);
+	vfree(idx);
+}
+
+static bool regop_whitelisted(struct gk20a *g,
+		struct regop_whitelist_index *idx, int list, u32 offset)
+{
+	u16 n;
+
+	if (idx && offset < (REGOP_WL_NR_PAGES << REGOP_WL_PAGE_SHIFT)) {
+		n = idx->page_map[offset >> REGOP_WL_PAGE_SHIFT];
+		return n && test_bit((offset &
+				((1 << REGOP_WL_PAGE_SHIFT) - 1)) >> 2,
+				idx->pages[n - 1][list].words);
+	}
+
+	switch (list) {
+	case REGOP_WL_GLOBAL:
+		return g->ops.regops.get_global_whitelist_ranges &&
+			!!bsearch(&offset,
+			g->ops.regops.get_global_whitelist_ranges(),
+			g->ops.regops.get_global_whitelist_ranges_count(),
+			sizeof(*g->ops.regops.get_global_whitelist_ranges()),
+			regop_bsearch_range_cmp);
+	case REGOP_WL_CONTEXT:
+		return g->ops.regops.get_context_whitelist_ranges &&
+			!!bsearch(&offset,
+			g->ops.regops.get_context_whitelist_ranges(),
+			g->ops.regops.get_context_whitelist_ranges_count(),
+			sizeof(*g->ops.regops.get_context_whitelist_ranges()),
+			regop_bsearch_range_cmp);
+	case REGOP_WL_RUNCONTROL:
+		return g->ops.regops.get_runcontrol_whitelist &&
+			linear_search(offset,
+				g->ops.regops.get_runcontrol_whitelist(),
+				g->ops.regops.get_runcontrol_whitelist_count());
+	case REGOP_WL_QCTL:
+		return g->ops.regops.get_qctl_whitelist &&
+			linear_search(offset,
+				g->ops.regops.get_qctl_whitelist(),
+				g->ops.regops.get_qctl_whitelist_count());
+	}
+
+	return false;
+}
+
 static bool check_whitelists(struct dbg_session_gk20a *dbg_s,
 			  struct nvgpu_dbg_gpu_reg_op *op, u32 offset)
 {
 	struct gk20a *g = dbg_s->g;
+	struct regop_whitelist_index *idx;
 	bool valid = false;
 	struct channel_gk20a *ch;
 
 	ch = nvgpu_dbg_gpu_get_session_channel(dbg_s);
+	idx = regop_wl_index_get(g);
 
 	if (op->type == REGOP(TYPE_GLOBAL)) {
 		/* search global list */
-		valid = g->ops.regops.get_global_whitelist_ranges &&
-			!!bsearch(&offset,
-			g->ops.regops.get_global_whitelist_ranges(),
-			g->ops.regops.get_global_whitelist_ranges_count(),
-			sizeof(*g->ops.regops.get_global_whitelist_ranges()),
-			regop_bsearch_range_cmp);
+		valid = regop_whitelisted(g, idx, REGOP_WL_GLOBAL, offset);
 
 		/* if debug session and channel is bound search context list */
-		if ((!valid) && (!dbg_s->is_profiler && ch)) {
-			/* binary search context list */
-			valid = g->ops.regops.get_context_whitelist_ranges &&
-				!!bsearch(&offset,
-			g->ops.regops.get_context_whitelist_ranges(),
-			g->ops.regops.get_context_whitelist_ranges_count(),
-			sizeof(*g->ops.regops.get_context_whitelist_ranges()),
-			regop_bsearch_range_cmp);
-		}
+		if ((!valid) && (!dbg_s->is_profiler && ch))
+			valid = regop_whitelisted(g, idx, REGOP_WL_CONTEXT,
+						  offset);
 
 		/* if debug session and channel is bound search runcontrol list */
-		if ((!valid) && (!dbg_s->is_profiler && ch)) {
-			valid = g->ops.regops.get_runcontrol_whitelist &&
-				linear_search(offset,
-				g->ops.regops.get_runcontrol_whitelist(),
-				g->ops.regops.get_runcontrol_whitelist_count());
-		}
+		if ((!valid) && (!dbg_s->is_profiler && ch))
+			valid = regop_whitelisted(g, idx, REGOP_WL_RUNCONTROL,
+						  offset);
 	} else if (op->type == REGOP(TYPE_GR_CTX)) {
 		/* it's a context-relative op */
 		if (!ch) {
@@ -599,38 +744,119 @@ static bool check_whitelists(struct dbg_session_gk20a *dbg_s,
 			return valid;
 		}
 
-		/* binary search context list */
-		valid = g->ops.regops.get_context_whitelist_ranges &&
-			!!bsearch(&offset,
-			g->ops.regops.get_context_whitelist_ranges(),
-			g->ops.regops.get_context_whitelist_ranges_count(),
-			sizeof(*g->ops.regops.get_context_whitelist_ranges()),
-			regop_bsearch_range_cmp);
+		/* search context list */
+		valid = regop_whitelisted(g, idx, REGOP_WL_CONTEXT, offset);
 
 		/* if debug session and channel is bound search runcontrol list */
-		if ((!valid) && (!dbg_s->is_profiler && ch)) {
-			valid = g->ops.regops.get_runcontrol_whitelist &&
-				linear_search(offset,
-				g->ops.regops.get_runcontrol_whitelist(),
-				g->ops.regops.get_runcontrol_whitelist_count());
-		}
+		if ((!valid) && (!dbg_s->is_profiler && ch))
+			valid = regop_whitelisted(g, idx, REGOP_WL_RUNCONTROL,
+						  offset);
 
 	} else if (op->type == REGOP(TYPE_GR_CTX_QUAD)) {
-		valid = g->ops.regops.get_qctl_whitelist &&
-			linear_search(offset,
-				g->ops.regops.get_qctl_whitelist(),
-				g->ops.regops.get_qctl_whitelist_count());
+		valid = regop_whitelisted(g, idx, REGOP_WL_QCTL, offset);
+	}
+
+	return valid;
+}
+
+/*
+ * Returns 0 with *valid set once the offset has been looked up in both the
+ * gr and pm ctx buffer layouts, or the error of a lookup that could not be
+ * done yet (no golden image, out of memory) and may succeed later.
+ */
+static int regop_ctx_offset_resolve(struct dbg_session_gk20a *dbg_s,
+				    struct nvgpu_dbg_gpu_reg_op *op,
+				    bool *valid)
+{
+	u32 buf_offset_lo, buf_offset_addr, num_offsets;
+	int err, pm_err;
+
+	err = gr_gk20a_get_ctx_buffer_offsets(dbg_s->g,
+					      op->offset,
+					      1,
+					      &buf_offset_lo,
+					      &buf_offset_addr,
+					      &num_offsets,
+					      op->type == REGOP(TYPE_GR_CTX_QUAD),
+					      op->quad);
+	if (err) {
+		pm_err = gr_gk20a_get_pm_ctx_buffer_offsets(dbg_s->g,
+						      op->offset,
+						      1,
+						      &buf_offset_lo,
+						      &buf_offset_addr,
+						      &num_offsets);
+		if (pm_err) {
+			if (err != -EINVAL)
+				return err;
+			if (pm_err != -EINVAL)
+				return pm_err;
+			*valid = false;
+			return 0;
+		}
+	}
+
+	*valid = num_offsets != 0;
+	return 0;
+}
+
+#define REGOP_CTX_OFFSET_CACHE_MAX	1024
+
+/*
+ * The ctx buffer layout does not change for the life of a session, so the
+ * result of resolving an (offset, quad) pair is remembered per session.
+ * Lookups that failed for a transient reason are not cached.
+ */
+static bool regop_ctx_offset_valid(struct dbg_session_gk20a *dbg_s,
+				   struct nvgpu_dbg_gpu_reg_op *op)
+{
+	struct regop_ctx_offset_entry *e;
+	bool is_quad = op->type == REGOP(TYPE_GR_CTX_QUAD);
+	u64 key = (u64)op->offset | ((u64)is_quad << 32) |
+		((u64)(is_quad ? op->quad : 0) << 40);
+	bool valid;
+
+	hash_for_each_possible(dbg_s->ctx_offset_cache, e, node, key)
+		if (e->key == key)
+			return e->valid;
+
+	if (regop_ctx_offset_resolve(dbg_s, op, &valid))
+		return false;
+
+	if (dbg_s->ctx_offset_cache_entries < REGOP_CTX_OFFSET_CACHE_MAX) {
+		e = kmalloc(sizeof(*e), GFP_KERNEL);
+		if (e) {
+			e->key = key;
+			e->valid = valid;
+			hash_add(dbg_s->ctx_offset_cache, &e->node, key);
+			dbg_s->ctx_offset_cache_entries++;
+		}
 	}
 
 	return valid;
 }
 
+void gk20a_regops_session_cleanup(struct dbg_session_gk20a *dbg_s)
+{
+	struct regop_ctx_offset_entry *e;
+	struct hlist_node *tmp;
+	int bkt;
+
+	hash_for_each_safe(dbg_s->ctx_offset_cache, bkt, tmp, e, node) {
+		hash_del(&e->node);
+		kfree(e);
+	}
+	dbg_s->ctx_offset_cache_entries = 0;
+
+	gr_gk20a_ctx_sample_program_free(dbg_s->ctx_sample_prog);
+	dbg_s->ctx_sample_prog = NULL;
+}
+
 /* note: the op here has already been through validate_reg_op_info */
 static int validate_reg_op_offset(struct dbg_session_gk20a *dbg_s,
 				  struct nvgpu_dbg_gpu_reg_op *op)
 {
-	int err;
-	u32 buf_offset_lo, buf_offset_addr, num_offsets, offset;
+	u32 offset;
 	bool valid = false;
 
 	op->status = 0;
@@ -648,28 +874,7 @@ static int validate_reg_op_offset(struct dbg_session_gk20a *dbg_s,
 		valid = check_whitelists(dbg_s, op, offset + 4);
 
 	if (valid && (op->type != REGOP(TYPE_GLOBAL))) {
-		err = gr_gk20a_get_ctx_buffer_offsets(dbg_s->g,
-						      op->offset,
-						      1,
-						      &buf_offset_lo,
-						      &buf_offset_addr,
-						      &num_offsets,
-						      op->type == REGOP(TYPE_GR_CTX_QUAD),
-						      op->quad);
-		if (err) {
-			err = gr_gk20a_get_pm_ctx_buffer_offsets(dbg_s->g,
-							      op->offset,
-							      1,
-							      &buf_offset_lo,
-							      &buf_offset_addr,
-							      &num_offsets);
-
-			if (err) {
-				op->status |= REGOP(STATUS_INVALID_OFFSET);
-				return -EINVAL;
-			}
-		}
-		if (!num_offsets) {
+		if (!regop_ctx_offset_valid(dbg_s, op)) {
 			op->status |= REGOP(STATUS_INVALID_OFFSET);
 			return -EINVAL;
 		}
@@ -721,14 +926,57 @@ static bool validate_reg_ops(struct dbg_session_gk20a *dbg_s,
 	return ok;
 }
 
+/*
+ * Replace the session's ctx sample program. The ops go through the same
+ * validation as exec_regops_gk20a(); num_ops == 0 only drops the program.
+ */
+int gk20a_regops_set_ctx_sample_program(struct dbg_session_gk20a *dbg_s,
+		struct nvgpu_dbg_gpu_reg_op *ops, u32 num_ops)
+{
+	struct gr_ctx_sample_program *prog = NULL;
+	u32 ctx_rd_count = 0, ctx_wr_count = 0;
+	int err;
+
+	/* see exec_regops_gk20a() */
+	if (gk20a_gpu_is_virtual(dbg_s->dev))
+		return -ENOSYS;
+
+	gr_gk20a_ctx_sample_program_free(dbg_s->ctx_sample_prog);
+	dbg_s->ctx_sample_prog = NULL;
+
+	if (!num_ops)
+		return 0;
+
+	if (!validate_reg_ops(dbg_s, &ctx_rd_count, &ctx_wr_count,
+			      ops, num_ops)) {
+		dev_err(dbg_s->dev, "invalid op(s)");
+		return -EINVAL;
+	}
+
+	err = gr_gk20a_ctx_sample_program_build(dbg_s->g, ops, num_ops, &prog);
+	if (err)
+		return err;
+
+	dbg_s->ctx_sample_prog = prog;
+	return 0;
+}
+
+int gk20a_regops_ctx_sample(struct dbg_session_gk20a *dbg_s, u64 *values)
+{
+	struct channel_gk20a *ch = nvgpu_dbg_gpu_get_session_channel(dbg_s);
+
+	if (!ch || !dbg_s->ctx_sample_prog)
+		return -EINVAL;
+
+	return gr_gk20a_ctx_sample(ch, dbg_s->ctx_sample_prog, values);
+}
+
 /* exported for tools like cyclestats, etc */
 bool is_bar0_global_offset_whitelisted_gk20a(struct gk20a *g, u32 offset)
 {
-	bool valid = !!bsearch(&offset,
-			g->ops.regops.get_global_whitelist_ranges(),
-			g->ops.regops.get_global_whitelist_ranges_count(),
-			sizeof(*g->ops.regops.get_global_whitelist_ranges()),
-			regop_bsearch_range_cmp);
+	/* may run from the GR isr, so only use an index that already exists */
+	bool valid = regop_whitelisted(g, READ_ONCE(g->regop_wl_index),
+				       REGOP_WL_GLOBAL, offset);
 	return valid;
 }
 
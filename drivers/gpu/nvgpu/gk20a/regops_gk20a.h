@@ -25,6 +25,40 @@ struct regop_offset_range {
 	u32 count:8;
 };
 
+enum {
+	REGOP_WL_GLOBAL,
+	REGOP_WL_CONTEXT,
+	REGOP_WL_RUNCONTROL,
+	REGOP_WL_QCTL,
+	REGOP_WL_MAX,
+};
+
+/* regop offsets are 24 bit and word aligned, indexed in 4K pages */
+#define REGOP_WL_PAGE_SHIFT	12
+#define REGOP_WL_NR_PAGES	(1 << (24 - REGOP_WL_PAGE_SHIFT))
+#define REGOP_WL_PAGE_WORDS	(1 << (REGOP_WL_PAGE_SHIFT - 2))
+
+/*
+ * Bitmap index of the whitelists from g->ops.regops, built once so that a
+ * whitelist check is two array lookups instead of bsearch()/linear_search().
+ * Only pages holding at least one listed register get a bitmap.
+ */
+struct regop_whitelist_index {
+	/* 1-based index into pages[], 0 when nothing in the page is listed */
+	u16 page_map[REGOP_WL_NR_PAGES];
+	u32 nr_pages;
+	struct {
+		DECLARE_BITMAP(words, REGOP_WL_PAGE_WORDS);
+	} (*pages)[REGOP_WL_MAX];
+};
+
+/* cached ctx buffer offset validation result, one per (offset, quad) */
+struct regop_ctx_offset_entry {
+	struct hlist_node node;
+	u64 key;
+	bool valid;
+};
+
 int exec_regops_gk20a(struct dbg_session_gk20a *dbg_s,
 		      struct nvgpu_dbg_gpu_reg_op *ops,
 		      u64 num_ops);
@@ -48,6 +82,11 @@ static inline bool reg_op_is_read(u8 op)
 }
 
 bool is_bar0_global_offset_whitelisted_gk20a(struct gk20a *g, u32 offset);
+void gk20a_regops_free_whitelist_index(struct gk20a *g);
+void gk20a_regops_session_cleanup(struct dbg_session_gk20a *dbg_s);
+int gk20a_regops_set_ctx_sample_program(struct dbg_session_gk20a *dbg_s,
+		struct nvgpu_dbg_gpu_reg_op *ops, u32 num_ops);
+int gk20a_regops_ctx_sample(struct dbg_session_gk20a *dbg_s, u64 *values);
 
 void gk20a_init_regops(struct gpu_ops *gops);
 #endif /* REGOPS_GK20A_H */
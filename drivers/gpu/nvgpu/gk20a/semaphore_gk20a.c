@@ -17,8 +17,10 @@
 
 #define pr_fmt(fmt) "gpu_sema: " fmt
 
+#include <linux/debugfs.h>
 #include <linux/dma-mapping.h>
 #include <linux/highmem.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 
 #include <asm/pgtable.h>
@@ -48,25 +50,44 @@ struct gk20a_semaphore_sea *gk20a_semaphore_get_sea(struct gk20a *g)
 	return g->sema_sea;
 }
 
+/*
+ * Add another chunk of SEMAPHORE_SEA_GROWTH_RATE pages to the sea. Must be
+ * called with the sea lock held. Existing VMs only map the new chunk once they
+ * need it; see gk20a_semaphore_map_ro().
+ */
 static int __gk20a_semaphore_sea_grow(struct gk20a_semaphore_sea *sea)
 {
-	int ret = 0;
+	int ret;
 	struct gk20a *gk20a = sea->gk20a;
+	struct mem_desc *chunk;
 
-	__lock_sema_sea(sea);
+	if (sea->chunk_count == SEMAPHORE_SEA_MAX_CHUNKS)
+		return -ENOSPC;
+
+	chunk = kzalloc(sizeof(*chunk), GFP_KERNEL);
+	if (!chunk) {
+		ret = -ENOMEM;
+		goto fail;
+	}
 
 	ret = gk20a_gmmu_alloc_attr_sys(gk20a, DMA_ATTR_NO_KERNEL_MAPPING,
-				    PAGE_SIZE * SEMAPHORE_POOL_COUNT,
-				    &sea->sea_mem);
-	if (ret)
-		goto out;
+				    SEMAPHORE_SEA_CHUNK_SIZE, chunk);
+	if (ret) {
+		kfree(chunk);
+		goto fail;
+	}
 
-	sea->ro_sg_table = sea->sea_mem.sgt;
-	sea->size = SEMAPHORE_POOL_COUNT;
-	sea->map_size = SEMAPHORE_POOL_COUNT * PAGE_SIZE;
+	sea->chunks[sea->chunk_count++] = chunk;
+	sea->size += SEMAPHORE_SEA_GROWTH_RATE;
+	sea->map_size = sea->size * PAGE_SIZE;
+	sea->grows++;
 
-out:
-	__unlock_sema_sea(sea);
+	gpu_sema_dbg("Grew semaphore sea to %zu pages (%d chunks)",
+		     sea->size, sea->chunk_count);
+	return 0;
+
+fail:
+	sea->grow_failures++;
 	return ret;
 }
 
@@ -89,8 +110,12 @@ struct gk20a_semaphore_sea *gk20a_semaphore_sea_create(struct gk20a *g)
 	INIT_LIST_HEAD(&g->sema_sea->pool_list);
 	mutex_init(&g->sema_sea->sea_lock);
 
-	if (__gk20a_semaphore_sea_grow(g->sema_sea))
+	__lock_sema_sea(g->sema_sea);
+	if (__gk20a_semaphore_sea_grow(g->sema_sea)) {
+		__unlock_sema_sea(g->sema_sea);
 		goto cleanup;
+	}
+	__unlock_sema_sea(g->sema_sea);
 
 	gpu_sema_dbg("Created semaphore sea!");
 	return g->sema_sea;
@@ -102,9 +127,18 @@ cleanup:
 	return NULL;
 }
 
-static int __semaphore_bitmap_alloc(unsigned long *bitmap, unsigned long len)
+/*
+ * Find and set a free bit, starting at @hint and wrapping around once.
+ */
+static int __semaphore_bitmap_alloc(unsigned long *bitmap, unsigned long len,
+				    unsigned long hint)
 {
-	unsigned long idx = find_first_zero_bit(bitmap, len);
+	unsigned long idx = len;
+
+	if (hint < len)
+		idx = find_next_zero_bit(bitmap, len, hint);
+	if (idx == len && hint)
+		idx = find_first_zero_bit(bitmap, len);
 
 	if (idx == len)
 		return -ENOSPC;
@@ -130,7 +164,14 @@ struct gk20a_semaphore_pool *gk20a_semaphore_pool_alloc(
 
 	__lock_sema_sea(sea);
 
-	ret = __semaphore_bitmap_alloc(sea->pools_alloced, SEMAPHORE_POOL_COUNT);
+	ret = __semaphore_bitmap_alloc(sea->pools_alloced, sea->size, 0);
+	if (ret == -ENOSPC) {
+		/* Every backed page is in use: back some more. */
+		ret = __gk20a_semaphore_sea_grow(sea);
+		if (!ret)
+			ret = __semaphore_bitmap_alloc(sea->pools_alloced,
+						       sea->size, 0);
+	}
 	if (ret < 0) {
 		err = ret;
 		goto fail;
@@ -138,15 +179,18 @@ struct gk20a_semaphore_pool *gk20a_semaphore_pool_alloc(
 
 	page_idx = (unsigned long)ret;
 
-	p->page = sea->sea_mem.pages[page_idx];
-	p->ro_sg_table = sea->ro_sg_table;
+	p->page = sea->chunks[page_idx / SEMAPHORE_SEA_GROWTH_RATE]->
+		pages[page_idx % SEMAPHORE_SEA_GROWTH_RATE];
 	p->page_idx = page_idx;
 	p->sema_sea = sea;
 	INIT_LIST_HEAD(&p->hw_semas);
+	INIT_LIST_HEAD(&p->free_hw_semas);
 	kref_init(&p->ref);
 	mutex_init(&p->pool_lock);
 
 	sea->page_count++;
+	if (sea->page_count > sea->peak_page_count)
+		sea->peak_page_count = sea->page_count;
 	list_add(&p->pool_list_entry, &sea->pool_list);
 	__unlock_sema_sea(sea);
 
@@ -161,6 +205,61 @@ fail:
 	return ERR_PTR(err);
 }
 
+/*
+ * Map every sea chunk not yet covered by the pool's RO mapping into @vm. The
+ * chunks go at fixed offsets inside the VA range reserved for the sea, so the
+ * global RO address of a semaphore is the same in every VM. Call with the sea
+ * lock held.
+ */
+static int __gk20a_semaphore_pool_map_ro(struct gk20a_semaphore_pool *p,
+					 struct vm_gk20a *vm)
+{
+	struct gk20a_semaphore_sea *sea = p->sema_sea;
+	u64 addr;
+
+	while (p->ro_chunks < sea->chunk_count) {
+		addr = gk20a_gmmu_fixed_map(vm, &sea->chunks[p->ro_chunks]->sgt,
+				sea->gpu_va +
+				(u64)p->ro_chunks * SEMAPHORE_SEA_CHUNK_SIZE,
+				SEMAPHORE_SEA_CHUNK_SIZE,
+				0,
+				gk20a_mem_flag_read_only,
+				false,
+				APERTURE_SYSMEM);
+		if (!addr)
+			return -ENOMEM;
+
+		p->ro_chunks++;
+	}
+
+	return 0;
+}
+
+/*
+ * Make sure the semaphore @s can be read through the global RO mapping from
+ * @vm. Pools handed out after @vm was set up may live in chunks @vm has not
+ * mapped yet, so call this before making @vm wait on another VM's semaphore.
+ */
+int gk20a_semaphore_map_ro(struct gk20a_semaphore *s, struct vm_gk20a *vm)
+{
+	struct gk20a_semaphore_pool *p = vm->sema_pool;
+	int err;
+
+	if (!p)
+		return -EINVAL;
+
+	/* ro_chunks only ever grows so a stale read just takes the lock. */
+	if (s->hw_sema->p->page_idx <
+	    ACCESS_ONCE(p->ro_chunks) * SEMAPHORE_SEA_GROWTH_RATE)
+		return 0;
+
+	__lock_sema_sea(p->sema_sea);
+	err = __gk20a_semaphore_pool_map_ro(p, vm);
+	__unlock_sema_sea(p->sema_sea);
+
+	return err;
+}
+
 /*
  * Map a pool into the passed vm's address space. This handles both the fixed
  * global RO mapping and the non-fixed private RW mapping.
@@ -169,7 +268,6 @@ int gk20a_semaphore_pool_map(struct gk20a_semaphore_pool *p,
 			     struct vm_gk20a *vm)
 {
 	int ents, err = 0;
-	u64 addr;
 
 	gpu_sema_dbg("Mapping sempahore pool! (idx=%d)", p->page_idx);
 
@@ -220,18 +318,12 @@ int gk20a_semaphore_pool_map(struct gk20a_semaphore_pool *p,
 	__lock_sema_sea(p->sema_sea);
 
 	BUG_ON(p->mapped);
-	addr = gk20a_gmmu_fixed_map(vm, &p->sema_sea->ro_sg_table,
-				    p->sema_sea->gpu_va, p->sema_sea->map_size,
-				    0,
-				    gk20a_mem_flag_read_only,
-				    false,
-				    APERTURE_SYSMEM);
-	if (!addr) {
-		err = -ENOMEM;
+	err = __gk20a_semaphore_pool_map_ro(p, vm);
+	if (err) {
 		BUG();
 		goto fail_unlock;
 	}
-	p->gpu_va_ro = addr;
+	p->gpu_va_ro = p->sema_sea->gpu_va;
 	p->mapped = 1;
 
 	gpu_sema_dbg("  %d: GPU read-only  VA = 0x%llx", p->page_idx,
@@ -262,14 +354,17 @@ void gk20a_semaphore_pool_unmap(struct gk20a_semaphore_pool *p,
 				struct vm_gk20a *vm)
 {
 	struct gk20a_semaphore_int *hw_sema;
+	int i;
 
 	kunmap(p->cpu_va);
 
 	/* First the global RO mapping... */
 	__lock_sema_sea(p->sema_sea);
-	gk20a_gmmu_unmap(vm, p->gpu_va_ro,
-			 p->sema_sea->map_size, gk20a_mem_flag_none);
-	p->ro_sg_table = NULL;
+	for (i = 0; i < p->ro_chunks; i++)
+		gk20a_gmmu_unmap(vm, p->gpu_va_ro +
+				 (u64)i * SEMAPHORE_SEA_CHUNK_SIZE,
+				 SEMAPHORE_SEA_CHUNK_SIZE, gk20a_mem_flag_none);
+	p->ro_chunks = 0;
 	__unlock_sema_sea(p->sema_sea);
 
 	/* And now the private RW mapping. */
@@ -304,7 +399,7 @@ static void gk20a_semaphore_pool_free(struct kref *ref)
 	struct gk20a_semaphore_sea *s = p->sema_sea;
 	struct gk20a_semaphore_int *hw_sema, *tmp;
 
-	WARN_ON(p->gpu_va || p->rw_sg_table || p->ro_sg_table);
+	WARN_ON(p->gpu_va || p->rw_sg_table || p->ro_chunks);
 
 	__lock_sema_sea(s);
 	list_del(&p->pool_list_entry);
@@ -314,6 +409,8 @@ static void gk20a_semaphore_pool_free(struct kref *ref)
 
 	list_for_each_entry_safe(hw_sema, tmp, &p->hw_semas, hw_sema_list)
 		kfree(hw_sema);
+	list_for_each_entry_safe(hw_sema, tmp, &p->free_hw_semas, hw_sema_list)
+		kfree(hw_sema);
 
 	gpu_sema_dbg("Freed semaphore pool! (idx=%d)", p->page_idx);
 	kfree(p);
@@ -352,13 +449,35 @@ static int __gk20a_init_hw_sema(struct channel_gk20a *ch)
 
 	mutex_lock(&p->pool_lock);
 
+	/*
+	 * Reuse a retired HW semaphore if there is one. It keeps counting from
+	 * where its last owner stopped so fences still pointing at it stay
+	 * signaled.
+	 */
+	hw_sema = list_first_entry_or_null(&p->free_hw_semas,
+					   struct gk20a_semaphore_int,
+					   hw_sema_list);
+	if (hw_sema) {
+		list_del(&hw_sema->hw_sema_list);
+		p->nr_free_hw_semas--;
+		atomic_inc(&p->sema_sea->hw_sema_cache_hits);
+
+		hw_sema->ch = ch;
+		hw_sema->nr_incrs = 0;
+		hw_sema->value = p->cpu_va + hw_sema->offset;
+		goto done;
+	}
+	atomic_inc(&p->sema_sea->hw_sema_cache_misses);
+
 	/* Find an available HW semaphore. */
 	hw_sema_idx = __semaphore_bitmap_alloc(p->semas_alloced,
-					       PAGE_SIZE / SEMAPHORE_SIZE);
+					       PAGE_SIZE / SEMAPHORE_SIZE,
+					       p->next_sema_idx);
 	if (hw_sema_idx < 0) {
 		ret = hw_sema_idx;
 		goto fail;
 	}
+	p->next_sema_idx = hw_sema_idx + 1;
 
 	hw_sema = kzalloc(sizeof(struct gk20a_semaphore_int), GFP_KERNEL);
 	if (!hw_sema) {
@@ -366,7 +485,6 @@ static int __gk20a_init_hw_sema(struct channel_gk20a *ch)
 		goto fail_free_idx;
 	}
 
-	ch->hw_sema = hw_sema;
 	hw_sema->ch = ch;
 	hw_sema->p = p;
 	hw_sema->idx = hw_sema_idx;
@@ -375,7 +493,10 @@ static int __gk20a_init_hw_sema(struct channel_gk20a *ch)
 	hw_sema->value = p->cpu_va + hw_sema->offset;
 	writel(0, hw_sema->value);
 
+done:
+	ch->hw_sema = hw_sema;
 	list_add(&hw_sema->hw_sema_list, &p->hw_semas);
+	atomic_inc(&p->sema_sea->hw_sema_count);
 
 	mutex_unlock(&p->pool_lock);
 
@@ -399,12 +520,19 @@ void gk20a_semaphore_free_hw_sema(struct channel_gk20a *ch)
 
 	mutex_lock(&p->pool_lock);
 
-	clear_bit(ch->hw_sema->idx, p->semas_alloced);
-
 	/* Make sure that when the ch is re-opened it will get a new HW sema. */
 	list_del(&ch->hw_sema->hw_sema_list);
-	kfree(ch->hw_sema);
+	if (p->nr_free_hw_semas < SEMAPHORE_POOL_FREE_CACHE) {
+		/* Keep the index reserved and park the sema for reuse. */
+		ch->hw_sema->ch = NULL;
+		list_add(&ch->hw_sema->hw_sema_list, &p->free_hw_semas);
+		p->nr_free_hw_semas++;
+	} else {
+		clear_bit(ch->hw_sema->idx, p->semas_alloced);
+		kfree(ch->hw_sema);
+	}
 	ch->hw_sema = NULL;
+	atomic_dec(&p->sema_sea->hw_sema_count);
 
 	mutex_unlock(&p->pool_lock);
 }
@@ -464,3 +592,58 @@ void gk20a_semaphore_get(struct gk20a_semaphore *s)
 {
 	kref_get(&s->ref);
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int gk20a_semaphore_sea_show(struct seq_file *s, void *unused)
+{
+	struct gk20a *g = s->private;
+	struct gk20a_semaphore_sea *sea = g->sema_sea;
+
+	if (!sea) {
+		seq_puts(s, "Semaphore sea not created\n");
+		return 0;
+	}
+
+	__lock_sema_sea(sea);
+	seq_printf(s, "chunks:          %d / %d\n",
+		   sea->chunk_count, SEMAPHORE_SEA_MAX_CHUNKS);
+	seq_printf(s, "pages backed:    %zu (%llu KB)\n",
+		   sea->size, sea->map_size >> 10);
+	seq_printf(s, "pools in use:    %d (peak %d)\n",
+		   sea->page_count, sea->peak_page_count);
+	seq_printf(s, "utilisation:     %zu%%\n",
+		   sea->size ? sea->page_count * 100 / sea->size : 0);
+	seq_printf(s, "grows:           %u (%u failed)\n",
+		   sea->grows, sea->grow_failures);
+	__unlock_sema_sea(sea);
+
+	seq_printf(s, "hw semas in use: %d\n",
+		   atomic_read(&sea->hw_sema_count));
+	seq_printf(s, "hw sema cache:   %d hits, %d misses\n",
+		   atomic_read(&sea->hw_sema_cache_hits),
+		   atomic_read(&sea->hw_sema_cache_misses));
+
+	return 0;
+}
+
+static int gk20a_semaphore_sea_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, gk20a_semaphore_sea_show, inode->i_private);
+}
+
+static const struct file_operations gk20a_semaphore_sea_fops = {
+	.open		= gk20a_semaphore_sea_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void gk20a_semaphore_debugfs_init(struct device *dev)
+{
+	struct gk20a_platform *platform = dev_get_drvdata(dev);
+	struct gk20a *g = get_gk20a(dev);
+
+	debugfs_create_file("sema_sea", S_IRUGO, platform->debugfs, g,
+			    &gk20a_semaphore_sea_fops);
+}
+#endif
@@ -29,12 +29,24 @@
 	gk20a_dbg(gpu_dbg_sema_v, fmt, ##args)
 
 /*
- * Max number of channels that can be used is 512. This of course needs to be
- * fixed to be dynamic but still fast.
+ * The sea is backed in chunks of SEMAPHORE_SEA_GROWTH_RATE pages which are
+ * only allocated once the existing chunks are full. SEMAPHORE_POOL_COUNT just
+ * bounds the GPU VA reserved in each VM for the global RO mapping; no memory
+ * or page tables are spent on chunks that were never needed.
  */
-#define SEMAPHORE_POOL_COUNT		512
+#define SEMAPHORE_POOL_COUNT		4096
 #define SEMAPHORE_SIZE			16
 #define SEMAPHORE_SEA_GROWTH_RATE	32
+#define SEMAPHORE_SEA_MAX_CHUNKS	\
+	(SEMAPHORE_POOL_COUNT / SEMAPHORE_SEA_GROWTH_RATE)
+#define SEMAPHORE_SEA_CHUNK_SIZE	(SEMAPHORE_SEA_GROWTH_RATE * PAGE_SIZE)
+#define SEMAPHORE_SEA_VA_SIZE		(SEMAPHORE_POOL_COUNT * PAGE_SIZE)
+
+/*
+ * Number of retired HW semaphores a pool keeps (index still reserved) so that
+ * the next channel in the VM can reuse one without a bitmap scan or kzalloc().
+ */
+#define SEMAPHORE_POOL_FREE_CACHE	8
 
 struct gk20a_semaphore_sea;
 
@@ -80,6 +92,10 @@ struct gk20a_semaphore_pool {
 
 	struct list_head hw_semas;		/* List of HW semas. */
 	DECLARE_BITMAP(semas_alloced, PAGE_SIZE / SEMAPHORE_SIZE);
+	int next_sema_idx;			/* Bitmap search hint. */
+
+	struct list_head free_hw_semas;		/* Retired HW semas to reuse. */
+	int nr_free_hw_semas;
 
 	struct gk20a_semaphore_sea *sema_sea;	/* Sea that owns this pool. */
 
@@ -92,10 +108,10 @@ struct gk20a_semaphore_pool {
 	struct sg_table *rw_sg_table;
 
 	/*
-	 * This is to keep track of whether the pool has had its sg_table
-	 * updated during sea resizing.
+	 * Number of sea chunks mapped RO into this pool's VM. The sea may have
+	 * grown since; gk20a_semaphore_map_ro() catches the VM up on demand.
 	 */
-	struct sg_table *ro_sg_table;
+	int ro_chunks;
 
 	int mapped;
 
@@ -119,22 +135,18 @@ struct gk20a_semaphore_sea {
 
 	size_t size;			/* Number of pages available. */
 	u64 gpu_va;			/* GPU virtual address of sema sea. */
-	u64 map_size;			/* Size of the mapping. */
+	u64 map_size;			/* Size of the backed region. */
 
-	/*
-	 * TODO:
-	 * List of pages that we use to back the pools. The number of pages
-	 * can grow dynamically since allocating 512 pages for all channels at
-	 * once would be a tremendous waste.
-	 */
 	int page_count;			/* Pages allocated to pools. */
+	int peak_page_count;
 
-	struct sg_table *ro_sg_table;
 	/*
-	struct page *pages[SEMAPHORE_POOL_COUNT];
-	*/
-
-	struct mem_desc sea_mem;
+	 * Backing memory for the pools, SEMAPHORE_SEA_GROWTH_RATE pages per
+	 * chunk. Chunk N backs pages [N * GROWTH_RATE, (N + 1) * GROWTH_RATE)
+	 * and is mapped at gpu_va + N * SEMAPHORE_SEA_CHUNK_SIZE in every VM.
+	 */
+	struct mem_desc *chunks[SEMAPHORE_SEA_MAX_CHUNKS];
+	int chunk_count;
 
 	/*
 	 * Can't use a regular allocator here since the full range of pools are
@@ -143,6 +155,13 @@ struct gk20a_semaphore_sea {
 	DECLARE_BITMAP(pools_alloced, SEMAPHORE_POOL_COUNT);
 
 	struct mutex sea_lock;		/* Lock alloc/free calls. */
+
+	/* Utilisation stats, see the sema_sea debugfs node. */
+	u32 grows;
+	u32 grow_failures;
+	atomic_t hw_sema_count;
+	atomic_t hw_sema_cache_hits;
+	atomic_t hw_sema_cache_misses;
 };
 
 enum gk20a_mem_rw_flag {
@@ -171,6 +190,7 @@ int gk20a_semaphore_pool_map(struct gk20a_semaphore_pool *pool,
 void gk20a_semaphore_pool_unmap(struct gk20a_semaphore_pool *pool,
 				struct vm_gk20a *vm);
 u64 __gk20a_semaphore_pool_gpu_va(struct gk20a_semaphore_pool *p, bool global);
+int gk20a_semaphore_map_ro(struct gk20a_semaphore *s, struct vm_gk20a *vm);
 void gk20a_semaphore_pool_get(struct gk20a_semaphore_pool *p);
 void gk20a_semaphore_pool_put(struct gk20a_semaphore_pool *p);
 
@@ -182,6 +202,8 @@ void gk20a_semaphore_put(struct gk20a_semaphore *s);
 void gk20a_semaphore_get(struct gk20a_semaphore *s);
 void gk20a_semaphore_free_hw_sema(struct channel_gk20a *ch);
 
+void gk20a_semaphore_debugfs_init(struct device *dev);
+
 /*
  * Return the address of a specific semaphore.
  *
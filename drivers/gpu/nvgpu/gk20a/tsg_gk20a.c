@@ -125,6 +125,9 @@ int gk20a_tsg_bind_channel(struct tsg_gk20a *tsg,
 	list_add_tail(&ch->ch_entry, &tsg->ch_list);
 	mutex_unlock(&tsg->ch_list_lock);
 
+	/* pick up BLOCKING_SYNC events already enabled on the TSG */
+	gk20a_channel_semaphore_wakeup_arm(ch);
+
 	kref_get(&tsg->refcount);
 
 	gk20a_dbg(gpu_dbg_fn, "BIND tsg:%d channel:%d\n",
@@ -164,6 +167,7 @@ int gk20a_init_tsg_support(struct gk20a *g, u32 tsgid)
 
 	INIT_LIST_HEAD(&tsg->ch_list);
 	mutex_init(&tsg->ch_list_lock);
+	INIT_LIST_HEAD(&tsg->runlist_level_entry);
 
 	INIT_LIST_HEAD(&tsg->event_id_list);
 	mutex_init(&tsg->event_id_list_lock);
@@ -254,6 +258,7 @@ static int gk20a_tsg_event_id_enable(struct tsg_gk20a *tsg,
 	struct file *file;
 	char *name;
 	struct gk20a_event_id_data *event_id_data;
+	struct channel_gk20a *ch;
 
 	err = gk20a_tsg_get_event_data_from_id(tsg,
 				event_id, &event_id_data);
@@ -294,6 +299,11 @@ static int gk20a_tsg_event_id_enable(struct tsg_gk20a *tsg,
 	list_add_tail(&event_id_data->event_id_node, &tsg->event_id_list);
 	mutex_unlock(&tsg->event_id_list_lock);
 
+	mutex_lock(&tsg->ch_list_lock);
+	list_for_each_entry(ch, &tsg->ch_list, ch_entry)
+		gk20a_channel_semaphore_wakeup_arm(ch);
+	mutex_unlock(&tsg->ch_list_lock);
+
 	fd_install(local_fd, file);
 	file->private_data = event_id_data;
 
@@ -423,6 +433,9 @@ int gk20a_tsg_open(struct gk20a *g, struct file *filp)
 	tsg->timeslice_scale = 0;
 	tsg->runlist_id = ~0;
 	tsg->tgid = current->tgid;
+#ifdef CONFIG_TEGRA_GR_VIRTUALIZATION
+	tsg->virt_async_err = 0;
+#endif
 
 	filp->private_data = tsg;
 
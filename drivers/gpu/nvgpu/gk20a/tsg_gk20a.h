@@ -52,12 +52,17 @@ struct tsg_gk20a {
 	struct vm_gk20a *vm;
 
 	u32 interleave_level;
+	struct list_head runlist_level_entry;
 
 	struct list_head event_id_list;
 	struct mutex event_id_list_lock;
 
 	u32 runlist_id;
 	pid_t tgid;
+
+#ifdef CONFIG_TEGRA_GR_VIRTUALIZATION
+	int virt_async_err;	/* first failed async vgpu cmd, not reported */
+#endif
 };
 
 int gk20a_enable_tsg(struct tsg_gk20a *tsg);
@@ -105,12 +105,9 @@ int gm20b_ltc_cbc_ctrl(struct gk20a *g, enum gk20a_cbc_op op,
 {
 	int err = 0;
 	struct gr_gk20a *gr = &g->gr;
-	u32 ltc, slice, ctrl1, val, hw_op = 0;
-	s32 retry = 200;
+	u32 hw_op = 0;
 	u32 slices_per_ltc = ltc_ltcs_ltss_cbc_param_slices_per_ltc_v(
 				gk20a_readl(g, ltc_ltcs_ltss_cbc_param_r()));
-	u32 ltc_stride = nvgpu_get_litter_value(g, GPU_LIT_LTC_STRIDE);
-	u32 lts_stride = nvgpu_get_litter_value(g, GPU_LIT_LTS_STRIDE);
 
 	gk20a_dbg_fn("");
 
@@ -137,32 +134,8 @@ int gm20b_ltc_cbc_ctrl(struct gk20a *g, enum gk20a_cbc_op op,
 	gk20a_writel(g, ltc_ltcs_ltss_cbc_ctrl1_r(),
 		     gk20a_readl(g, ltc_ltcs_ltss_cbc_ctrl1_r()) | hw_op);
 
-	for (ltc = 0; ltc < g->ltc_count; ltc++) {
-		for (slice = 0; slice < slices_per_ltc; slice++) {
-
-			ctrl1 = ltc_ltc0_lts0_cbc_ctrl1_r() +
-				ltc * ltc_stride + slice * lts_stride;
-
-			retry = 200;
-			do {
-				val = gk20a_readl(g, ctrl1);
-				if (!(val & hw_op))
-					break;
-				retry--;
-				udelay(5);
-
-			} while (retry >= 0 ||
-					!tegra_platform_is_silicon());
-
-			if (retry < 0 && tegra_platform_is_silicon()) {
-				gk20a_err(dev_from_gk20a(g),
-					   "comp tag clear timeout\n");
-				err = -EBUSY;
-				goto out;
-			}
-		}
-	}
-out:
+	err = gk20a_ltc_wait_cbc_ctrl(g, hw_op, g->ltc_count, slices_per_ltc);
+
 	trace_gk20a_ltc_cbc_ctrl_done(dev_name(g->dev));
 	mutex_unlock(&g->mm.l2_op_lock);
 	return err;
@@ -176,7 +176,7 @@ static irqreturn_t nvgpu_pci_intr_thread(int irq, void *dev_id)
 {
 	struct gk20a *g = dev_id;
 
-	g->ops.mc.isr_thread_stall(g);
+	gk20a_isr_thread_stall(g);
 	g->ops.mc.isr_thread_nonstall(g);
 
 	return IRQ_HANDLED;
@@ -79,6 +79,8 @@ static int vgpu_channel_alloc_inst(struct gk20a *g, struct channel_gk20a *ch)
 	}
 
 	ch->virt_ctx = p->handle;
+	/* anything queued for the previous user went out with this command */
+	vgpu_comm_take_async_err(&ch->virt_async_err);
 	gk20a_dbg_fn("done");
 	return 0;
 }
@@ -277,12 +279,15 @@ static int vgpu_init_fifo_setup_sw(struct gk20a *g)
 
 	f->channel = vzalloc(f->num_channels * sizeof(*f->channel));
 	f->tsg = vzalloc(f->num_channels * sizeof(*f->tsg));
+	f->sema_wakeup_map = kcalloc(BITS_TO_LONGS(f->num_channels),
+				sizeof(unsigned long), GFP_KERNEL);
 	f->engine_info = kzalloc(f->max_engines * sizeof(*f->engine_info),
 				GFP_KERNEL);
 	f->active_engines_list = kzalloc(f->max_engines * sizeof(u32),
 				GFP_KERNEL);
 
-	if (!(f->channel && f->tsg && f->engine_info && f->active_engines_list)) {
+	if (!(f->channel && f->tsg && f->sema_wakeup_map && f->engine_info &&
+		f->active_engines_list)) {
 		err = -ENOMEM;
 		goto clean_up;
 	}
@@ -294,6 +299,8 @@ static int vgpu_init_fifo_setup_sw(struct gk20a *g)
 
 	INIT_LIST_HEAD(&f->free_chs);
 	mutex_init(&f->free_chs_mutex);
+	spin_lock_init(&f->inst_hash_lock);
+	hash_init(f->inst_hash);
 
 	for (chid = 0; chid < f->num_channels; chid++) {
 		f->channel[chid].userd_iova =
@@ -326,6 +333,8 @@ clean_up:
 	f->channel = NULL;
 	vfree(f->tsg);
 	f->tsg = NULL;
+	kfree(f->sema_wakeup_map);
+	f->sema_wakeup_map = NULL;
 	kfree(f->engine_info);
 	f->engine_info = NULL;
 	kfree(f->active_engines_list);
@@ -554,18 +563,20 @@ static int vgpu_channel_set_priority(struct channel_gk20a *ch, u32 priority)
 	struct tegra_vgpu_cmd_msg msg;
 	struct tegra_vgpu_channel_priority_params *p =
 			&msg.params.channel_priority;
-	int err;
 
 	gk20a_dbg_info("channel %d set priority %u", ch->hw_chid, priority);
 
+	/*
+	 * Scheduling hint only: no need to wait for the server. A failure of
+	 * an earlier one on this channel is returned instead.
+	 */
 	msg.cmd = TEGRA_VGPU_CMD_CHANNEL_SET_PRIORITY;
 	msg.handle = vgpu_get_handle(ch->g);
 	p->handle = ch->virt_ctx;
 	p->priority = priority;
-	err = vgpu_comm_sendrecv(&msg, sizeof(msg), sizeof(msg));
-	WARN_ON(err || msg.ret);
+	vgpu_comm_send_async(&msg, &ch->virt_async_err);
 
-	return err ? err : msg.ret;
+	return vgpu_comm_take_async_err(&ch->virt_async_err);
 }
 
 static int vgpu_fifo_tsg_set_runlist_interleave(struct gk20a *g,
@@ -576,7 +587,6 @@ static int vgpu_fifo_tsg_set_runlist_interleave(struct gk20a *g,
 	struct tegra_vgpu_cmd_msg msg = {0};
 	struct tegra_vgpu_tsg_runlist_interleave_params *p =
 			&msg.params.tsg_interleave;
-	int err;
 
 	gk20a_dbg_fn("");
 
@@ -584,9 +594,8 @@ static int vgpu_fifo_tsg_set_runlist_interleave(struct gk20a *g,
 	msg.handle = vgpu_get_handle(g);
 	p->tsg_id = tsgid;
 	p->level = new_level;
-	err = vgpu_comm_sendrecv(&msg, sizeof(msg), sizeof(msg));
-	WARN_ON(err || msg.ret);
-	return err ? err : msg.ret;
+	vgpu_comm_send_async(&msg, &g->fifo.tsg[tsgid].virt_async_err);
+	return vgpu_comm_take_async_err(&g->fifo.tsg[tsgid].virt_async_err);
 }
 
 static int vgpu_fifo_set_runlist_interleave(struct gk20a *g,
@@ -599,7 +608,6 @@ static int vgpu_fifo_set_runlist_interleave(struct gk20a *g,
 	struct tegra_vgpu_channel_runlist_interleave_params *p =
 			&msg.params.channel_interleave;
 	struct channel_gk20a *ch;
-	int err;
 
 	gk20a_dbg_fn("");
 
@@ -612,9 +620,8 @@ static int vgpu_fifo_set_runlist_interleave(struct gk20a *g,
 	msg.handle = vgpu_get_handle(ch->g);
 	p->handle = ch->virt_ctx;
 	p->level = new_level;
-	err = vgpu_comm_sendrecv(&msg, sizeof(msg), sizeof(msg));
-	WARN_ON(err || msg.ret);
-	return err ? err : msg.ret;
+	vgpu_comm_send_async(&msg, &ch->virt_async_err);
+	return vgpu_comm_take_async_err(&ch->virt_async_err);
 }
 
 static int vgpu_channel_set_timeslice(struct channel_gk20a *ch, u32 timeslice)
@@ -622,7 +629,6 @@ static int vgpu_channel_set_timeslice(struct channel_gk20a *ch, u32 timeslice)
 	struct tegra_vgpu_cmd_msg msg;
 	struct tegra_vgpu_channel_timeslice_params *p =
 			&msg.params.channel_timeslice;
-	int err;
 
 	gk20a_dbg_fn("");
 
@@ -630,9 +636,8 @@ static int vgpu_channel_set_timeslice(struct channel_gk20a *ch, u32 timeslice)
 	msg.handle = vgpu_get_handle(ch->g);
 	p->handle = ch->virt_ctx;
 	p->timeslice_us = timeslice;
-	err = vgpu_comm_sendrecv(&msg, sizeof(msg), sizeof(msg));
-	WARN_ON(err || msg.ret);
-	return err ? err : msg.ret;
+	vgpu_comm_send_async(&msg, &ch->virt_async_err);
+	return vgpu_comm_take_async_err(&ch->virt_async_err);
 }
 
 static int vgpu_fifo_force_reset_ch(struct channel_gk20a *ch,
@@ -862,7 +862,7 @@ static int vgpu_gr_init_gr_setup_sw(struct gk20a *g)
 	gr->g = g;
 
 #if defined(CONFIG_GK20A_CYCLE_STATS)
-	mutex_init(&g->gr.cs_lock);
+	gr_gk20a_init_cyclestats_snapshot(g);
 #endif
 
 	err = vgpu_gr_init_gr_config(g, gr);
@@ -67,6 +67,222 @@ int vgpu_init_mm_support(struct gk20a *g)
 	return err;
 }
 
+/* PTE updates a mapping batch queues before pushing them out early. */
+#define VGPU_MAP_BATCH_MAX_OPS \
+	(PAGE_SIZE / sizeof(struct tegra_vgpu_as_map_batch_op))
+
+/* batch->deferred_ops; index[] is the batch->index each op was queued at */
+struct vgpu_map_batch_queue {
+	struct tegra_vgpu_as_map_batch_op ops[VGPU_MAP_BATCH_MAX_OPS];
+	u32 index[VGPU_MAP_BATCH_MAX_OPS];
+};
+
+/* Set once the server rejects TEGRA_VGPU_CMD_AS_MAP_BATCH. */
+static bool vgpu_as_map_batch_unsupported;
+
+static void vgpu_as_map_op_to_msg(struct vm_gk20a *vm,
+				  const struct tegra_vgpu_as_map_batch_op *op,
+				  struct tegra_vgpu_cmd_msg *msg)
+{
+	struct tegra_vgpu_as_map_params *p = &msg->params.as_map;
+
+	if (op->op == TEGRA_VGPU_AS_MAP_BATCH_OP_MAP)
+		msg->cmd = TEGRA_VGPU_CMD_AS_MAP;
+	else
+		msg->cmd = TEGRA_VGPU_CMD_AS_UNMAP;
+	msg->handle = vgpu_get_handle(gk20a_from_vm(vm));
+	p->handle = vm->handle;
+	p->addr = op->addr;
+	p->gpu_va = op->gpu_va;
+	p->size = op->size;
+	p->pgsz_idx = op->pgsz_idx;
+	p->iova = op->iova;
+	p->kind = op->kind;
+	p->cacheable = op->cacheable;
+	p->prot = op->prot;
+	p->ctag_offset = op->ctag_offset;
+	p->clear_ctags = op->clear_ctags;
+}
+
+/*
+ * Apply the ops as plain AS_MAP/AS_UNMAP commands, still sharing round trips
+ * through the generic command batch where the server supports it.
+ */
+static int vgpu_as_map_ops_fallback(struct vm_gk20a *vm,
+				    struct tegra_vgpu_as_map_batch_op *ops,
+				    u32 num)
+{
+	struct tegra_vgpu_cmd_msg *msgs;
+	u32 i;
+	int err;
+
+	msgs = kcalloc(num, sizeof(*msgs), GFP_KERNEL);
+	if (!msgs) {
+		for (i = 0; i < num; i++)
+			ops[i].ret = -ENOMEM;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num; i++)
+		vgpu_as_map_op_to_msg(vm, &ops[i], &msgs[i]);
+
+	err = vgpu_comm_sendrecv_batch(msgs, num);
+	for (i = 0; i < num; i++) {
+		ops[i].ret = err ? err : msgs[i].ret;
+		/* the server invalidates after each plain map/unmap */
+		if (!ops[i].ret)
+			gk20a_vm_tlb_stats_issued(vm);
+	}
+
+	kfree(msgs);
+	return err;
+}
+
+/*
+ * Apply @num queued map/unmap ops in one round trip, with a single TLB
+ * invalidate at the end if @invalidate is set. Per-op status is left in
+ * ops[i].ret.
+ */
+static int vgpu_as_map_batch_send(struct vm_gk20a *vm,
+				  struct tegra_vgpu_as_map_batch_op *ops,
+				  u32 num, bool invalidate)
+{
+	struct tegra_vgpu_cmd_msg msg = {0};
+	struct tegra_vgpu_as_map_batch_params *p = &msg.params.as_map_batch;
+	size_t oob_size, size = num * sizeof(*ops);
+	void *handle, *oob;
+	u32 i;
+	int err;
+
+	if (vgpu_as_map_batch_unsupported)
+		return vgpu_as_map_ops_fallback(vm, ops, num);
+
+	handle = tegra_gr_comm_oob_get_ptr(TEGRA_GR_COMM_CTX_CLIENT,
+					tegra_gr_comm_get_server_vmid(),
+					TEGRA_VGPU_QUEUE_CMD,
+					&oob, &oob_size);
+	if (!handle)
+		return vgpu_as_map_ops_fallback(vm, ops, num);
+
+	if (oob_size < size) {
+		tegra_gr_comm_oob_put_ptr(handle);
+		return vgpu_as_map_ops_fallback(vm, ops, num);
+	}
+
+	memcpy(oob, ops, size);
+
+	msg.cmd = TEGRA_VGPU_CMD_AS_MAP_BATCH;
+	msg.handle = vgpu_get_handle(gk20a_from_vm(vm));
+	p->handle = vm->handle;
+	p->num_ops = num;
+	p->num_done = 0;
+	p->invalidate = invalidate;
+	err = vgpu_comm_sendrecv(&msg, sizeof(msg), sizeof(msg));
+	if (!err && msg.ret && !p->num_done) {
+		tegra_gr_comm_oob_put_ptr(handle);
+		vgpu_as_map_batch_unsupported = true;
+		return vgpu_as_map_ops_fallback(vm, ops, num);
+	}
+
+	if (!err)
+		memcpy(ops, oob, min(p->num_done, num) * sizeof(*ops));
+	tegra_gr_comm_oob_put_ptr(handle);
+
+	if (!err && invalidate && p->num_done)
+		gk20a_vm_tlb_stats_issued(vm);
+
+	for (i = err ? 0 : min(p->num_done, num); i < num; i++)
+		ops[i].ret = err ? err : -EIO;
+
+	return err;
+}
+
+/*
+ * Push out what @batch has queued. Without @invalidate the TLB invalidate is
+ * left to gk20a_vm_mapping_batch_finish_locked(). Call with update_gmmu_lock
+ * held.
+ */
+static void vgpu_mapping_batch_send_queued(struct vm_gk20a *vm,
+					   struct vm_gk20a_mapping_batch *batch,
+					   bool invalidate)
+{
+	struct vgpu_map_batch_queue *q = batch->deferred_ops;
+	struct tegra_vgpu_as_map_batch_op *ops;
+	u32 i;
+	int err;
+
+	if (!batch->num_deferred_ops)
+		return;
+
+	ops = q->ops;
+
+	err = vgpu_as_map_batch_send(vm, ops, batch->num_deferred_ops,
+				     invalidate);
+	if (err && !batch->err)
+		batch->err = err;
+	batch->need_tlb_invalidate = err || !invalidate;
+
+	for (i = 0; i < batch->num_deferred_ops; i++) {
+		if (!ops[i].ret)
+			continue;
+		gk20a_err(dev_from_vm(vm),
+			  "deferred %s of 0x%llx failed, err=%d",
+			  ops[i].op == TEGRA_VGPU_AS_MAP_BATCH_OP_MAP ?
+			  "map" : "unmap", ops[i].gpu_va, ops[i].ret);
+		if (!batch->err)
+			batch->err = ops[i].ret;
+		if (ops[i].op == TEGRA_VGPU_AS_MAP_BATCH_OP_MAP)
+			batch->first_err_index = min(batch->first_err_index,
+						     q->index[i]);
+	}
+	batch->num_deferred_ops = 0;
+}
+
+/*
+ * Queue a map/unmap on @batch. Returns non-zero if it could not be queued and
+ * has to be sent right away instead.
+ */
+static int vgpu_mapping_batch_queue(struct vm_gk20a *vm,
+				    struct vm_gk20a_mapping_batch *batch,
+				    const struct tegra_vgpu_as_map_batch_op *op)
+{
+	struct vgpu_map_batch_queue *q = batch->deferred_ops;
+
+	if (!q) {
+		q = kmalloc(sizeof(*q), GFP_KERNEL);
+		if (!q)
+			return -ENOMEM;
+		batch->deferred_ops = q;
+	}
+
+	if (batch->num_deferred_ops == VGPU_MAP_BATCH_MAX_OPS)
+		vgpu_mapping_batch_send_queued(vm, batch, false);
+
+	q->index[batch->num_deferred_ops] = batch->index;
+	q->ops[batch->num_deferred_ops++] = *op;
+	return 0;
+}
+
+static void vgpu_mapping_batch_flush(struct vm_gk20a *vm,
+				     struct vm_gk20a_mapping_batch *batch)
+{
+	vgpu_mapping_batch_send_queued(vm, batch, true);
+	kfree(batch->deferred_ops);
+	batch->deferred_ops = NULL;
+}
+
+static int vgpu_as_map_op_send(struct vm_gk20a *vm,
+			       const struct tegra_vgpu_as_map_batch_op *op)
+{
+	struct tegra_vgpu_cmd_msg msg;
+	int err;
+
+	vgpu_as_map_op_to_msg(vm, op, &msg);
+	err = vgpu_comm_sendrecv(&msg, sizeof(msg), sizeof(msg));
+
+	return err ? err : msg.ret;
+}
+
 static u64 vgpu_locked_gmmu_map(struct vm_gk20a *vm,
 				u64 map_offset,
 				struct sg_table *sgt,
@@ -87,8 +303,8 @@ static u64 vgpu_locked_gmmu_map(struct vm_gk20a *vm,
 	struct device *d = dev_from_vm(vm);
 	struct gk20a *g = gk20a_from_vm(vm);
 	struct dma_iommu_mapping *mapping = to_dma_iommu_mapping(d);
-	struct tegra_vgpu_cmd_msg msg;
-	struct tegra_vgpu_as_map_params *p = &msg.params.as_map;
+	struct tegra_vgpu_as_map_batch_op op = {0};
+	struct tegra_vgpu_as_map_batch_op *p = &op;
 	u64 addr = g->ops.mm.get_iova_addr(g, sgt->sgl, flags);
 	u8 prot;
 
@@ -112,9 +328,7 @@ static u64 vgpu_locked_gmmu_map(struct vm_gk20a *vm,
 	else
 		prot = TEGRA_VGPU_MAP_PROT_NONE;
 
-	msg.cmd = TEGRA_VGPU_CMD_AS_MAP;
-	msg.handle = vgpu_get_handle(g);
-	p->handle = vm->handle;
+	p->op = TEGRA_VGPU_AS_MAP_BATCH_OP_MAP;
 	p->addr = addr;
 	p->gpu_va = map_offset;
 	p->size = size;
@@ -140,12 +354,21 @@ static u64 vgpu_locked_gmmu_map(struct vm_gk20a *vm,
 	p->prot = prot;
 	p->ctag_offset = ctag_offset;
 	p->clear_ctags = clear_ctags;
-	err = vgpu_comm_sendrecv(&msg, sizeof(msg), sizeof(msg));
-	err = err ? err : msg.ret;
+
+	/*
+	 * Within a mapping batch the PTE update goes out with the rest of the
+	 * batch, before the buffer can be used; see vgpu_mapping_batch_flush().
+	 */
+	gk20a_vm_tlb_stats_requested(vm);
+	if (batch && !vgpu_mapping_batch_queue(vm, batch, &op))
+		return map_offset;
+
+	err = vgpu_as_map_op_send(vm, &op);
 	if (err)
 		goto fail;
 
 	/* TLB invalidate handled on server side */
+	gk20a_vm_tlb_stats_issued(vm);
 
 	return map_offset;
 fail:
@@ -162,32 +385,38 @@ static void vgpu_locked_gmmu_unmap(struct vm_gk20a *vm,
 				bool sparse,
 				struct vm_gk20a_mapping_batch *batch)
 {
-	struct gk20a *g = gk20a_from_vm(vm);
-	struct tegra_vgpu_cmd_msg msg;
-	struct tegra_vgpu_as_map_params *p = &msg.params.as_map;
+	struct tegra_vgpu_as_map_batch_op op = {0};
 	int err;
 
 	gk20a_dbg_fn("");
 
+	op.op = TEGRA_VGPU_AS_MAP_BATCH_OP_UNMAP;
+	op.gpu_va = vaddr;
+
+	/*
+	 * The VA is freed and the buffer unpinned as soon as this returns, so
+	 * the PTEs have to be gone by then. Within a mapping batch only the
+	 * TLB invalidate waits; queued maps go out first to keep the order.
+	 */
+	gk20a_vm_tlb_stats_requested(vm);
+	if (batch && !vgpu_mapping_batch_queue(vm, batch, &op)) {
+		vgpu_mapping_batch_send_queued(vm, batch, false);
+	} else {
+		err = vgpu_as_map_op_send(vm, &op);
+		if (err)
+			dev_err(dev_from_vm(vm),
+				"failed to update gmmu ptes on unmap");
+		else
+			/* TLB invalidate handled on server side */
+			gk20a_vm_tlb_stats_issued(vm);
+	}
+
 	if (va_allocated) {
 		err = gk20a_vm_free_va(vm, vaddr, size, pgsz_idx);
-		if (err) {
+		if (err)
 			dev_err(dev_from_vm(vm),
 				"failed to free va");
-			return;
-		}
 	}
-
-	msg.cmd = TEGRA_VGPU_CMD_AS_UNMAP;
-	msg.handle = vgpu_get_handle(g);
-	p->handle = vm->handle;
-	p->gpu_va = vaddr;
-	err = vgpu_comm_sendrecv(&msg, sizeof(msg), sizeof(msg));
-	if (err || msg.ret)
-		dev_err(dev_from_vm(vm),
-			"failed to update gmmu ptes on unmap");
-
-	/* TLB invalidate handled on server side */
 }
 
 static void vgpu_vm_remove_support(struct vm_gk20a *vm)
@@ -195,6 +424,7 @@ static void vgpu_vm_remove_support(struct vm_gk20a *vm)
 	struct gk20a *g = vm->mm->g;
 	struct mapped_buffer_node *mapped_buffer;
 	struct vm_reserved_va_node *va_node, *va_node_tmp;
+	struct vm_gk20a_mapping_batch batch;
 	struct tegra_vgpu_cmd_msg msg;
 	struct tegra_vgpu_as_share_params *p = &msg.params.as_share;
 	struct rb_node *node;
@@ -206,13 +436,18 @@ static void vgpu_vm_remove_support(struct vm_gk20a *vm)
 	/* TBD: add a flag here for the unmap code to recognize teardown
 	 * and short-circuit any otherwise expensive operations. */
 
+	gk20a_vm_invalidate_buffer_set_locked(vm);
+
+	/* Tear the remaining mappings down with a single TLB invalidate. */
+	gk20a_vm_mapping_batch_start(&batch);
 	node = rb_first(&vm->mapped_buffers);
 	while (node) {
 		mapped_buffer =
 			container_of(node, struct mapped_buffer_node, node);
-		gk20a_vm_unmap_locked(mapped_buffer, NULL);
+		gk20a_vm_unmap_locked(mapped_buffer, &batch);
 		node = rb_first(&vm->mapped_buffers);
 	}
+	gk20a_vm_mapping_batch_finish_locked(vm, &batch);
 
 	/* destroy remaining reserved memory areas */
 	list_for_each_entry_safe(va_node, va_node_tmp, &vm->reserved_va_list,
@@ -549,6 +784,7 @@ void vgpu_init_mm_ops(struct gpu_ops *gops)
 	gops->mm.set_debug_mode = vgpu_mm_mmu_set_debug_mode;
 	gops->mm.gmmu_map = vgpu_locked_gmmu_map;
 	gops->mm.gmmu_unmap = vgpu_locked_gmmu_unmap;
+	gops->mm.mapping_batch_flush = vgpu_mapping_batch_flush;
 	gops->mm.vm_remove = vgpu_vm_remove_support;
 	gops->mm.vm_alloc_share = vgpu_vm_alloc_share;
 	gops->mm.vm_bind_channel = vgpu_vm_bind_channel;
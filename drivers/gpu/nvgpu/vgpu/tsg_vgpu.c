@@ -81,7 +81,6 @@ static int vgpu_tsg_set_timeslice(struct tsg_gk20a *tsg, u32 timeslice)
 	struct tegra_vgpu_cmd_msg msg = {0};
 	struct tegra_vgpu_tsg_timeslice_params *p =
 				&msg.params.tsg_timeslice;
-	int err;
 
 	gk20a_dbg_fn("");
 
@@ -89,11 +88,9 @@ static int vgpu_tsg_set_timeslice(struct tsg_gk20a *tsg, u32 timeslice)
 	msg.handle = vgpu_get_handle(tsg->g);
 	p->tsg_id = tsg->tsgid;
 	p->timeslice_us = timeslice;
-	err = vgpu_comm_sendrecv(&msg, sizeof(msg), sizeof(msg));
-	err = err ? err : msg.ret;
-	WARN_ON(err);
+	vgpu_comm_send_async(&msg, &tsg->virt_async_err);
 
-	return err;
+	return vgpu_comm_take_async_err(&tsg->virt_async_err);
 }
 
 void vgpu_init_tsg_ops(struct gpu_ops *gops)
@@ -15,9 +15,13 @@
 
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/debugfs.h>
 #include <linux/dma-mapping.h>
+#include <linux/ktime.h>
 #include <linux/pm_runtime.h>
 #include <linux/pm_qos.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
 
 #include "vgpu/vgpu.h"
 #include "vgpu/fecs_trace_vgpu.h"
@@ -34,10 +38,400 @@
 #include "nvgpu_gpuid_t18x.h"
 #endif
 
+/*
+ * Commands queued by vgpu_comm_send_async() before they go out. They are sent
+ * in front of the next synchronous command, when the queue fills up or after
+ * VGPU_COMM_ASYNC_DELAY_MS, whichever comes first. A failure is recorded in
+ * the error slot the sender passed, typically one per channel or TSG, and
+ * returned by the next scheduling call on that object.
+ */
+#define VGPU_COMM_ASYNC_MAX		16
+#define VGPU_COMM_ASYNC_DELAY_MS	1
+
+struct vgpu_comm;
+
+/*
+ * How a vgpu_comm reaches the server. The regular transport goes through
+ * tegra_gr_comm; the loopback one completes every command locally after a
+ * simulated round trip so batching can be measured without a hypervisor.
+ */
+struct vgpu_comm_transport {
+	int (*xfer)(struct vgpu_comm *comm, struct tegra_vgpu_cmd_msg *msg,
+		    size_t size_in, size_t size_out);
+	void *(*oob_get)(struct vgpu_comm *comm, void **oob, size_t *size);
+	void (*oob_put)(struct vgpu_comm *comm, void *handle);
+};
+
+struct vgpu_comm {
+	const struct vgpu_comm_transport *t;
+	struct device *dev;
+
+	/* Set once the server rejects TEGRA_VGPU_CMD_BATCH. */
+	bool no_batch;
+
+	struct mutex async_lock;
+	/* One spare slot for the synchronous command riding along. */
+	struct tegra_vgpu_cmd_msg async[VGPU_COMM_ASYNC_MAX + 1];
+	/* Where each queued command reports its failure, may be NULL. */
+	int *async_err_slot[VGPU_COMM_ASYNC_MAX];
+	u32 async_count;
+	int async_err;		/* First async failure not yet collected. */
+	struct delayed_work async_work;
+
+	void *loopback_oob;
+	u32 loopback_rtt_us;
+
+	atomic_t round_trips;
+	atomic_t cmds;
+	atomic_t batches;
+	atomic_t batched_cmds;
+	atomic_t async_cmds;
+	atomic_t async_errors;
+};
+
+/*
+ * The OOB area as taken by one sender. Whoever needs both it and async_lock
+ * takes the OOB area first: senders like REG_OPS already hold it when they
+ * come in through vgpu_comm_sendrecv().
+ */
+struct vgpu_comm_oob {
+	void *handle;
+	void *buf;
+	size_t size;
+};
+
+static struct vgpu_comm vgpu_comm_client;
+static u32 vgpu_comm_loopback_rtt_us = 20;
+
+static int vgpu_comm_server_xfer(struct vgpu_comm *comm,
+		struct tegra_vgpu_cmd_msg *msg, size_t size_in,
+		size_t size_out)
+{
+	void *handle;
+	size_t size = size_in;
+	void *data = msg;
+	int err;
+
+	err = tegra_gr_comm_sendrecv(TEGRA_GR_COMM_CTX_CLIENT,
+				tegra_gr_comm_get_server_vmid(),
+				TEGRA_VGPU_QUEUE_CMD, &handle, &data, &size);
+	if (!err) {
+		WARN_ON(size < size_out);
+		memcpy(msg, data, size_out);
+		tegra_gr_comm_release(handle);
+	}
+
+	return err;
+}
+
+static void *vgpu_comm_server_oob_get(struct vgpu_comm *comm, void **oob,
+		size_t *size)
+{
+	return tegra_gr_comm_oob_get_ptr(TEGRA_GR_COMM_CTX_CLIENT,
+					tegra_gr_comm_get_server_vmid(),
+					TEGRA_VGPU_QUEUE_CMD, oob, size);
+}
+
+static void vgpu_comm_server_oob_put(struct vgpu_comm *comm, void *handle)
+{
+	tegra_gr_comm_oob_put_ptr(handle);
+}
+
+static const struct vgpu_comm_transport vgpu_comm_server_transport = {
+	.xfer = vgpu_comm_server_xfer,
+	.oob_get = vgpu_comm_server_oob_get,
+	.oob_put = vgpu_comm_server_oob_put,
+};
+
+static int vgpu_comm_loopback_xfer(struct vgpu_comm *comm,
+		struct tegra_vgpu_cmd_msg *msg, size_t size_in,
+		size_t size_out)
+{
+	struct tegra_vgpu_cmd_msg *cmds = comm->loopback_oob;
+	u32 i;
+
+	if (comm->loopback_rtt_us)
+		udelay(comm->loopback_rtt_us);
+
+	if (msg->cmd == TEGRA_VGPU_CMD_BATCH) {
+		for (i = 0; i < msg->params.batch.num_cmds; i++)
+			cmds[i].ret = 0;
+		msg->params.batch.num_done = msg->params.batch.num_cmds;
+	}
+	msg->ret = 0;
+
+	return 0;
+}
+
+static void *vgpu_comm_loopback_oob_get(struct vgpu_comm *comm, void **oob,
+		size_t *size)
+{
+	*oob = comm->loopback_oob;
+	*size = PAGE_SIZE;
+	return comm->loopback_oob;
+}
+
+static void vgpu_comm_loopback_oob_put(struct vgpu_comm *comm, void *handle)
+{
+}
+
+static const struct vgpu_comm_transport vgpu_comm_loopback_transport = {
+	.xfer = vgpu_comm_loopback_xfer,
+	.oob_get = vgpu_comm_loopback_oob_get,
+	.oob_put = vgpu_comm_loopback_oob_put,
+};
+
+static int __vgpu_comm_xfer(struct vgpu_comm *comm,
+		struct tegra_vgpu_cmd_msg *msg, size_t size_in,
+		size_t size_out)
+{
+	atomic_inc(&comm->round_trips);
+	return comm->t->xfer(comm, msg, size_in, size_out);
+}
+
+static void vgpu_comm_oob_get(struct vgpu_comm *comm,
+		struct vgpu_comm_oob *oob)
+{
+	oob->handle = comm->t->oob_get(comm, &oob->buf, &oob->size);
+}
+
+static void vgpu_comm_oob_put(struct vgpu_comm *comm,
+		struct vgpu_comm_oob *oob)
+{
+	if (oob->handle)
+		comm->t->oob_put(comm, oob->handle);
+	oob->handle = NULL;
+}
+
+/*
+ * Commands whose sender holds the OOB area across the round trip. Anything
+ * sent ahead of them must not try to take it again.
+ */
+static bool vgpu_comm_cmd_holds_oob(u32 cmd)
+{
+	return cmd == TEGRA_VGPU_CMD_REG_OPS ||
+		cmd == TEGRA_VGPU_CMD_AS_MAP_BATCH;
+}
+
+/*
+ * Run @num commands in order using as few round trips as the OOB area allows,
+ * or one by one if @oob is NULL or was not available. Each command's status
+ * is written to its own ret field; the return value only reports transport
+ * errors.
+ */
+static int __vgpu_comm_batch(struct vgpu_comm *comm,
+		struct tegra_vgpu_cmd_msg *cmds, u32 num,
+		struct vgpu_comm_oob *oob)
+{
+	struct tegra_vgpu_cmd_msg msg;
+	struct tegra_vgpu_batch_params *p = &msg.params.batch;
+	u32 done = 0, n;
+	int err;
+
+	atomic_add(num, &comm->cmds);
+
+	while (done < num) {
+		n = 1;
+		if (oob && oob->handle && !comm->no_batch && num - done > 1)
+			n = min_t(u32, num - done, oob->size / sizeof(*cmds));
+
+		if (n < 2) {
+			err = __vgpu_comm_xfer(comm, &cmds[done],
+					sizeof(*cmds), sizeof(*cmds));
+			if (err)
+				return err;
+			done++;
+			continue;
+		}
+
+		memcpy(oob->buf, &cmds[done], n * sizeof(*cmds));
+
+		msg.cmd = TEGRA_VGPU_CMD_BATCH;
+		msg.handle = cmds[done].handle;
+		p->num_cmds = n;
+		p->num_done = 0;
+		err = __vgpu_comm_xfer(comm, &msg, sizeof(msg), sizeof(msg));
+		if (!err && msg.ret && !p->num_done) {
+			/* Server predates batching: go one by one from now on. */
+			comm->no_batch = true;
+			continue;
+		}
+		if (err)
+			return err;
+		memcpy(&cmds[done], oob->buf,
+		       min(p->num_done, n) * sizeof(*cmds));
+		if (WARN_ON(!p->num_done))
+			return -EIO;
+
+		atomic_inc(&comm->batches);
+		atomic_add(p->num_done, &comm->batched_cmds);
+		done += min(p->num_done, n);
+	}
+
+	return 0;
+}
+
+/*
+ * Send whatever is queued plus an optional synchronous command at the end,
+ * batched through @oob if the caller took it. Call with async_lock held.
+ */
+static int __vgpu_comm_flush_async(struct vgpu_comm *comm,
+		struct tegra_vgpu_cmd_msg *sync_msg, size_t size_out,
+		struct vgpu_comm_oob *oob)
+{
+	u32 num = comm->async_count;
+	u32 i;
+	int err;
+
+	if (sync_msg)
+		comm->async[num++] = *sync_msg;
+	if (!num)
+		return 0;
+
+	err = __vgpu_comm_batch(comm, comm->async, num, oob);
+
+	for (i = 0; i < comm->async_count; i++) {
+		int ret = err ? err : comm->async[i].ret;
+
+		if (!ret)
+			continue;
+		gk20a_err(comm->dev, "async vgpu cmd %u failed, err=%d",
+			  comm->async[i].cmd, ret);
+		atomic_inc(&comm->async_errors);
+		if (!comm->async_err)
+			comm->async_err = ret;
+		if (comm->async_err_slot[i] && !*comm->async_err_slot[i])
+			*comm->async_err_slot[i] = ret;
+	}
+	comm->async_count = 0;
+
+	if (sync_msg && !err)
+		memcpy(sync_msg, &comm->async[num - 1], size_out);
+
+	return err;
+}
+
+static void vgpu_comm_async_worker(struct work_struct *work)
+{
+	struct vgpu_comm *comm = container_of(to_delayed_work(work),
+					struct vgpu_comm, async_work);
+	struct vgpu_comm_oob oob;
+
+	if (!ACCESS_ONCE(comm->async_count))
+		return;
+
+	vgpu_comm_oob_get(comm, &oob);
+	mutex_lock(&comm->async_lock);
+	__vgpu_comm_flush_async(comm, NULL, 0, &oob);
+	mutex_unlock(&comm->async_lock);
+	vgpu_comm_oob_put(comm, &oob);
+}
+
+static void __vgpu_comm_init(struct vgpu_comm *comm, struct device *dev,
+		const struct vgpu_comm_transport *t)
+{
+	comm->t = t;
+	comm->dev = dev;
+	comm->no_batch = false;
+	comm->async_count = 0;
+	comm->async_err = 0;
+	mutex_init(&comm->async_lock);
+	INIT_DELAYED_WORK(&comm->async_work, vgpu_comm_async_worker);
+	atomic_set(&comm->round_trips, 0);
+	atomic_set(&comm->cmds, 0);
+	atomic_set(&comm->batches, 0);
+	atomic_set(&comm->batched_cmds, 0);
+	atomic_set(&comm->async_cmds, 0);
+	atomic_set(&comm->async_errors, 0);
+}
+
+static int __vgpu_comm_sendrecv(struct vgpu_comm *comm,
+		struct tegra_vgpu_cmd_msg *msg, size_t size_in,
+		size_t size_out)
+{
+	struct vgpu_comm_oob oob = { NULL };
+	int err;
+
+	if (!ACCESS_ONCE(comm->async_count)) {
+		atomic_inc(&comm->cmds);
+		return __vgpu_comm_xfer(comm, msg, size_in, size_out);
+	}
+
+	/* Let the queued commands ride along in front of this one. */
+	if (!vgpu_comm_cmd_holds_oob(msg->cmd))
+		vgpu_comm_oob_get(comm, &oob);
+	mutex_lock(&comm->async_lock);
+	err = __vgpu_comm_flush_async(comm, msg, size_out, &oob);
+	mutex_unlock(&comm->async_lock);
+	vgpu_comm_oob_put(comm, &oob);
+
+	return err;
+}
+
+static void __vgpu_comm_send_async(struct vgpu_comm *comm,
+		struct tegra_vgpu_cmd_msg *msg, int *err_slot)
+{
+	struct vgpu_comm_oob oob;
+
+	mutex_lock(&comm->async_lock);
+	while (comm->async_count == VGPU_COMM_ASYNC_MAX) {
+		/* Full: push it out, taking the OOB area outside the lock. */
+		mutex_unlock(&comm->async_lock);
+		vgpu_comm_oob_get(comm, &oob);
+		mutex_lock(&comm->async_lock);
+		if (comm->async_count == VGPU_COMM_ASYNC_MAX)
+			__vgpu_comm_flush_async(comm, NULL, 0, &oob);
+		mutex_unlock(&comm->async_lock);
+		vgpu_comm_oob_put(comm, &oob);
+		mutex_lock(&comm->async_lock);
+	}
+	comm->async_err_slot[comm->async_count] = err_slot;
+	comm->async[comm->async_count++] = *msg;
+	atomic_inc(&comm->async_cmds);
+	if (comm->async_count == VGPU_COMM_ASYNC_MAX)
+		mod_delayed_work(system_wq, &comm->async_work, 0);
+	else if (comm->async_count == 1)
+		schedule_delayed_work(&comm->async_work,
+			msecs_to_jiffies(VGPU_COMM_ASYNC_DELAY_MS));
+	mutex_unlock(&comm->async_lock);
+}
+
+static int __vgpu_comm_collect_async(struct vgpu_comm *comm)
+{
+	struct vgpu_comm_oob oob;
+	int err;
+
+	vgpu_comm_oob_get(comm, &oob);
+	mutex_lock(&comm->async_lock);
+	err = __vgpu_comm_flush_async(comm, NULL, 0, &oob);
+	if (!err)
+		err = comm->async_err;
+	comm->async_err = 0;
+	mutex_unlock(&comm->async_lock);
+	vgpu_comm_oob_put(comm, &oob);
+
+	return err;
+}
+
+static int __vgpu_comm_take_async_err(struct vgpu_comm *comm, int *err_slot)
+{
+	int err;
+
+	mutex_lock(&comm->async_lock);
+	err = *err_slot;
+	*err_slot = 0;
+	mutex_unlock(&comm->async_lock);
+
+	return err;
+}
+
 static inline int vgpu_comm_init(struct platform_device *pdev)
 {
 	size_t queue_sizes[] = { TEGRA_VGPU_QUEUE_SIZES };
 
+	__vgpu_comm_init(&vgpu_comm_client, &pdev->dev,
+			 &vgpu_comm_server_transport);
+
 	return tegra_gr_comm_init(pdev, TEGRA_GR_COMM_CTX_CLIENT, 3,
 				queue_sizes, TEGRA_VGPU_QUEUE_CMD,
 				ARRAY_SIZE(queue_sizes));
@@ -47,6 +441,9 @@ static inline void vgpu_comm_deinit(void)
 {
 	size_t queue_sizes[] = { TEGRA_VGPU_QUEUE_SIZES };
 
+	cancel_delayed_work_sync(&vgpu_comm_client.async_work);
+	__vgpu_comm_collect_async(&vgpu_comm_client);
+
 	tegra_gr_comm_deinit(TEGRA_GR_COMM_CTX_CLIENT, TEGRA_VGPU_QUEUE_CMD,
 			ARRAY_SIZE(queue_sizes));
 }
@@ -54,23 +451,198 @@ static inline void vgpu_comm_deinit(void)
 int vgpu_comm_sendrecv(struct tegra_vgpu_cmd_msg *msg, size_t size_in,
 		size_t size_out)
 {
-	void *handle;
-	size_t size = size_in;
-	void *data = msg;
+	return __vgpu_comm_sendrecv(&vgpu_comm_client, msg, size_in,
+				    size_out);
+}
+
+/*
+ * Run several independent commands with as few round trips as possible.
+ * Per-command status is returned in each msgs[i].ret.
+ */
+int vgpu_comm_sendrecv_batch(struct tegra_vgpu_cmd_msg *msgs, u32 num)
+{
+	struct vgpu_comm *comm = &vgpu_comm_client;
+	struct vgpu_comm_oob oob;
 	int err;
 
-	err = tegra_gr_comm_sendrecv(TEGRA_GR_COMM_CTX_CLIENT,
-				tegra_gr_comm_get_server_vmid(),
-				TEGRA_VGPU_QUEUE_CMD, &handle, &data, &size);
-	if (!err) {
-		WARN_ON(size < size_out);
-		memcpy(msg, data, size_out);
-		tegra_gr_comm_release(handle);
+	vgpu_comm_oob_get(comm, &oob);
+	mutex_lock(&comm->async_lock);
+	err = __vgpu_comm_flush_async(comm, NULL, 0, &oob);
+	if (!err)
+		err = __vgpu_comm_batch(comm, msgs, num, &oob);
+	mutex_unlock(&comm->async_lock);
+	vgpu_comm_oob_put(comm, &oob);
+
+	return err;
+}
+
+/*
+ * Queue a command whose result the caller does not need right away. Failures
+ * are logged, reported by the next vgpu_comm_collect_async() and, if @err_slot
+ * is set, stored there until vgpu_comm_take_async_err() picks them up.
+ */
+void vgpu_comm_send_async(struct tegra_vgpu_cmd_msg *msg, int *err_slot)
+{
+	__vgpu_comm_send_async(&vgpu_comm_client, msg, err_slot);
+}
+
+/*
+ * Return and clear the first failure recorded in @err_slot by commands sent
+ * so far. Commands still queued report into it later.
+ */
+int vgpu_comm_take_async_err(int *err_slot)
+{
+	return __vgpu_comm_take_async_err(&vgpu_comm_client, err_slot);
+}
+
+/*
+ * Push out all queued async commands and return the first error any of them
+ * hit since the last collect.
+ */
+int vgpu_comm_collect_async(void)
+{
+	return __vgpu_comm_collect_async(&vgpu_comm_client);
+}
+
+#ifdef CONFIG_DEBUG_FS
+#define VGPU_COMM_BENCH_CMDS	256
+
+static int vgpu_comm_stats_show(struct seq_file *s, void *unused)
+{
+	struct vgpu_comm *comm = &vgpu_comm_client;
+
+	seq_printf(s, "round trips:    %d\n", atomic_read(&comm->round_trips));
+	seq_printf(s, "commands:       %d\n", atomic_read(&comm->cmds));
+	seq_printf(s, "batches:        %d (%d cmds)\n",
+		   atomic_read(&comm->batches),
+		   atomic_read(&comm->batched_cmds));
+	seq_printf(s, "async commands: %d (%d failed)\n",
+		   atomic_read(&comm->async_cmds),
+		   atomic_read(&comm->async_errors));
+	seq_printf(s, "batching:       %s\n",
+		   comm->no_batch ? "unsupported by server" : "enabled");
+
+	return 0;
+}
+
+/*
+ * Push the same stream of commands through a loopback transport one by one,
+ * as explicit batches and through the async queue, and report how many round
+ * trips and how much time each approach took.
+ */
+static int vgpu_comm_bench_show(struct seq_file *s, void *unused)
+{
+	static const char * const modes[] = { "sync", "batch", "async" };
+	struct device *dev = s->private;
+	struct tegra_vgpu_cmd_msg *cmds;
+	struct vgpu_comm *comm;
+	struct vgpu_comm_oob bench_oob;
+	void *oob;
+	u64 start, ns;
+	int mode, i, err = 0;
+
+	comm = kzalloc(sizeof(*comm), GFP_KERNEL);
+	cmds = kcalloc(VGPU_COMM_BENCH_CMDS, sizeof(*cmds), GFP_KERNEL);
+	oob = kzalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!comm || !cmds || !oob) {
+		err = -ENOMEM;
+		goto done;
 	}
 
+	seq_printf(s, "loopback rtt %u us, %d commands\n",
+		   vgpu_comm_loopback_rtt_us, VGPU_COMM_BENCH_CMDS);
+	seq_puts(s, "mode   round-trips  total(us)  per-cmd(ns)\n");
+
+	for (mode = 0; mode < ARRAY_SIZE(modes); mode++) {
+		__vgpu_comm_init(comm, dev, &vgpu_comm_loopback_transport);
+		comm->loopback_oob = oob;
+		comm->loopback_rtt_us = vgpu_comm_loopback_rtt_us;
+
+		for (i = 0; i < VGPU_COMM_BENCH_CMDS; i++) {
+			cmds[i].cmd = TEGRA_VGPU_CMD_CHANNEL_SET_PRIORITY;
+			cmds[i].handle = vgpu_get_handle_from_dev(dev);
+		}
+
+		start = ktime_to_ns(ktime_get());
+		switch (mode) {
+		case 0:
+			for (i = 0; i < VGPU_COMM_BENCH_CMDS && !err; i++)
+				err = __vgpu_comm_sendrecv(comm, &cmds[i],
+						sizeof(cmds[i]),
+						sizeof(cmds[i]));
+			break;
+		case 1:
+			vgpu_comm_oob_get(comm, &bench_oob);
+			err = __vgpu_comm_batch(comm, cmds,
+					VGPU_COMM_BENCH_CMDS, &bench_oob);
+			vgpu_comm_oob_put(comm, &bench_oob);
+			break;
+		case 2:
+			for (i = 0; i < VGPU_COMM_BENCH_CMDS; i++)
+				__vgpu_comm_send_async(comm, &cmds[i], NULL);
+			err = __vgpu_comm_collect_async(comm);
+			break;
+		}
+		ns = ktime_to_ns(ktime_get()) - start;
+		cancel_delayed_work_sync(&comm->async_work);
+		if (err)
+			break;
+
+		seq_printf(s, "%-6s %11d  %9llu  %11llu\n", modes[mode],
+			   atomic_read(&comm->round_trips),
+			   div64_u64(ns, 1000),
+			   div64_u64(ns, VGPU_COMM_BENCH_CMDS));
+	}
+
+done:
+	kfree(oob);
+	kfree(cmds);
+	kfree(comm);
 	return err;
 }
 
+static int vgpu_comm_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vgpu_comm_stats_show, inode->i_private);
+}
+
+static int vgpu_comm_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vgpu_comm_bench_show, inode->i_private);
+}
+
+static const struct file_operations vgpu_comm_stats_fops = {
+	.open		= vgpu_comm_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static const struct file_operations vgpu_comm_bench_fops = {
+	.open		= vgpu_comm_bench_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void vgpu_comm_debugfs_init(struct device *dev)
+{
+	struct gk20a_platform *platform = dev_get_drvdata(dev);
+	struct dentry *root;
+
+	root = debugfs_create_dir("vgpu_comm", platform->debugfs);
+	if (IS_ERR_OR_NULL(root))
+		return;
+
+	debugfs_create_file("stats", S_IRUGO, root, dev,
+			    &vgpu_comm_stats_fops);
+	debugfs_create_file("loopback_bench", S_IRUSR, root, dev,
+			    &vgpu_comm_bench_fops);
+	debugfs_create_u32("loopback_rtt_us", S_IRUGO|S_IWUSR, root,
+			   &vgpu_comm_loopback_rtt_us);
+}
+#endif
+
 static u64 vgpu_connect(void)
 {
 	struct tegra_vgpu_cmd_msg msg;
@@ -296,7 +868,7 @@ static int vgpu_init_gpu_characteristics(struct gk20a *g)
 		return err;
 
 	g->gpu_characteristics.max_freq = priv->constants.max_freq;
-	g->gpu_characteristics.map_buffer_batch_limit = 0;
+	g->gpu_characteristics.map_buffer_batch_limit = 256;
 	return 0;
 }
 
@@ -603,6 +1175,9 @@ int vgpu_probe(struct platform_device *pdev)
 		return -ENOMEM;
 
 	gk20a_debug_init(dev, "gpu.0");
+#ifdef CONFIG_DEBUG_FS
+	vgpu_comm_debugfs_init(dev);
+#endif
 
 	/* Set DMA parameters to allow larger sgt lists */
 	dev->dma_parms = &gk20a->dma_parms;
@@ -95,6 +95,10 @@ int vgpu_init_fifo_support(struct gk20a *g);
 int vgpu_get_attribute(u64 handle, u32 attrib, u32 *value);
 int vgpu_comm_sendrecv(struct tegra_vgpu_cmd_msg *msg, size_t size_in,
 		size_t size_out);
+int vgpu_comm_sendrecv_batch(struct tegra_vgpu_cmd_msg *msgs, u32 num);
+void vgpu_comm_send_async(struct tegra_vgpu_cmd_msg *msg, int *err_slot);
+int vgpu_comm_take_async_err(int *err_slot);
+int vgpu_comm_collect_async(void);
 
 void vgpu_init_hal_common(struct gk20a *g);
 int vgpu_gk20a_init_hal(struct gk20a *g);
@@ -191,6 +195,23 @@ static inline int vgpu_comm_sendrecv(struct tegra_vgpu_cmd_msg *msg, size_t size
 {
 	return -ENOSYS;
 }
+static inline int vgpu_comm_sendrecv_batch(struct tegra_vgpu_cmd_msg *msgs,
+		u32 num)
+{
+	return -ENOSYS;
+}
+static inline void vgpu_comm_send_async(struct tegra_vgpu_cmd_msg *msg,
+		int *err_slot)
+{
+}
+static inline int vgpu_comm_take_async_err(int *err_slot)
+{
+	return -ENOSYS;
+}
+static inline int vgpu_comm_collect_async(void)
+{
+	return -ENOSYS;
+}
 #endif
 
 #endif
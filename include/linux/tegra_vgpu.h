@@ -98,6 +98,8 @@ enum {
 	TEGRA_VGPU_CMD_SET_GPU_CLK_RATE = 61,
 	TEGRA_VGPU_CMD_GET_CONSTANTS = 62,
 	TEGRA_VGPU_CMD_CHANNEL_CYCLESTATS_SNAPSHOT = 63,
+	TEGRA_VGPU_CMD_BATCH = 64,
+	TEGRA_VGPU_CMD_AS_MAP_BATCH = 65,
 };
 
 struct tegra_vgpu_connect_params {
@@ -191,6 +193,41 @@ struct tegra_vgpu_mem_desc {
 	u64 length;
 };
 
+enum {
+	TEGRA_VGPU_AS_MAP_BATCH_OP_MAP = 0,
+	TEGRA_VGPU_AS_MAP_BATCH_OP_UNMAP,
+};
+
+/* unmap only uses gpu_va */
+struct tegra_vgpu_as_map_batch_op {
+	u8 op;
+	u8 pgsz_idx;
+	u8 iova;
+	u8 kind;
+	u8 cacheable;
+	u8 clear_ctags;
+	u8 prot;
+	int ret;
+	u32 ctag_offset;
+	u64 addr;
+	u64 gpu_va;
+	u64 size;
+};
+
+/*
+ * TEGRA_VGPU_CMD_AS_MAP_BATCH: the OOB area holds num_ops entries of
+ * struct tegra_vgpu_as_map_batch_op for the address space handle. They are
+ * applied in order without per-op TLB invalidates; if invalidate is set the
+ * server invalidates once after the last op. Each entry's ret holds its
+ * status and num_done the number of entries processed.
+ */
+struct tegra_vgpu_as_map_batch_params {
+	u64 handle;
+	u32 num_ops;
+	u32 num_done;
+	u8 invalidate;
+};
+
 struct tegra_vgpu_as_invalidate_params {
 	u64 handle;
 };
@@ -449,6 +486,16 @@ struct tegra_vgpu_channel_cyclestats_snapshot_params {
 	u8 hw_overflow;
 };
 
+/*
+ * TEGRA_VGPU_CMD_BATCH: the OOB area holds num_cmds complete
+ * struct tegra_vgpu_cmd_msg entries. The server runs them in order and writes
+ * each entry back with its own ret; num_done is the number of entries run.
+ */
+struct tegra_vgpu_batch_params {
+	u32 num_cmds;
+	u32 num_done;
+};
+
 struct tegra_vgpu_cmd_msg {
 	u32 cmd;
 	int ret;
@@ -494,6 +541,8 @@ struct tegra_vgpu_cmd_msg {
 		struct tegra_vgpu_gpu_clk_rate_params gpu_clk_rate;
 		struct tegra_vgpu_constants_params constants;
 		struct tegra_vgpu_channel_cyclestats_snapshot_params cyclestats_snapshot;
+		struct tegra_vgpu_batch_params batch;
+		struct tegra_vgpu_as_map_batch_params as_map_batch;
 		char padding[192];
 	} params;
 };
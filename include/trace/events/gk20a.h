@@ -472,6 +472,27 @@ TRACE_EVENT(gk20a_as_ioctl_get_va_regions,
 	TP_printk("name=%s ",  __entry->name)
 );
 
+TRACE_EVENT(gk20a_vm_get_buffer_set,
+	TP_PROTO(int as_id, u64 gen, int num_buffers, bool rebuilt),
+	TP_ARGS(as_id, gen, num_buffers, rebuilt),
+	TP_STRUCT__entry(
+			 __field(int, as_id)
+			 __field(u64, gen)
+			 __field(int, num_buffers)
+			 __field(bool, rebuilt)
+			 ),
+	TP_fast_assign(
+		       __entry->as_id = as_id;
+		       __entry->gen = gen;
+		       __entry->num_buffers = num_buffers;
+		       __entry->rebuilt = rebuilt;
+		       ),
+	TP_printk("as=%d gen=%llu num_buffers=%d rebuilt=%d refs_taken=%d",
+		  __entry->as_id, __entry->gen, __entry->num_buffers,
+		  __entry->rebuilt,
+		  __entry->rebuilt ? __entry->num_buffers + 1 : 1)
+);
+
 TRACE_EVENT(gk20a_mmu_fault,
 	    TP_PROTO(u32 fault_hi, u32 fault_lo,
 		     u32 fault_info,
@@ -545,6 +566,54 @@ TRACE_EVENT(gk20a_ltc_cbc_ctrl_done,
 
 );
 
+TRACE_EVENT(gk20a_ltc_cbc_clear_queue,
+	TP_PROTO(const char *name, u32 min_value, u32 max_value,
+		 u32 clear_min, u32 clear_max, u64 ticket),
+	TP_ARGS(name, min_value, max_value, clear_min, clear_max, ticket),
+
+	TP_STRUCT__entry(
+		__field(const char *, name)
+		__field(u32, min_value)
+		__field(u32, max_value)
+		__field(u32, clear_min)
+		__field(u32, clear_max)
+		__field(u64, ticket)
+	),
+
+	TP_fast_assign(
+		__entry->name = name;
+		__entry->min_value = min_value;
+		__entry->max_value = max_value;
+		__entry->clear_min = clear_min;
+		__entry->clear_max = clear_max;
+		__entry->ticket = ticket;
+	),
+
+	TP_printk("name=%s, min_value=%u, max_value=%u, clear_min=%u, clear_max=%u, ticket=%llu",
+		__entry->name, __entry->min_value, __entry->max_value,
+		__entry->clear_min, __entry->clear_max, __entry->ticket)
+);
+
+TRACE_EVENT(gk20a_ltc_cbc_clear_wait,
+	TP_PROTO(const char *name, u64 ticket, u64 wait_ns),
+	TP_ARGS(name, ticket, wait_ns),
+
+	TP_STRUCT__entry(
+		__field(const char *, name)
+		__field(u64, ticket)
+		__field(u64, wait_ns)
+	),
+
+	TP_fast_assign(
+		__entry->name = name;
+		__entry->ticket = ticket;
+		__entry->wait_ns = wait_ns;
+	),
+
+	TP_printk("name=%s, ticket=%llu, wait_ns=%llu",
+		__entry->name, __entry->ticket, __entry->wait_ns)
+);
+
 DECLARE_EVENT_CLASS(gk20a_cde,
 	TP_PROTO(const void *ctx),
 	TP_ARGS(ctx),
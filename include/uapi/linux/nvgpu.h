@@ -1239,8 +1239,34 @@ struct nvgpu_dbg_gpu_access_fb_memory_args {
 	_IOWR(NVGPU_DBG_GPU_IOCTL_MAGIC, 19, struct nvgpu_dbg_gpu_access_fb_memory_args)
 
 
+/*
+ * Ctx register sampling. SET_CTX_SAMPLE_PROGRAM validates a set of ctx read
+ * ops once and resolves where each register lives in the context image;
+ * per-op status is written back. CTX_SAMPLE then reads all of them at once
+ * into an array of (value_hi << 32 | value_lo), in the order the ops were
+ * given. Setting a program with num_ops == 0 drops it.
+ */
+struct nvgpu_dbg_gpu_set_ctx_sample_program_args {
+	__u64 ops;		/* in/out: pointer to nvgpu_dbg_gpu_reg_op[] */
+	__u32 num_ops;		/* in */
+	__u32 _pad0;
+};
+
+#define NVGPU_DBG_GPU_IOCTL_SET_CTX_SAMPLE_PROGRAM			\
+	_IOW(NVGPU_DBG_GPU_IOCTL_MAGIC, 20, struct nvgpu_dbg_gpu_set_ctx_sample_program_args)
+
+struct nvgpu_dbg_gpu_ctx_sample_args {
+	__u64 values;		/* out: pointer to __u64[num_values] */
+	__u32 num_values;	/* in: must match the program's num_ops */
+	__u32 _pad0;
+};
+
+#define NVGPU_DBG_GPU_IOCTL_CTX_SAMPLE					\
+	_IOW(NVGPU_DBG_GPU_IOCTL_MAGIC, 21, struct nvgpu_dbg_gpu_ctx_sample_args)
+
+
 #define NVGPU_DBG_GPU_IOCTL_LAST		\
-	_IOC_NR(NVGPU_DBG_GPU_IOCTL_ACCESS_FB_MEMORY)
+	_IOC_NR(NVGPU_DBG_GPU_IOCTL_CTX_SAMPLE)
 
 #define NVGPU_DBG_GPU_IOCTL_MAX_ARG_SIZE		\
 	sizeof(struct nvgpu_dbg_gpu_access_fb_memory_args)
@@ -1452,6 +1478,9 @@ struct nvgpu_cycle_stats_snapshot_args {
 #define NVGPU_IOCTL_CHANNEL_CYCLE_STATS_SNAPSHOT_CMD_FLUSH   0
 #define NVGPU_IOCTL_CHANNEL_CYCLE_STATS_SNAPSHOT_CMD_ATTACH  1
 #define NVGPU_IOCTL_CHANNEL_CYCLE_STATS_SNAPSHOT_CMD_DETACH  2
+/* dmabuf_fd carries an eventfd signalled when the client fifo fills up */
+/* to extra entries, extra == 0 disables the notification               */
+#define NVGPU_IOCTL_CHANNEL_CYCLE_STATS_SNAPSHOT_CMD_NOTIFY  3
 
 /* disable watchdog per-channel */
 struct nvgpu_channel_wdt_args {